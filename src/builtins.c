@@ -4,13 +4,22 @@
 #include "io_helpers.h"
 #include "variables.h"
 #include "commands.h"
+#include "filter.h"
+#include "traverse.h"
+#include "dircache.h"
+#include "extsort.h"
+#include "plugins.h"
+#include "fanout.h"
+#include "lines.h"
+#include "linesort.h"
+#include "search.h"
+#include "du.h"
+#include "history.h"
+#include "server.h"
+#include "builtins_table.h"
 
 
-#define MAX_DEPTH 9999
-// We'll make an assumption that the depth of the directory is at most 9999.
-// Directory depth is unlikely to be that deep.
 char CURR_WORKING_DIR[4096] = "mysh$ ";
-char *filter;
 // Server stuff, need to track if the server is running, and furthermore, its pid.
 static pid_t server_pid = -1;
 static int server_running = 0;
@@ -54,128 +63,48 @@ void bn_echo_expansion(char *str){
 		display_message(getVar(currVar));
 	}
 }
-/*
-	Return whether or not a filename contains the specified filter.	
-*/
-int filter_check(const struct dirent *entry){
-	// check if the filter is NULL, if so, then we return 1.
-	if(filter == NULL){
-		return 1;
-	}
-	// printf("Filtering: %s in %s, status: %s\n", filter, entry->d_name, strstr(entry->d_name, filter));
-	// check if the filter is in the entry name.	
-	if(strstr(entry->d_name, filter) != NULL){
-		
-		return 1;
-	}
-	return 0;
-}
-/*
- Aids in the expansion of directories (provided a depth is provided).
-*/
-int traverse_dir_depth(char *dir, int depth, int maxDepth){
-	// base case: maxdepth of zero displays the current directory's name:
-	if(maxDepth == 0){
-		display_message(dir);
-		display_message("\n");
-		return 0;
-	}
-	// base case: dir is actually not a directory, but a file.
-	// if (opendir(dir) == NULL){
-	// 	display_message(dir);
-	// 	display_message("\n");
-	// 	return 0;
-	// }
-	// base case: we have reached the max depth.
-	if(depth >= maxDepth){
-		struct dirent **nameList;
-		// filter_check has a NULL check, so we don't need to worry about that.
-		int n = scandir(dir, &nameList, filter_check, NULL), err = 0;
-		if(n < 0){
-			display_error("ERROR: Invalid path: ", dir);
-			// free the nameList and its contents
-			for(int i = 0; i < n; i++){
-				free(nameList[i]);
-			}
-			free(nameList);
-			return -1;
-		}
-		for(int i = 0; i < n; i++){
-			// print the name of the file.
-			display_message(nameList[i]->d_name);
-			display_message("\n");
-			// free the nameList[i] once done.
-			free(nameList[i]);
-		}
-		// free the nameList once done.
-		free(nameList);
-		return err;
-	}else{ // recursive case: we have not reached the max depth.
-		// List all files in the directory.
-		struct dirent **nameList;
-		int n = scandir(dir, &nameList, filter_check, NULL), err = 0;
-		if(n < 0){
-			display_error("ERROR: Cannot open directory: ", dir);
-			// free the nameList and its contents
-			for(int i = 0; i < n; i++){
-				free(nameList[i]);
-			}
-			free(nameList);
-			return -1;
-		}
-		for(int i = 0; i < n; i++){
-			display_message(nameList[i]->d_name);
-			display_message("\n");
-			free(nameList[i]);
-		}
-		free(nameList);
-		// Recurse on all directories: Reset nameList
-		n = scandir(dir, &nameList, NULL, NULL);
-		for(int i = 0; i < n; i++){
-			if(nameList[i]->d_type == DT_DIR){
-				// skip the parent and current directories:
-			if((strlen(nameList[i]->d_name) == 1 && !strncmp(nameList[i]->d_name, ".", strlen(".")))
-				|| (strlen(nameList[i]->d_name) == 2 && !strncmp(nameList[i]->d_name, "..", strlen("..")))){
-					free(nameList[i]);
-					continue;
-			}
-				// create the path to the directory.
-				char path[4096];
-				strncpy(path, dir, strlen(dir));
-				strncat(path, "/", 2);
-				strncat(path, nameList[i]->d_name, strlen(nameList[i]->d_name));
-				err += traverse_dir_depth(path, depth+1, maxDepth);
-				// clear char path arr
-				memset(path, 0, 4096);
-			}
-			// free the directories once done, as they are no longer needed.
-			free(nameList[i]);
-		}
-		// Free nameList once done.
-		free(nameList);
-		return err;
-	}
-}
-
 // ======== Path Printing =======
 
 void print_path(){
 	display_message(CURR_WORKING_DIR);
 }
 
+const char *current_prompt(void){
+	return CURR_WORKING_DIR;
+}
+
 
 // ====== Command execution =====
 
-/* Return: index of builtin or -1 if cmd doesn't match a builtin
- */
+static const builtin_entry *core_builtin(const char *cmd, size_t len) {
+    const builtin_entry *e = &BUILTIN_TABLE[builtin_hash(cmd, len, BUILTIN_SEED) & BUILTIN_MASK];
+    if (e->name != NULL && e->len == len && memcmp(e->name, cmd, len) == 0) {
+        return e;
+    }
+    return NULL;
+}
+
 bn_ptr check_builtin(const char *cmd) {
-    // NOTE: Change this code as var expansion is now down beforehand.
-    ssize_t cmd_num = 0;
-    while (cmd_num < BUILTINS_COUNT &&
-           strncmp(BUILTINS[cmd_num], cmd, MAX_STR_LEN) != 0) {
-        cmd_num += 1;
+    size_t len = strnlen(cmd, MAX_STR_LEN + 1);
+    const builtin_entry *e = core_builtin(cmd, len);
+    if (e != NULL) {
+        return e->fn;
     }
-    return BUILTINS_FN[cmd_num];
+    return plugin_lookup(cmd, len);
+}
+
+int builtin_flags(const char *cmd) {
+    const builtin_entry *e = core_builtin(cmd, strnlen(cmd, MAX_STR_LEN + 1));
+    return e != NULL ? e->flags : 0;
+}
+
+void visit_builtins(name_visit visit, void *ctx) {
+    for (size_t i = 0; i <= BUILTIN_MASK; i++) {
+        if (BUILTIN_TABLE[i].name != NULL) {
+            visit(ctx, BUILTIN_TABLE[i].name, BUILTIN_TABLE[i].len);
+        }
+    }
+    plugin_visit(visit, ctx);
 }
 
 // ====== Server Cleanup =====
@@ -223,6 +152,227 @@ ssize_t bn_echo(char **tokens) {
     return 0;
 }
 
+/*
+ * Shared argument parsing for head and tail: [-n count] [-f] [file].
+ * Return 0 on success and -1 on error.
+ */
+static int parse_line_args(char **tokens, const char *name, int allow_follow,
+                           size_t *count, int *follow, char **path) {
+	*count = DEFAULT_LINE_COUNT;
+	*follow = 0;
+	*path = NULL;
+	for (ssize_t index = 1; tokens[index] != NULL; index++) {
+		if (strcmp(tokens[index], "-n") == 0) {
+			char *end;
+			if (tokens[index + 1] == NULL) {
+				display_error("ERROR: Missing line count for ", (char *) name);
+				return -1;
+			}
+			errno = 0;
+			long long n = strtoll(tokens[++index], &end, 10);
+			if (*end != '\0' || end == tokens[index] || n < 0 || errno != 0) {
+				display_error("ERROR: Invalid line count: ", tokens[index]);
+				return -1;
+			}
+			*count = n;
+		} else if (allow_follow && strcmp(tokens[index], "-f") == 0) {
+			*follow = 1;
+		} else if (*path == NULL) {
+			*path = tokens[index];
+		} else {
+			display_error("ERROR: Too many arguments: takes a single file", "");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Open path for head/tail, or use stdin when no file was given.
+ * Return the fd or -1 on error.
+ */
+static int open_line_input(char *path) {
+	if (path == NULL) {
+		return io_input_fd();
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		display_error("ERROR: Cannot open file: ", path);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+		display_error("ERROR: Cannot read a directory: ", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Prereq: tokens is a NULL terminated sequence of strings.
+ * Prints the first lines (10 unless -n says otherwise) of a file or stdin.
+ * Return 0 on success and -1 on error.
+ */
+ssize_t bn_head(char **tokens){
+	size_t count;
+	int follow;
+	char *path;
+	if (parse_line_args(tokens, "head", 0, &count, &follow, &path) < 0) {
+		return -1;
+	}
+	int fd = open_line_input(path);
+	if (fd < 0) {
+		return -1;
+	}
+	int ret = head_lines(fd, count);
+	if (fd != io_input_fd()) {
+		close(fd);
+	}
+	return ret;
+}
+
+/* Prereq: tokens is a NULL terminated sequence of strings.
+ * Prints the last lines of a file or stdin, then with -f keeps printing
+ * what gets appended to the file until interrupted.
+ * Return 0 on success and -1 on error.
+ */
+ssize_t bn_tail(char **tokens){
+	size_t count;
+	int follow;
+	char *path;
+	if (parse_line_args(tokens, "tail", 1, &count, &follow, &path) < 0) {
+		return -1;
+	}
+	int fd = open_line_input(path);
+	if (fd < 0) {
+		return -1;
+	}
+	int ret = tail_lines(fd, count);
+	// following only makes sense for a named file.
+	if (ret == 0 && follow && path != NULL) {
+		ret = follow_file(fd, path);
+	}
+	if (fd != io_input_fd()) {
+		close(fd);
+	}
+	return ret;
+}
+
+/*
+ * Parse a -k argument: start[,end], both 1-based fields.
+ * Return 0 on success and -1 on error.
+ */
+static int parse_sort_key(char *arg, sort_options *opts){
+	char *end;
+	long start = strtol(arg, &end, 10);
+	long last = 0;
+	if (*end == ',') {
+		char *field = end + 1;
+		last = strtol(field, &end, 10);
+		if (end == field || last < start) {
+			return -1;
+		}
+	}
+	if (end == arg || *end != '\0' || start < 1) {
+		return -1;
+	}
+	opts->key_start = start;
+	opts->key_end = last;
+	return 0;
+}
+
+/* Prereq: tokens is a NULL terminated sequence of strings.
+ * Sorts the lines of a file or stdin: sort [-n] [-r] [-u] [-k start[,end]] [file].
+ * SORT_MB (default EXTSORT_DEFAULT_MB) caps the memory used before sorted
+ * runs spill to temp files.
+ * Return 0 on success and -1 on error.
+ */
+ssize_t bn_sort(char **tokens){
+	sort_options opts = {0, 0, 0, 0, 0, 0};
+	char *path = NULL;
+	for (ssize_t index = 1; tokens[index] != NULL; index++) {
+		char *arg = tokens[index];
+		if (!strncmp(arg, "-k", 2)) {
+			char *key = arg[2] != '\0' ? arg + 2 : tokens[++index];
+			if (key == NULL || parse_sort_key(key, &opts) < 0) {
+				display_error("ERROR: Invalid sort key: ", key == NULL ? "" : key);
+				return -1;
+			}
+		} else if (arg[0] == '-' && arg[1] != '\0') {
+			// single letter flags, possibly grouped (-nr).
+			for (char *c = arg + 1; *c != '\0'; c++) {
+				if (*c == 'n') {
+					opts.numeric = 1;
+				} else if (*c == 'r') {
+					opts.reverse = 1;
+				} else if (*c == 'u') {
+					opts.unique = 1;
+				} else {
+					display_error("ERROR: Unknown sort option: ", arg);
+					return -1;
+				}
+			}
+		} else if (path == NULL) {
+			path = arg;
+		} else {
+			display_error("ERROR: Too many arguments: sort takes a single file", "");
+			return -1;
+		}
+	}
+	long mb = strtol(getVar("SORT_MB"), NULL, 10);
+	if (mb <= 0) {
+		mb = EXTSORT_DEFAULT_MB;
+	}
+	opts.budget = (size_t) mb << 20;
+	int fd = open_line_input(path);
+	if (fd < 0) {
+		return -1;
+	}
+	int ret = sort_lines(fd, &opts);
+	if (ret < 0) {
+		display_error("ERROR: sort: ", strerror(errno));
+	}
+	if (fd != io_input_fd()) {
+		close(fd);
+	}
+	return ret;
+}
+
+/* Prereq: tokens is a NULL terminated sequence of strings.
+ * Copies its input to the output and to every file given (-a appends).
+ * Return 0 on success and -1 on error.
+ */
+ssize_t bn_tee(char **tokens){
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	ssize_t index = 1;
+	if (tokens[index] != NULL && strcmp(tokens[index], "-a") == 0) {
+		flags = (flags & ~O_TRUNC) | O_APPEND;
+		index++;
+	}
+	// the output comes first, then one fd per file.
+	int fds[MAX_STR_LEN + 1];
+	size_t count = 0;
+	ssize_t ret = 0;
+	fds[count++] = io_output_fd();
+	for (; tokens[index] != NULL; index++) {
+		int fd = open(tokens[index], flags, 0644);
+		if (fd < 0) {
+			display_error("ERROR: Cannot open file: ", tokens[index]);
+			ret = -1;
+			continue;
+		}
+		fds[count++] = fd;
+	}
+	if (fanout_stream(io_input_fd(), fds, count) < 0 && errno != EPIPE) {
+		display_error("ERROR: tee: ", strerror(errno));
+		ret = -1;
+	}
+	for (size_t i = 1; i < count; i++) {
+		close(fds[i]);
+	}
+	return ret;
+}
+
 /* Prereq: tokens is a NULL terminated sequence of strings.
  * Return 0 on success and -1 on error ... but there are no errors on echo. 
  */
@@ -232,7 +382,7 @@ ssize_t bn_wc(char **tokens){
     FILE *file = NULL;
     if (tokens[index] == NULL) {
         // No input source provided, read from STDIN
-        file = stdin;
+        file = io_input_file();
     } else {
         // multiple paths are provided.
         if (tokens[index + 1] != NULL) {
@@ -269,7 +419,9 @@ ssize_t bn_wc(char **tokens){
 		}
 		c = fgetc(file);	
 	}
-	fclose(file);
+	if (file != stdin) {
+		fclose(file);
+	}
 	//account for EOF.
 	//characters++;
 	// convert the words, characters, lines counts to strings
@@ -294,33 +446,87 @@ ssize_t bn_wc(char **tokens){
  * Return 0 on success and -1 on error ... but there are no errors on echo. 
  */
 
+/*
+ * Record a --f/--glob/--regex pattern for ls. Giving a second, different filter is an error.
+ * Return 0 on success and -1 on error.
+ */
+static int parse_filter_arg(char **tokens, ssize_t index, filter_kind kind,
+                            char **pattern, filter_kind *pattern_kind){
+	if(tokens[index+1] == NULL){
+		display_error("ERROR: no filter provided", "");
+		return -1;
+	}
+	//check if filter is defined, if so, then check if they match. 
+	//throw an error if they don't.
+	if(*pattern != NULL && (*pattern_kind != kind || strcmp(*pattern, tokens[index+1]))){
+		display_error("ERROR: Filters differ: ", tokens[index+1]);
+		return -1;
+	}
+	*pattern = tokens[index+1];
+	*pattern_kind = kind;
+	return 0;
+}
+
+/*
+ * The listing cache is opt-in per session: LS_CACHE=on enables it and
+ * LS_CACHE_MB (default DIRCACHE_DEFAULT_MB) bounds how much memory it may hold.
+ */
+static void configure_ls_cache(void){
+	char *enabled = getVar("LS_CACHE");
+	if(strcmp(enabled, "on") && strcmp(enabled, "1")){
+		if(dircache_enabled()){
+			dircache_configure(0, 0);
+		}
+		return;
+	}
+	long mb = strtol(getVar("LS_CACHE_MB"), NULL, 10);
+	if(mb <= 0){
+		mb = DIRCACHE_DEFAULT_MB;
+	}
+	dircache_configure(1, (size_t) mb << 20);
+}
+
 ssize_t bn_ls(char **tokens){
 	ssize_t index = 1;
 	char *leftovers;
 	int depth = 1, rec = 0, dProv = 0, pProv = 0;
-	// Set filter to null:
-	filter = NULL;
+	// The pattern is only compiled once all the flags are known.
+	char *pattern = NULL;
+	filter_kind kind = FILTER_NONE;
+	ls_options opts = {NULL, 0, LS_SORT_NONE, 0, 0, NULL, NULL};
 	char *path = ".";
 	// Parse the tokens.
 	while(tokens[index] != NULL){
-		// display_message("Tokens: ");
-		// display_message(tokens[index]);
-		// display_message("\n");
 		// otherwise, we simply parse the flags.
-		if(!strncmp(tokens[index], "--f", strlen("--f"))){
-			if(tokens[index+1] == NULL){
-				display_error("ERROR: no filter provided", "");
+		if(!strncmp(tokens[index], "--glob", strlen("--glob"))){
+			if(parse_filter_arg(tokens, index, FILTER_GLOB, &pattern, &kind)){
 				return -1;
 			}
-			//check if filter is defined, if so, then check if they match. 
-			//throw an error if they don't.
-			if(filter != NULL && strlen(filter) == strlen(tokens[index+1])
-			 && strncmp(filter, tokens[index+1], strlen(tokens[index+1]))){
-				display_error("ERROR: Filters differ: ", tokens[index+1]);
+			index++;
+		}else if(!strncmp(tokens[index], "--regex", strlen("--regex"))){
+			if(parse_filter_arg(tokens, index, FILTER_REGEX, &pattern, &kind)){
 				return -1;
 			}
-			filter = strndup(tokens[index+1], strlen(tokens[index+1]));
 			index++;
+		}else if(!strncmp(tokens[index], "--f", strlen("--f"))){
+			if(parse_filter_arg(tokens, index, FILTER_SUBSTR, &pattern, &kind)){
+				return -1;
+			}
+			index++;
+		}else if(!strcmp(tokens[index], "-l")){
+			opts.long_format = 1;
+		}else if(!strcmp(tokens[index], "--sorted")){
+			opts.sorted = 1;
+		}else if(!strncmp(tokens[index], "--sort=", strlen("--sort="))){
+			char *key = tokens[index] + strlen("--sort=");
+			if(!strcmp(key, "size")){
+				opts.sort = LS_SORT_SIZE;
+			}else if(!strcmp(key, "mtime")){
+				opts.sort = LS_SORT_MTIME;
+			}else{
+				display_error("ERROR: Invalid sort key: ", key);
+				return -1;
+			}
 		}else if(!strncmp(tokens[index], "--rec", strlen("--rec"))){
 			rec = 1;
 		}else if(!strncmp(tokens[index], "--d", strlen("--d"))){
@@ -368,15 +574,279 @@ ssize_t bn_ls(char **tokens){
 	if (strlen(path) == 0){
 		path = ".";
 	}
-	// Call directory traversal function.
-	int err = traverse_dir_depth(path, 1, depth);
+	// --sorted orders by name, --sort= by metadata; they cannot both apply.
+	if(opts.sorted && opts.sort != LS_SORT_NONE){
+		display_error("ERROR: --sorted cannot be combined with --sort=", "");
+		return -1;
+	}
+	// LS_SORT_MB bounds the memory a --sorted listing holds before spilling to disk.
+	long sort_mb = strtol(getVar("LS_SORT_MB"), NULL, 10);
+	opts.sort_budget = (size_t) (sort_mb > 0 ? sort_mb : EXTSORT_DEFAULT_MB) << 20;
+	ls_filter filter;
+	if(filter_compile(&filter, kind, pattern)){
+		display_error("ERROR: Invalid filter: ", pattern);
+		return -1;
+	}
+	opts.filter = &filter;
+	configure_ls_cache();
+	// Call directory traversal function, output is batched until the end.
+	out_buffer *out = malloc(sizeof(out_buffer));
+	if(out == NULL){
+		filter_free(&filter);
+		return -1;
+	}
+	out->len = 0;
+	int err = traverse_dir_depth(path, 1, depth, &opts, out);
+	out_flush(out);
+	free(out);
+	filter_free(&filter);
 	if(err){
-		// display_error("ERROR: Error in directory traversal", "");
 		return -1;
-	}	
-	free(filter);
-	// flush output:
-	// fflush(stdout);
+	}
+	return 0;
+}
+
+/* Prereq: tokens is a NULL terminated sequence of strings.
+ * search PATTERN [path] [--f/--glob/--regex namefilter] [--d depth] [-E]
+ * Prints the lines of the files under path (recursively unless --d limits
+ * it) that contain PATTERN, or match it as an extended regex with -E. The
+ * name filters and --d behave as in ls.
+ * Return 0 on success and -1 on error.
+ */
+ssize_t bn_search(char **tokens){
+	ssize_t index = 1;
+	char *leftovers;
+	int depth = MAX_DEPTH, dProv = 0;
+	char *pattern = NULL, *content_pattern = NULL, *path = ".";
+	filter_kind kind = FILTER_NONE, content_kind = FILTER_SUBSTR;
+	int pProv = 0;
+	while(tokens[index] != NULL){
+		if(!strncmp(tokens[index], "--glob", strlen("--glob"))){
+			if(parse_filter_arg(tokens, index, FILTER_GLOB, &pattern, &kind)){
+				return -1;
+			}
+			index++;
+		}else if(!strncmp(tokens[index], "--regex", strlen("--regex"))){
+			if(parse_filter_arg(tokens, index, FILTER_REGEX, &pattern, &kind)){
+				return -1;
+			}
+			index++;
+		}else if(!strncmp(tokens[index], "--f", strlen("--f"))){
+			if(parse_filter_arg(tokens, index, FILTER_SUBSTR, &pattern, &kind)){
+				return -1;
+			}
+			index++;
+		}else if(!strcmp(tokens[index], "-E")){
+			content_kind = FILTER_REGEX;
+		}else if(!strncmp(tokens[index], "--d", strlen("--d"))){
+			if(tokens[index+1] == NULL){
+				display_error("ERROR: no depth provided", "");
+				return -1;
+			}
+			if(dProv && depth != strtol(tokens[index+1], &leftovers, 10)){
+				display_error("ERROR: Depths differ: ", tokens[index+1]);
+				return -1;
+			}
+			depth = strtol(tokens[index+1], &leftovers, 10);
+			// a depth of 0 would only name the directory, there is nothing to search.
+			if(strlen(leftovers) > 0 || depth < 1){
+				display_error("ERROR: Invalid depth: ", tokens[index+1]);
+				return -1;
+			}
+			dProv = 1;
+			index++;
+		}else if(content_pattern == NULL){
+			content_pattern = tokens[index];
+		}else if(!pProv){
+			path = tokens[index];
+			pProv = 1;
+		}else{
+			display_error("ERROR: Too many arguments: search takes a pattern and a single path", "");
+			return -1;
+		}
+		index++;
+	}
+	if(content_pattern == NULL || strlen(content_pattern) == 0){
+		display_error("ERROR: No search pattern provided", "");
+		return -1;
+	}
+	ls_filter names, content;
+	if(filter_compile(&names, kind, pattern)){
+		display_error("ERROR: Invalid filter: ", pattern);
+		return -1;
+	}
+	if(filter_compile(&content, content_kind, content_pattern)){
+		display_error("ERROR: Invalid pattern: ", content_pattern);
+		filter_free(&names);
+		return -1;
+	}
+	configure_ls_cache();
+	out_buffer *out = malloc(sizeof(out_buffer));
+	if(out == NULL){
+		filter_free(&names);
+		filter_free(&content);
+		return -1;
+	}
+	out->len = 0;
+	int err = search_tree(path, depth, &names, &content, out);
+	out_flush(out);
+	free(out);
+	filter_free(&names);
+	filter_free(&content);
+	return err ? -1 : 0;
+}
+
+/*
+ * du [path] [--d depth] [--f/--glob/--regex filter]: disk usage in KiB of path
+ * and of each directory under it down to depth levels (all by default, and
+ * 0 for only the total). The filter picks the files that count, as for ls.
+ * Return 0 on success and -1 on error.
+ */
+ssize_t bn_du(char **tokens){
+	ssize_t index = 1;
+	char *leftovers;
+	int depth = MAX_DEPTH, dProv = 0;
+	char *pattern = NULL, *path = ".";
+	filter_kind kind = FILTER_NONE;
+	int pProv = 0;
+	while(tokens[index] != NULL){
+		if(!strncmp(tokens[index], "--glob", strlen("--glob"))){
+			if(parse_filter_arg(tokens, index, FILTER_GLOB, &pattern, &kind)){
+				return -1;
+			}
+			index++;
+		}else if(!strncmp(tokens[index], "--regex", strlen("--regex"))){
+			if(parse_filter_arg(tokens, index, FILTER_REGEX, &pattern, &kind)){
+				return -1;
+			}
+			index++;
+		}else if(!strncmp(tokens[index], "--f", strlen("--f"))){
+			if(parse_filter_arg(tokens, index, FILTER_SUBSTR, &pattern, &kind)){
+				return -1;
+			}
+			index++;
+		}else if(!strncmp(tokens[index], "--d", strlen("--d"))){
+			if(tokens[index+1] == NULL){
+				display_error("ERROR: no depth provided", "");
+				return -1;
+			}
+			if(dProv && depth != strtol(tokens[index+1], &leftovers, 10)){
+				display_error("ERROR: Depths differ: ", tokens[index+1]);
+				return -1;
+			}
+			depth = strtol(tokens[index+1], &leftovers, 10);
+			if(strlen(leftovers) > 0 || depth < 0){
+				display_error("ERROR: Invalid depth: ", tokens[index+1]);
+				return -1;
+			}
+			dProv = 1;
+			index++;
+		}else if(!pProv){
+			path = tokens[index];
+			pProv = 1;
+		}else{
+			display_error("ERROR: Too many arguments: du takes a single path", "");
+			return -1;
+		}
+		index++;
+	}
+	ls_filter filter;
+	if(filter_compile(&filter, kind, pattern)){
+		display_error("ERROR: Invalid filter: ", pattern);
+		return -1;
+	}
+	out_buffer *out = malloc(sizeof(out_buffer));
+	if(out == NULL){
+		filter_free(&filter);
+		return -1;
+	}
+	out->len = 0;
+	int err = du_tree(path, depth, &filter, out);
+	out_flush(out);
+	free(out);
+	filter_free(&filter);
+	return err ? -1 : 0;
+}
+
+typedef struct history_listing {
+	out_buffer *out;
+	// number of the next entry, 0 when they are not numbered.
+	size_t number;
+} history_listing;
+
+static int print_history_entry(void *ctx, const char *line, size_t len){
+	history_listing *l = ctx;
+	if(l->number > 0){
+		char num[32];
+		int n = snprintf(num, sizeof(num), "%5zu  ", l->number++);
+		out_append(l->out, num, n);
+	}
+	out_append(l->out, line, len);
+	out_append(l->out, "\n", 1);
+	return 0;
+}
+
+/*
+ * history [count]: the last count commands (all by default), numbered.
+ * history -s text...: the commands containing text, newest first.
+ * Return 0 on success and -1 on error.
+ */
+ssize_t bn_history(char **tokens){
+	char *leftovers;
+	size_t count = 0;
+	char *text = NULL;
+	if(tokens[1] != NULL && !strcmp(tokens[1], "-s")){
+		if(tokens[2] == NULL){
+			display_error("ERROR: No search text provided", "");
+			return -1;
+		}
+		size_t len = 0;
+		for(ssize_t i = 2; tokens[i] != NULL; i++){
+			len += strlen(tokens[i]) + 1;
+		}
+		text = malloc(len);
+		if(text == NULL){
+			return -1;
+		}
+		text[0] = '\0';
+		for(ssize_t i = 2; tokens[i] != NULL; i++){
+			if(i > 2){
+				strcat(text, " ");
+			}
+			strcat(text, tokens[i]);
+		}
+	}else if(tokens[1] != NULL){
+		long n = strtol(tokens[1], &leftovers, 10);
+		if(strlen(leftovers) > 0 || n <= 0){
+			display_error("ERROR: Invalid count: ", tokens[1]);
+			return -1;
+		}
+		if(tokens[2] != NULL){
+			display_error("ERROR: Too many arguments: history takes a single count", "");
+			return -1;
+		}
+		count = n;
+	}
+	out_buffer *out = malloc(sizeof(out_buffer));
+	if(out == NULL){
+		free(text);
+		return -1;
+	}
+	out->len = 0;
+	history_listing listing = {out, 0};
+	long ret;
+	if(text != NULL){
+		ret = history_search(text, strlen(text), print_history_entry, &listing);
+	}else{
+		ret = history_recent(count, &listing.number, print_history_entry, &listing);
+	}
+	out_flush(out);
+	free(out);
+	free(text);
+	if(ret < 0){
+		display_error("ERROR: History is unavailable", "");
+		return -1;
+	}
 	return 0;
 }
 
@@ -388,7 +858,7 @@ ssize_t bn_cat(char **tokens){
     FILE *file = NULL;
     if (tokens[index] == NULL) {
         // No input source provided, read from STDIN
-        file = stdin;
+        file = io_input_file();
     } else {
         // multiple paths are provided.
         if (tokens[index + 1] != NULL) {
@@ -407,13 +877,18 @@ ssize_t bn_cat(char **tokens){
             display_error("ERROR: Cannot open file: ", tokens[index]);
             return -1;
         }
+        // the whole file is about to be written out, so let a redirected file reserve it.
+        struct stat st;
+        if (fstat(fileno(file), &st) == 0) {
+            io_output_hint(st.st_size);
+        }
     }
 	if(file == NULL){
 		display_error("ERROR: No input source provided", "");
 		return -1;
 	}
     char output[128];
-    while (fgets(output, sizeof(output), file) != NULL) {
+    while (!io_output_closed() && fgets(output, sizeof(output), file) != NULL) {
         display_message(output);
     }
     if (file != stdin) {
@@ -544,9 +1019,18 @@ ssize_t bn_start_server(char **tokens) {
         return -1;
     }
 
-    if (tokens[index + 1] != NULL) {
-        display_error("ERROR: Too many arguments: start_server takes a single port", "");
-        return -1;
+    server_options opts;
+    server_options_default(&opts);
+    for (int i = index + 1; tokens[i] != NULL; i++) {
+        if (strncmp(tokens[i], "--", 2) != 0) {
+            display_error("ERROR: Too many arguments: start_server takes a single port", "");
+            return -1;
+        }
+        int used = server_parse_option(&opts, &tokens[i]);
+        if (used < 0) {
+            return -1;
+        }
+        i += used - 1;
     }
 
     if (server_running) {
@@ -585,7 +1069,7 @@ ssize_t bn_start_server(char **tokens) {
     }
 	//child process: start server.
     if (pid == 0) {
-        start_server(port);
+        start_server(port, &opts);
         exit(0);
     }
 
@@ -637,12 +1121,46 @@ ssize_t bn_start_client(char **tokens) {
         return -1;
     }
     const char *hostname = tokens[2];
+	// start-client PORT HOST --binary: frames instead of lines.
+	int binary = tokens[3] != NULL && strcmp(tokens[3], "--binary") == 0;
     // start the client
-	start_client(port, hostname);
+	start_client(port, hostname, binary);
 	// if we catch any ctrl d, then we return here
     return 0;
 }
 
+/*
+ * Send msg as one binary frame on sock_fd, once the server agrees to them.
+ * Closes sock_fd and frees msg.
+ */
+static ssize_t send_binary(int sock_fd, char *msg) {
+	net_buf in;
+	in.start = in.len = 0;
+	size_t len = strlen(msg);
+	int max = negotiate_binary(sock_fd, &in, 0);
+	char *frame = NULL;
+	ssize_t ret = -1;
+	if (max < 0) {
+		display_error("ERROR: Server does not support binary framing", "");
+	} else if (len > (size_t) max) {
+		display_error("ERROR: Message too long for the server", "");
+	} else if ((frame = malloc(BIN_HEADER + len)) == NULL) {
+		perror("malloc");
+	} else {
+		put_bin_header(frame, len, 0, 1);
+		memcpy(frame + BIN_HEADER, msg, len);
+		if (write_to_socket(sock_fd, frame, BIN_HEADER + len) != 0) {
+			display_error("ERROR: Failed to send message to server", "");
+		} else {
+			ret = 0;
+		}
+	}
+	free(frame);
+	free(msg);
+	close(sock_fd);
+	return ret;
+}
+
 ssize_t bn_send(char **tokens){
 	// send port host_name msg
 	// check for provided hostname, port.
@@ -662,26 +1180,29 @@ ssize_t bn_send(char **tokens){
 		return -1;
 	}
 	const char *hostname = tokens[2];
+	// send PORT HOST --binary MSG: one binary frame instead of a line.
+	int binary = tokens[3] != NULL && strcmp(tokens[3], "--binary") == 0;
+	int first = 3 + binary;
 	// need to send message to the server
 	// if msg empty, substitute for newline character.
 	char *msg;
-	if (tokens[3] == NULL) {
+	if (tokens[first] == NULL) {
 		// to retain consistency with the other case, we need to allocate memory for the newline character.
 		msg = malloc(2);
-		strcpy(msg, "\n");
+		strcpy(msg, binary ? "" : "\n");
 	} else {
-		// need to concatenate all the tokens past the first 3 tokens.
+		// need to concatenate all the tokens past the port and host.
 		int msg_len = 0;
-		for (int i = 3; tokens[i] != NULL; i++) {
+		for (int i = first; tokens[i] != NULL; i++) {
 			msg_len += strlen(tokens[i]) + 1;
 		}
 		msg = malloc(msg_len + 1);	
 	}
 	// fencepost problem solution.
-	if (tokens[3] != NULL) {
-		strcpy(msg, tokens[3]);
+	if (tokens[first] != NULL) {
+		strcpy(msg, tokens[first]);
 	}
-	for (int i = 4; tokens[i] != NULL; i++) {
+	for (int i = first + 1; tokens[i] != NULL; i++) {
 		strcat(msg, " ");
 		strcat(msg, tokens[i]);
 	}
@@ -717,6 +1238,9 @@ ssize_t bn_send(char **tokens){
 		close(sock_fd);
 		return -1;
 	}
+	if (binary) {
+		return send_binary(sock_fd, msg);
+	}
 	// add server newline character to the message
 	char formatted_msg[BUF_SIZE];
 	snprintf(formatted_msg, sizeof(formatted_msg), "%s\r\n", msg);
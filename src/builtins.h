@@ -2,6 +2,7 @@
 #define __BUILTINS_H__
 
 #include <unistd.h>
+#include <stdint.h>
 
 
 /* Type for builtin handling functions
@@ -13,7 +14,14 @@ ssize_t bn_echo(char **tokens);
 ssize_t bn_cd(char **tokens);
 ssize_t bn_cat(char **tokens);
 ssize_t bn_wc(char **tokens);
+ssize_t bn_tee(char **tokens);
+ssize_t bn_head(char **tokens);
+ssize_t bn_tail(char **tokens);
+ssize_t bn_sort(char **tokens);
 ssize_t bn_ls(char **tokens);
+ssize_t bn_search(char **tokens);
+ssize_t bn_du(char **tokens);
+ssize_t bn_history(char **tokens);
 ssize_t bn_ps(char **tokens);
 ssize_t bn_kill(char **tokens);
 ssize_t bn_start_server(char **tokens);
@@ -23,16 +31,59 @@ ssize_t bn_send(char **tokens);
 
 char * decode_variable(char * str);
 void print_path(void);
-/* Return: index of builtin or -1 if cmd doesn't match a builtin
+/* Return: handler of the builtin (core or plugin) named cmd, or NULL if
+ * cmd doesn't match a builtin
  */
 bn_ptr check_builtin(const char *cmd);
 
+/* Builtin flags (see builtins.def).
+ * BUILTIN_FILTER: only reads stdin, writes stdout and leaves the shell's own
+ * state alone, so a pipeline made of these can run inside the shell.
+ */
+#define BUILTIN_FILTER 1
+/* BUILTIN_SHARED: uses process wide caches without locks (the directory
+ * cache, the statx ring, the history map and its index), so only one such
+ * stage of a pipeline runs in-process.
+ */
+#define BUILTIN_SHARED 2
+
+/* Return: the BUILTIN_* flags of a core builtin, 0 for anything else.
+ */
+int builtin_flags(const char *cmd);
+
+/* Called with each name listed by visit_builtins. name is NULL terminated.
+ */
+typedef void (*name_visit)(void *ctx, const char *name, size_t len);
+
+/* Call visit with the name of every builtin, core and plugin.
+ */
+void visit_builtins(name_visit visit, void *ctx);
+
+/* Return: the prompt print_path displays.
+ */
+const char *current_prompt(void);
+
+
+/* Slot of the generated core builtin table (see builtins.def).
+ */
+typedef struct builtin_entry {
+    const char *name;
+    size_t len;
+    bn_ptr fn;
+    int flags;
+} builtin_entry;
 
-/* BUILTINS and BUILTINS_FN are parallel arrays of length BUILTINS_COUNT
+/* FNV-1a over the name, salted with seed. gen_builtins searches for the seed
+ * that gives every core builtin its own slot, and lookups use the same hash.
  */
-static const char * const BUILTINS[] = {"echo", "cd", "cat", "wc", "ls", "ps", "kill", "start-server", "close-server", "start-client", "send"}; // Extra null element for 'non-builtin'
-static const bn_ptr BUILTINS_FN[] = {bn_echo, bn_cd, bn_cat, bn_wc, bn_ls, bn_ps, bn_kill, bn_start_server, bn_close_server, bn_start_client, bn_send, NULL};    // Extra null element for 'non-builtin'
-static const ssize_t BUILTINS_COUNT = sizeof(BUILTINS) / sizeof(char *);
+static inline uint32_t builtin_hash(const char *name, size_t len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) name[i];
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
 
 /* Just a cleanup function for servers (prevents random servers bugging out test cases)
 */
@@ -1,3 +1,8 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <poll.h>
+#include <pthread.h>
+
 #include "builtins.h"
 #include "commands.h"
 #include "variables.h"
@@ -54,7 +59,366 @@ ssize_t print_background_processes() {
     return 0;
 }
 
-void execute_commands(char **tokens, int token_count){
+/*
+ * Add pid to the background jobs and print its job number. The command line
+ * kept for ps and the Done message is cut short if it does not fit.
+ */
+static void add_background_job(pid_t pid, char **tokens) {
+    char message[512];
+    snprintf(message, sizeof(message), "[%d] %d\n", bg_process_count + 1, pid);
+    display_message(message);
+    bg_process *job = &bg_processes[bg_process_count];
+    job->pid = pid;
+    job->job_number = bg_process_count + 1;
+    job->command[0] = '\0';
+    size_t len = 0;
+    for (int i = 0; tokens[i] != NULL && len < sizeof(job->command) - 1; i++) {
+        int n = snprintf(job->command + len, sizeof(job->command) - len, i ? " %s" : "%s", tokens[i]);
+        if (n < 0) {
+            break;
+        }
+        len += n;
+    }
+    bg_process_count++;
+}
+
+/*
+ * Return 1 if the pipeline can run inside the shell: every stage is a builtin
+ * filter, at most one of them uses the shared caches, and none follows a file
+ * (tail -f never ends on its own and a thread cannot be interrupted).
+ */
+static int pipeline_in_process(int count, int width, char *commands[][width]) {
+    int shared = 0;
+    for (int i = 0; i < count; i++) {
+        int flags = commands[i][0] != NULL ? builtin_flags(commands[i][0]) : 0;
+        if (!(flags & BUILTIN_FILTER)) {
+            return 0;
+        }
+        if ((flags & BUILTIN_SHARED) && shared++) {
+            return 0;
+        }
+        if (!strcmp(commands[i][0], "tail")) {
+            for (int j = 1; commands[i][j] != NULL; j++) {
+                if (!strcmp(commands[i][j], "-f")) {
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * If args[i] is a redirection (<, >, >>, 2>, 2>> or 2>&1, with the file name
+ * attached or in the next argument), point the stream in fds at it. Opened
+ * files are added to opened so they can be closed after the command.
+ * Literal arguments (see tokenize_input) are never redirections.
+ * Return 0 if args[i] is not one, otherwise the number of arguments it used,
+ * or -1 on error.
+ */
+static int take_redirect(char **args, const unsigned char *literal, int i, io_fds *fds, int *opened,
+                         int *opened_count) {
+    char *arg = args[i];
+    int *target;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (literal[i]) {
+        return 0;
+    } else if (!strncmp(arg, "2>", 2)) {
+        target = &fds->err;
+        arg += 2;
+    } else if (arg[0] == '>') {
+        target = &fds->out;
+        arg += 1;
+    } else if (arg[0] == '<') {
+        target = &fds->in;
+        flags = O_RDONLY | O_CLOEXEC;
+        arg += 1;
+    } else {
+        return 0;
+    }
+    if (target != &fds->in && arg[0] == '>') {
+        flags = (flags & ~O_TRUNC) | O_APPEND;
+        arg++;
+    }
+    if (target == &fds->err && !strcmp(arg, "&1")) {
+        *target = fds->out;
+        return 1;
+    }
+    int used = 1;
+    if (arg[0] == '\0') {
+        arg = args[i + 1];
+        used = 2;
+    }
+    if (arg == NULL) {
+        display_error("ERROR: No file given for redirection: ", args[i]);
+        return -1;
+    }
+    int fd = open(arg, flags, 0644);
+    if (fd < 0) {
+        display_error("ERROR: Cannot open file: ", arg);
+        return -1;
+    }
+    opened[(*opened_count)++] = fd;
+    *target = fd;
+    return used;
+}
+
+/*
+ * Run one command with its redirections applied on top of base: builtins
+ * write straight to the files, other commands get them as 0, 1 and 2.
+ */
+static void run_redirected(char **args, const unsigned char *literal, io_fds base) {
+    int count = 0;
+    while (args[count] != NULL) {
+        count++;
+    }
+    // the command's own arguments, without the redirections.
+    char **argv = malloc(sizeof(char *) * (count + 1));
+    int *opened = malloc(sizeof(int) * (count + 1));
+    int argc = 0, opened_count = 0;
+    io_fds fds = base;
+    if (argv == NULL || opened == NULL) {
+        free(argv);
+        free(opened);
+        display_error("ERROR: Out of memory", "");
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        int used = take_redirect(args, literal, i, &fds, opened, &opened_count);
+        if (used < 0) {
+            argc = 0;
+            break;
+        }
+        if (used == 0) {
+            argv[argc++] = args[i];
+        } else {
+            i += used - 1;
+        }
+    }
+    argv[argc] = NULL;
+    if (argc > 0) {
+        io_fds saved = io_redirect(fds);
+        execute_command(argv[0], argv);
+        io_redirect(saved);
+    }
+    for (int i = 0; i < opened_count; i++) {
+        close(opened[i]);
+    }
+    free(opened);
+    free(argv);
+}
+
+/* One stage of an in-process pipeline, with the pipe ends it owns. */
+typedef struct {
+    char **args;
+    const unsigned char *literal;
+    io_fds fds;
+    int own_in;
+    int own_out;
+    pthread_t tid;
+} pipe_stage;
+
+static void *run_stage(void *arg) {
+    pipe_stage *stage = arg;
+    io_redirect(stage->fds);
+    run_redirected(stage->args, stage->literal, stage->fds);
+    // the next stage sees the end of its input, the previous one EPIPE.
+    if (stage->own_in >= 0) {
+        close(stage->own_in);
+    }
+    close(stage->own_out);
+    return NULL;
+}
+
+/*
+ * Run a pipeline of builtin filters inside the shell: every stage but the
+ * last gets a thread and they run at the same time over real pipes, so a
+ * stage that quits early (head) stops the ones before it and nothing is held
+ * in memory between stages. The last stage runs on the shell's own thread.
+ * The first stage reads and the last one writes the current fds.
+ * Return 0 if the pipeline ran and -1 if it has to be forked instead.
+ */
+static int run_pipeline_in_process(int count, int width, char *commands[][width],
+                                   unsigned char literal[][width]) {
+    if (!pipeline_in_process(count, width, commands)) {
+        return -1;
+    }
+    pipe_stage *stages = malloc(sizeof(pipe_stage) * count);
+    if (stages == NULL) {
+        return -1;
+    }
+    io_fds base = io_current();
+    // signals (SIGINT, SIGCHLD, the SIGPIPE of a stage whose reader quit)
+    // stay with the shell's thread; the stage threads inherit this mask.
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    int input = -1, started = 0;
+    for (; started < count - 1; started++) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) < 0) {
+            display_error("ERROR: Pipe failed", "");
+            break;
+        }
+        pipe_stage *stage = &stages[started];
+        stage->args = commands[started];
+        stage->literal = literal[started];
+        stage->fds = base;
+        if (input >= 0) {
+            stage->fds.in = input;
+        }
+        stage->fds.out = fds[1];
+        stage->own_in = input;
+        stage->own_out = fds[1];
+        if (pthread_create(&stage->tid, NULL, run_stage, stage) != 0) {
+            display_error("ERROR: Cannot start pipeline stage", "");
+            close(fds[0]);
+            close(fds[1]);
+            break;
+        }
+        input = fds[0];
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (started == count - 1) {
+        io_fds fds = base;
+        fds.in = input;
+        run_redirected(commands[count - 1], literal[count - 1], fds);
+    }
+    // a last stage that stopped reading early lets the writers finish.
+    if (input >= 0) {
+        close(input);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(stages[i].tid, NULL);
+    }
+    free(stages);
+    return 0;
+}
+
+/*
+ * Return 1 if the line is a command or pipeline made only of builtin
+ * filters, so it can run inside the shell. Anything that may change the
+ * shell's state (cd, variables, the server) is forked like in a subshell.
+ */
+static int line_is_builtins(char **tokens, const unsigned char *literal, size_t count) {
+    if (!literal[count - 1] && !strcmp(tokens[count - 1], "&")) {
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        // a pipe glued to an argument splits the line somewhere else; fork those.
+        if (!literal[i] && strchr(tokens[i], '|') != NULL && strcmp(tokens[i], "|")) {
+            return 0;
+        }
+        int head = i == 0 || (!literal[i - 1] && !strcmp(tokens[i - 1], "|"));
+        if (head && !(builtin_flags(tokens[i]) & BUILTIN_FILTER)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Read fd from its current offset to the end into a new NULL terminated
+ * buffer. Reads go straight into the buffer, CAPTURE_READ bytes at a time.
+ */
+static char *read_all(int fd, size_t *len) {
+    char *buf = NULL;
+    size_t used = 0, cap = 0;
+    while (1) {
+        if (cap - used < CAPTURE_READ + 1) {
+            cap = cap ? cap * 2 : CAPTURE_READ * 2;
+            char *grown = realloc(buf, cap);
+            if (grown == NULL) {
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+        }
+        ssize_t got = read(fd, buf + used, cap - used - 1);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            free(buf);
+            return NULL;
+        }
+        if (got == 0) {
+            break;
+        }
+        used += got;
+    }
+    buf[used] = '\0';
+    *len = used;
+    return buf;
+}
+
+static char *capture_in_shell(char **tokens, unsigned char *literal, size_t count, size_t *len) {
+    int fd = memfd_create("mysh-capture", MFD_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    io_fds fds = io_current();
+    fds.out = fd;
+    io_fds saved = io_redirect(fds);
+    execute_commands(tokens, literal, count);
+    io_redirect(saved);
+    lseek(fd, 0, SEEK_SET);
+    char *out = read_all(fd, len);
+    close(fd);
+    return out;
+}
+
+static char *capture_forked(char **tokens, unsigned char *literal, size_t count, size_t *len) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        return NULL;
+    }
+    // a bigger pipe means fewer wakeups on large outputs; not fatal if refused.
+    fcntl(fds[0], F_SETPIPE_SZ, CAPTURE_PIPE_SIZE);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        io_fds child = io_current();
+        child.out = fds[1];
+        io_redirect(child);
+        execute_commands(tokens, literal, count);
+        _exit(0);
+    }
+    close(fds[1]);
+    char *out = read_all(fds[0], len);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return out;
+}
+
+char *capture_command(const char *line, size_t *len) {
+    char *copy = strdup(line);
+    char **tokens = NULL;
+    unsigned char *literal = NULL;
+    char *out = NULL;
+    if (copy == NULL) {
+        return NULL;
+    }
+    size_t count = tokenize_input(copy, &tokens, &literal);
+    if (count == 0) {
+        out = strdup("");
+        *len = 0;
+    } else if (line_is_builtins(tokens, literal, count)) {
+        out = capture_in_shell(tokens, literal, count, len);
+    } else {
+        out = capture_forked(tokens, literal, count, len);
+    }
+    free_tokens(tokens, literal, count);
+    free(copy);
+    return out;
+}
+
+void execute_commands(char **tokens, unsigned char *literal, int token_count){
     // resgister the signal handler for SIGCHLD
     signal(SIGCHLD, handle_sigchld);
     // need to check if there are any pipes:
@@ -63,7 +427,7 @@ void execute_commands(char **tokens, int token_count){
     int pipeCount = 0;
     int bg = 0;
     // check for the ampersand at the end of the command:
-    if (strchr(tokens[token_count - 1], '&') != NULL && strlen(tokens[token_count - 1]) == 1){
+    if (!literal[token_count - 1] && strchr(tokens[token_count - 1], '&') != NULL && strlen(tokens[token_count - 1]) == 1){
         bg = 1;
         // free the ampersand from the command:
         free(tokens[token_count - 1]);
@@ -73,7 +437,7 @@ void execute_commands(char **tokens, int token_count){
     }
     // check for pipes:
     for(int i = 0; i < token_count; i++){
-        if (strchr(tokens[i], '|') != NULL){
+        if (!literal[i] && strchr(tokens[i], '|') != NULL){
             // count the number of pipes using a for loop going over each char:
             for(size_t j = 0; j < strlen(tokens[i]); j++){
                 if(tokens[i][j] == '|'){
@@ -100,63 +464,49 @@ void execute_commands(char **tokens, int token_count){
                 // ignore sigint
                 signal(SIGINT, SIG_IGN);
                 // execute the command:
-                execute_command(tokens[0], tokens);
+                run_redirected(tokens, literal, io_current());
                 // if execute_command fails, then we exit the child process.
                 exit(1);
             }else{
                 // parent process
                 // add the process to the list of background processes.
-                char message[512];
-                snprintf(message, sizeof(message), "[%d] %d\n", bg_process_count + 1, pid);
-                display_message(message);
-                bg_processes[bg_process_count].pid = pid;
-                bg_processes[bg_process_count].job_number = bg_process_count + 1;
-                char command[512];
-                int ind = 0;
-                command[0] = '\0';
-                if (tokens[ind] != NULL){
-                    strncat(command, tokens[ind], strlen(tokens[ind]));
-                    ind++;
-                }
-                while(tokens[ind] != NULL){
-                    strncat(command, " ", 2);
-                    strncat(command, tokens[ind], strlen(tokens[ind]));
-                    ind++;
-                }
-                strcpy(bg_processes[bg_process_count].command, command);
-                bg_process_count++;
+                add_background_job(pid, tokens);
                 // display_message("Background process added\n");
             }
         }else{
             // proceed as usual.
-            execute_command(tokens[0], tokens);
+            run_redirected(tokens, literal, io_current());
         }
     }else{
         // display_message("Pipes detected\n");
         // there are pipes, so we need to route the outputs of the previous command into the input of the next command.
         // grab the commands first by creating a sanitized version of the tokens array, then splitting on the pipes using strtok.
-        char *sanitized[token_count];
-        for(int i = 0; i < token_count; i++){
-            sanitized[i] = strdup(tokens[i]);
+        //check if the first char of the first token is a pipe, if so, throw an error.
+        if (tokens[0][0] == '|'){
+            display_error("ERROR: Invalid command", "");
+            return;
         }
+        // on the heap: a wildcard can make the line far too long for the stack.
+        char **sanitized = malloc(sizeof(char *) * token_count);
         // losing my mind, 2 index.
-        char *commands[pipeCount + 2][token_count + 2];
-        //memset the commands:
-        for(int i = 0; i < pipeCount + 2; i++){
-            for(int j = 0; j < token_count+2; j++){
-                commands[i][j] = NULL;
-            }
+        char *(*commands)[token_count + 2] = calloc(pipeCount + 2, sizeof(*commands));
+        // which arguments of commands are literal; the pieces of a glued pipe are not.
+        unsigned char (*literals)[token_count + 2] = calloc(pipeCount + 2, sizeof(*literals));
+        if (sanitized == NULL || commands == NULL || literals == NULL) {
+            free(sanitized);
+            free(commands);
+            free(literals);
+            display_error("ERROR: Out of memory", "");
+            return;
+        }
+        for(int i = 0; i < token_count; i++){
+            sanitized[i] = strdup(tokens[i]);
         }
         int commandCount = 0;
         int argCount = 0;
         int cmdl = 0;
-        //check if the first char of the first token is a pipe, if so, throw an error.
-        if (tokens[0][0] == '|'){
-            display_error("ERROR: Invalid command", "");
-            return;
-        }
         for(int i = 0; i < token_count; i++){
-            if (strchr(tokens[i], '|') != NULL){
+            if (!literal[i] && strchr(tokens[i], '|') != NULL){
                 // check if it is a singular pipe:
                 if(strlen(tokens[i]) == 1){
                     // just update the command count, arg count, and move on
@@ -205,6 +555,7 @@ void execute_commands(char **tokens, int token_count){
             }else{
                 // we proceed as usual:
                 commands[commandCount][argCount] = strndup(sanitized[i], strlen(sanitized[i]));
+                literals[commandCount][argCount] = literal[i];
                 argCount++;
             }
             // printf("Command count: %d\nArgument count: %d\n", commandCount, argCount);
@@ -235,84 +586,71 @@ void execute_commands(char **tokens, int token_count){
 
         // END DEBUG CODE
 
-        // now that we have all commands stored in the commands array, we can start the piping process.
-        // create a pipe for each pipe:
-        int pipefds[pipeCount + 1][2];
-        for(int i = 0; i < pipeCount + 1; i++){
-            if(pipe(pipefds[i]) == -1){
-                display_error("ERROR: Pipe failed", "");
-                return;
-            }
-        }
-        // create a child process for each command, and connect the pipes.
-        for(int i = 0; i < pipeCount+1; i++){
-            pid_t pid = fork();
-            if (pid == -1) {
-                display_error("ERROR: Fork failed", "");
-                return;
-            } else if (pid == 0) {
-                // child
-                //ignore sigint
-                signal(SIGINT, SIG_IGN);
-                if (i > 0) {
-                    // not first, redir input
-                    dup2(pipefds[i - 1][0], STDIN_FILENO);
-                }
-                if (i < pipeCount) {
-                    // not last, redir output
-                    dup2(pipefds[i][1], STDOUT_FILENO);
-                }
-                // close all fds.
-                for (int j = 0; j < pipeCount + 1; j++) {
-                    close(pipefds[j][0]);
-                    close(pipefds[j][1]);
+        // a pipeline of builtin filters runs right here, no fork needed.
+        if (bg || run_pipeline_in_process(pipeCount + 1, token_count + 2, commands, literals) < 0) {
+            // now that we have all commands stored in the commands array, we can start the piping process.
+            // create a pipe for each pipe:
+            int pipefds[pipeCount + 1][2];
+            for(int i = 0; i < pipeCount + 1; i++){
+                if(pipe(pipefds[i]) == -1){
+                    display_error("ERROR: Pipe failed", "");
+                    goto cleanup;
                 }
-                // execute all commands.
-                if (commands[i][0] != NULL){
-                    execute_command(commands[i][0], commands[i]);
-                }
-                exit(1);
-            } else if (bg && i == commandCount - 1) {
-                // parent process plus background.
-                char message[512];
-                // display the message of command number and pid.
-                snprintf(message, sizeof(message), "[%d] %d\n", bg_process_count + 1, pid);
-                display_message(message);
-                // add to the linked list the pid, num and cmd.
-                bg_processes[bg_process_count].pid = pid;
-                bg_processes[bg_process_count].job_number = bg_process_count + 1;
-                char command[512];
-                int ind = 0;
-                command[ind] = '\0';
-                if (tokens[ind]!=NULL){
-                    strncat(command, tokens[ind], strlen(tokens[ind]));
-                    ind++;
-                }
-                while(tokens[ind] != NULL){
-                    strncat(command, " ", 2);
-                    strncat(command, tokens[ind], strlen(tokens[ind]));
-                    ind++;
+            }
+            // create a child process for each command, and connect the pipes.
+            for(int i = 0; i < pipeCount+1; i++){
+                pid_t pid = fork();
+                if (pid == -1) {
+                    display_error("ERROR: Fork failed", "");
+                    goto cleanup;
+                } else if (pid == 0) {
+                    // child
+                    //ignore sigint
+                    signal(SIGINT, SIG_IGN);
+                    // the pipeline as a whole reads and writes the shell's current fds.
+                    io_to_std();
+                    if (i > 0) {
+                        // not first, redir input
+                        dup2(pipefds[i - 1][0], STDIN_FILENO);
+                    }
+                    if (i < pipeCount) {
+                        // not last, redir output
+                        dup2(pipefds[i][1], STDOUT_FILENO);
+                    }
+                    // close all fds.
+                    for (int j = 0; j < pipeCount + 1; j++) {
+                        close(pipefds[j][0]);
+                        close(pipefds[j][1]);
+                    }
+                    // execute all commands.
+                    if (commands[i][0] != NULL){
+                        run_redirected(commands[i], literals[i], IO_STD_FDS);
+                    }
+                    exit(1);
+                } else if (bg && i == commandCount - 1) {
+                    // parent process plus background.
+                    add_background_job(pid, tokens);
                 }
-                strcpy(bg_processes[bg_process_count].command, command);
-                bg_process_count++;
             }
-        }
-        // close all the pipes in the parent process:
-        for(int i = 0; i < pipeCount + 1; i++){
-            close(pipefds[i][0]);
-            close(pipefds[i][1]);
-        }
-        // wait for all the child processes to finish:
-        if (!bg) {
-            for (int i = 0; i < commandCount; i++) {
-                wait(NULL);
+            // close all the pipes in the parent process:
+            for(int i = 0; i < pipeCount + 1; i++){
+                close(pipefds[i][0]);
+                close(pipefds[i][1]);
+            }
+            // wait for all the child processes to finish:
+            if (!bg) {
+                for (int i = 0; i < commandCount; i++) {
+                    wait(NULL);
+                }
             }
         }
         // display_message("Commands finished\n");
+cleanup:
         // free all of sanitized.
         for(int  i= 0 ; i < token_count; i++){
 		    free(sanitized[i]);
 	    }
+        free(sanitized);
        	// free all of commands.
         for(int i = 0; i < pipeCount + 2; i++){
             for(int j = 0; j < token_count+2; j++){
@@ -321,6 +659,8 @@ void execute_commands(char **tokens, int token_count){
                 }
             }
         }
+        free(commands);
+        free(literals);
     }
 }
 
@@ -361,6 +701,7 @@ int execute_bin_command(char *command, char **args) {
                 return -2;
             }
             if (pid == 0) {
+                io_to_std();
                 execv(command, args);
                 exit(1); 
             } else {
@@ -381,6 +722,7 @@ int execute_bin_command(char *command, char **args) {
             return -2;
         }
         if (pid == 0) {
+            io_to_std();
             execv(path, args);
             exit(1);  // If execv fails
         } else {
@@ -397,6 +739,7 @@ int execute_bin_command(char *command, char **args) {
             return -2;
         }
         if (pid == 0) {
+            io_to_std();
             execv(path, args);
             exit(1);
         } else {
@@ -462,23 +805,55 @@ void setup_server_socket(struct listen_sock *s, int port) {
 /* Insert helper functions from last week here. */
 
 int find_network_newline(const char *buf, int inbuf) {
-    // do simple for loop.
-    for (int i = 0; i < inbuf - 1; i++) {
-        if (buf[i] == '\r' && buf[i + 1] == '\n') {
-            return i + 2;
+    // every \n is a candidate: the first with a \r before it ends the message.
+    const char *p = buf + 1;
+    const char *end = buf + inbuf;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        if (p[-1] == '\r') {
+            return p - buf + 1;
         }
+        p++;
     }
     return -1;
 }
 
-int read_from_socket(int sock_fd, char *buf, int *inbuf) {
-    int nbytes = read(sock_fd, buf + *inbuf, BUF_SIZE - *inbuf);
+int net_buf_space(net_buf *b) {
+    if (b->len == 0) {
+        b->start = 0;
+    } else if (b->start > 0 && b->start + b->len + BUF_SIZE > NET_BUF_SIZE) {
+        // at most one unfinished message, so one short move per read.
+        memmove(b->data, b->data + b->start, b->len);
+        b->start = 0;
+    }
+    return NET_BUF_SIZE - b->start - b->len;
+}
+
+int check_buffer(net_buf *b) {
+    if (find_network_newline(b->data + b->start, b->len) == -1) {
+        // only an overflow if no message ends in it: a client sending
+        // faster than it is read fills the buffer with several.
+        if (b->len >= BUF_SIZE) {
+            display_error("ERROR: Buffer overflow", "");
+            return -1;
+        }
+        return 2;
+    }
+    return 0;
+}
+
+int read_from_socket(int sock_fd, net_buf *b) {
+    int space = net_buf_space(b);
+    int nbytes = read(sock_fd, b->data + b->start + b->len, space);
     if (nbytes < 0) {
+        // a non-blocking socket with nothing left to read.
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 3;
+        }
         perror("read");
         return -1;
     } else if (nbytes == 0) {
         // check to make sure that the client actually disconnected.
-        if (*inbuf == 0) {
+        if (b->len == 0) {
             // client disconnected.
             return 1; 
         } else {
@@ -487,46 +862,153 @@ int read_from_socket(int sock_fd, char *buf, int *inbuf) {
         }
     }
 
-    *inbuf += nbytes;
-    // printf("DEBUG: Read %d bytes from socket %d. Total in buffer: %d\n", nbytes, sock_fd, *inbuf);
-    if (*inbuf >= BUF_SIZE) {
-        display_error("ERROR: Buffer overflow", "");
-        return -1;
+    b->len += nbytes;
+    return check_buffer(b);
+}
+
+int get_messages(net_buf *b, net_msg *msgs, int max) {
+    int n = 0;
+    while (n < max) {
+        char *text = b->data + b->start;
+        int newline = find_network_newline(text, b->len);
+        if (newline == -1) {
+            break;
+        }
+        // end it over the \r, or cut it short.
+        int message_length = newline - 2;
+        int end = message_length < MAX_USER_MSG ? message_length : MAX_USER_MSG;
+        msgs[n].cut = text[end];
+        text[end] = '\0';
+        msgs[n].text = text;
+        msgs[n].size = newline;
+        n++;
+        b->start += newline;
+        b->len -= newline;
     }
+    return n;
+}
 
-    if (find_network_newline(buf, *inbuf) == -1) {
-        return 2;
+void unget_messages(net_buf *b, net_msg *msgs, int n) {
+    if (n == 0) {
+        return;
     }
-    return 0;
+    for (int i = 0; i < n; i++) {
+        int message_length = msgs[i].size - 2;
+        msgs[i].text[message_length < MAX_USER_MSG ? message_length : MAX_USER_MSG] = msgs[i].cut;
+    }
+    int start = msgs[0].text - b->data;
+    b->len += b->start - start;
+    b->start = start;
 }
 
-int get_message(char **dst, char *src, int *inbuf) {
-    // printf("DEBUG: Inbuf at %d\n", *inbuf);
-    int newline = find_network_newline(src, *inbuf); 
-    if (newline == -1) {
-        return 1;
+void put_bin_header(char *dst, uint32_t len, uint32_t sender, uint32_t seq) {
+    uint32_t header[3] = {htonl(len), htonl(sender), htonl(seq)};
+    memcpy(dst, header, BIN_HEADER);
+}
+
+int bin_buf_init(bin_buf *b, uint32_t max, net_buf *in) {
+    b->cap = BIN_HEADER + (size_t) max;
+    b->start = b->len = 0;
+    b->data = malloc(b->cap);
+    if (b->data == NULL) {
+        return -1;
     }
-    // remove the \r\n
-    int message_length = newline - 2;
-    // truncate the message if it is too long.
-    if (message_length > MAX_USER_MSG) {
-        message_length = MAX_USER_MSG;
+    if (in != NULL) {
+        memcpy(b->data, in->data + in->start, in->len);
+        b->len = in->len;
+        in->start = in->len = 0;
     }
-    // make new msg.
-    *dst = malloc(message_length + 1);
-    if (*dst == NULL) {
-        perror("malloc");
+    return 0;
+}
+
+void bin_buf_free(bin_buf *b) {
+    free(b->data);
+    b->data = NULL;
+    b->cap = b->start = b->len = 0;
+}
+
+size_t bin_buf_space(bin_buf *b) {
+    if (b->len == 0) {
+        b->start = 0;
+    } else if (b->start > 0 && b->start + b->len > b->cap / 2) {
+        // what is left is less than a frame, moved once per read.
+        memmove(b->data, b->data + b->start, b->len);
+        b->start = 0;
+    }
+    return b->cap - b->start - b->len;
+}
+
+int read_frames(int sock_fd, bin_buf *b) {
+    int nbytes = read(sock_fd, b->data + b->start + b->len, bin_buf_space(b));
+    if (nbytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 3;
+        }
+        // the other end left with frames it never read.
+        if (errno == ECONNRESET) {
+            return 1;
+        }
+        perror("read");
+        return -1;
+    } else if (nbytes == 0) {
         return 1;
     }
-    // copy only msg, not newline stuff
-    memcpy(*dst, src, message_length);
-    (*dst)[message_length] = '\0';
-    // remove msg, newline stuff from buf
-    memmove(src, src + newline, *inbuf - newline);
-    *inbuf -= newline;
+    b->len += nbytes;
     return 0;
 }
 
+int get_frame(bin_buf *b, bin_msg *msg) {
+    if (b->len < BIN_HEADER) {
+        return 0;
+    }
+    uint32_t header[3];
+    memcpy(header, b->data + b->start, BIN_HEADER);
+    msg->len = ntohl(header[0]);
+    if (msg->len > b->cap - BIN_HEADER) {
+        return -1;
+    }
+    if (b->len < BIN_HEADER + (size_t) msg->len) {
+        return 0;
+    }
+    msg->sender = ntohl(header[1]);
+    msg->seq = ntohl(header[2]);
+    msg->payload = b->data + b->start + BIN_HEADER;
+    b->start += BIN_HEADER + msg->len;
+    b->len -= BIN_HEADER + msg->len;
+    return 1;
+}
+
+int negotiate_binary(int sock_fd, net_buf *in, int show) {
+    if (write_to_socket(sock_fd, "\\binary\r\n", 9) != 0) {
+        return -1;
+    }
+    char strbuf[BUF_SIZE + 1];
+    net_msg msgs[NET_BATCH];
+    while (1) {
+        struct pollfd wait_fd = {sock_fd, POLLIN, 0};
+        if (poll(&wait_fd, 1, BIN_NEGOTIATE_MS) <= 0) {
+            return -1;
+        }
+        int code = read_from_socket(sock_fd, in);
+        if (code == -1 || code == 1) {
+            return -1;
+        }
+        int n = get_messages(in, msgs, NET_BATCH);
+        for (int i = 0; i < n; i++) {
+            if (strncmp(msgs[i].text, "\\binary ", 8) == 0) {
+                // what came after it is already in frames.
+                unget_messages(in, msgs + i + 1, n - i - 1);
+                long max = strtol(msgs[i].text + 8, NULL, 10);
+                return max > 0 && max <= BIN_MAX_LIMIT ? max : -1;
+            }
+            if (show) {
+                snprintf(strbuf, sizeof(strbuf), "%s\n", msgs[i].text);
+                display_message(strbuf);
+            }
+        }
+    }
+}
+
 /* Helper function to be completed for this week. */
 
 int write_to_socket(int sock_fd, char *buf, int len) {
@@ -538,6 +1020,12 @@ int write_to_socket(int sock_fd, char *buf, int len) {
             if (errno == EINTR) {
                 continue;
             }
+            // a full non-blocking socket: wait until it drains.
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd wait_fd = {sock_fd, POLLOUT, 0};
+                poll(&wait_fd, 1, -1);
+                continue;
+            }
             perror("write");
             return 1;
         }
@@ -551,79 +1039,88 @@ int write_to_socket(int sock_fd, char *buf, int len) {
     return 0;
 }
 
-// chat helpers.
-// code directly taken from w10's lab.
-int write_buf_to_client(struct client_sock *c, char *buf, int len) {
-    // prelim check for invalid input.
-    if (c == NULL || buf == NULL || len <= 0) {
-        display_error("Error: Invalid input to write_buf_to_client", "");
-        return 1;
-    }
-    // too long of a message.
-    if (len + 2 > BUF_SIZE) {
-        display_error("Error: Message too long to send to client", "");
-        return 1;
-    }
-    // copy the message to a temp buffer, and add the \r\n.
-    char temp_buf[BUF_SIZE];
-    memcpy(temp_buf, buf, len);
-    temp_buf[len] = '\r';
-    temp_buf[len + 1] = '\n';
-
-    // printf("DEBUG: Sending message to client %d: %.*s\n", c->sock_fd, len + 2, temp_buf);
-    return write_to_socket(c->sock_fd, temp_buf, len + 2);
-}
+// Clients
 
-int remove_client(struct client_sock **curr, struct client_sock **clients) {
-    // no clients, no need to remove.
-    if (*clients == NULL) {
-        return 1;
+/*
+ * Chat in binary frames of payloads up to max bytes, once the server has
+ * agreed to them, starting with whatever came after its answer in in.
+ */
+static void client_binary_loop(int sock_fd, net_buf *in, uint32_t max) {
+    bin_buf b;
+    // a typed line, behind the room for its header.
+    char *out = malloc(BIN_HEADER + (size_t) max + 2);
+    // a frame as shown: who from, then the payload.
+    char *shown = malloc((size_t) max + 32);
+    if (out == NULL || shown == NULL || bin_buf_init(&b, max, in) < 0) {
+        perror("malloc");
+        free(out);
+        free(shown);
+        return;
     }
-    // treat the clients list as a linked list, need to replace the client with the next client.
-    struct client_sock *temp = *clients;
-    struct client_sock *prev = NULL;
-    // classic linked list traversal.
-    while (temp != NULL) {
-        if (temp == *curr) {
-            // client found.
-            if (prev == NULL) {
-                // indicates that this is the first client, so we need to update the head of the list.
-                *clients = temp->next;
+    uint32_t seq = 0;
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {sock_fd, POLLIN, 0}};
+    while (1) {
+        bin_msg msg;
+        int got;
+        while ((got = get_frame(&b, &msg)) == 1) {
+            if (msg.sender == 0) {
+                snprintf(shown, (size_t) max + 32, "%.*s\n", (int) msg.len, msg.payload);
             } else {
-                // removing a client in the middle or end of the list
-                prev->next = temp->next;
+                snprintf(shown, (size_t) max + 32, "client%u: %.*s\n", msg.sender, (int) msg.len, msg.payload);
+            }
+            display_message(shown);
+        }
+        if (got < 0) {
+            display_error("Error reading from server", "");
+            break;
+        }
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents) {
+            if (fgets(out + BIN_HEADER, max + 2, stdin) == NULL) {
+                display_message("Disconnected from server.\n");
+                break;
+            }
+            size_t len = strlen(out + BIN_HEADER);
+            if (len > 0 && out[BIN_HEADER + len - 1] == '\n') {
+                len--;
+            }
+            if (len > max) {
+                len = max;
+            }
+            put_bin_header(out, len, 0, ++seq);
+            if (write_to_socket(sock_fd, out, BIN_HEADER + len)) {
+                display_error("Error sending message to server", "");
+                break;
+            }
+        }
+        if (fds[1].revents) {
+            int server_closed = read_frames(sock_fd, &b);
+            if (server_closed == -1) {
+                display_error("Error reading from server", "");
+                break;
+            } else if (server_closed == 1) {
+                display_message("Server closed the connection.\n");
+                break;
             }
-
-            // remember to close socket, free mem.
-            close(temp->sock_fd);
-            free(temp);
-            // safety.
-            *curr = NULL; 
-            return 0;
         }
-        prev = temp;
-        temp = temp->next;
     }
-    // only reached if client was never found.
-    return 1; 
+    bin_buf_free(&b);
+    free(out);
+    free(shown);
 }
 
-int read_from_client(struct client_sock *curr) {
-    return read_from_socket(curr->sock_fd, curr->buf, &(curr->inbuf));
-}
-
-int set_username(struct client_sock *curr) {
-    // username not needed. suppress unused variable warning.
-    (void) curr;
-    return 0;
-}
-// Clients
 // code directly taken from w10's lab.
-void start_client(int port, const char *hostname) {
+void start_client(int port, const char *hostname, int binary) {
     struct sockaddr_in server;
     int sock_fd;
-    char buf[BUF_SIZE];
-    int inbuf = 0;
+    net_buf in;
+    in.start = in.len = 0;
     char strbuf[1000];
 
     // create socket fd
@@ -664,6 +1161,17 @@ void start_client(int port, const char *hostname) {
         sleep(2); // Wait before retrying
     }
 
+    if (binary) {
+        int max = negotiate_binary(sock_fd, &in, 1);
+        if (max < 0) {
+            display_error("ERROR: Server does not support binary framing", "");
+        } else {
+            client_binary_loop(sock_fd, &in, max);
+        }
+        close(sock_fd);
+        return;
+    }
+
     // reading messages
     fd_set fdset;
     FD_ZERO(&fdset);
@@ -730,7 +1238,7 @@ void start_client(int port, const char *hostname) {
 
         // handle from the server.
         if (FD_ISSET(sock_fd, &tmp_fds)) {
-            int server_closed = read_from_socket(sock_fd, buf, &inbuf);
+            int server_closed = read_from_socket(sock_fd, &in);
             if (server_closed == -1) {
                 display_error("Error reading from server", "");
                 break;
@@ -738,297 +1246,16 @@ void start_client(int port, const char *hostname) {
                 display_message("Server closed the connection.\n");
                 break;
             }
-            char *msg;
-            while (get_message(&msg, buf, &inbuf) == 0) {
-                snprintf(strbuf, 1000, "%s\n", msg);
-                display_message(strbuf);
-                // display_message("%s\n", msg);
-                free(msg);
+            net_msg msgs[NET_BATCH];
+            int n;
+            while ((n = get_messages(&in, msgs, NET_BATCH)) > 0) {
+                for (int i = 0; i < n; i++) {
+                    snprintf(strbuf, 1000, "%s\n", msgs[i].text);
+                    display_message(strbuf);
+                }
             }
         }
     }
 
     close(sock_fd);
 }
-// Server
-// code directly taken from w10's lab.
-// static int sigint_received = 0;
-
-static int unique_id = 1;
-
-// static void sigint_handler(int code) {
-//     (void) code;
-//     sigint_received = 1;
-// }
-
-/*
- * Wait for and accept a new connection.
- * Return -1 if the accept call failed.
- */
-int accept_connection(int fd, struct client_sock **clients) {
-    struct sockaddr_in peer;
-    unsigned int peer_len = sizeof(peer);
-    peer.sin_family = AF_INET;
-
-    int num_clients = 0;
-    struct client_sock *curr = *clients;
-    while (curr != NULL && num_clients < MAX_CONNECTIONS && curr->next != NULL) {
-        curr = curr->next;
-        num_clients++;
-    }
-
-    int client_fd = accept(fd, (struct sockaddr *)&peer, &peer_len);
-    
-    if (client_fd < 0) {
-        perror("server: accept");
-        close(fd);
-        exit(1);
-    }
-
-    if (num_clients == MAX_CONNECTIONS) {
-        close(client_fd);
-        return -1;
-    }
-
-    struct client_sock *newclient = malloc(sizeof(struct client_sock));
-    newclient->sock_fd = client_fd;
-    newclient->inbuf = newclient->state = 0;
-    newclient->id = unique_id++;
-    newclient->next = NULL;
-    memset(newclient->buf, 0, BUF_SIZE);
-    // need to get the ip address of the client, and assign it to the client.
-    if (inet_ntop(AF_INET, &peer.sin_addr, newclient->ip_address, sizeof(newclient->ip_address)) == NULL) {
-        perror("inet_ntop");
-        strncpy(newclient->ip_address, "\0", INET_ADDRSTRLEN);
-    }
-
-
-
-    if (*clients == NULL) {
-        *clients = newclient;
-    }
-    else {
-        curr->next = newclient;
-    }
-
-    return client_fd;
-}
-
-static void clean_exit(struct listen_sock s, struct client_sock *clients, int exit_status) {
-    struct client_sock *tmp;
-    while (clients) {
-        tmp = clients;
-        close(tmp->sock_fd);
-        clients = clients->next;
-        free(tmp);
-    }
-    close(s.sock_fd);
-    free(s.addr);
-    exit(exit_status);
-}
-
-void start_server(int port) {
-
-    //Code taken directly from w10's lab.
-    // setbuf(stdout, NULL);
-
-    /*
-     * Turn off SIGPIPE: write() to a socket that is closed on the other
-     * end will return -1 with errno set to EPIPE, instead of generating
-     * a SIGPIPE signal that terminates the process.
-     */
-    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
-        perror("signal");
-        exit(1);
-    }
-
-    // char strbuf[1000];
-
-    // Linked list of clients
-    struct client_sock *clients = NULL;
-
-    struct listen_sock s;
-    setup_server_socket(&s, port);
-
-    // Set up SIGINT handler: Want to ignore sigint here:
-    struct sigaction sa_sigint;
-    memset(&sa_sigint, 0, sizeof(sa_sigint));
-    sa_sigint.sa_handler = SIG_IGN;
-    sa_sigint.sa_flags = 0;
-    sigemptyset(&sa_sigint.sa_mask);
-    sigaction(SIGINT, &sa_sigint, NULL);
-
-    int exit_status = 0;
-
-    int max_fd = s.sock_fd;
-
-    fd_set all_fds, listen_fds;
-
-    FD_ZERO(&all_fds);
-    FD_SET(s.sock_fd, &all_fds);
-
-    do {
-        listen_fds = all_fds;
-        int nready = select(max_fd + 1, &listen_fds, NULL, NULL, NULL);
-        // if (sigint_received) break;
-        if (nready == -1) {
-            if (errno == EINTR) continue;
-            perror("server: select");
-            exit_status = 1;
-            break;
-        }
-
-        /* 
-         * If a new client is connecting, create new
-         * client_sock struct and add to clients linked list.
-         */
-        if (FD_ISSET(s.sock_fd, &listen_fds)) {
-            int client_fd = accept_connection(s.sock_fd, &clients);
-            if (client_fd < 0) {
-                display_message("Failed to accept incoming connection.\n");
-                continue;
-            }
-            if (client_fd > max_fd) {
-                max_fd = client_fd;
-            }
-            FD_SET(client_fd, &all_fds);
-            // snprintf(strbuf, sizeof(strbuf), "Accepted connection from client %d\n", client_fd);
-            // display_message(strbuf);
-        }
-        // display_message("DEBUG: Incoming connection.\n");
-        /*
-         * Accept incoming messages from clients,
-         * and send to all other connected clients.
-         */
-        struct client_sock *curr = clients;
-        while (curr) {
-            if (!FD_ISSET(curr->sock_fd, &listen_fds)) {
-                curr = curr->next;
-                continue;
-            }
-            int client_closed = read_from_client(curr);
-            char write_buf[BUF_SIZE + 20];
-            write_buf[0] = '\0';
-            if (client_closed == 2) {
-                // null term the buffer at the max message length:
-                curr->buf[MAX_USER_MSG] = '\0';
-                // Optionally, broadcast the chunk to other clients
-                struct client_sock *dest_c = clients;
-                while (dest_c) {
-                    if (dest_c->ip_address[0] == '\0' || strcmp(dest_c->ip_address, curr->ip_address) != 0) {
-                        dest_c = dest_c->next;
-                        continue;
-                    }    
-                    char *formatted_msg = malloc(strlen(curr->buf) + 100);
-                    snprintf(formatted_msg, strlen(curr->buf) + 100, "client%d: %s\n", curr->id, curr->buf);
-                    display_message(formatted_msg);
-                    int ret = write_buf_to_client(dest_c, formatted_msg, strlen(formatted_msg));
-                    if (ret == 2) {
-                        close(dest_c->sock_fd);
-                        FD_CLR(dest_c->sock_fd, &all_fds);
-                        assert(remove_client(&dest_c, &clients) == 0);
-                        continue;
-                    }
-                    free(formatted_msg);
-                    dest_c = dest_c->next;
-                }
-            
-                // Clear the buffer for the client
-                curr->inbuf = 0;
-                curr->buf[0] = '\0';
-            
-                // Skip further processing for this client in this iteration
-                continue;
-            }
-
-            // If error encountered when receiving data
-            if (client_closed == -1) {
-                client_closed = 1; // Disconnect the client
-            }
-
-            char *msg;
-            // display_message("DEBUG: Incoming message with client_closed equal to: ");
-            // char msgbuf[100];
-            // snprintf(msgbuf, sizeof(msgbuf), "%d\n", client_closed);
-            // display_message(msgbuf);
-            // Loop through buffer to get complete message(s)
-            while (client_closed == 0 && !get_message(&msg, curr->buf, &(curr->inbuf))) {
-                // check if the command run was the \\connected command.
-                if (strncmp(msg, "\\connected", 10) == 0) {
-                    // get the number of clients via iterating thru client_sock:
-                    struct client_sock *temp = clients;
-                    int num_clients = 0;
-                    while (temp) {
-                        num_clients++;
-                        temp = temp->next;
-                    }
-                    // print out the number of connected clients, using the unique id:
-                    snprintf(write_buf, sizeof(write_buf), "Connected clients: %d", num_clients);
-                    // write it to the client that sent the message.
-                    int ret = write_buf_to_client(curr, write_buf, strlen(write_buf));
-                    if (ret == 2){
-                        close(curr->sock_fd);
-                        FD_CLR(curr->sock_fd, &all_fds);
-                        assert(remove_client(&curr, &clients) == 0);
-                        continue;
-                    }
-                    // don't want to write to everyone else
-                    continue;
-                }
-                // Write the message to the server console, in the format client#: message
-                snprintf(write_buf, sizeof(write_buf), "client%d: %s\n", curr->id, msg);
-                display_message(write_buf);
-                // print_path();
-                // display_message("Test Message.");
-                // Write the message in the same format as above to all other clients connected to the same hostname on the server.
-                struct client_sock *dest_c = clients;
-                while (dest_c) {
-                    // check for matching ips.
-                    // printf("DEBUG: Comparing sender IP %s with recipient IP %s\n", curr->ip_address, dest_c->ip_address);
-                    if (dest_c->ip_address[0] == '\0'||strcmp(dest_c->ip_address, curr->ip_address) != 0) {
-                        dest_c = dest_c->next;
-                        continue;
-                    }
-                    // need to write to the client the message in the form client#: message
-                    char *formatted_msg = malloc(strlen(msg) + 100);
-                    snprintf(formatted_msg, strlen(msg) + 100, "client%d: %s", curr->id, msg);
-                    // printf("DEBUG: Sending message to client %d: %s\n", dest_c->sock_fd, formatted_msg);
-                    int ret = write_buf_to_client(dest_c, formatted_msg, strlen(formatted_msg));
-                    if (ret == 0) {
-                        // snprintf(strbuf, sizeof(strbuf), "Sent message to client %d\n", dest_c->id);
-                        // display_message(strbuf);
-                        // print_path();
-                    } else {
-                        // snprintf(strbuf, sizeof(strbuf), "Failed to send message to client %d\n", dest_c->id);
-                        // display_message(strbuf);
-                        // print_path();
-                        if (ret == 2) {
-                            // snprintf(strbuf, sizeof(strbuf), "Client %d disconnected\n", dest_c->sock_fd);
-                            // display_message(strbuf);
-                            close(dest_c->sock_fd);
-                            FD_CLR(dest_c->sock_fd, &all_fds);
-                            assert(remove_client(&dest_c, &clients) == 0);
-                            continue;
-                        }
-                    }
-                    // free formatted_msg
-                    free(formatted_msg);
-                    dest_c = dest_c->next;
-                }
-                free(msg);
-            }
-
-            if (client_closed == 1) { // Client disconnected
-                FD_CLR(curr->sock_fd, &all_fds);
-                close(curr->sock_fd);
-                // snprintf(strbuf, sizeof(strbuf), "Client %d disconnected\n", curr->sock_fd);
-                // display_message(strbuf);
-                assert(remove_client(&curr, &clients) == 0);
-            } else {
-                curr = curr->next;
-            }
-        }
-    } while (1);
-
-    clean_exit(s, clients, exit_status);
-}
\ No newline at end of file
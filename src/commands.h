@@ -1,10 +1,29 @@
 #ifndef __COMMANDS_H__
 #define __COMMANDS_H__
 
+#include <stdint.h>
+#include <stddef.h>
+
  // Commands
 #define MAX_BG_PROCESSES 4096
 
-void execute_commands(char **tokens, int token_count);
+// Command substitution: bytes read from the output per call, and the pipe
+// size asked for when the command has to be forked.
+#define CAPTURE_READ 65536
+#define CAPTURE_PIPE_SIZE (1 << 20)
+
+/* Run the tokens of a line; literal flags those no operator is taken from,
+ * as tokenize_input sets them.
+ */
+void execute_commands(char **tokens, unsigned char *literal, int token_count);
+
+/* Run line as a command and collect what it writes to its output. Builtins
+ * (and pipelines of them) run inside the shell into a memfd; anything else
+ * runs in a forked shell and is read back through one pipe.
+ * Return: the output (*len bytes, NULL terminated) for the caller to free,
+ * or NULL on error.
+ */
+char *capture_command(const char *line, size_t *len);
 void handle_sigchld(int sig);
 void execute_command(char *command, char **args);
 int execute_bin_command(char *command, char **args);
@@ -19,7 +38,7 @@ ssize_t print_background_processes();
 #endif
 
 #ifndef MAX_BACKLOG
-    #define MAX_BACKLOG 5
+    #define MAX_BACKLOG SOMAXCONN
 #endif
 
 #ifndef MAX_NAME
@@ -49,6 +68,69 @@ ssize_t print_background_processes();
     #define BUF_SIZE MAX_PROTO_MSG+1 
 #endif
 
+// Bytes a connection's input buffer holds: what one read takes in, on top
+// of the unfinished message (under BUF_SIZE) left from the last.
+#define NET_BUF_SIZE 2048
+// Messages get_messages takes out at a time.
+#define NET_BATCH 64
+
+/* A connection's input: bytes read but not yet taken as messages, at
+ * data[start, start + len). Taking a message only moves start; what is left
+ * of an unfinished one is moved to the front before a read needs the room.
+ */
+typedef struct net_buf {
+    int start;
+    int len;
+    char data[NET_BUF_SIZE];
+} net_buf;
+
+/* A message taken from a net_buf, in place: its text is NULL terminated over
+ * the \r (or cut short to MAX_USER_MSG), and stays valid until the next read
+ * into the buffer.
+ */
+typedef struct net_msg {
+    char *text;
+    // bytes it took from the buffer, network newline included.
+    int size;
+    // the byte the NULL terminator replaced, put back by unget_messages.
+    char cut;
+} net_msg;
+
+/* Binary framing. A client that sends the line "\\binary" is answered with
+ * "\\binary MAX" (the largest payload the server takes), and from then on
+ * both ends exchange frames instead of lines: a BIN_HEADER-byte header of
+ * the payload length, the sender's id (0 for the server itself) and the
+ * sender's sequence number, each 32 bits in network byte order, then the
+ * payload.
+ */
+#define BIN_HEADER 12
+// Largest payload a server takes unless told otherwise, and the most it can
+// be told.
+#define BIN_MAX_DEFAULT (64 * 1024)
+#define BIN_MAX_LIMIT (16 * 1024 * 1024)
+// How long a client waits for the server to agree to binary framing.
+#define BIN_NEGOTIATE_MS 2000
+
+/* A connection's input in binary framing: data[start, start + len) of cap
+ * bytes, room for a whole frame of the largest payload.
+ */
+typedef struct bin_buf {
+    char *data;
+    size_t cap;
+    size_t start;
+    size_t len;
+} bin_buf;
+
+/* A frame taken from a bin_buf: its payload stays where it was read, valid
+ * until the next read into the buffer.
+ */
+typedef struct bin_msg {
+    uint32_t sender;
+    uint32_t seq;
+    const char *payload;
+    uint32_t len;
+} bin_msg;
+
 struct listen_sock {
     struct sockaddr_in *addr;
     int sock_fd;
@@ -64,92 +146,102 @@ void setup_server_socket(struct listen_sock *s, int port);
  * Search the first n characters of buf for a network newline (\r\n).
  * Return one plus the index of the '\n' of the first network newline,
  * or -1 if no network newline is found.
- * Definitely do not use strchr or other string functions to search here. (Why not?)
+ * Not strchr (buf isn't NULL terminated): memchr, which libc vectorizes.
  */
 int find_network_newline(const char *buf, int n);
 
-/* 
- * Reads from socket sock_fd into buffer *buf containing *inbuf bytes
- * of data. Updates *inbuf after reading from socket.
+/*
+ * Reads from socket sock_fd into b, as much as fits.
  *
  * Return -1 if read error or maximum message size is exceeded.
  * Return 0 upon receipt of CRLF-terminated message.
  * Return 1 if socket has been closed.
  * Return 2 upon receipt of partial (non-CRLF-terminated) message.
+ * Return 3 if sock_fd is non-blocking and has nothing more to read.
  */
-int read_from_socket(int sock_fd, char *buf, int *inbuf);
+int read_from_socket(int sock_fd, net_buf *b);
 
 /*
- * Search src for a network newline, and copy complete message
- * into a newly-allocated NULL-terminated string **dst.
- * Remove the complete message from the *src buffer by moving
- * the remaining content of the buffer to the front.
- *
- * Return 0 on success, 1 on error.
+ * Make room for another read into b.
+ * Return the number of bytes that fit.
  */
-int get_message(char **dst, char *src, int *inbuf);
+int net_buf_space(net_buf *b);
 
 /*
- * Write a string to a socket.
- *
- * Return 0 on success.
- * Return 1 on error.
- * Return 2 on disconnect.
- * 
- * See Robert Love Linux System Programming 2e p. 37 for relevant details
+ * Say what b holds once bytes were added to it, as read_from_socket does:
+ * 0 if a message is complete, 2 if not, -1 (with an error shown) if the
+ * unfinished one has outgrown BUF_SIZE.
  */
-int write_to_socket(int sock_fd, char *buf, int len);
- // chat helpers.
-#include <netdb.h>
+int check_buffer(net_buf *b);
 
-struct client_sock {
-    int sock_fd;
-    int state;
-    int id;
-    char buf[BUF_SIZE];
-    char ip_address[INET_ADDRSTRLEN];
-    int inbuf;
-    struct client_sock *next;
-};
+/*
+ * Take up to max complete messages out of b into msgs, oldest first, without
+ * copying them (see net_msg).
+ * Return the number taken.
+ */
+int get_messages(net_buf *b, net_msg *msgs, int max);
 
-/* 
- * Send a string to a client.
- * 
- * Input buffer must contain a NULL-terminated string. The NULL
- * terminator is replaced with a network-newline (CRLF) before
- * being sent to the client.
- * 
- * On success, return 0.
- * On error, return 1.
- * On client disconnect, return 2.
+/*
+ * Put back the n messages at msgs, last taken by get_messages, to be taken
+ * again later.
  */
-int write_buf_to_client(struct client_sock *c, char *buf, int len);
+void unget_messages(net_buf *b, net_msg *msgs, int n);
 
-/* 
- * Remove client from list. Return 0 on success, 1 on failure.
- * Update curr pointer to the new node at the index of the removed node.
- * Update clients pointer if head node was removed.
+/*
+ * Write a binary frame header for a payload of len bytes into dst.
  */
-int remove_client(struct client_sock **curr, struct client_sock **clients);
+void put_bin_header(char *dst, uint32_t len, uint32_t sender, uint32_t seq);
 
-/* 
- * Read incoming bytes from client.
- * 
- * Return -1 if read error or maximum message size is exceeded.
- * Return 0 upon receipt of CRLF-terminated message.
- * Return 1 if client socket has been closed.
- * Return 2 upon receipt of partial (non-CRLF-terminated) message.
+/*
+ * Set b up for frames of payloads up to max bytes, starting with what is
+ * left in in (if not NULL) after the line that switched to them.
+ * Return 0 on success and -1 on out of memory.
+ */
+int bin_buf_init(bin_buf *b, uint32_t max, net_buf *in);
+void bin_buf_free(bin_buf *b);
+
+/*
+ * Make room for another read into b.
+ * Return the number of bytes that fit.
+ */
+size_t bin_buf_space(bin_buf *b);
+
+/*
+ * Reads from socket sock_fd into b, as much as fits.
+ * Return -1 on read error, 1 if the socket has been closed, 3 if sock_fd
+ * is non-blocking and has nothing more to read, and 0 otherwise.
+ */
+int read_frames(int sock_fd, bin_buf *b);
+
+/*
+ * Take the oldest complete frame out of b into msg, without copying it.
+ * Return 1 if one was taken, 0 if none is complete yet, and -1 if the next
+ * one is longer than b has room for.
  */
-int read_from_client(struct client_sock *curr);
+int get_frame(bin_buf *b, bin_msg *msg);
 
-/* Set a client's user name.
- * Returns 0 on success.
- * Returns 1 on either get_message() failure or
- * if user name contains invalid character(s).
+/*
+ * Ask the server on sock_fd for binary framing and wait for its answer,
+ * showing the lines that come before it if show is set. Bytes after the
+ * answer are left in in.
+ * Return the largest payload the server takes, or -1 if it does not agree.
  */
-int set_username(struct client_sock *curr);
+int negotiate_binary(int sock_fd, net_buf *in, int show);
 
-void start_server(int port);
-void start_client(int port, const char *hostname);
+/*
+ * Write a string to a socket.
+ *
+ * Return 0 on success.
+ * Return 1 on error.
+ * Return 2 on disconnect.
+ * 
+ * See Robert Love Linux System Programming 2e p. 37 for relevant details
+ */
+int write_to_socket(int sock_fd, char *buf, int len);
+/*
+ * Chat with the server at hostname:port, from standard input, in lines or
+ * (if binary is set and the server agrees) in binary frames.
+ */
+void start_client(int port, const char *hostname, int binary);
 
 #endif
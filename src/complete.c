@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "complete.h"
+#include "builtins.h"
+#include "variables.h"
+#include "dircache.h"
+
+/* Node of the executable name trie. Children hang off child as a list
+ * linked through sibling in byte order, so walking a subtree yields the
+ * names sorted. Links are indices into nodes (0, the root, means none) so
+ * growing the array doesn't invalidate them.
+ */
+typedef struct trie_node {
+    uint32_t child;
+    uint32_t sibling;
+    unsigned char byte;
+    // a name ends here.
+    unsigned char terminal;
+} trie_node;
+
+/* A PATH directory as it was when the trie was built.
+ */
+typedef struct path_dir {
+    char *path;
+    struct timespec mtime;
+    int present;
+} path_dir;
+
+static trie_node *nodes = NULL;
+static uint32_t node_count = 0;
+static uint32_t node_cap = 0;
+
+// the PATH the trie was built from, NULL before the first build.
+static char *trie_path = NULL;
+static path_dir *dirs = NULL;
+static size_t dir_count = 0;
+
+// ===== Candidates =====
+
+static int add_item(completion *c, const char *head, size_t head_len, const char *tail, size_t tail_len, int slash) {
+	if (c->count == c->cap) {
+		size_t cap = c->cap ? c->cap * 2 : 32;
+		char **grown = realloc(c->items, sizeof(char *) * cap);
+		if (grown == NULL) {
+			return -1;
+		}
+		c->items = grown;
+		c->cap = cap;
+	}
+	char *item = malloc(head_len + tail_len + 2);
+	if (item == NULL) {
+		return -1;
+	}
+	memcpy(item, head, head_len);
+	memcpy(item + head_len, tail, tail_len);
+	if (slash) {
+		item[head_len + tail_len++] = '/';
+	}
+	item[head_len + tail_len] = '\0';
+	c->items[c->count++] = item;
+	return 0;
+}
+
+void completion_free(completion *c) {
+	for (size_t i = 0; i < c->count; i++) {
+		free(c->items[i]);
+	}
+	free(c->items);
+	memset(c, 0, sizeof(*c));
+}
+
+size_t completion_common(const completion *c) {
+	if (c->count == 0) {
+		return 0;
+	}
+	size_t len = strlen(c->items[0]);
+	for (size_t i = 1; i < c->count; i++) {
+		size_t k = 0;
+		while (k < len && c->items[i][k] == c->items[0][k]) k++;
+		len = k;
+	}
+	return len;
+}
+
+static int compare_items(const void *a, const void *b) {
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void sort_unique(completion *c) {
+	size_t sorted = 1;
+	while (sorted < c->count && strcmp(c->items[sorted - 1], c->items[sorted]) < 0) sorted++;
+	if (sorted >= c->count) {
+		return;
+	}
+	qsort(c->items, c->count, sizeof(char *), compare_items);
+	size_t kept = 0;
+	for (size_t i = 0; i < c->count; i++) {
+		if (kept > 0 && !strcmp(c->items[kept - 1], c->items[i])) {
+			free(c->items[i]);
+		} else {
+			c->items[kept++] = c->items[i];
+		}
+	}
+	c->count = kept;
+}
+
+/* What a name visitor is looking for: names starting with prefix, added to
+ * c after head.
+ */
+typedef struct name_match {
+    completion *c;
+    const char *head;
+    size_t head_len;
+    const char *prefix;
+    size_t prefix_len;
+    int failed;
+} name_match;
+
+static void match_name(void *ctx, const char *name, size_t len) {
+	name_match *m = ctx;
+	if (!m->failed && len >= m->prefix_len && !memcmp(name, m->prefix, m->prefix_len)) {
+		m->failed = add_item(m->c, m->head, m->head_len, name, len, 0) < 0;
+	}
+}
+
+// ===== Executable trie =====
+
+static void trie_free(void) {
+	free(nodes);
+	nodes = NULL;
+	node_count = node_cap = 0;
+	for (size_t i = 0; i < dir_count; i++) {
+		free(dirs[i].path);
+	}
+	free(dirs);
+	dirs = NULL;
+	dir_count = 0;
+	free(trie_path);
+	trie_path = NULL;
+}
+
+static uint32_t trie_node_new(unsigned char byte, uint32_t sibling) {
+	if (node_count == node_cap) {
+		uint32_t cap = node_cap ? node_cap * 2 : 1024;
+		trie_node *grown = realloc(nodes, sizeof(trie_node) * cap);
+		if (grown == NULL) {
+			return 0;
+		}
+		nodes = grown;
+		node_cap = cap;
+	}
+	nodes[node_count] = (trie_node) {0, sibling, byte, 0};
+	return node_count++;
+}
+
+static int trie_insert(const char *name, size_t len) {
+	uint32_t cur = 0;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char b = name[i];
+		uint32_t prev = 0;
+		uint32_t next = nodes[cur].child;
+		while (next != 0 && nodes[next].byte < b) {
+			prev = next;
+			next = nodes[next].sibling;
+		}
+		if (next == 0 || nodes[next].byte != b) {
+			uint32_t n = trie_node_new(b, next);
+			if (n == 0) {
+				return -1;
+			}
+			if (prev == 0) {
+				nodes[cur].child = n;
+			} else {
+				nodes[prev].sibling = n;
+			}
+			next = n;
+		}
+		cur = next;
+	}
+	nodes[cur].terminal = 1;
+	return 0;
+}
+
+/*
+ * Add the executables directly in dir (regular files with an x bit, or links
+ * to them) to the trie.
+ */
+static int trie_add_dir(const char *dir) {
+	dir_listing *l = dir_listing_read(dir);
+	if (l == NULL) {
+		return 0;
+	}
+	int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	int ret = 0;
+	for (size_t i = 0; dfd >= 0 && i < l->count && ret == 0; i++) {
+		const dir_item *item = &l->items[i];
+		struct stat st;
+		if (item->d_type == DT_DIR || item->name[0] == '.') {
+			continue;
+		}
+		if (fstatat(dfd, item->name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111)) {
+			ret = trie_insert(item->name, item->len);
+		}
+	}
+	if (dfd >= 0) {
+		close(dfd);
+	}
+	dir_listing_release(l);
+	return ret;
+}
+
+static void dir_stamp(path_dir *d) {
+	struct stat st;
+	d->present = stat(d->path, &st) == 0;
+	if (d->present) {
+		d->mtime = st.st_mtim;
+	}
+}
+
+/*
+ * Return: 1 if the trie no longer matches path: another PATH, or a directory
+ * that gained, lost or renamed an entry since the build (which bumps its
+ * mtime). Costs a stat per PATH directory.
+ */
+static int trie_stale(const char *path) {
+	if (trie_path == NULL || strcmp(trie_path, path)) {
+		return 1;
+	}
+	for (size_t i = 0; i < dir_count; i++) {
+		path_dir now = dirs[i];
+		dir_stamp(&now);
+		if (now.present != dirs[i].present || (now.present &&
+		    (now.mtime.tv_sec != dirs[i].mtime.tv_sec || now.mtime.tv_nsec != dirs[i].mtime.tv_nsec))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void trie_add_builtin(void *ctx, const char *name, size_t len) {
+	int *failed = ctx;
+	*failed = *failed || trie_insert(name, len) < 0;
+}
+
+static int trie_build(const char *path) {
+	trie_free();
+	trie_path = strdup(path);
+	size_t n = 1;
+	for (const char *p = path; *p != '\0'; p++) {
+		n += *p == ':';
+	}
+	dirs = calloc(n, sizeof(path_dir));
+	// the root; node 0 is never anyone's child or sibling.
+	trie_node_new(0, 0);
+	int failed = trie_path == NULL || dirs == NULL || node_count == 0;
+	// builtins go in too, so a command name comes out of one sorted walk.
+	if (!failed) {
+		visit_builtins(trie_add_builtin, &failed);
+	}
+	if (failed) {
+		trie_free();
+		return -1;
+	}
+	for (const char *p = path;; p++) {
+		const char *end = strchrnul(p, ':');
+		// an empty entry is the current directory.
+		char *dir = end == p ? strdup(".") : strndup(p, end - p);
+		if (dir == NULL) {
+			trie_free();
+			return -1;
+		}
+		dirs[dir_count].path = dir;
+		// stamp before reading, so a change made meanwhile still shows next time.
+		dir_stamp(&dirs[dir_count]);
+		dir_count++;
+		if (trie_add_dir(dir) < 0) {
+			trie_free();
+			return -1;
+		}
+		if (*end == '\0') {
+			break;
+		}
+		p = end;
+	}
+	return 0;
+}
+
+/*
+ * Add every name in the subtree of node (whose name is name[0..len)) to c.
+ */
+static int trie_collect(uint32_t node, char *name, size_t len, completion *c) {
+	if (nodes[node].terminal && add_item(c, name, len, "", 0, 0) < 0) {
+		return -1;
+	}
+	if (len >= NAME_MAX) {
+		return 0;
+	}
+	for (uint32_t k = nodes[node].child; k != 0; k = nodes[k].sibling) {
+		name[len] = nodes[k].byte;
+		if (trie_collect(k, name, len + 1, c) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int complete_executable(const char *prefix, size_t len, completion *c) {
+	const char *path = getenv("PATH");
+	if (path == NULL) {
+		path = "";
+	}
+	if (trie_stale(path) && trie_build(path) < 0) {
+		return -1;
+	}
+	if (len > NAME_MAX) {
+		return 0;
+	}
+	uint32_t cur = 0;
+	for (size_t i = 0; i < len; i++) {
+		uint32_t k = nodes[cur].child;
+		while (k != 0 && nodes[k].byte != (unsigned char) prefix[i]) k = nodes[k].sibling;
+		if (k == 0) {
+			return 0;
+		}
+		cur = k;
+	}
+	char name[NAME_MAX + 1];
+	memcpy(name, prefix, len);
+	return trie_collect(cur, name, len, c);
+}
+
+void complete_reset(void) {
+	trie_free();
+}
+
+// ===== Files =====
+
+static int is_dir(const char *dir, size_t dir_len, const dir_item *item) {
+	if (item->d_type == DT_DIR) {
+		return 1;
+	}
+	if (item->d_type != DT_LNK && item->d_type != DT_UNKNOWN) {
+		return 0;
+	}
+	char path[PATH_MAX];
+	struct stat st;
+	if (dir_len + item->len + 1 > sizeof(path)) {
+		return 0;
+	}
+	memcpy(path, dir, dir_len);
+	memcpy(path + dir_len, item->name, item->len + 1);
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static int complete_file(const char *word, size_t len, completion *c) {
+	const char *slash = memrchr(word, '/', len);
+	size_t dir_len = slash == NULL ? 0 : (size_t) (slash - word) + 1;
+	const char *prefix = word + dir_len;
+	size_t prefix_len = len - dir_len;
+	char dir[PATH_MAX];
+	if (dir_len + 1 > sizeof(dir)) {
+		return 0;
+	}
+	memcpy(dir, word, dir_len);
+	dir[dir_len] = '\0';
+	dir_listing *l = dircache_get(dir_len > 0 ? dir : ".");
+	if (l == NULL) {
+		return 0;
+	}
+	int ret = 0;
+	for (size_t i = 0; i < l->count && ret == 0; i++) {
+		const dir_item *item = &l->items[i];
+		if (item->name[0] == '.' && (prefix_len == 0 || prefix[0] != '.' ||
+		    item->len == 1 || (item->len == 2 && item->name[1] == '.'))) {
+			continue;
+		}
+		if (item->len < prefix_len || memcmp(item->name, prefix, prefix_len)) {
+			continue;
+		}
+		ret = add_item(c, word, dir_len, item->name, item->len, is_dir(dir, dir_len, item));
+	}
+	dir_listing_release(l);
+	return ret;
+}
+
+// ===== Words =====
+
+static int is_space(char ch) {
+	return ch == ' ' || ch == '\t';
+}
+
+int complete_word(const char *line, size_t pos, completion *c) {
+	memset(c, 0, sizeof(*c));
+	size_t start = pos;
+	while (start > 0 && !is_space(line[start - 1]) && line[start - 1] != '|') start--;
+	c->start = start;
+	const char *word = line + start;
+	size_t len = pos - start;
+	// a command starts the line and follows each |.
+	size_t before = start;
+	while (before > 0 && is_space(line[before - 1])) before--;
+	int command = before == 0 || line[before - 1] == '|';
+	const char *dollar = memrchr(word, '$', len);
+	int ret;
+	if (dollar != NULL) {
+		size_t head_len = dollar - word + 1;
+		name_match m = {c, word, head_len, dollar + 1, len - head_len, 0};
+		visitVars(match_name, &m);
+		ret = m.failed ? -1 : 0;
+	} else if (command && memchr(word, '/', len) == NULL) {
+		ret = complete_executable(word, len, c);
+	} else {
+		ret = complete_file(word, len, c);
+	}
+	if (ret < 0) {
+		completion_free(c);
+		return -1;
+	}
+	sort_unique(c);
+	return 0;
+}
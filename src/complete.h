@@ -0,0 +1,35 @@
+#ifndef __COMPLETE_H__
+#define __COMPLETE_H__
+
+#include <stddef.h>
+
+/* Candidates for the word under the cursor, each the whole word as it would
+ * be typed, sorted and without duplicates. Directories end in /.
+ */
+typedef struct completion {
+    char **items;
+    size_t count;
+    size_t cap;
+    // the candidates replace line[start..pos).
+    size_t start;
+} completion;
+
+/* Complete the word of line that ends at pos: a command name (builtins and
+ * executables on PATH) where a command starts, a variable name after $, a
+ * file name anywhere else. Command names come from a trie built on first use
+ * and rebuilt only once PATH or one of its directories changes.
+ * Return: 0 on success and -1 on out of memory (c is then empty).
+ */
+int complete_word(const char *line, size_t pos, completion *c);
+
+/* Return: length of the prefix the candidates in c all share.
+ */
+size_t completion_common(const completion *c);
+
+void completion_free(completion *c);
+
+/* Drop the executable trie.
+ */
+void complete_reset(void);
+
+#endif
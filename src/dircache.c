@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "dircache.h"
+#include "dirstream.h"
+
+#define DIRCACHE_BUCKETS 4096
+// Any change to the set of names (or the directory going away) drops the listing.
+#define DIRCACHE_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                             IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static int cache_enabled = 0;
+static size_t cache_budget = 0;
+static size_t cache_bytes = 0;
+static int inotify_fd = -1;
+// most recently used at the head.
+static dir_listing *lru_head = NULL;
+static dir_listing *lru_tail = NULL;
+static dir_listing *by_key[DIRCACHE_BUCKETS];
+static dir_listing *by_wd[DIRCACHE_BUCKETS];
+
+// ===== Reading =====
+
+static void free_listing(dir_listing *l) {
+	free(l->names);
+	free(l->items);
+	free(l);
+}
+
+dir_listing *dir_listing_read(const char *dir) {
+	dir_stream stream;
+	if (dir_stream_open(&stream, dir) < 0) {
+		return NULL;
+	}
+	dir_listing *l = calloc(1, sizeof(dir_listing));
+	size_t names_cap = 4096, items_cap = 64;
+	if (l != NULL) {
+		l->names = malloc(names_cap);
+		l->items = malloc(sizeof(dir_item) * items_cap);
+	}
+	if (l == NULL || l->names == NULL || l->items == NULL) {
+		if (l != NULL) free_listing(l);
+		dir_stream_close(&stream);
+		errno = ENOMEM;
+		return NULL;
+	}
+	dir_item entry;
+	int r;
+	while ((r = dir_stream_next(&stream, &entry)) == 1) {
+		size_t len = entry.len;
+		if (l->names_len + len + 1 > names_cap || l->count == items_cap) {
+			while (l->names_len + len + 1 > names_cap) names_cap *= 2;
+			if (l->count == items_cap) items_cap *= 2;
+			char *names = realloc(l->names, names_cap);
+			if (names != NULL) l->names = names;
+			dir_item *items = realloc(l->items, sizeof(dir_item) * items_cap);
+			if (items != NULL) l->items = items;
+			if (names == NULL || items == NULL) {
+				free_listing(l);
+				dir_stream_close(&stream);
+				errno = ENOMEM;
+				return NULL;
+			}
+		}
+		memcpy(l->names + l->names_len, entry.name, len + 1);
+		// the names block may still move, so store offsets for now.
+		l->items[l->count].name = (const char *) l->names_len;
+		l->items[l->count].len = len;
+		l->items[l->count].d_type = entry.d_type;
+		l->names_len += len + 1;
+		l->count++;
+	}
+	dir_stream_close(&stream);
+	if (r < 0) {
+		free_listing(l);
+		return NULL;
+	}
+	for (size_t i = 0; i < l->count; i++) {
+		l->items[i].name = l->names + (size_t) l->items[i].name;
+	}
+	l->refs = 1;
+	l->wd = -1;
+	l->bytes = sizeof(dir_listing) + names_cap + sizeof(dir_item) * items_cap;
+	return l;
+}
+
+void dir_listing_release(dir_listing *l) {
+	if (l == NULL) {
+		return;
+	}
+	l->refs--;
+	// listings still in the cache are kept, evicted ones go once unused.
+	if (l->refs == 0 && !l->cached) {
+		free_listing(l);
+	}
+}
+
+// ===== Cache bookkeeping =====
+
+static size_t key_bucket(dev_t dev, ino_t ino) {
+	return (size_t) ((ino * 0x9E3779B97F4A7C15ULL) ^ dev) % DIRCACHE_BUCKETS;
+}
+
+static void lru_unlink(dir_listing *l) {
+	if (l->lru_prev) l->lru_prev->lru_next = l->lru_next;
+	else lru_head = l->lru_next;
+	if (l->lru_next) l->lru_next->lru_prev = l->lru_prev;
+	else lru_tail = l->lru_prev;
+	l->lru_prev = l->lru_next = NULL;
+}
+
+static void lru_push_front(dir_listing *l) {
+	l->lru_prev = NULL;
+	l->lru_next = lru_head;
+	if (lru_head) lru_head->lru_prev = l;
+	lru_head = l;
+	if (lru_tail == NULL) lru_tail = l;
+}
+
+static void unlink_chain(dir_listing **head, dir_listing *l, int wd_chain) {
+	while (*head != NULL) {
+		if (*head == l) {
+			*head = wd_chain ? l->wd_next : l->key_next;
+			return;
+		}
+		head = wd_chain ? &(*head)->wd_next : &(*head)->key_next;
+	}
+}
+
+/*
+ * Take a listing out of the cache. The watch goes with it (unless the kernel
+ * already dropped it) and the memory goes once nobody is using it.
+ */
+static void cache_remove(dir_listing *l, int watch_gone) {
+	lru_unlink(l);
+	unlink_chain(&by_key[key_bucket(l->dev, l->ino)], l, 0);
+	unlink_chain(&by_wd[l->wd % DIRCACHE_BUCKETS], l, 1);
+	if (!watch_gone && inotify_fd >= 0) {
+		inotify_rm_watch(inotify_fd, l->wd);
+	}
+	cache_bytes -= l->bytes;
+	l->cached = 0;
+	if (l->refs == 0) {
+		free_listing(l);
+	}
+}
+
+static void cache_clear(void) {
+	while (lru_head != NULL) {
+		cache_remove(lru_head, 0);
+	}
+}
+
+static dir_listing *find_wd(int wd) {
+	dir_listing *l = by_wd[wd % DIRCACHE_BUCKETS];
+	while (l != NULL && l->wd != wd) {
+		l = l->wd_next;
+	}
+	return l;
+}
+
+/*
+ * Apply every pending inotify event: any change to a watched directory
+ * drops its listing. A queue overflow means we lost track, so drop it all.
+ */
+static void drain_events(void) {
+	char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+	while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + n; ) {
+			struct inotify_event *ev = (struct inotify_event *) p;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				cache_clear();
+			} else {
+				dir_listing *l = find_wd(ev->wd);
+				if (l != NULL) {
+					cache_remove(l, (ev->mask & IN_IGNORED) != 0);
+				}
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+}
+
+static void evict_to_fit(size_t bytes) {
+	dir_listing *l = lru_tail;
+	while (l != NULL && cache_bytes + bytes > cache_budget) {
+		dir_listing *prev = l->lru_prev;
+		cache_remove(l, 0);
+		l = prev;
+	}
+}
+
+static void dircache_cleanup(void) {
+	dircache_configure(0, 0);
+}
+
+// ===== Public interface =====
+
+void dircache_configure(int enabled, size_t budget) {
+	static int registered = 0;
+	if (!enabled) {
+		cache_clear();
+		if (inotify_fd >= 0) {
+			close(inotify_fd);
+			inotify_fd = -1;
+		}
+		cache_enabled = 0;
+		return;
+	}
+	if (!registered) {
+		atexit(dircache_cleanup);
+		registered = 1;
+	}
+	if (inotify_fd < 0) {
+		inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify_fd < 0) {
+			// without watches we cannot stay coherent, so never cache.
+			cache_enabled = 0;
+			return;
+		}
+	}
+	cache_enabled = 1;
+	cache_budget = budget;
+	evict_to_fit(0);
+}
+
+int dircache_enabled(void) {
+	return cache_enabled;
+}
+
+dir_listing *dircache_get(const char *dir) {
+	if (!cache_enabled) {
+		return dir_listing_read(dir);
+	}
+	drain_events();
+	struct stat st;
+	if (stat(dir, &st) < 0) {
+		return NULL;
+	}
+	dir_listing *l = by_key[key_bucket(st.st_dev, st.st_ino)];
+	while (l != NULL && (l->dev != st.st_dev || l->ino != st.st_ino)) {
+		l = l->key_next;
+	}
+	if (l != NULL) {
+		lru_unlink(l);
+		lru_push_front(l);
+		l->refs++;
+		return l;
+	}
+	// watch before reading, so nothing that changes after the read is missed.
+	int wd = inotify_add_watch(inotify_fd, dir, DIRCACHE_WATCH_MASK);
+	l = dir_listing_read(dir);
+	if (wd < 0) {
+		return l;
+	}
+	// the same inode may already be watched through another path.
+	if (l == NULL || find_wd(wd) != NULL || l->bytes > cache_budget) {
+		if (find_wd(wd) == NULL) {
+			inotify_rm_watch(inotify_fd, wd);
+		}
+		return l;
+	}
+	evict_to_fit(l->bytes);
+	l->cached = 1;
+	l->wd = wd;
+	l->dev = st.st_dev;
+	l->ino = st.st_ino;
+	size_t k = key_bucket(l->dev, l->ino);
+	l->key_next = by_key[k];
+	by_key[k] = l;
+	l->wd_next = by_wd[wd % DIRCACHE_BUCKETS];
+	by_wd[wd % DIRCACHE_BUCKETS] = l;
+	lru_push_front(l);
+	cache_bytes += l->bytes;
+	return l;
+}
@@ -0,0 +1,62 @@
+#ifndef __DIRCACHE_H__
+#define __DIRCACHE_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+
+#define DIRCACHE_DEFAULT_MB 64
+
+/* One entry of a directory listing. name points into the listing's names block.
+ */
+typedef struct dir_item {
+    const char *name;
+    size_t len;
+    unsigned char d_type;
+} dir_item;
+
+/* The full contents of a directory in two allocations: one packed block of
+ * NULL terminated names and one array of items, in readdir order.
+ */
+typedef struct dir_listing {
+    char *names;
+    size_t names_len;
+    dir_item *items;
+    size_t count;
+    // cache bookkeeping (unused for listings that are not cached).
+    int refs;
+    int cached;
+    int stale;
+    int wd;
+    dev_t dev;
+    ino_t ino;
+    size_t bytes;
+    struct dir_listing *lru_prev;
+    struct dir_listing *lru_next;
+    struct dir_listing *key_next;
+    struct dir_listing *wd_next;
+} dir_listing;
+
+/* Read dir into a fresh listing.
+ * Return: the listing (release with dir_listing_release) or NULL with errno set.
+ */
+dir_listing *dir_listing_read(const char *dir);
+
+/* Like dir_listing_read, but serve (and keep) the listing from the cache when
+ * the cache is enabled. Cached listings are invalidated through inotify.
+ */
+dir_listing *dircache_get(const char *dir);
+
+/* Drop a reference taken by dir_listing_read or dircache_get.
+ */
+void dir_listing_release(dir_listing *l);
+
+/* Turn the cache on (with a memory budget in bytes) or off. Turning it off
+ * frees everything cached and removes the inotify watches.
+ */
+void dircache_configure(int enabled, size_t budget);
+
+/* Return: 1 if listings are currently cached.
+ */
+int dircache_enabled(void);
+
+#endif
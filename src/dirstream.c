@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include "dirstream.h"
+
+/* Layout of the records getdents64 fills the buffer with.
+ */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+int dir_stream_open(dir_stream *s, const char *dir) {
+	s->pos = s->end = 0;
+	s->buf = NULL;
+	s->fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (s->fd < 0) {
+		return -1;
+	}
+	s->buf = malloc(DIR_STREAM_BUFFER);
+	if (s->buf == NULL) {
+		close(s->fd);
+		s->fd = -1;
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+int dir_stream_next(dir_stream *s, dir_item *item) {
+	if (s->pos >= s->end) {
+		long n = syscall(SYS_getdents64, s->fd, s->buf, DIR_STREAM_BUFFER);
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			return 0;
+		}
+		s->pos = 0;
+		s->end = n;
+	}
+	struct linux_dirent64 *d = (struct linux_dirent64 *) (s->buf + s->pos);
+	s->pos += d->d_reclen;
+	item->name = d->d_name;
+	item->len = strlen(d->d_name);
+	item->d_type = d->d_type;
+	return 1;
+}
+
+int dir_stream_rewind(dir_stream *s) {
+	s->pos = s->end = 0;
+	return lseek(s->fd, 0, SEEK_SET) < 0 ? -1 : 0;
+}
+
+void dir_stream_close(dir_stream *s) {
+	if (s->fd >= 0) {
+		close(s->fd);
+	}
+	free(s->buf);
+	s->fd = -1;
+	s->buf = NULL;
+}
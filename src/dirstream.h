@@ -0,0 +1,36 @@
+#ifndef __DIRSTREAM_H__
+#define __DIRSTREAM_H__
+
+#include "dircache.h"
+
+// Bytes of raw getdents64 records fetched per syscall.
+#define DIR_STREAM_BUFFER 32768
+
+/* Reads a directory straight from getdents64 with one fixed buffer, so
+ * memory stays constant no matter how large the directory is.
+ */
+typedef struct dir_stream {
+    int fd;
+    char *buf;
+    size_t pos;
+    size_t end;
+} dir_stream;
+
+/* Return: 0 on success and -1 (errno set) if dir cannot be opened.
+ */
+int dir_stream_open(dir_stream *s, const char *dir);
+
+/* Fetch the next entry. item->name points into the stream's buffer and is
+ * only valid until the following call.
+ * Return: 1 for an entry, 0 at the end of the directory and -1 on error.
+ */
+int dir_stream_next(dir_stream *s, dir_item *item);
+
+/* Go back to the first entry.
+ * Return: 0 on success and -1 on error.
+ */
+int dir_stream_rewind(dir_stream *s);
+
+void dir_stream_close(dir_stream *s);
+
+#endif
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "du.h"
+#include "dirstream.h"
+#include "workpool.h"
+
+#define LINK_STRIPES 64
+
+/* A directory being added up. It lives until its own scan and every
+ * subdirectory are done, then hands its total to the parent and is freed,
+ * so only directories still in progress take memory.
+ */
+typedef struct du_node {
+    struct du_node *parent;
+    int depth;
+    // own scan plus subdirectories not finished yet.
+    size_t pending;
+    // 512 byte blocks, added to from several threads.
+    uint64_t blocks;
+    size_t name_len;
+    char name[];
+} du_node;
+
+/* (dev, ino) of files with more than one link, so each is counted once.
+ * Split into stripes with their own lock and open addressing table.
+ */
+typedef struct link_key {
+    dev_t dev;
+    ino_t ino;
+} link_key;
+
+typedef struct link_stripe {
+    pthread_mutex_t lock;
+    link_key *keys;
+    size_t count;
+    size_t cap;
+} link_stripe;
+
+typedef struct du_ctx {
+    const ls_filter *filter;
+    int print_depth;
+    out_buffer *out;
+    pthread_mutex_t out_lock;
+    link_stripe links[LINK_STRIPES];
+    int errors;
+} du_ctx;
+
+// ===== Hard links =====
+
+static uint64_t link_hash(dev_t dev, ino_t ino) {
+	uint64_t h = (uint64_t) ino * 0x9e3779b97f4a7c15ull ^ (uint64_t) dev;
+	return h ^ (h >> 29);
+}
+
+/*
+ * Empty slots have ino 0, which no real file uses.
+ */
+static link_key *link_slot(link_key *keys, size_t cap, dev_t dev, ino_t ino) {
+	size_t i = (link_hash(dev, ino) / LINK_STRIPES) & (cap - 1);
+	while (keys[i].ino != 0 && (keys[i].ino != ino || keys[i].dev != dev)) {
+		i = (i + 1) & (cap - 1);
+	}
+	return &keys[i];
+}
+
+/*
+ * Return: 1 if (dev, ino) was not seen before (and is now), 0 otherwise.
+ */
+static int link_first_seen(du_ctx *ctx, dev_t dev, ino_t ino) {
+	link_stripe *s = &ctx->links[link_hash(dev, ino) % LINK_STRIPES];
+	int added = 0;
+	pthread_mutex_lock(&s->lock);
+	if ((s->count + 1) * 2 > s->cap) {
+		size_t cap = s->cap ? s->cap * 2 : 256;
+		link_key *keys = calloc(cap, sizeof(link_key));
+		if (keys == NULL) {
+			// out of memory: count the file, a duplicate beats a crash.
+			pthread_mutex_unlock(&s->lock);
+			return 1;
+		}
+		for (size_t i = 0; i < s->cap; i++) {
+			if (s->keys[i].ino != 0) {
+				*link_slot(keys, cap, s->keys[i].dev, s->keys[i].ino) = s->keys[i];
+			}
+		}
+		free(s->keys);
+		s->keys = keys;
+		s->cap = cap;
+	}
+	link_key *slot = link_slot(s->keys, s->cap, dev, ino);
+	if (slot->ino == 0) {
+		slot->dev = dev;
+		slot->ino = ino;
+		s->count++;
+		added = 1;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return added;
+}
+
+// ===== Tree =====
+
+static du_node *node_new(du_node *parent, const char *name, size_t len) {
+	du_node *n = malloc(sizeof(du_node) + len + 1);
+	if (n == NULL) {
+		return NULL;
+	}
+	n->parent = parent;
+	n->depth = parent != NULL ? parent->depth + 1 : 0;
+	n->pending = 1;
+	n->blocks = 0;
+	n->name_len = len;
+	memcpy(n->name, name, len);
+	n->name[len] = '\0';
+	return n;
+}
+
+/*
+ * Rebuild the full path of n from its ancestors (which are all still alive).
+ * Return: 0 on success and -1 if it does not fit.
+ */
+static int node_path(const du_node *n, char *buf, size_t size) {
+	size_t len = 0;
+	for (const du_node *p = n; p != NULL; p = p->parent) {
+		len += p->name_len + (p != n);
+	}
+	if (len + 1 > size) {
+		return -1;
+	}
+	buf[len] = '\0';
+	for (const du_node *p = n; p != NULL; p = p->parent) {
+		len -= p->name_len;
+		memcpy(buf + len, p->name, p->name_len);
+		if (p->parent != NULL) {
+			buf[--len] = '/';
+		}
+	}
+	return 0;
+}
+
+static void report_error(du_ctx *ctx, const char *msg, const char *path) {
+	pthread_mutex_lock(&ctx->out_lock);
+	out_flush(ctx->out);
+	display_error((char *) msg, (char *) path);
+	pthread_mutex_unlock(&ctx->out_lock);
+	__atomic_fetch_add(&ctx->errors, 1, __ATOMIC_RELAXED);
+}
+
+static void print_usage(du_ctx *ctx, uint64_t blocks, const char *path) {
+	char line[64];
+	// like du, whole KiB rounded up.
+	int n = snprintf(line, sizeof(line), "%llu\t", (unsigned long long) (blocks + 1) / 2);
+	pthread_mutex_lock(&ctx->out_lock);
+	out_append(ctx->out, line, n);
+	out_append(ctx->out, path, strlen(path));
+	out_append(ctx->out, "\n", 1);
+	pthread_mutex_unlock(&ctx->out_lock);
+}
+
+/*
+ * Drop one pending count of n. The last one finishes n: it is printed, its
+ * total moves up into the parent and the parent loses a pending count.
+ */
+static void node_release(du_ctx *ctx, du_node *n) {
+	while (n != NULL && __atomic_sub_fetch(&n->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+		uint64_t blocks = __atomic_load_n(&n->blocks, __ATOMIC_ACQUIRE);
+		if (n->depth <= ctx->print_depth) {
+			char path[4096];
+			if (node_path(n, path, sizeof(path)) == 0) {
+				print_usage(ctx, blocks, path);
+			}
+		}
+		du_node *parent = n->parent;
+		if (parent != NULL) {
+			__atomic_fetch_add(&parent->blocks, blocks, __ATOMIC_RELEASE);
+		}
+		free(n);
+		n = parent;
+	}
+}
+
+static int is_dot_entry(const char *name, size_t len) {
+	return (len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+/*
+ * Add up the files of one directory and queue its subdirectories.
+ */
+static void scan_dir(task_worker *w, void *task, void *arg) {
+	du_ctx *ctx = arg;
+	du_node *node = task;
+	char path[4096];
+	dir_stream stream;
+	if (node_path(node, path, sizeof(path)) < 0 || dir_stream_open(&stream, path) < 0) {
+		report_error(ctx, node->parent == NULL ? "ERROR: Invalid path: " : "ERROR: Cannot open directory: ", node->name);
+		node_release(ctx, node);
+		return;
+	}
+	uint64_t blocks = 0;
+	struct stat st;
+	if (ctx->filter->kind == FILTER_NONE && fstat(stream.fd, &st) == 0) {
+		blocks += st.st_blocks;
+	}
+	dir_item item;
+	int r;
+	while ((r = dir_stream_next(&stream, &item)) == 1) {
+		if (is_dot_entry(item.name, item.len)) {
+			continue;
+		}
+		unsigned char type = item.d_type;
+		struct statx stx;
+		int have_stx = 0;
+		if (type == DT_UNKNOWN || (type != DT_DIR && filter_match(ctx->filter, item.name, item.len))) {
+			if (statx(stream.fd, item.name, AT_SYMLINK_NOFOLLOW,
+			          STATX_TYPE | STATX_BLOCKS | STATX_NLINK | STATX_INO, &stx) < 0) {
+				report_error(ctx, "ERROR: Cannot stat: ", item.name);
+				continue;
+			}
+			have_stx = 1;
+			type = S_ISDIR(stx.stx_mode) ? DT_DIR : DT_REG;
+		}
+		if (type == DT_DIR) {
+			du_node *child = node_new(node, item.name, item.len);
+			if (child == NULL) {
+				report_error(ctx, "ERROR: Out of memory at: ", item.name);
+				continue;
+			}
+			__atomic_fetch_add(&node->pending, 1, __ATOMIC_RELAXED);
+			if (task_push(w, child) < 0) {
+				free(child);
+				__atomic_fetch_sub(&node->pending, 1, __ATOMIC_RELAXED);
+				report_error(ctx, "ERROR: Out of memory at: ", item.name);
+			}
+			continue;
+		}
+		if (!have_stx || !filter_match(ctx->filter, item.name, item.len)) {
+			continue;
+		}
+		if (stx.stx_nlink > 1 && !link_first_seen(ctx, makedev(stx.stx_dev_major, stx.stx_dev_minor), stx.stx_ino)) {
+			continue;
+		}
+		blocks += stx.stx_blocks;
+	}
+	if (r < 0) {
+		report_error(ctx, "ERROR: Cannot read directory: ", path);
+	}
+	dir_stream_close(&stream);
+	__atomic_fetch_add(&node->blocks, blocks, __ATOMIC_RELEASE);
+	node_release(ctx, node);
+}
+
+int du_tree(const char *path, int print_depth, const ls_filter *filter, out_buffer *out) {
+	du_ctx *ctx = calloc(1, sizeof(du_ctx));
+	if (ctx == NULL) {
+		return 1;
+	}
+	ctx->filter = filter;
+	ctx->print_depth = print_depth;
+	ctx->out = out;
+	pthread_mutex_init(&ctx->out_lock, NULL);
+	for (int i = 0; i < LINK_STRIPES; i++) {
+		pthread_mutex_init(&ctx->links[i].lock, NULL);
+	}
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		report_error(ctx, "ERROR: Invalid path: ", path);
+	} else if (!S_ISDIR(st.st_mode)) {
+		// a single file is its own total.
+		print_usage(ctx, st.st_blocks, path);
+	} else {
+		du_node *root = node_new(NULL, path, strlen(path));
+		if (root == NULL || task_pool_run(scan_dir, ctx, root) < 0) {
+			free(root);
+			ctx->errors++;
+		}
+	}
+	int errors = ctx->errors;
+	for (int i = 0; i < LINK_STRIPES; i++) {
+		pthread_mutex_destroy(&ctx->links[i].lock);
+		free(ctx->links[i].keys);
+	}
+	pthread_mutex_destroy(&ctx->out_lock);
+	free(ctx);
+	return errors;
+}
@@ -0,0 +1,16 @@
+#ifndef __DU_H__
+#define __DU_H__
+
+#include "filter.h"
+#include "io_helpers.h"
+
+/* Add up the disk usage under path and print "KiB<tab>path" for path and
+ * each directory down to print_depth levels below it, every directory after
+ * all of its subdirectories. Only files whose names pass filter count
+ * (directories count themselves when there is no filter), and a file with
+ * several hard links is counted once.
+ * Return: 0 on success, or the number of entries that could not be read.
+ */
+int du_tree(const char *path, int print_depth, const ls_filter *filter, out_buffer *out);
+
+#endif
@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "extsort.h"
+#include "workpool.h"
+
+#define RUN_IO_BUFFER 65536
+// Loser tree slot for the initial "beats everything" sentinel.
+#define TREE_MIN ((size_t) -1)
+
+// ===== In-memory phase =====
+
+void extsort_init(extsort *s, size_t budget, extsort_cmp cmp, void *ctx) {
+	memset(s, 0, sizeof(*s));
+	s->cmp = cmp;
+	s->ctx = ctx;
+	s->budget = budget;
+}
+
+static int compare_recs(const void *a, const void *b, void *arg) {
+	const extsort_rec *x = a, *y = b;
+	extsort *s = arg;
+	return s->cmp(x->data, x->len, y->data, y->len, s->ctx);
+}
+
+/* One parallel step of sort_memory: slices are sorted on their own, then
+ * merged pairwise from src into dst until one slice is left.
+ */
+typedef struct sort_job {
+    extsort *s;
+    extsort_rec *src;
+    extsort_rec *dst;
+    size_t *bounds;     // slice i is [bounds[i], bounds[i + 1])
+    size_t slices;
+} sort_job;
+
+static void sort_slice(void *ctx, size_t i) {
+	sort_job *job = ctx;
+	size_t lo = job->bounds[i];
+	qsort_r(job->src + lo, job->bounds[i + 1] - lo, sizeof(extsort_rec), compare_recs, job->s);
+}
+
+static void merge_pair(void *ctx, size_t pair) {
+	sort_job *job = ctx;
+	size_t i = pair * 2;
+	size_t a = job->bounds[i];
+	size_t a_end = job->bounds[i + 1];
+	// an odd slice out has no partner and is just carried over.
+	size_t b = a_end;
+	size_t b_end = i + 2 <= job->slices ? job->bounds[i + 2] : a_end;
+	size_t out = a;
+	while (a < a_end && b < b_end) {
+		// ties take the left side so equal records keep their order.
+		if (compare_recs(&job->src[b], &job->src[a], job->s) < 0) {
+			job->dst[out++] = job->src[b++];
+		} else {
+			job->dst[out++] = job->src[a++];
+		}
+	}
+	memcpy(job->dst + out, job->src + a, (a_end - a) * sizeof(extsort_rec));
+	out += a_end - a;
+	memcpy(job->dst + out, job->src + b, (b_end - b) * sizeof(extsort_rec));
+}
+
+/*
+ * Sort the in-memory records. Big batches are cut into one slice per
+ * thread, the slices are sorted in parallel and then merged in log2(slices)
+ * parallel rounds. Only the record array is copied, never the data.
+ */
+static void sort_memory(extsort *s) {
+	size_t threads = workpool_threads();
+	if (s->count < EXTSORT_PARALLEL_MIN || threads == 1) {
+		if (s->count > 0) {
+			qsort_r(s->recs, s->count, sizeof(extsort_rec), compare_recs, s);
+		}
+		return;
+	}
+	size_t bounds[WORKPOOL_MAX_THREADS + 1];
+	extsort_rec *tmp = malloc(sizeof(extsort_rec) * s->count);
+	if (tmp == NULL) {
+		qsort_r(s->recs, s->count, sizeof(extsort_rec), compare_recs, s);
+		return;
+	}
+	for (size_t i = 0; i <= threads; i++) {
+		bounds[i] = s->count * i / threads;
+	}
+	sort_job job = {s, s->recs, tmp, bounds, threads};
+	workpool_run_tasks(threads, sort_slice, &job);
+	while (job.slices > 1) {
+		size_t pairs = (job.slices + 1) / 2;
+		workpool_run_tasks(pairs, merge_pair, &job);
+		// every pair becomes one slice: keep each pair's outer bounds.
+		for (size_t i = 0; i < pairs; i++) {
+			bounds[i] = bounds[i * 2];
+		}
+		bounds[pairs] = s->count;
+		job.slices = pairs;
+		extsort_rec *swap = job.src;
+		job.src = job.dst;
+		job.dst = swap;
+	}
+	if (job.src != s->recs) {
+		free(s->recs);
+		s->recs = job.src;
+		s->recs_cap = s->count;
+	} else {
+		free(tmp);
+	}
+}
+
+/*
+ * Sort the in-memory records and write them out as a new run, leaving the
+ * memory empty for the next batch.
+ */
+static int spill(extsort *s) {
+	if (s->run_count == s->runs_cap) {
+		size_t cap = s->runs_cap ? s->runs_cap * 2 : 8;
+		extsort_run *runs = realloc(s->runs, sizeof(extsort_run) * cap);
+		if (runs == NULL) {
+			return -1;
+		}
+		s->runs = runs;
+		s->runs_cap = cap;
+	}
+	FILE *f = tmpfile();
+	if (f == NULL) {
+		return -1;
+	}
+	setvbuf(f, NULL, _IOFBF, RUN_IO_BUFFER);
+	sort_memory(s);
+	for (size_t i = 0; i < s->count; i++) {
+		uint32_t len = s->recs[i].len;
+		if (fwrite(&len, sizeof(len), 1, f) != 1 ||
+		    fwrite(s->recs[i].data, 1, len, f) != len) {
+			fclose(f);
+			return -1;
+		}
+	}
+	extsort_run *run = &s->runs[s->run_count++];
+	memset(run, 0, sizeof(*run));
+	run->file = f;
+	s->count = 0;
+	s->data_len = 0;
+	return 0;
+}
+
+int extsort_add(extsort *s, const char *rec, size_t len) {
+	size_t used = s->data_len + s->count * sizeof(extsort_rec);
+	if (s->count > 0 && used + len + sizeof(extsort_rec) > s->budget && spill(s) < 0) {
+		return -1;
+	}
+	if (s->data_len + len > s->data_cap) {
+		size_t cap = s->data_cap ? s->data_cap : 4096;
+		while (s->data_len + len > cap) cap *= 2;
+		char *data = realloc(s->data, cap);
+		if (data == NULL) {
+			return -1;
+		}
+		// records point into data, so move them along with it.
+		for (size_t i = 0; i < s->count; i++) {
+			s->recs[i].data = data + (s->recs[i].data - s->data);
+		}
+		s->data = data;
+		s->data_cap = cap;
+	}
+	if (s->count == s->recs_cap) {
+		size_t cap = s->recs_cap ? s->recs_cap * 2 : 256;
+		extsort_rec *recs = realloc(s->recs, sizeof(extsort_rec) * cap);
+		if (recs == NULL) {
+			return -1;
+		}
+		s->recs = recs;
+		s->recs_cap = cap;
+	}
+	memcpy(s->data + s->data_len, rec, len);
+	s->recs[s->count].data = s->data + s->data_len;
+	s->recs[s->count].len = len;
+	s->data_len += len;
+	s->count++;
+	return 0;
+}
+
+// ===== Merge phase =====
+
+static int run_advance(extsort_run *run) {
+	uint32_t len;
+	if (fread(&len, sizeof(len), 1, run->file) != 1) {
+		run->done = 1;
+		return 0;
+	}
+	if (len > run->cap) {
+		char *buf = realloc(run->buf, len);
+		if (buf == NULL) {
+			return -1;
+		}
+		run->buf = buf;
+		run->cap = len;
+	}
+	if (fread(run->buf, 1, len, run->file) != len) {
+		return -1;
+	}
+	run->len = len;
+	return 0;
+}
+
+/*
+ * Return: 1 if run a should come out before run b. Exhausted runs lose to
+ * everything, the sentinel wins against everything.
+ */
+static int beats(extsort *s, size_t a, size_t b) {
+	if (a == TREE_MIN) return 1;
+	if (b == TREE_MIN) return 0;
+	if (s->runs[a].done) return 0;
+	if (s->runs[b].done) return 1;
+	int c = s->cmp(s->runs[a].buf, s->runs[a].len, s->runs[b].buf, s->runs[b].len, s->ctx);
+	// ties go to the earlier run so equal records keep their input order.
+	return c < 0 || (c == 0 && a < b);
+}
+
+/*
+ * Replay the matches from leaf r up to the root: each node keeps the loser
+ * and the winner moves on, so only log(k) comparisons per record.
+ */
+static void tree_adjust(extsort *s, size_t r) {
+	size_t k = s->run_count;
+	size_t winner = r;
+	for (size_t t = (r + k) / 2; t > 0; t /= 2) {
+		if (beats(s, s->tree[t], winner)) {
+			size_t tmp = s->tree[t];
+			s->tree[t] = winner;
+			winner = tmp;
+		}
+	}
+	s->tree[0] = winner;
+}
+
+static int start_merge(extsort *s) {
+	size_t k = s->run_count;
+	for (size_t i = 0; i < k; i++) {
+		extsort_run *run = &s->runs[i];
+		if (fseek(run->file, 0, SEEK_SET) < 0) {
+			return -1;
+		}
+		run->done = 0;
+		if (run_advance(run) < 0) {
+			return -1;
+		}
+	}
+	for (size_t i = 0; i < k; i++) {
+		s->tree[i] = TREE_MIN;
+	}
+	for (size_t i = k; i > 0; i--) {
+		tree_adjust(s, i - 1);
+	}
+	return 0;
+}
+
+int extsort_finish(extsort *s) {
+	s->finished = 1;
+	s->pos = 0;
+	if (s->run_count == 0) {
+		sort_memory(s);
+		return 0;
+	}
+	// once anything spilled, the tail becomes a run as well.
+	if (s->count > 0 && spill(s) < 0) {
+		return -1;
+	}
+	free(s->data);
+	free(s->recs);
+	s->data = NULL;
+	s->recs = NULL;
+	s->data_cap = s->recs_cap = 0;
+	s->tree = malloc(sizeof(size_t) * s->run_count);
+	if (s->tree == NULL) {
+		return -1;
+	}
+	return start_merge(s);
+}
+
+int extsort_next(extsort *s, const char **rec, size_t *len) {
+	if (s->run_count == 0) {
+		if (s->pos >= s->count) {
+			return 0;
+		}
+		*rec = s->recs[s->pos].data;
+		*len = s->recs[s->pos].len;
+		s->pos++;
+		return 1;
+	}
+	// the previous winner's buffer was handed out, so advance it only now.
+	if (s->pos > 0) {
+		size_t prev = s->tree[0];
+		if (run_advance(&s->runs[prev]) < 0) {
+			return -1;
+		}
+		tree_adjust(s, prev);
+	}
+	size_t winner = s->tree[0];
+	if (s->runs[winner].done) {
+		return 0;
+	}
+	*rec = s->runs[winner].buf;
+	*len = s->runs[winner].len;
+	s->pos++;
+	return 1;
+}
+
+int extsort_rewind(extsort *s) {
+	s->pos = 0;
+	if (s->run_count == 0) {
+		return 0;
+	}
+	return start_merge(s);
+}
+
+size_t extsort_runs(const extsort *s) {
+	return s->run_count;
+}
+
+void extsort_free(extsort *s) {
+	for (size_t i = 0; i < s->run_count; i++) {
+		fclose(s->runs[i].file);
+		free(s->runs[i].buf);
+	}
+	free(s->runs);
+	free(s->tree);
+	free(s->data);
+	free(s->recs);
+	memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,91 @@
+#ifndef __EXTSORT_H__
+#define __EXTSORT_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Default memory budget for a sort before it starts spilling runs to disk.
+#define EXTSORT_DEFAULT_MB 64
+// Batches with at least this many records are sorted on several threads.
+#define EXTSORT_PARALLEL_MIN 16384
+
+/* Type for record comparison: <0, 0 or >0 like strcmp.
+ */
+typedef int (*extsort_cmp)(const char *a, size_t alen, const char *b, size_t blen, void *ctx);
+
+/* One record in memory (or the current head of a run during the merge).
+ */
+typedef struct extsort_rec {
+    const char *data;
+    size_t len;
+} extsort_rec;
+
+/* A spilled, sorted run: length prefixed records in an unlinked temp file.
+ */
+typedef struct extsort_run {
+    FILE *file;
+    char *buf;
+    size_t cap;
+    size_t len;
+    int done;
+} extsort_run;
+
+/* External merge sort of byte records. Records are collected in memory until
+ * the budget is hit, then sorted and spilled as a run; the runs are finally
+ * merged through a loser tree. Small inputs never touch the disk.
+ * Large batches are sorted on all threads, which briefly needs a second
+ * record array (16 bytes per record) on top of the budget.
+ */
+typedef struct extsort {
+    extsort_cmp cmp;
+    void *ctx;
+    size_t budget;
+    // in-memory records: packed data plus the record array.
+    char *data;
+    size_t data_len;
+    size_t data_cap;
+    extsort_rec *recs;
+    size_t count;
+    size_t recs_cap;
+    // spilled runs and the loser tree over them (tree[0] is the winner).
+    extsort_run *runs;
+    size_t run_count;
+    size_t runs_cap;
+    size_t *tree;
+    // iteration state
+    int finished;
+    size_t pos;
+} extsort;
+
+/* Prepare an empty sort with a budget in bytes.
+ */
+void extsort_init(extsort *s, size_t budget, extsort_cmp cmp, void *ctx);
+
+/* Add a record (copied).
+ * Return: 0 on success and -1 on error (out of memory or disk).
+ */
+int extsort_add(extsort *s, const char *rec, size_t len);
+
+/* Sort what is left in memory; no records may be added afterwards.
+ * Return: 0 on success and -1 on error.
+ */
+int extsort_finish(extsort *s);
+
+/* Fetch the next record in sorted order. The pointer stays valid until the
+ * next call.
+ * Return: 1 if a record was produced, 0 at the end and -1 on error.
+ */
+int extsort_next(extsort *s, const char **rec, size_t *len);
+
+/* Start the sorted iteration over from the beginning.
+ * Return: 0 on success and -1 on error.
+ */
+int extsort_rewind(extsort *s);
+
+/* Return: number of runs spilled to disk so far.
+ */
+size_t extsort_runs(const extsort *s);
+
+void extsort_free(extsort *s);
+
+#endif
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "fanout.h"
+
+/* State shared by one fanout_stream call.
+ */
+typedef struct fanout {
+    int in;
+    const int *out;
+    size_t count;
+    int *is_pipe;
+    size_t *sent;
+    // pipe used to tee into sinks that are not pipes themselves.
+    int scratch[2];
+    // copy buffer, only allocated once something has to go through user space.
+    char *buf;
+} fanout;
+
+static int is_fifo(int fd) {
+	struct stat st;
+	return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int ensure_buffer(fanout *f) {
+	if (f->buf == NULL) {
+		f->buf = malloc(FANOUT_CHUNK);
+		if (f->buf == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read exactly len bytes (len <= FANOUT_CHUNK) from src into the buffer.
+ */
+static int read_exact(fanout *f, int src, size_t len) {
+	if (ensure_buffer(f) < 0) {
+		return -1;
+	}
+	size_t got = 0;
+	while (got < len) {
+		ssize_t n = read(src, f->buf + got, len - got);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		got += n;
+	}
+	return 0;
+}
+
+/*
+ * Move len bytes that are already sitting in pipe src over to dst. Sinks
+ * that do not take splice (ttys on newer kernels, for one) get a plain copy
+ * of whatever is left.
+ */
+static int drain(fanout *f, int src, int dst, size_t len) {
+	size_t moved = 0;
+	while (moved < len) {
+		ssize_t n = splice(src, NULL, dst, NULL, len - moved, SPLICE_F_MOVE);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		moved += n;
+	}
+	if (moved == len) {
+		return 0;
+	}
+	return read_exact(f, src, len - moved) < 0 ? -1 : write_all(dst, f->buf, len - moved);
+}
+
+/*
+ * Plain read/write loop for inputs that are not pipes.
+ */
+static int copy_stream(fanout *f) {
+	if (ensure_buffer(f) < 0) {
+		return -1;
+	}
+	while (1) {
+		ssize_t n = read(f->in, f->buf, FANOUT_CHUNK);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return n;
+		}
+		for (size_t d = 0; d < f->count; d++) {
+			if (write_all(f->out[d], f->buf, n) < 0) {
+				return -1;
+			}
+		}
+	}
+}
+
+/*
+ * Single sink: nothing to duplicate, just splice the input across.
+ */
+static int splice_stream(fanout *f) {
+	while (1) {
+		ssize_t n = splice(f->in, NULL, f->out[0], NULL, FANOUT_CHUNK, SPLICE_F_MOVE);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0 && errno == EINVAL) {
+			return copy_stream(f);
+		}
+		if (n <= 0) {
+			return n;
+		}
+	}
+}
+
+/*
+ * Duplicate one chunk of the input to every sink but the last with tee(2),
+ * which leaves the data in the input pipe, then splice it to the last sink,
+ * which consumes it.
+ * Return: bytes handled, 0 at EOF and -1 on error.
+ */
+static ssize_t tee_chunk(fanout *f) {
+	ssize_t n = -1;
+	size_t last = f->count - 1;
+	size_t d = 0;
+	while (d < last) {
+		size_t want = n < 0 ? FANOUT_CHUNK : (size_t) n;
+		int target = f->is_pipe[d] ? f->out[d] : f->scratch[1];
+		ssize_t m = tee(f->in, target, want, 0);
+		if (m < 0 && errno == EINTR) {
+			continue;
+		}
+		if (m < 0) {
+			return -1;
+		}
+		if (!f->is_pipe[d] && m > 0 && drain(f, f->scratch[0], f->out[d], m) < 0) {
+			return -1;
+		}
+		if (n < 0) {
+			if (m == 0) {
+				return 0;
+			}
+			n = m;
+		}
+		f->sent[d] = m;
+		if (m < n) {
+			break;
+		}
+		d++;
+	}
+	if (d == last) {
+		return drain(f, f->in, f->out[last], n) < 0 ? -1 : n;
+	}
+	// tee cannot resume part way into the pipe, so finish this chunk by hand.
+	if (read_exact(f, f->in, n) < 0) {
+		return -1;
+	}
+	for (size_t i = d; i < f->count; i++) {
+		size_t from = i == d ? f->sent[i] : 0;
+		if (write_all(f->out[i], f->buf + from, n - from) < 0) {
+			return -1;
+		}
+	}
+	return n;
+}
+
+int fanout_stream(int in, const int *out, size_t count) {
+	fanout f = {in, out, count, NULL, NULL, {-1, -1}, NULL};
+	int ret = -1;
+	if (count == 0) {
+		return 0;
+	}
+	if (!is_fifo(in)) {
+		ret = copy_stream(&f);
+	} else if (count == 1) {
+		ret = splice_stream(&f);
+	} else {
+		f.is_pipe = calloc(count, sizeof(int));
+		f.sent = calloc(count, sizeof(size_t));
+		if (f.is_pipe == NULL || f.sent == NULL) {
+			errno = ENOMEM;
+			goto done;
+		}
+		int need_scratch = 0;
+		for (size_t d = 0; d < count; d++) {
+			f.is_pipe[d] = is_fifo(out[d]);
+			need_scratch |= d + 1 < count && !f.is_pipe[d];
+		}
+		if (need_scratch) {
+			if (pipe2(f.scratch, O_CLOEXEC) < 0) {
+				ret = copy_stream(&f);
+				goto done;
+			}
+			// the scratch pipe must hold a whole chunk of the input or tee comes up short.
+			int size = fcntl(in, F_GETPIPE_SZ);
+			fcntl(f.scratch[1], F_SETPIPE_SZ, size > FANOUT_CHUNK ? size : FANOUT_CHUNK);
+		}
+		ssize_t n;
+		while ((n = tee_chunk(&f)) > 0);
+		ret = n;
+	}
+done:
+	if (f.scratch[0] >= 0) {
+		close(f.scratch[0]);
+		close(f.scratch[1]);
+	}
+	free(f.is_pipe);
+	free(f.sent);
+	free(f.buf);
+	return ret;
+}
@@ -0,0 +1,17 @@
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#include <stddef.h>
+
+// Bytes moved per round, also the size requested for the scratch pipe.
+#define FANOUT_CHUNK (1 << 20)
+
+/* Copy everything from in to each of the count fds in out until in hits EOF.
+ * When in is a pipe the data is duplicated in the kernel with tee(2) and
+ * moved with splice(2); otherwise (or when a sink refuses splice) it goes
+ * through one large user space buffer.
+ * Return: 0 on success and -1 on error (errno set).
+ */
+int fanout_stream(int in, const int *out, size_t count);
+
+#endif
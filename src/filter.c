@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+// Compiled glob instruction types.
+#define GLOB_OP_LIT 0
+#define GLOB_OP_ANY 1
+#define GLOB_OP_SET 2
+#define GLOB_OP_STAR 3
+
+// ===== Substring matching =====
+
+/*
+ * Rough guess of how often a byte shows up in file names. Lower is rarer.
+ * Only used to pick which needle byte we hand to memchr.
+ */
+static int byte_commonness(unsigned char c) {
+	if (strchr("etaoinsrlc", c) != NULL && c != '\0') {
+		return 9;
+	}
+	if (c >= 'a' && c <= 'z') {
+		return 6;
+	}
+	if ((c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-') {
+		return 5;
+	}
+	if (c >= 'A' && c <= 'Z') {
+		return 3;
+	}
+	return 1;
+}
+
+size_t filter_pick_anchor(const char *needle, size_t len) {
+	size_t best = 0;
+	for (size_t i = 1; i < len; i++) {
+		if (byte_commonness(needle[i]) < byte_commonness(needle[best])) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+const char *filter_memmem(const char *hay, size_t hay_len,
+                          const char *needle, size_t needle_len, size_t anchor) {
+	if (needle_len == 0) {
+		return hay;
+	}
+	if (hay_len < needle_len) {
+		return NULL;
+	}
+	// memchr does the skipping (vectorized in libc); we only verify on a hit.
+	const char *p = hay + anchor;
+	const char *end = hay + hay_len - (needle_len - 1 - anchor);
+	while (p < end) {
+		const char *hit = memchr(p, needle[anchor], end - p);
+		if (hit == NULL) {
+			return NULL;
+		}
+		const char *start = hit - anchor;
+		if (memcmp(start, needle, needle_len) == 0) {
+			return start;
+		}
+		p = hit + 1;
+	}
+	return NULL;
+}
+
+// ===== Glob compilation =====
+
+/*
+ * Parse a [...] bracket expression starting at pattern[*i] (the '[').
+ * Fills set and advances *i past the closing ']'.
+ * Return 0 on success and -1 if there is no closing bracket.
+ */
+static int compile_bracket(const char *pattern, size_t len, size_t *i, unsigned char *set) {
+	size_t j = *i + 1;
+	int negate = 0;
+	memset(set, 0, 32);
+	if (j < len && (pattern[j] == '!' || pattern[j] == '^')) {
+		negate = 1;
+		j++;
+	}
+	// a leading ']' is a literal member.
+	int first = 1;
+	while (j < len && (pattern[j] != ']' || first)) {
+		unsigned char lo = pattern[j];
+		unsigned char hi = lo;
+		if (j + 2 < len && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+			hi = pattern[j + 2];
+			j += 2;
+		}
+		for (unsigned int c = lo; c <= hi; c++) {
+			set[c >> 3] |= 1 << (c & 7);
+		}
+		first = 0;
+		j++;
+	}
+	if (j >= len) {
+		return -1;
+	}
+	if (negate) {
+		for (int k = 0; k < 32; k++) {
+			set[k] = ~set[k];
+		}
+	}
+	*i = j + 1;
+	return 0;
+}
+
+static int compile_glob(ls_filter *f) {
+	const char *p = f->pattern;
+	f->ops = malloc(sizeof(glob_op) * (f->len + 1));
+	f->sets = malloc(32 * (f->len + 1));
+	if (f->ops == NULL || f->sets == NULL) {
+		return -1;
+	}
+	size_t i = 0;
+	while (i < f->len) {
+		glob_op op = {GLOB_OP_LIT, (unsigned char) p[i], 0};
+		if (p[i] == '*') {
+			op.type = GLOB_OP_STAR;
+			// runs of stars are the same as a single star.
+			while (i < f->len && p[i] == '*') {
+				i++;
+			}
+		} else if (p[i] == '?') {
+			op.type = GLOB_OP_ANY;
+			i++;
+		} else if (p[i] == '[' && compile_bracket(p, f->len, &i, f->sets[f->set_count]) == 0) {
+			op.type = GLOB_OP_SET;
+			op.set = f->set_count++;
+		} else if (p[i] == '\\' && i + 1 < f->len) {
+			op.c = p[i + 1];
+			i += 2;
+		} else {
+			i++;
+		}
+		f->ops[f->op_count++] = op;
+	}
+	// the leading literals are checked with one memcmp before running the ops.
+	size_t n = 0;
+	while (n < f->op_count && f->ops[n].type == GLOB_OP_LIT) {
+		n++;
+	}
+	f->prefix = malloc(n + 1);
+	if (f->prefix == NULL) {
+		return -1;
+	}
+	for (size_t k = 0; k < n; k++) {
+		f->prefix[k] = f->ops[k].c;
+	}
+	f->prefix[n] = '\0';
+	f->prefix_len = n;
+	return 0;
+}
+
+static int glob_step(const ls_filter *f, const glob_op *op, unsigned char c) {
+	switch (op->type) {
+	case GLOB_OP_LIT:
+		return op->c == c;
+	case GLOB_OP_ANY:
+		return 1;
+	case GLOB_OP_SET:
+		return (f->sets[op->set][c >> 3] >> (c & 7)) & 1;
+	}
+	return 0;
+}
+
+/*
+ * Classic single star backtracking: on a mismatch we only ever retry from the
+ * most recent star, so the match is linear for the common patterns.
+ */
+static int glob_match(const ls_filter *f, const char *name, size_t len) {
+	size_t i = f->prefix_len, j = f->prefix_len;
+	size_t star_op = (size_t) -1, star_j = 0;
+	while (j < len) {
+		if (i < f->op_count && f->ops[i].type == GLOB_OP_STAR) {
+			star_op = i++;
+			star_j = j;
+		} else if (i < f->op_count && glob_step(f, &f->ops[i], name[j])) {
+			i++;
+			j++;
+		} else if (star_op != (size_t) -1) {
+			i = star_op + 1;
+			j = ++star_j;
+		} else {
+			return 0;
+		}
+	}
+	while (i < f->op_count && f->ops[i].type == GLOB_OP_STAR) {
+		i++;
+	}
+	return i == f->op_count;
+}
+
+// ===== Regex literal extraction =====
+
+#define REGEX_META ".[]()*+?{}|^$\\"
+
+static int is_quantifier(char c) {
+	return c == '*' || c == '+' || c == '?' || c == '{';
+}
+
+/*
+ * Collect a run of literal bytes starting at pattern[i] into out.
+ * A literal directly followed by a quantifier is optional, so it ends the run.
+ * Return: number of bytes written; *i is moved to the end of the run.
+ */
+static size_t regex_literal_run(const char *pattern, size_t len, size_t *i, char *out) {
+	size_t n = 0;
+	while (*i < len) {
+		size_t step = 1;
+		char c = pattern[*i];
+		if (c == '\\' && *i + 1 < len && strchr(REGEX_META, pattern[*i + 1]) != NULL) {
+			c = pattern[*i + 1];
+			step = 2;
+		} else if (strchr(REGEX_META, c) != NULL) {
+			break;
+		}
+		if (*i + step < len && is_quantifier(pattern[*i + step])) {
+			break;
+		}
+		out[n++] = c;
+		*i += step;
+	}
+	return n;
+}
+
+/*
+ * Work out a literal that every match must contain so most names can be
+ * rejected without running regexec. Alternation makes this hard, so we give up.
+ */
+static int compile_regex_literals(ls_filter *f) {
+	const char *p = f->pattern;
+	f->prefix = calloc(f->len + 1, 1);
+	f->required = calloc(f->len + 1, 1);
+	if (f->prefix == NULL || f->required == NULL) {
+		return -1;
+	}
+	for (size_t i = 0; i < f->len; i++) {
+		if (p[i] == '\\') {
+			i++;
+		} else if (p[i] == '|') {
+			return 0;
+		}
+	}
+	size_t i = 0;
+	if (f->len > 0 && p[0] == '^') {
+		i = 1;
+		f->prefix_len = regex_literal_run(p, f->len, &i, f->prefix);
+		return 0;
+	}
+	// otherwise keep the longest top level literal run outside of [] and ().
+	char *run = malloc(f->len + 1);
+	if (run == NULL) {
+		return -1;
+	}
+	int depth = 0;
+	while (i < f->len) {
+		if (p[i] == '[') {
+			// skip the bracket expression, a leading ']' is part of it.
+			i++;
+			if (i < f->len && p[i] == '^') i++;
+			if (i < f->len && p[i] == ']') i++;
+			while (i < f->len && p[i] != ']') i++;
+			i++;
+		} else if (p[i] == '(') {
+			depth++;
+			i++;
+		} else if (p[i] == ')') {
+			depth--;
+			i++;
+		} else if (depth == 0) {
+			size_t start = i;
+			size_t n = regex_literal_run(p, f->len, &i, run);
+			if (n > f->required_len) {
+				memcpy(f->required, run, n);
+				f->required_len = n;
+			}
+			if (i == start) {
+				// a metacharacter or an escape like \w, neither is a literal.
+				i += (p[i] == '\\') ? 2 : 1;
+			}
+		} else {
+			i += (p[i] == '\\') ? 2 : 1;
+		}
+	}
+	free(run);
+	f->required_anchor = filter_pick_anchor(f->required, f->required_len);
+	return 0;
+}
+
+// ===== Public interface =====
+
+int filter_compile(ls_filter *f, filter_kind kind, const char *pattern) {
+	memset(f, 0, sizeof(*f));
+	if (pattern == NULL || kind == FILTER_NONE) {
+		return 0;
+	}
+	f->kind = kind;
+	f->len = strlen(pattern);
+	f->pattern = strndup(pattern, f->len);
+	if (f->pattern == NULL) {
+		return -1;
+	}
+	int err = 0;
+	if (kind == FILTER_SUBSTR) {
+		f->anchor = filter_pick_anchor(f->pattern, f->len);
+	} else if (kind == FILTER_GLOB) {
+		err = compile_glob(f);
+	} else if (kind == FILTER_REGEX) {
+		if (regcomp(&f->re, f->pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+			// regcomp leaves nothing to free on failure.
+			f->kind = FILTER_NONE;
+			err = -1;
+		} else {
+			err = compile_regex_literals(f);
+		}
+	}
+	if (err) {
+		filter_free(f);
+		return -1;
+	}
+	return 0;
+}
+
+int filter_match(const ls_filter *f, const char *name, size_t len) {
+	switch (f->kind) {
+	case FILTER_NONE:
+		return 1;
+	case FILTER_SUBSTR:
+		return filter_memmem(name, len, f->pattern, f->len, f->anchor) != NULL;
+	case FILTER_GLOB:
+		if (len < f->prefix_len || memcmp(name, f->prefix, f->prefix_len) != 0) {
+			return 0;
+		}
+		return glob_match(f, name, len);
+	case FILTER_REGEX:
+		if (len < f->prefix_len || memcmp(name, f->prefix, f->prefix_len) != 0) {
+			return 0;
+		}
+		if (f->required_len > 0 && filter_memmem(name, len, f->required,
+		        f->required_len, f->required_anchor) == NULL) {
+			return 0;
+		}
+		return regexec(&f->re, name, 0, NULL, 0) == 0;
+	}
+	return 0;
+}
+
+void filter_free(ls_filter *f) {
+	if (f->kind == FILTER_REGEX) {
+		regfree(&f->re);
+	}
+	free(f->pattern);
+	free(f->prefix);
+	free(f->required);
+	free(f->ops);
+	free(f->sets);
+	memset(f, 0, sizeof(*f));
+}
@@ -0,0 +1,75 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <stddef.h>
+#include <regex.h>
+
+/* Kinds of name filters understood by ls (and anything else that walks
+ * directories). FILTER_NONE matches everything.
+ */
+typedef enum {
+    FILTER_NONE,
+    FILTER_SUBSTR,   // --f: plain substring
+    FILTER_GLOB,     // --glob: shell style *, ? and [...]
+    FILTER_REGEX     // --regex: POSIX extended regex
+} filter_kind;
+
+/* A single compiled glob instruction. */
+typedef struct glob_op {
+    unsigned char type;     // one of the GLOB_OP_* values in filter.c
+    unsigned char c;        // literal byte for GLOB_OP_LIT
+    unsigned int set;       // index into sets for GLOB_OP_SET
+} glob_op;
+
+/* A pattern compiled once and then handed (read-only) to the traversal.
+ * Nothing in here is global, so several filters can be alive at once.
+ */
+typedef struct ls_filter {
+    filter_kind kind;
+    char *pattern;
+    size_t len;
+    // substring: offset of the rarest needle byte, scanned for with memchr.
+    size_t anchor;
+    // glob/regex: every match has to start with this literal prefix.
+    char *prefix;
+    size_t prefix_len;
+    // regex: every match has to contain this literal (when not anchored).
+    char *required;
+    size_t required_len;
+    size_t required_anchor;
+    // glob: compiled instructions and the [...] byte sets they refer to.
+    glob_op *ops;
+    size_t op_count;
+    unsigned char (*sets)[32];
+    size_t set_count;
+    // regex: the compiled expression itself.
+    regex_t re;
+} ls_filter;
+
+/* Compile pattern into f. A NULL pattern gives a filter that matches everything.
+ * Return: 0 on success and -1 on an invalid pattern (f is left empty).
+ */
+int filter_compile(ls_filter *f, filter_kind kind, const char *pattern);
+
+/* Prereq: name is a NULL terminated string of length len.
+ * Return: 1 if name passes the filter and 0 otherwise.
+ */
+int filter_match(const ls_filter *f, const char *name, size_t len);
+
+/* Release everything filter_compile allocated. Safe on an empty filter.
+ */
+void filter_free(ls_filter *f);
+
+/* Find needle in haystack, using the precomputed anchor byte of the needle
+ * as a memchr skip before verifying the whole needle.
+ * Return: pointer to the first match or NULL.
+ */
+const char *filter_memmem(const char *hay, size_t hay_len,
+                          const char *needle, size_t needle_len, size_t anchor);
+
+/* Pick the byte of needle least likely to show up in names, used as the
+ * memchr anchor of filter_memmem.
+ */
+size_t filter_pick_anchor(const char *needle, size_t len);
+
+#endif
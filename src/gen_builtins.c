@@ -0,0 +1,103 @@
+/*
+ * Build time generator for the core builtin table: reads the entries of
+ * builtins.def and searches for a hash seed that puts every name in its own
+ * slot, then writes the table out as builtins_table.h. Lookups at runtime are
+ * then one hash, one slot and one memcmp.
+ *
+ * Usage: gen_builtins <output header>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+
+typedef struct gen_entry {
+    const char *name;
+    const char *fn;
+    const char *flags;
+} gen_entry;
+
+#define BUILTIN(name, fn, flags) {name, #fn, #flags},
+static const gen_entry ENTRIES[] = {
+#include "builtins.def"
+};
+#undef BUILTIN
+
+#define ENTRY_COUNT (sizeof(ENTRIES) / sizeof(ENTRIES[0]))
+// Seeds tried per table size before the table is doubled.
+#define SEED_TRIES 1000000
+#define MAX_SLOTS 4096
+
+/*
+ * Return: 1 if seed maps every entry to a distinct slot of a table with
+ * mask + 1 slots, 0 otherwise. slots receives the entry index + 1 per slot.
+ */
+static int try_seed(uint32_t seed, uint32_t mask, size_t *slots) {
+	memset(slots, 0, sizeof(size_t) * (mask + 1));
+	for (size_t i = 0; i < ENTRY_COUNT; i++) {
+		uint32_t h = builtin_hash(ENTRIES[i].name, strlen(ENTRIES[i].name), seed) & mask;
+		if (slots[h] != 0) {
+			return 0;
+		}
+		slots[h] = i + 1;
+	}
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <output header>\n", argv[0]);
+		return 1;
+	}
+	for (size_t i = 0; i < ENTRY_COUNT; i++) {
+		for (size_t j = i + 1; j < ENTRY_COUNT; j++) {
+			if (strcmp(ENTRIES[i].name, ENTRIES[j].name) == 0) {
+				fprintf(stderr, "gen_builtins: duplicate builtin %s\n", ENTRIES[i].name);
+				return 1;
+			}
+		}
+	}
+	// start at twice the entry count so a seed turns up quickly.
+	uint32_t size = 1;
+	while (size < ENTRY_COUNT * 2) size *= 2;
+	size_t slots[MAX_SLOTS];
+	uint32_t seed = 0;
+	int found = 0;
+	while (!found && size <= MAX_SLOTS) {
+		for (seed = 0; seed < SEED_TRIES; seed++) {
+			if (try_seed(seed, size - 1, slots)) {
+				found = 1;
+				break;
+			}
+		}
+		if (!found) size *= 2;
+	}
+	if (!found) {
+		fprintf(stderr, "gen_builtins: no perfect hash found\n");
+		return 1;
+	}
+
+	FILE *out = fopen(argv[1], "w");
+	if (out == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	fprintf(out, "// Generated by gen_builtins from builtins.def, do not edit.\n");
+	fprintf(out, "#ifndef __BUILTINS_TABLE_H__\n#define __BUILTINS_TABLE_H__\n\n");
+	fprintf(out, "#define BUILTIN_SEED %uu\n", seed);
+	fprintf(out, "#define BUILTIN_MASK %uu\n\n", size - 1);
+	fprintf(out, "static const builtin_entry BUILTIN_TABLE[%u] = {\n", size);
+	for (uint32_t i = 0; i < size; i++) {
+		if (slots[i] != 0) {
+			const gen_entry *e = &ENTRIES[slots[i] - 1];
+			fprintf(out, "    [%u] = {\"%s\", %zu, %s, %s},\n", i, e->name, strlen(e->name), e->fn, e->flags);
+		}
+	}
+	fprintf(out, "};\n\n#endif\n");
+	if (fclose(out) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+#include "lines.h"
+
+// Slots in the compactor's set of lines already kept (a power of two, at
+// least twice HISTORY_KEEP).
+#define KEEP_SLOTS 32768
+
+/* Every entry containing one trigram, by the offset its line starts at, in
+ * file order.
+ */
+typedef struct trigram_list {
+    // (b0 << 16 | b1 << 8 | b2) + 1, so 0 marks an empty slot.
+    uint32_t key;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *offsets;
+} trigram_list;
+
+static int hist_fd = -1;
+static char *hist_path = NULL;
+// the whole file as of the last refresh, read only and shared.
+static char *hist_map = NULL;
+static size_t hist_mapped = 0;
+// the entries before this offset are in the trigram index.
+static size_t hist_indexed = 0;
+static size_t hist_compact_at = HISTORY_COMPACT_BYTES;
+
+static trigram_list *trigrams = NULL;
+static size_t trigram_cap = 0;
+static size_t trigram_count = 0;
+
+static pthread_t compactor;
+static int compacting = 0;
+static int compact_done = 0;
+
+// ===== Mapping =====
+
+static void index_reset(void) {
+	for (size_t i = 0; i < trigram_cap; i++) {
+		free(trigrams[i].offsets);
+	}
+	free(trigrams);
+	trigrams = NULL;
+	trigram_cap = 0;
+	trigram_count = 0;
+	hist_indexed = 0;
+}
+
+static void unmap(void) {
+	if (hist_map != NULL) {
+		munmap(hist_map, hist_mapped);
+	}
+	hist_map = NULL;
+	hist_mapped = 0;
+	index_reset();
+}
+
+/*
+ * Extend the mapping to the first size bytes of the file, which only ever
+ * grows until it is replaced.
+ */
+static int map_to(size_t size) {
+	if (size <= hist_mapped) {
+		return 0;
+	}
+	void *map = hist_map == NULL
+		? mmap(NULL, size, PROT_READ, MAP_SHARED, hist_fd, 0)
+		: mremap(hist_map, hist_mapped, size, MREMAP_MAYMOVE);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+	hist_map = map;
+	hist_mapped = size;
+	return 0;
+}
+
+static int reopen(void) {
+	struct stat st;
+	unmap();
+	if (hist_fd >= 0) {
+		close(hist_fd);
+	}
+	hist_fd = open(hist_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (hist_fd < 0) {
+		return -1;
+	}
+	if (fstat(hist_fd, &st) < 0) {
+		close(hist_fd);
+		hist_fd = -1;
+		return -1;
+	}
+	// a history that starts out big only gets compacted once it doubles.
+	hist_compact_at = (size_t) st.st_size * 2;
+	if (hist_compact_at < HISTORY_COMPACT_BYTES) {
+		hist_compact_at = HISTORY_COMPACT_BYTES;
+	}
+	return map_to(st.st_size);
+}
+
+/*
+ * Catch up with what other sessions appended, or move to the new file if a
+ * compaction replaced the one we have open.
+ */
+static int refresh(void) {
+	struct stat st;
+	if (fstat(hist_fd, &st) < 0) {
+		return -1;
+	}
+	if (st.st_nlink == 0) {
+		return reopen();
+	}
+	return map_to(st.st_size);
+}
+
+int history_open(const char *path) {
+	if (path == NULL) {
+		path = getenv(HISTORY_FILE_ENV);
+	}
+	if (path == NULL) {
+		const char *home = getenv("HOME");
+		if (home == NULL) {
+			return -1;
+		}
+		size_t len = strlen(home) + strlen(HISTORY_DEFAULT_NAME) + 2;
+		hist_path = malloc(len);
+		if (hist_path != NULL) {
+			snprintf(hist_path, len, "%s/%s", home, HISTORY_DEFAULT_NAME);
+		}
+	} else {
+		hist_path = strdup(path);
+	}
+	if (hist_path == NULL || reopen() < 0) {
+		history_close();
+		return -1;
+	}
+	return 0;
+}
+
+// ===== Compaction =====
+
+static uint64_t line_hash(const char *line, size_t len) {
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char) line[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+/*
+ * Rewrite the file as its last HISTORY_KEEP distinct entries, each where it
+ * was last used. Appends wait on the exclusive lock until the new file has
+ * been renamed in, then move over to it.
+ */
+static void *compact_file(void *arg) {
+	char *path = arg;
+	char *map = MAP_FAILED;
+	char *tmp = NULL;
+	char *out = NULL;
+	const char **lines = NULL;
+	size_t *lens = NULL;
+	uint32_t *slots = NULL;
+	size_t size = 0;
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		goto done;
+	}
+	if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0 || st.st_nlink == 0 || st.st_size == 0) {
+		goto done;
+	}
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	lines = malloc(sizeof(char *) * HISTORY_KEEP);
+	lens = malloc(sizeof(size_t) * HISTORY_KEEP);
+	slots = calloc(KEEP_SLOTS, sizeof(uint32_t));
+	tmp = malloc(strlen(path) + 8);
+	if (map == MAP_FAILED || lines == NULL || lens == NULL || slots == NULL || tmp == NULL) {
+		goto done;
+	}
+	// newest first, so the first copy of a line seen is the one kept.
+	size_t kept = 0;
+	size_t bytes = 0;
+	size_t end = size;
+	while (end > 0 && map[end - 1] != '\n') end--;
+	while (end > 0 && kept < HISTORY_KEEP) {
+		const char *nl = memrchr(map, '\n', end - 1);
+		size_t start = nl == NULL ? 0 : (size_t) (nl - map) + 1;
+		size_t len = end - 1 - start;
+		size_t s = line_hash(map + start, len) & (KEEP_SLOTS - 1);
+		while (slots[s] != 0 && (lens[slots[s] - 1] != len || memcmp(lines[slots[s] - 1], map + start, len))) {
+			s = (s + 1) & (KEEP_SLOTS - 1);
+		}
+		if (slots[s] == 0) {
+			lines[kept] = map + start;
+			lens[kept] = len;
+			slots[s] = ++kept;
+			bytes += len + 1;
+		}
+		end = start;
+	}
+	if (bytes == size || (out = malloc(bytes)) == NULL) {
+		goto done;
+	}
+	size_t at = 0;
+	for (size_t i = kept; i-- > 0;) {
+		memcpy(out + at, lines[i], lens[i]);
+		at += lens[i];
+		out[at++] = '\n';
+	}
+	sprintf(tmp, "%s.XXXXXX", path);
+	int tmp_fd = mkstemp(tmp);
+	if (tmp_fd < 0) {
+		goto done;
+	}
+	int ok = 1;
+	for (size_t written = 0; ok && written < bytes;) {
+		ssize_t n = write(tmp_fd, out + written, bytes - written);
+		ok = n > 0;
+		written += ok ? (size_t) n : 0;
+	}
+	ok = ok && fsync(tmp_fd) == 0;
+	close(tmp_fd);
+	if (!ok || rename(tmp, path) < 0) {
+		unlink(tmp);
+	}
+done:
+	if (map != MAP_FAILED) {
+		munmap(map, size);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	free(out);
+	free(tmp);
+	free(slots);
+	free(lens);
+	free(lines);
+	free(path);
+	__atomic_store_n(&compact_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void start_compaction(void) {
+	if (compacting) {
+		if (!__atomic_load_n(&compact_done, __ATOMIC_ACQUIRE)) {
+			return;
+		}
+		pthread_join(compactor, NULL);
+		compacting = 0;
+	}
+	// if this one achieves nothing, don't retry on every command.
+	hist_compact_at *= 2;
+	char *path = strdup(hist_path);
+	if (path == NULL) {
+		return;
+	}
+	compact_done = 0;
+	if (pthread_create(&compactor, NULL, compact_file, path) != 0) {
+		free(path);
+		return;
+	}
+	compacting = 1;
+}
+
+// ===== Appending =====
+
+void history_add(const char *buf, size_t len) {
+	if (hist_fd < 0) {
+		return;
+	}
+	char *out = malloc(len + 1);
+	size_t out_len = 0;
+	if (out == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < len;) {
+		const char *nl = memchr(buf + i, '\n', len - i);
+		size_t end = nl == NULL ? len : (size_t) (nl - buf);
+		size_t start = i;
+		i = end + 1;
+		while (start < end && (buf[start] == ' ' || buf[start] == '\t')) start++;
+		while (end > start && (buf[end - 1] == ' ' || buf[end - 1] == '\t' || buf[end - 1] == '\r')) end--;
+		if (end > start) {
+			memcpy(out + out_len, buf + start, end - start);
+			out_len += end - start;
+			out[out_len++] = '\n';
+		}
+	}
+	struct stat st;
+	// the shared lock only keeps a compaction from dropping this append; the
+	// O_APPEND write is what keeps sessions from overwriting each other.
+	for (int tries = 0; out_len > 0 && tries < 3; tries++) {
+		if (flock(hist_fd, LOCK_SH) < 0 || fstat(hist_fd, &st) < 0) {
+			break;
+		}
+		if (st.st_nlink == 0) {
+			flock(hist_fd, LOCK_UN);
+			if (reopen() < 0) {
+				break;
+			}
+			continue;
+		}
+		ssize_t n = write(hist_fd, out, out_len);
+		flock(hist_fd, LOCK_UN);
+		if (n > 0 && (size_t) st.st_size + n >= hist_compact_at) {
+			start_compaction();
+		}
+		break;
+	}
+	free(out);
+}
+
+// ===== Searching =====
+
+static trigram_list *trigram_find(uint32_t key) {
+	if (trigram_cap == 0) {
+		return NULL;
+	}
+	size_t s = (key * 2654435761u) & (trigram_cap - 1);
+	while (trigrams[s].key != 0) {
+		if (trigrams[s].key == key) {
+			return &trigrams[s];
+		}
+		s = (s + 1) & (trigram_cap - 1);
+	}
+	return NULL;
+}
+
+static int trigram_grow(void) {
+	size_t cap = trigram_cap ? trigram_cap * 2 : 4096;
+	trigram_list *grown = calloc(cap, sizeof(trigram_list));
+	if (grown == NULL) {
+		return -1;
+	}
+	for (size_t i = 0; i < trigram_cap; i++) {
+		if (trigrams[i].key != 0) {
+			size_t s = (trigrams[i].key * 2654435761u) & (cap - 1);
+			while (grown[s].key != 0) s = (s + 1) & (cap - 1);
+			grown[s] = trigrams[i];
+		}
+	}
+	free(trigrams);
+	trigrams = grown;
+	trigram_cap = cap;
+	return 0;
+}
+
+static int trigram_add(uint32_t key, uint32_t offset) {
+	trigram_list *l = trigram_find(key);
+	if (l == NULL) {
+		if ((trigram_count + 1) * 2 > trigram_cap && trigram_grow() < 0) {
+			return -1;
+		}
+		size_t s = (key * 2654435761u) & (trigram_cap - 1);
+		while (trigrams[s].key != 0) s = (s + 1) & (trigram_cap - 1);
+		l = &trigrams[s];
+		l->key = key;
+		trigram_count++;
+	}
+	// a trigram seen twice in one line is listed once.
+	if (l->count > 0 && l->offsets[l->count - 1] == offset) {
+		return 0;
+	}
+	if (l->count == l->cap) {
+		uint32_t cap = l->cap ? l->cap * 2 : 4;
+		uint32_t *grown = realloc(l->offsets, sizeof(uint32_t) * cap);
+		if (grown == NULL) {
+			return -1;
+		}
+		l->offsets = grown;
+		l->cap = cap;
+	}
+	l->offsets[l->count++] = offset;
+	return 0;
+}
+
+static inline uint32_t trigram_key(const char *p) {
+	return ((uint32_t) (unsigned char) p[0] << 16 | (uint32_t) (unsigned char) p[1] << 8 | (unsigned char) p[2]) + 1;
+}
+
+/*
+ * Index the complete lines mapped since the last call.
+ */
+static void index_extend(void) {
+	size_t end = hist_mapped;
+	while (end > hist_indexed && hist_map[end - 1] != '\n') end--;
+	if (end > UINT32_MAX) {
+		end = UINT32_MAX;
+	}
+	while (hist_indexed < end) {
+		size_t start = hist_indexed;
+		const char *nl = memchr(hist_map + start, '\n', end - start);
+		if (nl == NULL) {
+			break;
+		}
+		size_t line_end = nl - hist_map;
+		for (size_t i = start; i + 3 <= line_end; i++) {
+			if (trigram_add(trigram_key(hist_map + i), start) < 0) {
+				return;
+			}
+		}
+		hist_indexed = line_end + 1;
+	}
+}
+
+long history_search(const char *text, size_t len, history_visit visit, void *ctx) {
+	if (hist_fd < 0 || refresh() < 0) {
+		return -1;
+	}
+	index_extend();
+	long found = 0;
+	if (len < 3) {
+		// too short to have a trigram; the lines are scanned instead.
+		for (size_t end = hist_indexed; end > 0;) {
+			const char *nl = memrchr(hist_map, '\n', end - 1);
+			size_t start = nl == NULL ? 0 : (size_t) (nl - hist_map) + 1;
+			const char *line = hist_map + start;
+			size_t line_len = end - 1 - start;
+			end = start;
+			if (len == 0 || memmem(line, line_len, text, len) != NULL) {
+				found++;
+				if (visit(ctx, line, line_len)) {
+					break;
+				}
+			}
+		}
+		return found;
+	}
+	// only the lines holding the query's rarest trigram can match.
+	trigram_list *rarest = NULL;
+	for (size_t i = 0; i + 3 <= len; i++) {
+		trigram_list *l = trigram_find(trigram_key(text + i));
+		if (l == NULL) {
+			return 0;
+		}
+		if (rarest == NULL || l->count < rarest->count) {
+			rarest = l;
+		}
+	}
+	for (uint32_t k = rarest->count; k-- > 0;) {
+		size_t start = rarest->offsets[k];
+		const char *line = hist_map + start;
+		size_t line_len = (const char *) memchr(line, '\n', hist_indexed - start) - line;
+		if (memmem(line, line_len, text, len) != NULL) {
+			found++;
+			if (visit(ctx, line, line_len)) {
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+long history_recent(size_t count, size_t *first, history_visit visit, void *ctx) {
+	if (hist_fd < 0 || refresh() < 0) {
+		return -1;
+	}
+	size_t end = hist_mapped;
+	while (end > 0 && hist_map[end - 1] != '\n') end--;
+	size_t start = end;
+	for (size_t n = 0; start > 0 && (count == 0 || n < count); n++) {
+		const char *nl = memrchr(hist_map, '\n', start - 1);
+		start = nl == NULL ? 0 : (size_t) (nl - hist_map) + 1;
+	}
+	*first = count_newlines(hist_map, start) + 1;
+	long visited = 0;
+	while (start < end) {
+		const char *nl = memchr(hist_map + start, '\n', end - start);
+		visited++;
+		if (visit(ctx, hist_map + start, nl - hist_map - start)) {
+			break;
+		}
+		start = nl - hist_map + 1;
+	}
+	return visited;
+}
+
+void history_close(void) {
+	if (compacting) {
+		pthread_join(compactor, NULL);
+		compacting = 0;
+	}
+	unmap();
+	if (hist_fd >= 0) {
+		close(hist_fd);
+	}
+	hist_fd = -1;
+	free(hist_path);
+	hist_path = NULL;
+}
@@ -0,0 +1,49 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include <stddef.h>
+
+// Environment variable naming the history file; ~/HISTORY_DEFAULT_NAME otherwise.
+#define HISTORY_FILE_ENV "MYSH_HISTFILE"
+#define HISTORY_DEFAULT_NAME ".mysh_history"
+// Once the file is this big, a background compaction keeps the last
+// HISTORY_KEEP distinct commands.
+#define HISTORY_COMPACT_BYTES (1 << 20)
+#define HISTORY_KEEP 10000
+
+/* Called for each history entry found. line is not NULL terminated.
+ * Return: nonzero to stop.
+ */
+typedef int (*history_visit)(void *ctx, const char *line, size_t len);
+
+/* Open (or create) the history file at path (NULL for $HISTORY_FILE_ENV,
+ * then ~/HISTORY_DEFAULT_NAME) and map it. Nothing is read or indexed here,
+ * so this costs the same whatever the size of the history.
+ * Return: 0 on success and -1 on error (history is then off).
+ */
+int history_open(const char *path);
+
+/* Append every non blank line of buf (len bytes) as an entry. All of them
+ * go out in one O_APPEND write, so sessions sharing the file never mix
+ * their lines.
+ */
+void history_add(const char *buf, size_t len);
+
+/* Visit the entries containing text, newest first. The trigram index is
+ * brought up to date first, with only the entries added since the last
+ * search (by any session) being indexed.
+ * Return: number of entries visited, or -1 if history is off.
+ */
+long history_search(const char *text, size_t len, history_visit visit, void *ctx);
+
+/* Visit the last count entries (all of them for 0), oldest first, after
+ * setting *first to the number (from 1) of the first of them.
+ * Return: number of entries visited, or -1 if history is off.
+ */
+long history_recent(size_t count, size_t *first, history_visit visit, void *ctx);
+
+/* Wait for a running compaction, then unmap and close everything.
+ */
+void history_close(void);
+
+#endif
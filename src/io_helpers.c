@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -5,6 +6,69 @@
 
 #include "variables.h"
 #include "io_helpers.h"
+#include "commands.h"
+#include "wildcard.h"
+
+
+// ===== Redirection =====
+
+static __thread io_fds current = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+// set when a write to current.out failed with EPIPE.
+static __thread int output_closed = 0;
+
+io_fds io_redirect(io_fds fds) {
+    io_fds previous = current;
+    current = fds;
+    output_closed = 0;
+    return previous;
+}
+
+io_fds io_current(void) {
+    return current;
+}
+
+int io_output_closed(void) {
+    return output_closed;
+}
+
+int io_input_fd(void) {
+    return current.in;
+}
+
+int io_output_fd(void) {
+    return current.out;
+}
+
+FILE *io_input_file(void) {
+    if (current.in == STDIN_FILENO) {
+        return stdin;
+    }
+    int fd = dup(current.in);
+    if (fd < 0) {
+        return NULL;
+    }
+    FILE *file = fdopen(fd, "r");
+    if (file == NULL) {
+        close(fd);
+    }
+    return file;
+}
+
+void io_to_std(void) {
+    // dup2 clears close-on-exec on the copies, so the opened files survive exec.
+    if (current.in != STDIN_FILENO) dup2(current.in, STDIN_FILENO);
+    if (current.out != STDOUT_FILENO) dup2(current.out, STDOUT_FILENO);
+    if (current.err != STDERR_FILENO) dup2(current.err, STDERR_FILENO);
+}
+
+void io_output_hint(off_t bytes) {
+    struct stat st;
+    if (bytes <= 0 || fstat(current.out, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+    // only a hint: file systems without fallocate just grow the file as usual.
+    fallocate(current.out, FALLOC_FL_KEEP_SIZE, st.st_size, bytes);
+}
 
 
 // ===== Output helpers =====
@@ -12,7 +76,12 @@
 /* Prereq: str is a NULL terminated string
  */
 void display_message(char *str) {
-    write(STDOUT_FILENO, str, strnlen(str, MAX_STR_LEN));
+    if (output_closed) {
+        return;
+    }
+    if (write(current.out, str, strnlen(str, MAX_STR_LEN)) < 0 && errno == EPIPE) {
+        output_closed = 1;
+    }
 	fflush(stdout);
 }
 
@@ -20,14 +89,80 @@ void display_message(char *str) {
 /* Prereq: pre_str, str are NULL terminated string
  */
 void display_error(char *pre_str, char *str) {
-    write(STDERR_FILENO, pre_str, strnlen(pre_str, MAX_STR_LEN));
-    write(STDERR_FILENO, str, strnlen(str, MAX_STR_LEN));
-    write(STDERR_FILENO, "\n", 1);
+    write(current.err, pre_str, strnlen(pre_str, MAX_STR_LEN));
+    write(current.err, str, strnlen(str, MAX_STR_LEN));
+    write(current.err, "\n", 1);
+}
+
+
+/* Prereq: buf holds at least len bytes
+ */
+void display_buffer(const char *buf, size_t len) {
+    while (len > 0 && !output_closed) {
+        ssize_t n = write(current.out, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EPIPE) {
+            output_closed = 1;
+        }
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+void out_append(out_buffer *b, const char *str, size_t len) {
+    if (b->len + len > OUT_BUFFER_SIZE) {
+        out_flush(b);
+    }
+    // anything bigger than the whole buffer goes straight out.
+    if (len > OUT_BUFFER_SIZE) {
+        display_buffer(str, len);
+        return;
+    }
+    memcpy(b->data + b->len, str, len);
+    b->len += len;
+}
+
+void out_flush(out_buffer *b) {
+    display_buffer(b->data, b->len);
+    b->len = 0;
 }
 
 
 // ===== Input tokenizing =====
 
+/* The line substitute_commands builds, with mask[i] set for every byte of
+ * command output. Those are literal text: never expanded, never taken for
+ * an operator, and only split where the output is split into words.
+ */
+typedef struct {
+    char *text;
+    char *mask;
+    size_t len;
+    size_t cap;
+} subst_line;
+
+/* The tokens tokenize_input builds, with literal[i] set for those that must
+ * not be taken for operators.
+ */
+typedef struct {
+    char **tokens;
+    unsigned char *literal;
+    size_t count;
+    size_t cap;
+    size_t literal_cap;
+    // every directory a wildcard looks into is read once for the whole line.
+    glob_cache globs;
+} token_list;
+
+// The redirections that can be typed in front of command output, longest
+// first.
+static const char *const typed_redirects[] = {"2>>", "2>", ">>", ">", "<"};
+
 
 
 /* Prereq: in_ptr points to a character buffer of size > MAX_STR_LEN
@@ -66,32 +201,192 @@ ssize_t get_input(char *in_ptr) {
     return retval;
 }
 
-/* Prereq: in_ptr is a string, tokens is of size >= len(in_ptr)
- * Warning: in_ptr is modified
- * Return: number of tokens.
+static int text_append(char **text, size_t *len, size_t *cap, const char *add, size_t n) {
+    if (*len + n + 1 > *cap) {
+        size_t grown_cap = (*len + n + 1) * 2;
+        char *grown = realloc(*text, grown_cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        *text = grown;
+        *cap = grown_cap;
+    }
+    memcpy(*text + *len, add, n);
+    *len += n;
+    (*text)[*len] = '\0';
+    return 0;
+}
+
+static int line_append(subst_line *line, const char *add, size_t n, char literal) {
+    if (line->len + n + 1 > line->cap) {
+        size_t grown_cap = (line->len + n + 1) * 2;
+        char *grown = realloc(line->text, grown_cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        line->text = grown;
+        grown = realloc(line->mask, grown_cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        line->mask = grown;
+        line->cap = grown_cap;
+    }
+    memcpy(line->text + line->len, add, n);
+    memset(line->mask + line->len, literal, n);
+    line->len += n;
+    line->text[line->len] = '\0';
+    return 0;
+}
+
+/*
+ * Return 1 if text[i] splits words: whitespace that was typed, or that came
+ * from command output outside an assignment (mask is NULL if none did).
  */
-size_t tokenize_input(char *in_ptr, char **tokens) {
-    // TODO: Remove unused attribute
-    // clear out garbage
-    memset(tokens, 0, sizeof(char)*(MAX_STR_LEN+1));
-    // Prep String saves for strtok_r
-    char *inStrPtrSave = NULL;
+static int splits_at(const char *text, const char *mask, size_t i) {
+    return text[i] != '\0' && strchr(DELIMITERS, text[i]) != NULL && (mask == NULL || !mask[i]);
+}
+
+/*
+ * Return 1 if the word at the end of line is the first of the line and an
+ * assignment (NAME=...), whose value is kept whole rather than split.
+ */
+static int in_assignment(const subst_line *line) {
+    if (line->len == 0) {
+        return 0;
+    }
+    size_t start = line->len;
+    while (start > 0 && !splits_at(line->text, line->mask, start - 1)) start--;
+    for (size_t i = 0; i < start; i++) {
+        if (!splits_at(line->text, line->mask, i)) {
+            return 0;
+        }
+    }
+    const char *word = line->text + start;
+    const char *eq = memchr(word, '=', line->len - start);
+    return eq != NULL && eq > word && memchr(word, '$', eq - word) == NULL;
+}
+
+/*
+ * Add a command's output to the line being built, marked literal. Trailing
+ * newlines are dropped and other whitespace becomes a space, which splits
+ * the output into words except in an assignment.
+ */
+static int append_output(subst_line *line, const char *out, size_t n) {
+    int whole = in_assignment(line);
+    while (n > 0 && out[n - 1] == '\n') n--;
+    const char *end = out + n;
+    while (out < end) {
+        const char *stop = out;
+        while (stop < end && (*stop == '\0' || strchr(DELIMITERS, *stop) == NULL)) stop++;
+        if (line_append(line, out, stop - out, 1) < 0) {
+            return -1;
+        }
+        if (stop == end) {
+            break;
+        }
+        if (line_append(line, " ", 1, whole) < 0) {
+            return -1;
+        }
+        out = stop + 1;
+    }
+    return 0;
+}
+
+/*
+ * Replace every $(command) of line by its output. An unclosed $( is kept as
+ * it is, and so is $$(.
+ * Return: the new line for the caller to free, with *mask set to a new
+ * array marking its literal bytes (NULL if it has none), or NULL when there
+ * was nothing to replace (or no memory to do it).
+ */
+static char *substitute_commands(const char *line, char **mask) {
+    const char *p = strstr(line, "$(");
+    if (p == NULL) {
+        return NULL;
+    }
+    subst_line built;
+    memset(&built, 0, sizeof(built));
+    p = line;
+    while (*p != '\0') {
+        if (p[0] == '$' && p[1] == '$') {
+            if (line_append(&built, p, 2, 0) < 0) goto fail;
+            p += 2;
+            continue;
+        }
+        if (p[0] != '$' || p[1] != '(') {
+            if (line_append(&built, p, 1, 0) < 0) goto fail;
+            p++;
+            continue;
+        }
+        // find the ) that closes this one, skipping nested $( ).
+        const char *close = p + 2;
+        int depth = 1;
+        while (*close != '\0') {
+            if (*close == '(') depth++;
+            if (*close == ')' && --depth == 0) break;
+            close++;
+        }
+        if (*close == '\0') {
+            if (line_append(&built, p, strlen(p), 0) < 0) goto fail;
+            break;
+        }
+        char *command = strndup(p + 2, close - (p + 2));
+        size_t out_len = 0;
+        char *out = command != NULL ? capture_command(command, &out_len) : NULL;
+        free(command);
+        if (out == NULL) {
+            display_error("ERROR: Command substitution failed", "");
+        } else if (append_output(&built, out, out_len) < 0) {
+            free(out);
+            goto fail;
+        }
+        free(out);
+        p = close + 1;
+    }
+    if (built.text == NULL) {
+        // every substitution came out empty.
+        built.text = strdup("");
+    }
+    *mask = built.mask;
+    return built.text;
+fail:
+    free(built.text);
+    free(built.mask);
+    return NULL;
+}
+
+/*
+ * Split the next word off text from *pos, as strtok_r would on DELIMITERS
+ * but keeping the whitespace mask marks as literal inside the word.
+ * Return: the word, NULL terminated in place, or NULL at the end of text.
+ */
+static char *next_word(char *text, const char *mask, size_t *pos) {
+    size_t i = *pos;
+    while (splits_at(text, mask, i)) i++;
+    if (text[i] == '\0') {
+        *pos = i;
+        return NULL;
+    }
+    size_t start = i;
+    while (text[i] != '\0' && !splits_at(text, mask, i)) i++;
+    *pos = text[i] != '\0' ? i + 1 : i;
+    text[i] = '\0';
+    return text + start;
+}
+
+/*
+ * Expand the variables ($NAME, with $$ for a $) of a typed word.
+ * Warning: cmd_ptr is modified
+ * Return: the expanded word for the caller to free.
+ */
+static char *expand_word(char *cmd_ptr) {
+    // Prep String save for strtok_r
     char *expPtrSave = NULL;
     const char expDelim[] = "$";
     // Strings
     char *exp_ptr = "";
-    char *cmd_ptr = strtok_r (in_ptr, DELIMITERS, &inStrPtrSave);
     char *tempStr;
-
-    // int skip_count = 0;
-    size_t token_count = 0;
-    // before doing the tokenization, check for longer than size:
-    if(cmd_ptr != NULL && strlen(cmd_ptr) > MAX_STR_LEN){
-	    cmd_ptr[MAX_STR_LEN] = '\0';
-    }
-    // because it is easier to expand strings during tokenization, we do it in here:
-    while (cmd_ptr != NULL && token_count < MAX_STR_LEN) {  // TODO: Fix this
-        // TODO: Fix this
 	// Check for dollar signs
 	if(strchr(cmd_ptr, '$') != NULL){
 		// need a sanitized version of the string pre strtok.
@@ -159,18 +454,253 @@ size_t tokenize_input(char *in_ptr, char **tokens) {
 			strncat(cmdExp, "$", strlen("$")+1);
 		}
 		//printf("cmd line expanded: %s\n", cmdExp);
-		tokens[token_count] = cmdExp;
 		// free the sanitized duplicate
 		free(sanitized);
+		return cmdExp;
 	}else{
 		// No expansion means continue as usual.
-		tokens[token_count] = strndup(cmd_ptr, strlen(cmd_ptr));
+		return strndup(cmd_ptr, strlen(cmd_ptr));
 	}
-	cmd_ptr = strtok_r(NULL, DELIMITERS, &inStrPtrSave);
-	token_count += 1;
+}
+
+/*
+ * Grow literal to the size of tokens, which glob_expand may have grown.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int literal_reserve(token_list *list) {
+    if (list->literal_cap >= list->cap) {
+        return 0;
+    }
+    unsigned char *grown = realloc(list->literal, list->cap);
+    if (grown == NULL) {
+        return -1;
+    }
+    list->literal = grown;
+    list->literal_cap = list->cap;
+    return 0;
+}
+
+/*
+ * Make room for need more entries (and the NULL after them) in list.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int tokens_reserve(token_list *list, size_t need) {
+    if (list->count + need + 1 > list->cap) {
+        size_t grown_cap = list->cap ? list->cap * 2 : MAX_STR_LEN;
+        while (list->count + need + 1 > grown_cap) grown_cap *= 2;
+        char **grown = realloc(list->tokens, sizeof(char *) * grown_cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        list->tokens = grown;
+        list->cap = grown_cap;
+    }
+    return literal_reserve(list);
+}
+
+/*
+ * Return 1 if the word to become the next token of list is the PATTERN of a
+ * search: its first argument that is neither an option nor an option's value.
+ */
+static int is_search_pattern(const token_list *list) {
+    char **tokens = list->tokens;
+    size_t count = list->count;
+    size_t head = count;
+    while (head > 0 && (strcmp(tokens[head - 1], "|") || list->literal[head - 1])) head--;
+    if (head == count || strcmp(tokens[head], "search")) {
+        return 0;
+    }
+    for (size_t i = head + 1; i < count; i++) {
+        if (!strncmp(tokens[i], "--", 2)) {
+            // --f, --glob, --regex and --d all take the next word.
+            i++;
+        } else if (strcmp(tokens[i], "-E")) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Return 1 if the word to become the next token of list should have its
+ * wildcards expanded: not an assignment, not the pattern handed to a --f,
+ * --glob, --regex or -E option and not the PATTERN of a search (those
+ * builtins match it themselves).
+ */
+static int should_glob(const token_list *list, const char *word) {
+    char **tokens = list->tokens;
+    size_t count = list->count;
+    if (count == 0 && strchr(word, '=') != NULL) {
+        return 0;
+    }
+    if (count > 0 && (!strncmp(tokens[count - 1], "--f", 3) || !strncmp(tokens[count - 1], "--glob", 6) ||
+                      !strncmp(tokens[count - 1], "--regex", 7) || !strcmp(tokens[count - 1], "-E"))) {
+        return 0;
+    }
+    if (is_search_pattern(list)) {
+        return 0;
+    }
+    return glob_is_pattern(word);
+}
+
+/*
+ * Add token (the list takes it over) to list. A word with wildcards is
+ * replaced by the paths it matches, if any; those are literal.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int add_token(token_list *list, char *token, int literal) {
+    if (token == NULL || tokens_reserve(list, 1) < 0) {
+        free(token);
+        return -1;
+    }
+    if (should_glob(list, token)) {
+        // the matches are written over the word; with none it stays as typed.
+        size_t first = list->count;
+        if (glob_expand(&list->globs, token, &list->tokens, &list->count, &list->cap) > 0) {
+            free(token);
+            if (literal_reserve(list) < 0) {
+                while (list->count > first) free(list->tokens[--list->count]);
+                return -1;
+            }
+            memset(list->literal + first, 1, list->count - first);
+            return 0;
+        }
+    }
+    list->tokens[list->count] = token;
+    list->literal[list->count++] = literal;
+    return 0;
+}
+
+/*
+ * Add len bytes of a word holding command output, from between typed pipes.
+ * A typed redirection in front stays an operator token; the rest becomes
+ * one literal token, with the variables of its typed parts expanded.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int add_segment(token_list *list, const char *word, const char *mask, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (memchr(mask, 1, len) == NULL) {
+        char *typed = strndup(word, len);
+        char *token = typed != NULL ? expand_word(typed) : NULL;
+        free(typed);
+        return add_token(list, token, 0);
+    }
+    for (size_t i = 0; i < sizeof(typed_redirects) / sizeof(*typed_redirects); i++) {
+        size_t n = strlen(typed_redirects[i]);
+        if (n < len && !strncmp(word, typed_redirects[i], n) && memchr(mask, 1, n) == NULL) {
+            if (add_token(list, strdup(typed_redirects[i]), 0) < 0) {
+                return -1;
+            }
+            word += n;
+            mask += n;
+            len -= n;
+            break;
+        }
+    }
+    char *token = NULL;
+    size_t token_len = 0, token_cap = 0;
+    for (size_t i = 0; i < len;) {
+        size_t run = i;
+        while (run < len && mask[run] == mask[i]) run++;
+        char *expanded = NULL;
+        if (!mask[i]) {
+            char *typed = strndup(word + i, run - i);
+            expanded = typed != NULL ? expand_word(typed) : NULL;
+            free(typed);
+            if (expanded == NULL) {
+                free(token);
+                return -1;
+            }
+        }
+        int appended = expanded != NULL ? text_append(&token, &token_len, &token_cap, expanded, strlen(expanded))
+                                        : text_append(&token, &token_len, &token_cap, word + i, run - i);
+        free(expanded);
+        if (appended < 0) {
+            free(token);
+            return -1;
+        }
+        i = run;
+    }
+    return add_token(list, token, 1);
+}
+
+/*
+ * Add a word holding command output (marked in mask) to list. Every typed |
+ * in it is a pipe token of its own, and so is what is between them.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int add_substituted(token_list *list, char *word, const char *mask) {
+    size_t len = strlen(word);
+    size_t start = 0;
+    while (1) {
+        size_t end = start;
+        while (end < len && (word[end] != '|' || mask[end])) end++;
+        if (add_segment(list, word + start, mask + start, end - start) < 0) {
+            return -1;
+        }
+        if (end == len) {
+            return 0;
+        }
+        if (add_token(list, strdup("|"), 0) < 0) {
+            return -1;
+        }
+        start = end + 1;
     }
-    tokens[token_count] = NULL;
-    return token_count;
 }
 
+void free_tokens(char **tokens, unsigned char *literal, size_t count) {
+    free(literal);
+    if (tokens == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        free(tokens[i]);
+    }
+    free(tokens);
+}
 
+/* Prereq: in_ptr is a string
+ * Warning: in_ptr is modified
+ * Return: number of tokens.
+ */
+size_t tokenize_input(char *in_ptr, char ***tokens_out, unsigned char **literal_out) {
+    token_list list;
+    memset(&list, 0, sizeof(list));
+    // command output can make the line longer, so it gets its own copy.
+    char *mask = NULL;
+    char *substituted = substitute_commands(in_ptr, &mask);
+    if (substituted != NULL) {
+        in_ptr = substituted;
+    }
+    size_t pos = 0;
+    char *cmd_ptr = next_word(in_ptr, mask, &pos);
+    // before doing the tokenization, check for longer than size:
+    if(cmd_ptr != NULL && strlen(cmd_ptr) > MAX_STR_LEN){
+	    cmd_ptr[MAX_STR_LEN] = '\0';
+    }
+    // because it is easier to expand strings during tokenization, we do it in here:
+    while (cmd_ptr != NULL) {
+	const char *word_mask = mask != NULL ? mask + (cmd_ptr - in_ptr) : NULL;
+	int added;
+	if (word_mask != NULL && memchr(word_mask, 1, strlen(cmd_ptr)) != NULL) {
+		added = add_substituted(&list, cmd_ptr, word_mask);
+	} else {
+		added = add_token(&list, expand_word(cmd_ptr), 0);
+	}
+	if (added < 0) {
+		break;
+	}
+	cmd_ptr = next_word(in_ptr, mask, &pos);
+    }
+    glob_cache_free(&list.globs);
+    if (list.tokens != NULL) {
+        list.tokens[list.count] = NULL;
+    }
+    free(substituted);
+    free(mask);
+    *tokens_out = list.tokens;
+    *literal_out = list.literal;
+    return list.count;
+}
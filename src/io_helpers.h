@@ -24,11 +24,71 @@
 #define DELIMITERS " \t\n"     // Assumption: all input tokens are whitespace delimited
 
 
+/* The fds builtins read from and write to: 0, 1 and 2 unless a redirection
+ * is in effect for the command being run.
+ */
+typedef struct io_fds {
+    int in;
+    int out;
+    int err;
+} io_fds;
+
+#define IO_STD_FDS ((io_fds) {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO})
+
+/* Make fds the current input, output and error. The current fds belong to
+ * the calling thread, so the stages of an in-process pipeline each get their own.
+ * Return: the fds in effect before, to be put back when the command is done.
+ */
+io_fds io_redirect(io_fds fds);
+
+io_fds io_current(void);
+
+/* Return: 1 once a write found nobody reading the current output any more
+ * (the next stage of the pipeline quit), so a builtin can stop early.
+ * Further output is dropped until the next io_redirect.
+ */
+int io_output_closed(void);
+int io_input_fd(void);
+int io_output_fd(void);
+
+/* The current input as a stdio stream: stdin itself when it is not
+ * redirected, otherwise a stream the caller fcloses (which leaves the
+ * redirected fd open).
+ * Return: the stream, or NULL on error.
+ */
+FILE *io_input_file(void);
+
+/* For a child about to exec: move the current fds onto 0, 1 and 2.
+ */
+void io_to_std(void);
+
+/* Hint that about bytes more output are coming. When the output is a regular
+ * file the blocks are reserved up front (fallocate), so a large write does
+ * not grow the file one extent at a time. The file size is not changed.
+ */
+void io_output_hint(off_t bytes);
+
 /* Prereq: pre_str, str are NULL terminated string
  */
 void display_message(char *str);
 void display_error(char *pre_str, char *str);
 
+/* Write len bytes of buf to the output as is (no MAX_STR_LEN cap).
+ */
+void display_buffer(const char *buf, size_t len);
+
+/* Output staging buffer: builtins that print many lines collect them here
+ * and write them out in large chunks instead of one write per line.
+ */
+#define OUT_BUFFER_SIZE 65536
+typedef struct out_buffer {
+    char data[OUT_BUFFER_SIZE];
+    size_t len;
+} out_buffer;
+
+void out_append(out_buffer *b, const char *str, size_t len);
+void out_flush(out_buffer *b);
+
 
 /* Prereq: in_ptr points to a character buffer of size > MAX_STR_LEN
  * Return: number of bytes read
@@ -36,11 +96,22 @@ void display_error(char *pre_str, char *str);
 ssize_t get_input(char *in_ptr);
 
 
-/* Prereq: in_ptr is a string, tokens is of size >= len(in_ptr)
+/* Prereq: in_ptr is a string
+ * Every $(command) is replaced by the command's output before the line is
+ * split, so the output becomes words of the line. Words with *, ? or [...]
+ * are then replaced by the paths they match, if any.
+ * *tokens is set to a new NULL terminated array, and *literal to a new array
+ * with a flag per token, set if the token holds command output or is a
+ * path: those are never taken for |, <, > or &. Both are released with
+ * free_tokens.
  * Warning: in_ptr is modified
  * Return: number of tokens.
  */
-size_t tokenize_input(char *in_ptr, char **tokens);
+size_t tokenize_input(char *in_ptr, char ***tokens, unsigned char **literal);
+
+/* Free count tokens and the arrays tokenize_input made for them.
+ */
+void free_tokens(char **tokens, unsigned char *literal, size_t count);
 
 
 #endif
@@ -0,0 +1,501 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "lineedit.h"
+#include "complete.h"
+#include "history.h"
+#include "io_helpers.h"
+
+#define KEY_CTRL(key) ((key) & 0x1f)
+#define KEY_BACKSPACE 127
+#define KEY_ESC 27
+// Longest Ctrl-R query kept.
+#define SEARCH_MAX 64
+// Bytes of screen updates collected before each write.
+#define SCREEN_BUF 1024
+
+/* The line being edited. buf holds len bytes, with the cursor before
+ * buf[pos]; one byte is always left over for the '\n'.
+ */
+typedef struct line_state {
+    char *buf;
+    size_t len;
+    size_t pos;
+    const char *prompt;
+    size_t prompt_len;
+    // Up/Down position: 0 is the line being typed, k the kth newest entry.
+    size_t back;
+    // number of the entry shown, to tell when Up ran out of history.
+    size_t back_number;
+    // the line being typed, kept while Up/Down show other entries.
+    char typed[MAX_STR_LEN + 1];
+    size_t typed_len;
+    // the last key was a Tab that had several candidates.
+    int tabbed;
+} line_state;
+
+/* Screen output collected into one write.
+ */
+typedef struct screen {
+    char data[SCREEN_BUF];
+    size_t len;
+} screen;
+
+// ===== Terminal =====
+
+int lineedit_usable(void) {
+	const char *term = getenv("TERM");
+	return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) && (term == NULL || strcmp(term, "dumb"));
+}
+
+static int raw_mode(struct termios *saved) {
+	if (tcgetattr(STDIN_FILENO, saved) < 0) {
+		return -1;
+	}
+	struct termios raw = *saved;
+	// keys arrive one at a time, unechoed, with Ctrl-C and friends as bytes.
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_cflag |= CS8;
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	return tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+}
+
+static void screen_put(screen *s, const char *str, size_t len) {
+	if (s->len + len > SCREEN_BUF) {
+		write(STDOUT_FILENO, s->data, s->len);
+		s->len = 0;
+	}
+	if (len > SCREEN_BUF) {
+		write(STDOUT_FILENO, str, len);
+		return;
+	}
+	memcpy(s->data + s->len, str, len);
+	s->len += len;
+}
+
+static void screen_flush(screen *s) {
+	write(STDOUT_FILENO, s->data, s->len);
+	s->len = 0;
+}
+
+static void beep(void) {
+	write(STDOUT_FILENO, "\a", 1);
+}
+
+/*
+ * Redraw the prompt and line in place and put the cursor back.
+ */
+static void refresh(line_state *l) {
+	screen s;
+	char move[32];
+	s.len = 0;
+	screen_put(&s, "\r", 1);
+	screen_put(&s, l->prompt, l->prompt_len);
+	screen_put(&s, l->buf, l->len);
+	screen_put(&s, "\x1b[K\r", 4);
+	size_t column = l->prompt_len + l->pos;
+	if (column > 0) {
+		int n = snprintf(move, sizeof(move), "\x1b[%zuC", column);
+		screen_put(&s, move, n);
+	}
+	screen_flush(&s);
+}
+
+static int read_key(void) {
+	unsigned char c;
+	while (1) {
+		ssize_t n = read(STDIN_FILENO, &c, 1);
+		if (n == 1) {
+			return c;
+		}
+		if (n == 0 || errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+// ===== Editing =====
+
+static int insert(line_state *l, const char *text, size_t n) {
+	if (l->len + n > MAX_STR_LEN - 1) {
+		beep();
+		return -1;
+	}
+	memmove(l->buf + l->pos + n, l->buf + l->pos, l->len - l->pos);
+	memcpy(l->buf + l->pos, text, n);
+	l->len += n;
+	l->pos += n;
+	return 0;
+}
+
+static void delete_range(line_state *l, size_t from, size_t to) {
+	memmove(l->buf + from, l->buf + to, l->len - to);
+	l->len -= to - from;
+	l->pos = from;
+}
+
+static void set_line(line_state *l, const char *text, size_t n) {
+	if (n > MAX_STR_LEN - 1) {
+		n = MAX_STR_LEN - 1;
+	}
+	memcpy(l->buf, text, n);
+	l->len = l->pos = n;
+}
+
+// ===== History =====
+
+/* One entry wanted from the history: the skip + 1th visited (with Ctrl-R,
+ * the matches past the one shown).
+ */
+typedef struct entry_pick {
+    size_t skip;
+    char line[MAX_STR_LEN + 1];
+    size_t len;
+    int found;
+} entry_pick;
+
+static int pick_entry(void *ctx, const char *line, size_t len) {
+	entry_pick *p = ctx;
+	if (p->skip > 0) {
+		p->skip--;
+		return 0;
+	}
+	if (len > MAX_STR_LEN) {
+		len = MAX_STR_LEN;
+	}
+	memcpy(p->line, line, len);
+	p->len = len;
+	p->found = 1;
+	return 1;
+}
+
+/*
+ * Step Up (dir 1) or Down (dir -1) through the history.
+ */
+static void history_step(line_state *l, int dir) {
+	if (dir < 0 && l->back == 0) {
+		beep();
+		return;
+	}
+	if (l->back == 0) {
+		memcpy(l->typed, l->buf, l->len);
+		l->typed_len = l->len;
+	}
+	size_t back = l->back + dir;
+	if (back == 0) {
+		l->back = 0;
+		set_line(l, l->typed, l->typed_len);
+		return;
+	}
+	entry_pick pick = {0, "", 0, 0};
+	size_t first = 0;
+	// the oldest of the last back entries is the one back steps away.
+	if (history_recent(back, &first, pick_entry, &pick) < 0 || !pick.found ||
+	    (dir > 0 && l->back > 0 && first == l->back_number)) {
+		beep();
+		return;
+	}
+	l->back = back;
+	l->back_number = first;
+	set_line(l, pick.line, pick.len);
+}
+
+/*
+ * Ctrl-R: search the history as the query is typed, newest match first, with
+ * Ctrl-R again moving on to older matches.
+ * Return: 1 if Enter ran the match, 0 if editing goes on and -1 at the end
+ * of the input.
+ */
+static int reverse_search(line_state *l) {
+	char query[SEARCH_MAX];
+	size_t query_len = 0;
+	size_t skip = 0;
+	entry_pick shown = {0, "", 0, 0};
+	char original[MAX_STR_LEN + 1];
+	size_t original_len = l->len;
+	memcpy(original, l->buf, l->len);
+	while (1) {
+		entry_pick pick = {skip, "", 0, 0};
+		if (query_len > 0 && history_search(query, query_len, pick_entry, &pick) > 0 && pick.found) {
+			shown = pick;
+		} else if (query_len > 0 && skip > 0) {
+			// no older match: stay on the last one.
+			skip--;
+			beep();
+		}
+		screen s;
+		s.len = 0;
+		screen_put(&s, "\r(reverse-i-search)`", 20);
+		screen_put(&s, query, query_len);
+		screen_put(&s, "': ", 3);
+		screen_put(&s, shown.line, shown.len);
+		screen_put(&s, "\x1b[K", 3);
+		screen_flush(&s);
+		int key = read_key();
+		if (key < 0) {
+			return -1;
+		}
+		if (key == KEY_CTRL('r')) {
+			skip++;
+		} else if (key == KEY_BACKSPACE || key == KEY_CTRL('h')) {
+			query_len -= query_len > 0;
+			skip = 0;
+			shown.len = 0;
+		} else if (key >= ' ' && key < KEY_BACKSPACE) {
+			if (query_len < SEARCH_MAX) {
+				query[query_len++] = key;
+			}
+			skip = 0;
+		} else if (key == KEY_CTRL('c') || key == KEY_CTRL('g')) {
+			set_line(l, original, original_len);
+			return 0;
+		} else {
+			set_line(l, shown.line, shown.len);
+			return key == '\r' || key == '\n';
+		}
+	}
+}
+
+// ===== Completion =====
+
+/*
+ * List the candidates under the line in columns, by their last path
+ * component as the rest is already typed.
+ */
+static void list_candidates(const completion *c) {
+	struct winsize ws;
+	size_t width = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+	size_t widest = 0;
+	size_t *skip = malloc(sizeof(size_t) * c->count);
+	if (skip == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < c->count; i++) {
+		size_t len = strlen(c->items[i]);
+		const char *slash = len > 1 ? memrchr(c->items[i], '/', len - 1) : NULL;
+		skip[i] = slash == NULL ? 0 : (size_t) (slash - c->items[i]) + 1;
+		if (len - skip[i] > widest) {
+			widest = len - skip[i];
+		}
+	}
+	size_t column = widest + 2;
+	size_t columns = width / column > 0 ? width / column : 1;
+	size_t rows = (c->count + columns - 1) / columns;
+	screen s;
+	s.len = 0;
+	screen_put(&s, "\r\n", 2);
+	for (size_t r = 0; r < rows; r++) {
+		// down the columns, like ls.
+		for (size_t k = 0; k < columns && r + k * rows < c->count; k++) {
+			const char *name = c->items[r + k * rows] + skip[r + k * rows];
+			size_t len = strlen(name);
+			screen_put(&s, name, len);
+			for (size_t pad = len; k + 1 < columns && pad < column; pad++) {
+				screen_put(&s, " ", 1);
+			}
+		}
+		screen_put(&s, "\r\n", 2);
+	}
+	screen_flush(&s);
+	free(skip);
+}
+
+/*
+ * Tab: fill in as much as all candidates agree on, finishing the word when
+ * only one is left. A second Tab with nothing to fill in lists them.
+ */
+static void tab_complete(line_state *l) {
+	completion c;
+	l->buf[l->len] = '\0';
+	if (complete_word(l->buf, l->pos, &c) < 0 || c.count == 0) {
+		beep();
+		completion_free(&c);
+		return;
+	}
+	size_t typed = l->pos - c.start;
+	size_t common = completion_common(&c);
+	int tabbed = l->tabbed;
+	l->tabbed = 0;
+	if (common > typed) {
+		insert(l, c.items[0] + typed, common - typed);
+	}
+	if (c.count == 1) {
+		size_t len = strlen(c.items[0]);
+		if (c.items[0][len - 1] != '/' && (l->pos == l->len || l->buf[l->pos] != ' ')) {
+			insert(l, " ", 1);
+		}
+	} else if (common == typed && tabbed) {
+		list_candidates(&c);
+	} else if (common == typed) {
+		beep();
+		l->tabbed = 1;
+	}
+	completion_free(&c);
+}
+
+// ===== Reading a line =====
+
+/*
+ * Act on an escape sequence (arrows, Home, End, Delete).
+ */
+static void escape_key(line_state *l) {
+	int a = read_key();
+	int b = a < 0 ? -1 : read_key();
+	if (a != '[' && a != 'O') {
+		return;
+	}
+	if (b >= '0' && b <= '9') {
+		if (read_key() != '~') {
+			return;
+		}
+		if (b == '3' && l->pos < l->len) {
+			delete_range(l, l->pos, l->pos + 1);
+		} else if (b == '1' || b == '7') {
+			l->pos = 0;
+		} else if (b == '4' || b == '8') {
+			l->pos = l->len;
+		}
+		return;
+	}
+	switch (b) {
+	case 'A':
+		history_step(l, 1);
+		break;
+	case 'B':
+		history_step(l, -1);
+		break;
+	case 'C':
+		l->pos += l->pos < l->len;
+		break;
+	case 'D':
+		l->pos -= l->pos > 0;
+		break;
+	case 'H':
+		l->pos = 0;
+		break;
+	case 'F':
+		l->pos = l->len;
+		break;
+	}
+}
+
+static ssize_t finish(line_state *l, struct termios *saved, ssize_t ret) {
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, saved);
+	write(STDOUT_FILENO, "\r\n", 2);
+	if (ret > 0) {
+		l->buf[l->len++] = '\n';
+		l->buf[l->len] = '\0';
+		ret = l->len;
+	}
+	return ret;
+}
+
+ssize_t edit_line(char *in_ptr, const char *prompt) {
+	struct termios saved;
+	line_state l;
+	memset(in_ptr, 0, MAX_STR_LEN + 1);
+	memset(&l, 0, sizeof(l));
+	l.buf = in_ptr;
+	l.prompt = prompt;
+	l.prompt_len = strlen(prompt);
+	if (raw_mode(&saved) < 0) {
+		return -1;
+	}
+	refresh(&l);
+	while (1) {
+		int key = read_key();
+		if (key < 0) {
+			return finish(&l, &saved, l.len > 0 ? 1 : 0);
+		}
+		if (key != '\t') {
+			l.tabbed = 0;
+		}
+		switch (key) {
+		case '\r':
+		case '\n':
+			return finish(&l, &saved, 1);
+		case '\t':
+			tab_complete(&l);
+			break;
+		case KEY_CTRL('d'):
+			if (l.len == 0) {
+				return finish(&l, &saved, 0);
+			}
+			if (l.pos < l.len) {
+				delete_range(&l, l.pos, l.pos + 1);
+			}
+			break;
+		case KEY_CTRL('c'):
+			// like SIGINT at the prompt: drop the line, start over.
+			write(STDOUT_FILENO, "^C\r\n", 4);
+			l.len = l.pos = l.back = 0;
+			break;
+		case KEY_BACKSPACE:
+		case KEY_CTRL('h'):
+			if (l.pos > 0) {
+				delete_range(&l, l.pos - 1, l.pos);
+			}
+			break;
+		case KEY_CTRL('a'):
+			l.pos = 0;
+			break;
+		case KEY_CTRL('e'):
+			l.pos = l.len;
+			break;
+		case KEY_CTRL('b'):
+			l.pos -= l.pos > 0;
+			break;
+		case KEY_CTRL('f'):
+			l.pos += l.pos < l.len;
+			break;
+		case KEY_CTRL('p'):
+			history_step(&l, 1);
+			break;
+		case KEY_CTRL('n'):
+			history_step(&l, -1);
+			break;
+		case KEY_CTRL('u'):
+			delete_range(&l, 0, l.pos);
+			break;
+		case KEY_CTRL('k'):
+			l.len = l.pos;
+			break;
+		case KEY_CTRL('w'): {
+			size_t from = l.pos;
+			while (from > 0 && l.buf[from - 1] == ' ') from--;
+			while (from > 0 && l.buf[from - 1] != ' ') from--;
+			delete_range(&l, from, l.pos);
+			break;
+		}
+		case KEY_CTRL('l'):
+			write(STDOUT_FILENO, "\x1b[H\x1b[2J", 7);
+			break;
+		case KEY_CTRL('r'): {
+			int ran = reverse_search(&l);
+			if (ran != 0) {
+				return finish(&l, &saved, ran > 0 ? 1 : (l.len > 0));
+			}
+			break;
+		}
+		case KEY_ESC:
+			escape_key(&l);
+			break;
+		default:
+			if (key >= ' ') {
+				char c = key;
+				insert(&l, &c, 1);
+			}
+			break;
+		}
+		refresh(&l);
+	}
+}
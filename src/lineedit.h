@@ -0,0 +1,20 @@
+#ifndef __LINEEDIT_H__
+#define __LINEEDIT_H__
+
+#include <sys/types.h>
+
+/* Return: 1 if input comes from a terminal the line editor can drive.
+ */
+int lineedit_usable(void);
+
+/* Show prompt and read one line from the terminal in raw mode, with cursor
+ * movement, Tab completion (see complete.h), Up/Down through the history and
+ * Ctrl-R to search it. Ctrl-C drops the line and starts a new one, Ctrl-D on
+ * an empty line ends the input.
+ * Prereq: in_ptr points to a character buffer of size > MAX_STR_LEN
+ * Return: as for get_input, the number of bytes put in in_ptr (the line and
+ * its '\n'), 0 at the end of the input or -1 on error.
+ */
+ssize_t edit_line(char *in_ptr, const char *prompt);
+
+#endif
@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lines.h"
+#include "io_helpers.h"
+
+// Pipe input for tail is trimmed back to its last n lines past this size.
+#define TAIL_TRIM (4 * LINE_BLOCK)
+
+// ===== Newline scanning =====
+
+size_t count_newlines(const char *buf, size_t len) {
+	size_t count = 0;
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	while (i + 16 <= len) {
+		// each matching byte is -1, so subtracting counts up per lane. A lane
+		// overflows after 255 rounds, fold the lanes into count before that.
+		__m128i acc = zero;
+		for (int round = 0; round < 255 && i + 16 <= len; round++, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+		}
+		__m128i sums = _mm_sad_epu8(acc, zero);
+		count += (size_t) _mm_cvtsi128_si32(sums) + (size_t) _mm_extract_epi16(sums, 4);
+	}
+#endif
+	for (; i < len; i++) {
+		count += buf[i] == '\n';
+	}
+	return count;
+}
+
+size_t tail_offset(const char *buf, size_t len, size_t n) {
+	if (n == 0) {
+		return len;
+	}
+	size_t pos = len;
+	if (pos > 0 && buf[pos - 1] == '\n') {
+		pos--;
+	}
+	// the last n lines start after the nth newline from the end.
+	size_t need = n;
+	while (pos > 0) {
+		size_t block = pos < LINE_BLOCK ? pos : LINE_BLOCK;
+		const char *start = buf + pos - block;
+		size_t found = count_newlines(start, block);
+		if (found >= need) {
+			const char *p = start + block;
+			while (need > 0) {
+				p = memrchr(start, '\n', p - start);
+				need--;
+			}
+			return p - buf + 1;
+		}
+		need -= found;
+		pos -= block;
+	}
+	return 0;
+}
+
+// ===== head =====
+
+int head_lines(int fd, size_t n) {
+	char *buf = malloc(LINE_BLOCK);
+	if (buf == NULL) {
+		return -1;
+	}
+	int ret = 0;
+	while (n > 0) {
+		ssize_t got = read(fd, buf, LINE_BLOCK);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			ret = got;
+			break;
+		}
+		size_t found = count_newlines(buf, got);
+		if (found < n) {
+			display_buffer(buf, got);
+			n -= found;
+			continue;
+		}
+		const char *p = buf;
+		while (n > 0) {
+			p = (const char *) memchr(p, '\n', buf + got - p) + 1;
+			n--;
+		}
+		display_buffer(buf, p - buf);
+	}
+	free(buf);
+	return ret;
+}
+
+// ===== tail =====
+
+/*
+ * Input that cannot be mapped: keep a buffer that is cut back to its last n
+ * lines whenever it grows past TAIL_TRIM.
+ */
+static int tail_stream(int fd, size_t n) {
+	size_t cap = TAIL_TRIM + LINE_BLOCK;
+	size_t len = 0;
+	size_t trim_at = TAIL_TRIM;
+	char *buf = malloc(cap);
+	if (buf == NULL) {
+		return -1;
+	}
+	while (1) {
+		if (len + LINE_BLOCK > cap) {
+			char *grown = realloc(buf, cap * 2);
+			if (grown == NULL) {
+				free(buf);
+				return -1;
+			}
+			buf = grown;
+			cap *= 2;
+		}
+		ssize_t got = read(fd, buf + len, LINE_BLOCK);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got < 0) {
+			free(buf);
+			return -1;
+		}
+		if (got == 0) {
+			break;
+		}
+		len += got;
+		if (len > trim_at) {
+			size_t off = tail_offset(buf, len, n);
+			memmove(buf, buf + off, len - off);
+			len -= off;
+			// long lines may keep most of the buffer, don't rescan it every read.
+			trim_at = len * 2 > TAIL_TRIM ? len * 2 : TAIL_TRIM;
+		}
+	}
+	size_t off = tail_offset(buf, len, n);
+	display_buffer(buf + off, len - off);
+	free(buf);
+	return 0;
+}
+
+int tail_lines(int fd, size_t n) {
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		return -1;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		return tail_stream(fd, n);
+	}
+	if (st.st_size == 0) {
+		return 0;
+	}
+	// only the pages from the start of the output onwards are ever touched.
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return tail_stream(fd, n);
+	}
+	size_t off = tail_offset(map, st.st_size, n);
+	display_buffer(map + off, st.st_size - off);
+	munmap(map, st.st_size);
+	// leave the offset at the end for follow_file.
+	lseek(fd, st.st_size, SEEK_SET);
+	return 0;
+}
+
+// ===== tail -f =====
+
+static volatile sig_atomic_t follow_stop = 0;
+
+static void follow_sigint(int sig) {
+	(void) sig;
+	follow_stop = 1;
+}
+
+/*
+ * Write out everything from the current offset to the end of the file.
+ */
+static int copy_new_data(int fd, char *buf) {
+	struct stat st;
+	off_t pos = lseek(fd, 0, SEEK_CUR);
+	if (fstat(fd, &st) == 0 && st.st_size < pos) {
+		display_error("tail: file truncated", "");
+		lseek(fd, 0, SEEK_SET);
+	}
+	while (1) {
+		ssize_t got = read(fd, buf, LINE_BLOCK);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			return got;
+		}
+		display_buffer(buf, got);
+	}
+}
+
+int follow_file(int fd, const char *path) {
+	int ifd = inotify_init1(IN_CLOEXEC);
+	if (ifd < 0) {
+		return -1;
+	}
+	// unlinking while we hold the file open only shows up as IN_ATTRIB.
+	if (inotify_add_watch(ifd, path, IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+		close(ifd);
+		return -1;
+	}
+	char *buf = malloc(LINE_BLOCK);
+	if (buf == NULL) {
+		close(ifd);
+		return -1;
+	}
+	// the shell restarts reads on SIGINT, here it has to interrupt the wait.
+	struct sigaction sa, old;
+	sa.sa_handler = follow_sigint;
+	sa.sa_flags = 0;
+	sigemptyset(&sa.sa_mask);
+	follow_stop = 0;
+	sigaction(SIGINT, &sa, &old);
+
+	int ret = copy_new_data(fd, buf);
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int gone = 0;
+	// a pipe whose reader quit (tail -f | head) reports POLLERR on our end.
+	struct pollfd fds[2] = {{ifd, POLLIN, 0}, {io_output_fd(), 0, 0}};
+	while (ret == 0 && !gone && !follow_stop) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ret = -1;
+			break;
+		}
+		if (fds[1].revents & (POLLERR | POLLHUP)) {
+			break;
+		}
+		if (!(fds[0].revents & POLLIN)) {
+			continue;
+		}
+		ssize_t got = read(ifd, events, sizeof(events));
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			ret = -1;
+			break;
+		}
+		for (char *p = events; p < events + got; ) {
+			struct inotify_event *ev = (struct inotify_event *) p;
+			gone |= (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) != 0;
+			if (ev->mask & IN_ATTRIB) {
+				struct stat st;
+				gone |= fstat(fd, &st) == 0 && st.st_nlink == 0;
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+		ret = copy_new_data(fd, buf);
+	}
+
+	sigaction(SIGINT, &old, NULL);
+	free(buf);
+	close(ifd);
+	return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef __LINES_H__
+#define __LINES_H__
+
+#include <stddef.h>
+
+#define DEFAULT_LINE_COUNT 10
+// Bytes read or scanned per step by head and tail.
+#define LINE_BLOCK 65536
+
+/* Return: number of '\n' bytes in buf (SSE2 when available).
+ */
+size_t count_newlines(const char *buf, size_t len);
+
+/* Return: offset in buf where its last n lines start (0 if it has fewer).
+ * A '\n' at the very end finishes the last line rather than starting one.
+ */
+size_t tail_offset(const char *buf, size_t len, size_t n);
+
+/* Write the first n lines of fd to the output, reading no further than the
+ * block that holds the nth newline.
+ * Return: 0 on success and -1 on error.
+ */
+int head_lines(int fd, size_t n);
+
+/* Write the last n lines of fd to the output. Regular files are mapped and
+ * scanned backwards from the end, anything else is read through.
+ * Return: 0 on success and -1 on error.
+ */
+int tail_lines(int fd, size_t n);
+
+/* Keep writing whatever gets appended to the file at path (opened as fd)
+ * until it is removed or SIGINT arrives. Waits on inotify, no polling.
+ * Return: 0 on success and -1 on error.
+ */
+int follow_file(int fd, const char *path);
+
+#endif
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "linesort.h"
+#include "extsort.h"
+#include "lines.h"
+#include "io_helpers.h"
+
+// ===== Keys =====
+
+static int is_blank(char c) {
+	return c == ' ' || c == '\t';
+}
+
+/*
+ * Find the -k key of a line. Leading blanks of a field are not part of it.
+ */
+static void find_key(const char *line, size_t len, const sort_options *opts,
+                     const char **key, size_t *key_len) {
+	const char *p = line;
+	const char *end = line + len;
+	if (opts->key_start == 0) {
+		*key = line;
+		*key_len = len;
+		return;
+	}
+	while (p < end && is_blank(*p)) p++;
+	for (size_t field = 1; field < opts->key_start && p < end; field++) {
+		while (p < end && !is_blank(*p)) p++;
+		while (p < end && is_blank(*p)) p++;
+	}
+	*key = p;
+	if (opts->key_end == 0) {
+		*key_len = end - p;
+		return;
+	}
+	for (size_t field = opts->key_start; field <= opts->key_end && p < end; field++) {
+		while (p < end && is_blank(*p)) p++;
+		while (p < end && !is_blank(*p)) p++;
+	}
+	*key_len = p - *key;
+}
+
+static int compare_bytes(const char *a, size_t alen, const char *b, size_t blen) {
+	int c = memcmp(a, b, alen < blen ? alen : blen);
+	if (c != 0) {
+		return c;
+	}
+	return (alen > blen) - (alen < blen);
+}
+
+/*
+ * Records are NULL terminated lines, so strtod can run over the key as is
+ * (it stops at the blank that ends a field).
+ */
+static int compare_keys(const char *a, size_t alen, const char *b, size_t blen, const sort_options *opts) {
+	const char *ka, *kb;
+	size_t ka_len, kb_len;
+	find_key(a, alen, opts, &ka, &ka_len);
+	find_key(b, blen, opts, &kb, &kb_len);
+	if (opts->numeric) {
+		double x = strtod(ka, NULL);
+		double y = strtod(kb, NULL);
+		return (x > y) - (x < y);
+	}
+	return compare_bytes(ka, ka_len, kb, kb_len);
+}
+
+static int compare_lines(const char *a, size_t alen, const char *b, size_t blen, void *ctx) {
+	const sort_options *opts = ctx;
+	// drop the NULL terminators.
+	alen--;
+	blen--;
+	int c = compare_keys(a, alen, b, blen, opts);
+	// equal keys fall back to the whole line, except when -u needs them equal.
+	if (c == 0 && !opts->unique) {
+		c = compare_bytes(a, alen, b, blen);
+	}
+	return opts->reverse ? -c : c;
+}
+
+// ===== Input =====
+
+/*
+ * Add one line (without its newline) as a NULL terminated record.
+ */
+static int add_line(extsort *s, char *line, size_t len) {
+	line[len] = '\0';
+	return extsort_add(s, line, len + 1);
+}
+
+/*
+ * Grow the partial line buffer by part bytes, keeping room for a terminator.
+ */
+static int append_carry(char **carry, size_t *len, size_t *cap, const char *part, size_t part_len) {
+	if (*len + part_len + 1 > *cap) {
+		size_t grown_cap = (*len + part_len + 1) * 2;
+		char *grown = realloc(*carry, grown_cap);
+		if (grown == NULL) {
+			return -1;
+		}
+		*carry = grown;
+		*cap = grown_cap;
+	}
+	memcpy(*carry + *len, part, part_len);
+	*len += part_len;
+	return 0;
+}
+
+static int read_lines(int fd, extsort *s) {
+	char *buf = malloc(LINE_BLOCK);
+	// a line cut off by the end of a read is collected here.
+	char *carry = NULL;
+	size_t carry_len = 0, carry_cap = 0;
+	int ret = -1;
+	if (buf == NULL) {
+		return -1;
+	}
+	while (1) {
+		ssize_t got = read(fd, buf, LINE_BLOCK);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got < 0) {
+			goto done;
+		}
+		if (got == 0) {
+			break;
+		}
+		char *p = buf;
+		char *end = buf + got;
+		char *nl;
+		while ((nl = memchr(p, '\n', end - p)) != NULL) {
+			if (carry_len > 0) {
+				if (append_carry(&carry, &carry_len, &carry_cap, p, nl - p) < 0 ||
+				    add_line(s, carry, carry_len) < 0) {
+					goto done;
+				}
+				carry_len = 0;
+			} else if (add_line(s, p, nl - p) < 0) {
+				goto done;
+			}
+			p = nl + 1;
+		}
+		if (p < end && append_carry(&carry, &carry_len, &carry_cap, p, end - p) < 0) {
+			goto done;
+		}
+	}
+	// a last line without a newline still counts.
+	if (carry_len > 0 && add_line(s, carry, carry_len) < 0) {
+		goto done;
+	}
+	ret = 0;
+done:
+	free(carry);
+	free(buf);
+	return ret;
+}
+
+// ===== Output =====
+
+int sort_lines(int fd, const sort_options *opts) {
+	extsort s;
+	extsort_init(&s, opts->budget, compare_lines, (void *) opts);
+	if (read_lines(fd, &s) < 0 || extsort_finish(&s) < 0) {
+		extsort_free(&s);
+		return -1;
+	}
+	out_buffer *out = malloc(sizeof(out_buffer));
+	if (out == NULL) {
+		extsort_free(&s);
+		return -1;
+	}
+	out->len = 0;
+	// -u compares against the last line printed, which has to be copied
+	// since the sort reuses its record buffers.
+	char *prev = NULL;
+	size_t prev_len = 0, prev_cap = 0;
+	const char *rec;
+	size_t len;
+	int r, ret = 0;
+	while ((r = extsort_next(&s, &rec, &len)) > 0) {
+		if (opts->unique) {
+			if (prev != NULL && compare_keys(prev, prev_len - 1, rec, len - 1, opts) == 0) {
+				continue;
+			}
+			if (len > prev_cap) {
+				prev_cap = len * 2;
+				char *grown = realloc(prev, prev_cap);
+				if (grown == NULL) {
+					ret = -1;
+					break;
+				}
+				prev = grown;
+			}
+			memcpy(prev, rec, len);
+			prev_len = len;
+		}
+		out_append(out, rec, len - 1);
+		out_append(out, "\n", 1);
+	}
+	if (r < 0) {
+		ret = -1;
+	}
+	out_flush(out);
+	free(out);
+	free(prev);
+	extsort_free(&s);
+	return ret;
+}
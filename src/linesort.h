@@ -0,0 +1,24 @@
+#ifndef __LINESORT_H__
+#define __LINESORT_H__
+
+#include <stddef.h>
+
+/* What the sort builtin was asked for.
+ */
+typedef struct sort_options {
+    int numeric;        // -n: compare the key as a number
+    int reverse;        // -r
+    int unique;         // -u: print only the first of lines with equal keys
+    // -k start[,end]: 1-based whitespace separated fields, 0 = whole line
+    // (start) or up to the end of the line (end).
+    size_t key_start;
+    size_t key_end;
+    size_t budget;      // bytes kept in memory before runs spill to disk
+} sort_options;
+
+/* Sort the lines read from fd and write them to the output.
+ * Return: 0 on success and -1 on error.
+ */
+int sort_lines(int fd, const sort_options *opts);
+
+#endif
@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <pwd.h>
+#include <grp.h>
+
+#include "metadata.h"
+#include "uring.h"
+#include "workpool.h"
+
+#define STAT_RING_ENTRIES 256
+#define ID_CACHE_BUCKETS 64
+
+// The ring is set up on first use and then shared by every ls.
+// ring_state: 0 untried, 1 ready, -1 unavailable (use the thread pool).
+static uring ring;
+static int ring_state = 0;
+
+typedef struct id_name {
+    unsigned int id;
+    char *name;
+    struct id_name *next;
+} id_name;
+
+static id_name *uid_cache[ID_CACHE_BUCKETS];
+static id_name *gid_cache[ID_CACHE_BUCKETS];
+
+// ===== Cleanup =====
+
+static void free_id_cache(id_name **cache) {
+	for (int i = 0; i < ID_CACHE_BUCKETS; i++) {
+		id_name *curr = cache[i];
+		while (curr != NULL) {
+			id_name *next = curr->next;
+			free(curr->name);
+			free(curr);
+			curr = next;
+		}
+		cache[i] = NULL;
+	}
+}
+
+static void metadata_cleanup(void) {
+	if (ring_state == 1) {
+		uring_exit(&ring);
+	}
+	ring_state = 0;
+	free_id_cache(uid_cache);
+	free_id_cache(gid_cache);
+}
+
+static void register_cleanup(void) {
+	static int registered = 0;
+	if (!registered) {
+		atexit(metadata_cleanup);
+		registered = 1;
+	}
+}
+
+// ===== Batched statx =====
+
+typedef struct {
+    int dirfd;
+    ls_entry *entries;
+    unsigned int mask;
+} stat_ctx;
+
+static void stat_one(void *arg, size_t i) {
+	stat_ctx *ctx = arg;
+	ls_entry *e = &ctx->entries[i];
+	e->err = 0;
+	if (statx(ctx->dirfd, e->name, AT_SYMLINK_NOFOLLOW, ctx->mask, &e->stx) < 0) {
+		e->err = errno;
+	}
+}
+
+static int ring_ready(void) {
+	if (ring_state == 0) {
+		register_cleanup();
+		// MYSH_NO_URING forces the thread pool, handy for comparing the two.
+		if (getenv("MYSH_NO_URING") == NULL && uring_init(&ring, STAT_RING_ENTRIES, 0) == 0) {
+			ring_state = 1;
+		} else {
+			ring_state = -1;
+		}
+	}
+	return ring_state == 1;
+}
+
+// reap whatever has completed so far, returns how many entries finished.
+static size_t stat_reap(ls_entry *entries) {
+	size_t reaped = 0;
+	struct io_uring_cqe *cqe;
+	while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+		ls_entry *e = &entries[cqe->user_data];
+		e->err = cqe->res < 0 ? -cqe->res : 0;
+		uring_cqe_seen(&ring);
+		reaped++;
+	}
+	return reaped;
+}
+
+/*
+ * Keep the submission queue full, one syscall per refill submits the new
+ * statx requests and waits for at least one of the outstanding ones.
+ * In-flight requests stay below the completion queue size so the kernel
+ * never has to hold back completions (which is what makes submit fail
+ * with EBUSY). Returns -1 if the ring failed, every request the kernel
+ * took has completed by then so the caller can redo the batch elsewhere.
+ */
+static int stat_batch_uring(int dirfd, ls_entry *entries, size_t n, unsigned int mask) {
+	size_t next = 0, done = 0, consumed = 0;
+	while (done < n) {
+		struct io_uring_sqe *sqe;
+		while (next < n && next - done < ring.cq_entries && (sqe = uring_get_sqe(&ring)) != NULL) {
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = dirfd;
+			sqe->addr = (unsigned long) entries[next].name;
+			sqe->len = mask;
+			sqe->off = (unsigned long) &entries[next].stx;
+			sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+			sqe->user_data = next;
+			next++;
+		}
+		int ret = uring_submit(&ring, 1);
+		if (ret < 0) {
+			if (errno == EBUSY || errno == EAGAIN) {
+				// the kernel is short on room, make some before trying again.
+				size_t reaped = stat_reap(entries);
+				done += reaped;
+				if (reaped == 0) {
+					sched_yield();
+				}
+				continue;
+			}
+			// anything the kernel accepted still writes into entries, wait
+			// for it to land before handing the batch to the thread pool.
+			while (done < consumed) {
+				size_t reaped = stat_reap(entries);
+				done += reaped;
+				if (reaped == 0) {
+					sched_yield();
+				}
+			}
+			ring_state = -1;
+			uring_exit(&ring);
+			return -1;
+		}
+		consumed += (size_t) ret;
+		done += stat_reap(entries);
+	}
+	return 0;
+}
+
+int stat_batch(int dirfd, ls_entry *entries, size_t n, unsigned int mask) {
+	if (n == 0) {
+		return 0;
+	}
+	if (ring_ready() && stat_batch_uring(dirfd, entries, n, mask) == 0) {
+		return 0;
+	}
+	stat_ctx ctx = {dirfd, entries, mask};
+	workpool_run(n, stat_one, &ctx);
+	return 0;
+}
+
+// ===== uid/gid name caches =====
+
+static const char *cache_lookup(id_name **cache, unsigned int id, int is_group) {
+	id_name *curr = cache[id % ID_CACHE_BUCKETS];
+	while (curr != NULL) {
+		if (curr->id == id) {
+			return curr->name;
+		}
+		curr = curr->next;
+	}
+	register_cleanup();
+	// not cached: ask nss once, and remember misses as the plain number.
+	char buf[4096];
+	char *name = NULL;
+	if (is_group) {
+		struct group gr, *res = NULL;
+		if (getgrgid_r(id, &gr, buf, sizeof(buf), &res) == 0 && res != NULL) {
+			name = strdup(res->gr_name);
+		}
+	} else {
+		struct passwd pw, *res = NULL;
+		if (getpwuid_r(id, &pw, buf, sizeof(buf), &res) == 0 && res != NULL) {
+			name = strdup(res->pw_name);
+		}
+	}
+	if (name == NULL) {
+		char num[32];
+		snprintf(num, sizeof(num), "%u", id);
+		name = strdup(num);
+	}
+	id_name *node = malloc(sizeof(id_name));
+	if (node == NULL || name == NULL) {
+		free(node);
+		free(name);
+		return "?";
+	}
+	node->id = id;
+	node->name = name;
+	node->next = cache[id % ID_CACHE_BUCKETS];
+	cache[id % ID_CACHE_BUCKETS] = node;
+	return name;
+}
+
+const char *uid_to_name(uid_t uid) {
+	return cache_lookup(uid_cache, uid, 0);
+}
+
+const char *gid_to_name(gid_t gid) {
+	return cache_lookup(gid_cache, gid, 1);
+}
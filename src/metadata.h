@@ -0,0 +1,33 @@
+#ifndef __METADATA_H__
+#define __METADATA_H__
+
+/* struct statx needs _GNU_SOURCE defined before any system header.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+
+/* One directory entry plus whatever metadata was asked of stat_batch.
+ */
+typedef struct ls_entry {
+    const char *name;
+    size_t name_len;
+    unsigned char d_type;
+    int err;               // 0, or the errno statx failed with
+    struct statx stx;
+} ls_entry;
+
+/* statx every entry (relative to dirfd), requesting only the fields in mask.
+ * Uses a batched io_uring when the kernel allows it and a thread pool otherwise.
+ * Per entry failures are reported through entries[i].err.
+ * Return: 0 on success and -1 if the batch could not be run at all.
+ */
+int stat_batch(int dirfd, ls_entry *entries, size_t n, unsigned int mask);
+
+/* Return: the user/group name for an id, falling back to the number.
+ * Lookups are cached for the lifetime of the shell.
+ */
+const char *uid_to_name(uid_t uid);
+const char *gid_to_name(gid_t gid);
+
+#endif
@@ -3,6 +3,10 @@
 #include "io_helpers.h"
 #include "variables.h"
 #include "commands.h"
+#include "plugins.h"
+#include "history.h"
+#include "lineedit.h"
+#include "complete.h"
 // need to prevent sigint from killing the console:
 #include <signal.h>
 void sigint_handler(int sig) {
@@ -24,41 +28,58 @@ int main(__attribute__((unused)) int argc,
     sa.sa_flags = SA_RESTART;       
     sigemptyset(&sa.sa_mask);
     sigaction(SIGINT, &sa, NULL);
+    load_plugins(getenv(PLUGIN_PATH_ENV));
+    int interactive = lineedit_usable();
+    // history is optional: without a usable file the shell just runs without it.
+    // Scripts and piped input only keep one when MYSH_HISTFILE asks for it.
+    if (interactive || getenv(HISTORY_FILE_ENV) != NULL) {
+        history_open(NULL);
+    }
 
     char input_buf[MAX_STR_LEN + 1];
     input_buf[MAX_STR_LEN] = '\0';
-    char *token_arr[MAX_STR_LEN] = {NULL};
+    char **token_arr = NULL;
+    unsigned char *literal_arr = NULL;
     size_t token_count = 0;
     while (1) {
         // Prompt and input tokenization
         //clear of garbage
 	    memset(input_buf, 0, sizeof(input_buf));
-        for (size_t i = 0; i < token_count; i++) {
-            free(token_arr[i]);
-            token_arr[i] = NULL;
-        }
+        free_tokens(token_arr, literal_arr, token_count);
+        token_arr = NULL;
+        literal_arr = NULL;
         // TODO Step 2:
         // Display the prompt via the display_message function.
-	    print_path();
-        int ret = get_input(input_buf);
+        int ret;
+        if (interactive) {
+            // the editor draws the prompt itself, it redraws it on every key.
+            ret = edit_line(input_buf, current_prompt());
+        } else {
+            print_path();
+            ret = get_input(input_buf);
+        }
+        if (ret > 0) {
+            history_add(input_buf, strlen(input_buf));
+        }
         // New version of tokenize_input should now do expansion as it is tokenizing.
         // As such, we do need to change things around.
-        token_count = tokenize_input(input_buf, token_arr);
+        token_count = tokenize_input(input_buf, &token_arr, &literal_arr);
         // Clean exit
         // TODO: The next line has a subtle issue.
-        if (ret != -1 && ((token_count == 0 && ret == 0) || (token_arr[0] != NULL && strncmp("exit", token_arr[0], 5) == 0))) {
-            for(size_t i = 0 ; i < token_count; i++){
-                free(token_arr[i]);
-            }
+        if (ret != -1 && ((token_count == 0 && ret == 0) || (token_count > 0 && strncmp("exit", token_arr[0], 5) == 0))) {
+            free_tokens(token_arr, literal_arr, token_count);
             break;
         }
         // Command execution
         if (token_count >= 1) {
-            execute_commands(token_arr, token_count);
+            execute_commands(token_arr, literal_arr, token_count);
         }
     }
     // free the vars, kill the server (if running) and exit
     freeVars();
     close_server();
+    unload_plugins();
+    history_close();
+    complete_reset();
     return 0;
 }
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+
+#include "plugins.h"
+#include "io_helpers.h"
+#include "variables.h"
+
+// Seed for the plugin table, any value works as it is not a perfect hash.
+#define PLUGIN_SEED 0u
+
+/* Slot of the plugin builtin table (open addressing, linear probing).
+ */
+typedef struct plugin_builtin {
+    char *name;
+    size_t len;
+    bn_ptr fn;
+} plugin_builtin;
+
+static plugin_builtin *table = NULL;
+static size_t table_cap = 0;
+static size_t table_count = 0;
+
+static void **handles = NULL;
+static size_t handle_count = 0;
+
+static const plugin_api API = {
+	PLUGIN_API_VERSION,
+	register_builtin,
+	display_message,
+	display_error,
+	getVar
+};
+
+// ===== Registry =====
+
+static plugin_builtin *find_slot(plugin_builtin *slots, size_t cap, const char *name, size_t len) {
+	size_t i = builtin_hash(name, len, PLUGIN_SEED) & (cap - 1);
+	while (slots[i].name != NULL &&
+	       !(slots[i].len == len && memcmp(slots[i].name, name, len) == 0)) {
+		i = (i + 1) & (cap - 1);
+	}
+	return &slots[i];
+}
+
+/*
+ * Keep the table at most half full so probe runs stay short.
+ */
+static int grow_table(void) {
+	size_t cap = table_cap ? table_cap * 2 : 16;
+	plugin_builtin *slots = calloc(cap, sizeof(plugin_builtin));
+	if (slots == NULL) {
+		return -1;
+	}
+	for (size_t i = 0; i < table_cap; i++) {
+		if (table[i].name != NULL) {
+			*find_slot(slots, cap, table[i].name, table[i].len) = table[i];
+		}
+	}
+	free(table);
+	table = slots;
+	table_cap = cap;
+	return 0;
+}
+
+int register_builtin(const char *name, bn_ptr fn) {
+	size_t len = strnlen(name, MAX_STR_LEN + 1);
+	// the name has to survive tokenizing, and '=' would look like an assignment.
+	if (fn == NULL || len == 0 || len > MAX_STR_LEN || strpbrk(name, DELIMITERS "=|$") != NULL) {
+		display_error("ERROR: Invalid builtin name: ", (char *) name);
+		return -1;
+	}
+	if (check_builtin(name) != NULL) {
+		display_error("ERROR: Builtin already exists: ", (char *) name);
+		return -1;
+	}
+	if ((table_count + 1) * 2 > table_cap && grow_table() < 0) {
+		return -1;
+	}
+	char *copy = strdup(name);
+	if (copy == NULL) {
+		return -1;
+	}
+	plugin_builtin *slot = find_slot(table, table_cap, name, len);
+	slot->name = copy;
+	slot->len = len;
+	slot->fn = fn;
+	table_count++;
+	return 0;
+}
+
+bn_ptr plugin_lookup(const char *name, size_t len) {
+	if (table_count == 0) {
+		return NULL;
+	}
+	return find_slot(table, table_cap, name, len)->fn;
+}
+
+void plugin_visit(name_visit visit, void *ctx) {
+	for (size_t i = 0; i < table_cap; i++) {
+		if (table[i].name != NULL) {
+			visit(ctx, table[i].name, table[i].len);
+		}
+	}
+}
+
+// ===== Loading =====
+
+static int load_plugin(const char *path) {
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		display_error("ERROR: Cannot load plugin: ", dlerror());
+		return -1;
+	}
+	plugin_init_fn init;
+	// dlsym returns a void *, assign through it as POSIX suggests for functions.
+	*(void **) &init = dlsym(handle, PLUGIN_INIT_SYMBOL);
+	if (init == NULL) {
+		display_error("ERROR: Plugin has no " PLUGIN_INIT_SYMBOL ": ", (char *) path);
+		dlclose(handle);
+		return -1;
+	}
+	void **grown = realloc(handles, sizeof(void *) * (handle_count + 1));
+	if (grown == NULL) {
+		dlclose(handle);
+		return -1;
+	}
+	handles = grown;
+	// keep the handle even if init fails, it may have registered builtins first.
+	handles[handle_count++] = handle;
+	if (init(&API) < 0) {
+		display_error("ERROR: Plugin failed to initialize: ", (char *) path);
+		return -1;
+	}
+	return 0;
+}
+
+int load_plugins(const char *paths) {
+	if (paths == NULL || *paths == '\0') {
+		return 0;
+	}
+	char *list = strdup(paths);
+	if (list == NULL) {
+		return 0;
+	}
+	int loaded = 0;
+	char *save = NULL;
+	for (char *path = strtok_r(list, ":", &save); path != NULL; path = strtok_r(NULL, ":", &save)) {
+		if (load_plugin(path) == 0) {
+			loaded++;
+		}
+	}
+	free(list);
+	return loaded;
+}
+
+void unload_plugins(void) {
+	for (size_t i = 0; i < table_cap; i++) {
+		free(table[i].name);
+	}
+	free(table);
+	table = NULL;
+	table_cap = table_count = 0;
+	for (size_t i = handle_count; i > 0; i--) {
+		dlclose(handles[i - 1]);
+	}
+	free(handles);
+	handles = NULL;
+	handle_count = 0;
+}
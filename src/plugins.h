@@ -0,0 +1,55 @@
+#ifndef __PLUGINS_H__
+#define __PLUGINS_H__
+
+#include <stddef.h>
+#include "builtins.h"
+
+// Bumped whenever plugin_api changes incompatibly.
+#define PLUGIN_API_VERSION 1
+// Symbol every plugin exports; called once right after dlopen.
+#define PLUGIN_INIT_SYMBOL "mysh_plugin_init"
+// Environment variable with the ':' separated plugin paths to load at startup.
+#define PLUGIN_PATH_ENV "MYSH_PLUGINS"
+
+/* What the shell hands a plugin. Plugins print through display_message and
+ * display_error rather than writing to fd 1 themselves, so their output goes
+ * wherever the shell's output goes.
+ */
+typedef struct plugin_api {
+    int version;
+    int (*register_builtin)(const char *name, bn_ptr fn);
+    void (*display_message)(char *str);
+    void (*display_error)(char *pre_str, char *str);
+    char *(*get_var)(char *name);
+} plugin_api;
+
+/* Type of PLUGIN_INIT_SYMBOL.
+ * Return: 0 on success and -1 if the plugin cannot be used.
+ */
+typedef int (*plugin_init_fn)(const plugin_api *api);
+
+/* Add a builtin at runtime. Core builtins cannot be replaced.
+ * Prereq: name is a NULL terminated string, at most MAX_STR_LEN long
+ * Return: 0 on success and -1 on error (taken name, out of memory)
+ */
+int register_builtin(const char *name, bn_ptr fn);
+
+/* Return: handler of the plugin builtin called name, or NULL.
+ */
+bn_ptr plugin_lookup(const char *name, size_t len);
+
+/* Call visit with the name of every plugin builtin.
+ */
+void plugin_visit(name_visit visit, void *ctx);
+
+/* dlopen every plugin in the ':' separated list paths and run its init
+ * function. Plugins that fail are reported and skipped.
+ * Return: number of plugins loaded.
+ */
+int load_plugins(const char *paths);
+
+/* Drop the registered builtins and dlclose the plugins.
+ */
+void unload_plugins(void);
+
+#endif
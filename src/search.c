@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "search.h"
+#include "traverse.h"
+#include "workpool.h"
+#include "lines.h"
+
+// Files with a NULL byte this early on are treated as binary and skipped.
+#define BINARY_PROBE 4096
+
+/* Matches found in one file, collected by a worker until the walk prints them.
+ */
+typedef struct search_file {
+    char *found;
+    size_t len;
+    size_t cap;
+    int err;
+    // set once a worker is through with the file.
+    int done;
+    char path[];
+} search_file;
+
+/* Shared by the walk (which queues and prints the files) and the workers.
+ */
+typedef struct search_ctx {
+    const ls_filter *content;
+    // literal every matching line has to contain, NULL if there is none.
+    const char *literal;
+    size_t literal_len;
+    size_t literal_anchor;
+    // files in walk order; [head, tail) are queued but not printed yet.
+    search_file *window[SEARCH_WINDOW];
+    size_t head;
+    size_t tail;
+    // the walk's worker, which every file is pushed on.
+    task_worker *walker;
+    // the walk sleeps on finished when the oldest file is still being searched.
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int waiting;
+    char *path;
+    int max_depth;
+    const ls_filter *names;
+    out_buffer *out;
+    int errors;
+} search_ctx;
+
+// ===== Matching =====
+
+static int found_append(search_file *f, const char *str, size_t len) {
+	if (f->len + len > f->cap) {
+		size_t cap = f->cap ? f->cap : 4096;
+		while (f->len + len > cap) cap *= 2;
+		char *grown = realloc(f->found, cap);
+		if (grown == NULL) {
+			return -1;
+		}
+		f->found = grown;
+		f->cap = cap;
+	}
+	memcpy(f->found + f->len, str, len);
+	f->len += len;
+	return 0;
+}
+
+static int line_matches(const search_ctx *ctx, const char *line, size_t len) {
+	if (ctx->content->kind != FILTER_REGEX) {
+		// the literal prefilter already found the substring in this line.
+		return 1;
+	}
+	regmatch_t m;
+	m.rm_so = 0;
+	m.rm_eo = len;
+	return regexec(&ctx->content->re, line, 1, &m, REG_STARTEND) == 0;
+}
+
+/*
+ * Scan a whole mapped file. With a literal, memchr on its rarest byte skips
+ * straight to candidate lines and only those reach the full matcher; line
+ * numbers are counted lazily, only up to the lines that match.
+ */
+static void search_buffer(const search_ctx *ctx, search_file *f, const char *map, size_t size) {
+	const char *p = map;
+	const char *end = map + size;
+	const char *counted = map;
+	size_t line_no = 1;
+	while (p < end) {
+		const char *start = p;
+		if (ctx->literal != NULL) {
+			const char *hit = filter_memmem(p, end - p, ctx->literal, ctx->literal_len, ctx->literal_anchor);
+			if (hit == NULL) {
+				return;
+			}
+			const char *nl = memrchr(p, '\n', hit - p);
+			start = nl != NULL ? nl + 1 : p;
+		}
+		const char *stop = memchr(start, '\n', end - start);
+		if (stop == NULL) {
+			stop = end;
+		}
+		if (line_matches(ctx, start, stop - start)) {
+			char num[32];
+			line_no += count_newlines(counted, start - counted);
+			counted = start;
+			int n = snprintf(num, sizeof(num), ":%zu:", line_no);
+			if (found_append(f, f->path, strlen(f->path)) < 0 ||
+			    found_append(f, num, n) < 0 ||
+			    found_append(f, start, stop - start) < 0 ||
+			    found_append(f, "\n", 1) < 0) {
+				f->err = 1;
+				return;
+			}
+		}
+		if (stop == end) {
+			return;
+		}
+		p = stop + 1;
+	}
+}
+
+static void search_one(const search_ctx *ctx, search_file *f) {
+	int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		f->err = 1;
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		f->err = 1;
+		return;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	size_t probe = st.st_size < BINARY_PROBE ? st.st_size : BINARY_PROBE;
+	if (memchr(map, '\0', probe) == NULL) {
+		search_buffer(ctx, f, map, st.st_size);
+	}
+	munmap(map, st.st_size);
+}
+
+// ===== Walking =====
+
+static void finish_file(search_ctx *ctx, search_file *f) {
+	// the walk sets waiting before it checks done, we do the reverse.
+	__atomic_store_n(&f->done, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ctx->waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&ctx->lock);
+		pthread_cond_signal(&ctx->finished);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+}
+
+/*
+ * Print the files at the front of the window that are done, in the order the
+ * walk found them. Only the walk calls this, on the thread that owns the output.
+ */
+static void print_done(search_ctx *ctx) {
+	while (ctx->head < ctx->tail) {
+		search_file *f = ctx->window[ctx->head % SEARCH_WINDOW];
+		if (!__atomic_load_n(&f->done, __ATOMIC_SEQ_CST)) {
+			return;
+		}
+		if (f->err) {
+			out_flush(ctx->out);
+			display_error("ERROR: Cannot search file: ", f->path);
+			ctx->errors++;
+		}
+		if (f->len > 0) {
+			out_append(ctx->out, f->found, f->len);
+		}
+		free(f->found);
+		free(f);
+		ctx->head++;
+	}
+}
+
+/*
+ * Wait for the oldest queued file. Files still on the walk's own deque are
+ * searched right here (there may be no other thread), and only when every
+ * one of them was taken do we sleep until a worker finishes.
+ */
+static void wait_oldest(search_ctx *ctx) {
+	search_file *f = ctx->window[ctx->head % SEARCH_WINDOW];
+	while (!__atomic_load_n(&f->done, __ATOMIC_SEQ_CST)) {
+		if (task_help(ctx->walker)) {
+			continue;
+		}
+		pthread_mutex_lock(&ctx->lock);
+		__atomic_store_n(&ctx->waiting, 1, __ATOMIC_SEQ_CST);
+		while (!__atomic_load_n(&f->done, __ATOMIC_SEQ_CST)) {
+			pthread_cond_wait(&ctx->finished, &ctx->lock);
+		}
+		__atomic_store_n(&ctx->waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+}
+
+/*
+ * Hand path to the workers and keep walking. At most SEARCH_WINDOW files are
+ * in flight, so a walk that outruns the search waits for the oldest one.
+ */
+static void queue_file(search_ctx *ctx, const char *dir, const char *name, size_t len) {
+	size_t size = dir != NULL ? strlen(dir) + len + 2 : len + 1;
+	search_file *f = calloc(1, sizeof(search_file) + size);
+	if (f == NULL) {
+		ctx->errors++;
+		return;
+	}
+	if (dir != NULL) {
+		snprintf(f->path, size, "%s/%.*s", dir, (int) len, name);
+	} else {
+		memcpy(f->path, name, len);
+	}
+	print_done(ctx);
+	if (ctx->tail - ctx->head == SEARCH_WINDOW) {
+		wait_oldest(ctx);
+		print_done(ctx);
+	}
+	ctx->window[ctx->tail++ % SEARCH_WINDOW] = f;
+	if (task_push(ctx->walker, f) < 0) {
+		search_one(ctx, f);
+		f->done = 1;
+	}
+}
+
+static void visit_entry(void *arg, const char *dir, const char *name, size_t len, unsigned char d_type) {
+	search_ctx *ctx = arg;
+	// anything else (directories, devices, links) is not searched.
+	if (d_type != DT_REG && d_type != DT_UNKNOWN) {
+		return;
+	}
+	queue_file(ctx, dir, name, len);
+}
+
+/*
+ * Task handler: the first task (the ctx itself) is the walk, on the calling
+ * thread; every other task is a file, searched on whichever thread takes it.
+ */
+static void search_task(task_worker *w, void *task, void *arg) {
+	search_ctx *ctx = arg;
+	if (task != arg) {
+		search_one(ctx, task);
+		finish_file(ctx, task);
+		return;
+	}
+	ctx->walker = w;
+	struct stat st;
+	if (stat(ctx->path, &st) == 0 && !S_ISDIR(st.st_mode)) {
+		queue_file(ctx, NULL, ctx->path, strlen(ctx->path));
+	} else {
+		ls_options opts = {ctx->names, 0, LS_SORT_NONE, 0, 0, visit_entry, ctx};
+		ctx->errors += traverse_dir_depth(ctx->path, 1, ctx->max_depth, &opts, ctx->out);
+	}
+	while (ctx->head < ctx->tail) {
+		wait_oldest(ctx);
+		print_done(ctx);
+	}
+}
+
+int search_tree(char *path, int max_depth, const ls_filter *names, const ls_filter *content, out_buffer *out) {
+	search_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.content = content;
+	ctx.out = out;
+	if (content->kind == FILTER_SUBSTR) {
+		ctx.literal = content->pattern;
+		ctx.literal_len = content->len;
+		ctx.literal_anchor = content->anchor;
+	} else if (content->required_len > 0) {
+		ctx.literal = content->required;
+		ctx.literal_len = content->required_len;
+		ctx.literal_anchor = content->required_anchor;
+	} else if (content->prefix_len > 0) {
+		ctx.literal = content->prefix;
+		ctx.literal_len = content->prefix_len;
+		ctx.literal_anchor = filter_pick_anchor(content->prefix, content->prefix_len);
+	}
+	ctx.path = path;
+	ctx.max_depth = max_depth;
+	ctx.names = names;
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.finished, NULL);
+	if (task_pool_run(search_task, &ctx, &ctx) < 0) {
+		ctx.errors++;
+	}
+	pthread_cond_destroy(&ctx.finished);
+	pthread_mutex_destroy(&ctx.lock);
+	return ctx.errors;
+}
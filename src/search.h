@@ -0,0 +1,18 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+#include "filter.h"
+#include "io_helpers.h"
+
+// Files the walk may get ahead of the output by.
+#define SEARCH_WINDOW 256
+
+/* Print every line matching content (FILTER_SUBSTR or FILTER_REGEX) as
+ * path:line:text, for path itself if it is a file or for the files under it
+ * (down to max_depth levels) whose names pass the names filter.
+ * Return: 0 on success, or the number of files and directories that could
+ * not be read.
+ */
+int search_tree(char *path, int max_depth, const ls_filter *names, const ls_filter *content, out_buffer *out);
+
+#endif
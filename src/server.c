@@ -0,0 +1,2108 @@
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+
+#include "server.h"
+#include "uring.h"
+
+struct room;
+struct frame;
+struct uring_op;
+
+/* The fields the event loop touches on every read. Clients live in slabs
+ * of CLIENT_SLAB, so a client keeps its address (and its slot number) from
+ * accept to close, and a slot is reused straight after.
+ */
+struct client_sock {
+    // -1 while the slot is free.
+    int sock_fd;
+    int state;
+    int id;
+    // bumped each time the slot is released, so a handle to an earlier
+    // client in the same slot no longer matches.
+    uint32_t gen;
+    uint32_t slot;
+    // position in the live array.
+    uint32_t live_index;
+    // the room broadcasts go to, and the position among its members.
+    struct room *room;
+    uint32_t room_pos;
+    // frames not yet taken by the socket, oldest at out_head, in a ring of
+    // out_cap (a power of 2); out_sent bytes of the oldest are already gone.
+    struct frame **out;
+    uint32_t out_head;
+    uint32_t out_count;
+    uint32_t out_cap;
+    int out_sent;
+    size_t out_bytes;
+    // 1 while not being read from, as a room member has too much queued.
+    int paused;
+    // 1 while on the server's dirty list, to be flushed at the end of the
+    // loop iteration.
+    int dirty;
+    // 1 while registered for EPOLLOUT.
+    int watching;
+    // sends handed to io_uring and not completed yet.
+    int inflight;
+    // 1 once it asked for binary framing; then its input goes to bin, not
+    // in. seq counts the messages it sent.
+    int binary;
+    uint32_t seq;
+    bin_buf bin;
+    net_buf in;
+};
+
+/* What is only looked at now and then, kept apart from the hot fields.
+ */
+typedef struct client_info {
+    // the peer's address, which names the room a client starts in.
+    struct in_addr addr;
+} client_info;
+
+typedef struct client_slab {
+    struct client_sock hot[CLIENT_SLAB];
+    client_info cold[CLIENT_SLAB];
+} client_slab;
+
+/* Every client, by slot. live lists the slots in use (in no particular
+ * order, removal swaps the last one in) and free the ones that are not.
+ */
+typedef struct client_table {
+    client_slab **slabs;
+    size_t slab_count;
+    uint32_t *live;
+    size_t live_count;
+    uint32_t *free;
+    size_t free_count;
+} client_table;
+
+/* The clients a message goes to: those connected from one address, or
+ * those that \join'ed one channel name. A room exists while it has members.
+ */
+typedef struct room {
+    // next in the hash chain.
+    struct room *next;
+    uint32_t hash;
+    // 1 for a channel, 0 for an address room.
+    int named;
+    struct in_addr addr;
+    char name[MAX_ROOM_NAME + 1];
+    // slots of the members, in no particular order.
+    uint32_t *members;
+    size_t count;
+    size_t cap;
+} room;
+
+struct server_group;
+
+/* A broadcast passed on to another shard: the frame, and the key of the
+ * room it is for there.
+ */
+typedef struct shard_msg {
+    struct shard_msg *next;
+    struct frame *f;
+    int named;
+    struct in_addr addr;
+    char name[MAX_ROOM_NAME + 1];
+} shard_msg;
+
+/* Messages for a shard from the others: any shard pushes (swapping itself
+ * in at tail), only the owner pops (from head). stub keeps the list from
+ * ever being empty, so neither side has to lock.
+ */
+typedef struct shard_inbox {
+    shard_msg *head;
+    shard_msg *tail;
+    shard_msg stub;
+} shard_inbox;
+
+/* Everything one event loop works on: a shard of the server, with its own
+ * listener on the shared port, its own clients and its own rooms.
+ */
+typedef struct chat_server {
+    struct server_group *group;
+    struct listen_sock listener;
+    int epoll_fd;
+    client_table clients;
+    // rooms by hash of their key, chained; the bucket count is a power of 2.
+    room **rooms;
+    size_t room_buckets;
+    size_t room_count;
+    server_options opts;
+    // handles of the paused clients, and whether a queue has drained enough
+    // to try them again.
+    uint64_t *paused;
+    size_t paused_count;
+    size_t paused_cap;
+    int resume;
+    // handles of the clients queued to during this loop iteration.
+    uint64_t *dirty;
+    size_t dirty_count;
+    size_t dirty_cap;
+    // broadcasts from the other shards, and an eventfd to wake for them
+    // (written only by whoever sets woken).
+    shard_inbox inbox;
+    int wake_fd;
+    int woken;
+    // the io_uring engine (NULL under epoll): the ring, the provided buffers
+    // recvs pick from and the ring they are handed out through, and spare
+    // recv and send ops.
+    uring *ring;
+    struct io_uring_buf_ring *recv_bufs;
+    char *recv_mem;
+    uint16_t recv_tail;
+    struct uring_op *spare_ops;
+    struct uring_op *spare_sends;
+    // recv completions not yet taken, oldest first at held_head of a ring
+    // of held_cap (a power of 2), and whether a queue they added to is
+    // backed up behind a send still in flight.
+    struct held_cqe *held;
+    size_t held_head;
+    size_t held_count;
+    size_t held_cap;
+    int backed_up;
+    // a descriptor held in reserve so a full table can still accept (and
+    // refuse) a connection, and whether accepting waits for a client to leave.
+    int spare_fd;
+    int accept_paused;
+} chat_server;
+
+/* What the shards share.
+ */
+typedef struct server_group {
+    chat_server *shards;
+    int count;
+    // clients on all shards, and the id the next one gets.
+    size_t live_total;
+    int next_id;
+} server_group;
+
+// epoll data for a shard's eventfd: no client handle has every bit set.
+#define WAKE_HANDLE UINT64_MAX
+
+/* A message as it goes out on the wire: a line, network newline (CRLF)
+ * included, or a binary frame, header included. It is built once and every
+ * recipient is sent the same bytes; the last holder to let go frees it.
+ */
+typedef struct frame {
+    int refs;
+    int len;
+    // 1 for a binary frame.
+    int binary;
+    // who it is from (0 for the server itself), their sequence number, and
+    // where the message itself is in data.
+    int sender;
+    uint32_t seq;
+    int body;
+    int body_len;
+    // the frame whose count this one shares: itself, or the frame it is the
+    // other framing of.
+    struct frame *base;
+    // the same message in the other framing, made the first time a client
+    // that takes it is sent it.
+    struct frame *alt;
+    char data[];
+} frame;
+
+static frame *frame_alloc(size_t cap) {
+    frame *f = malloc(sizeof(frame) + cap);
+    if (f == NULL) {
+        return NULL;
+    }
+    f->refs = 1;
+    f->binary = f->sender = f->body = 0;
+    f->seq = 0;
+    f->base = f;
+    f->alt = NULL;
+    return f;
+}
+
+/*
+ * Format a new line from the server, with one reference, as printf would.
+ * Return NULL if the result would not fit a client's buffer or on out of
+ * memory.
+ */
+static frame *frame_new(const char *format, ...) {
+    // room for the widest id and the CRLF on top of a full buffer.
+    size_t cap = BUF_SIZE + 24;
+    frame *f = frame_alloc(cap);
+    if (f == NULL) {
+        return NULL;
+    }
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(f->data, cap, format, args);
+    va_end(args);
+    if (len < 0 || len + 2 > BUF_SIZE) {
+        display_error("Error: Message too long to send to client", "");
+        free(f);
+        return NULL;
+    }
+    f->data[len] = '\r';
+    f->data[len + 1] = '\n';
+    f->len = len + 2;
+    f->body_len = len;
+    return f;
+}
+
+/*
+ * The line "client<sender>: text", as frame_new.
+ */
+static frame *frame_text(int sender, uint32_t seq, const char *text, int len) {
+    frame *f = frame_new("client%d: %.*s", sender, len, text);
+    if (f != NULL) {
+        f->sender = sender;
+        f->seq = seq;
+        f->body = f->len - 2 - len;
+        f->body_len = len;
+    }
+    return f;
+}
+
+/*
+ * A binary frame of len bytes of payload, with one reference.
+ * Return NULL on out of memory.
+ */
+static frame *frame_bin(int sender, uint32_t seq, const char *payload, uint32_t len) {
+    frame *f = frame_alloc(BIN_HEADER + (size_t) len);
+    if (f == NULL) {
+        return NULL;
+    }
+    put_bin_header(f->data, len, sender, seq);
+    memcpy(f->data + BIN_HEADER, payload, len);
+    f->len = BIN_HEADER + len;
+    f->binary = 1;
+    f->sender = sender;
+    f->seq = seq;
+    f->body = BIN_HEADER;
+    f->body_len = len;
+    return f;
+}
+
+/*
+ * How much of text goes into a line: up to MAX_USER_MSG bytes, and none of
+ * a newline (which would end it early) or what follows.
+ */
+static int line_length(const char *text, int len) {
+    int n = 0;
+    while (n < len && n < MAX_USER_MSG && text[n] != '\r' && text[n] != '\n' && text[n] != '\0') {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * f in the framing binary asks for, made from f if it wasn't yet.
+ * Return NULL on out of memory (or a line too long to be sent).
+ */
+static frame *frame_as(frame *f, int binary) {
+    f = f->base;
+    if (f->binary == binary) {
+        return f;
+    }
+    // frames are shared between shards: whoever makes it first wins.
+    frame *alt = __atomic_load_n(&f->alt, __ATOMIC_ACQUIRE);
+    if (alt != NULL) {
+        return alt;
+    }
+    const char *body = f->data + f->body;
+    if (binary) {
+        alt = frame_bin(f->sender, f->seq, body, f->body_len);
+    } else if (f->sender != 0) {
+        alt = frame_text(f->sender, f->seq, body, line_length(body, f->body_len));
+    } else {
+        alt = frame_new("%.*s", line_length(body, f->body_len), body);
+    }
+    if (alt == NULL) {
+        return NULL;
+    }
+    alt->base = f;
+    frame *expected = NULL;
+    if (!__atomic_compare_exchange_n(&f->alt, &expected, alt, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(alt);
+        return expected;
+    }
+    return alt;
+}
+
+// frames are shared between shards, so the count is atomic.
+static frame *frame_hold(frame *f) {
+    __atomic_fetch_add(&f->base->refs, 1, __ATOMIC_RELAXED);
+    return f;
+}
+
+static void frame_release(frame *f) {
+    if (f == NULL) {
+        return;
+    }
+    f = f->base;
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(f->alt);
+        free(f);
+    }
+}
+
+// ===== Client table =====
+
+static struct client_sock *client_at(client_table *t, uint32_t slot) {
+    return &t->slabs[slot / CLIENT_SLAB]->hot[slot % CLIENT_SLAB];
+}
+
+static client_info *client_info_at(client_table *t, uint32_t slot) {
+    return &t->slabs[slot / CLIENT_SLAB]->cold[slot % CLIENT_SLAB];
+}
+
+/*
+ * Add a slab of free slots, numbered so the lowest is handed out first.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int table_grow(client_table *t) {
+    size_t count = t->slab_count + 1;
+    client_slab **slabs = realloc(t->slabs, sizeof(client_slab *) * count);
+    if (slabs == NULL) {
+        return -1;
+    }
+    t->slabs = slabs;
+    uint32_t *live = realloc(t->live, sizeof(uint32_t) * count * CLIENT_SLAB);
+    if (live != NULL) {
+        t->live = live;
+    }
+    uint32_t *free_slots = realloc(t->free, sizeof(uint32_t) * count * CLIENT_SLAB);
+    if (free_slots != NULL) {
+        t->free = free_slots;
+    }
+    client_slab *slab = malloc(sizeof(client_slab));
+    if (live == NULL || free_slots == NULL || slab == NULL) {
+        free(slab);
+        return -1;
+    }
+    slabs[t->slab_count] = slab;
+    uint32_t base = t->slab_count * CLIENT_SLAB;
+    for (uint32_t i = CLIENT_SLAB; i-- > 0;) {
+        slab->hot[i].sock_fd = -1;
+        slab->hot[i].gen = 0;
+        slab->hot[i].slot = base + i;
+        t->free[t->free_count++] = base + i;
+    }
+    t->slab_count = count;
+    return 0;
+}
+
+/*
+ * Return a free client slot, now live, or NULL on out of memory.
+ */
+static struct client_sock *client_alloc(client_table *t) {
+    if (t->free_count == 0 && table_grow(t) < 0) {
+        return NULL;
+    }
+    uint32_t slot = t->free[--t->free_count];
+    struct client_sock *c = client_at(t, slot);
+    c->live_index = t->live_count;
+    t->live[t->live_count++] = slot;
+    return c;
+}
+
+static void client_release(client_table *t, struct client_sock *c) {
+    uint32_t last = t->live[--t->live_count];
+    t->live[c->live_index] = last;
+    client_at(t, last)->live_index = c->live_index;
+    c->sock_fd = -1;
+    c->gen++;
+    t->free[t->free_count++] = c->slot;
+}
+
+static void table_free(client_table *t) {
+    for (size_t i = 0; i < t->slab_count; i++) {
+        free(t->slabs[i]);
+    }
+    free(t->slabs);
+    free(t->live);
+    free(t->free);
+    memset(t, 0, sizeof(*t));
+}
+
+/* epoll data for a client: its slot (plus one, as 0 is the listener) and
+ * the slot's generation, so an event left over from a client that has since
+ * been dropped is recognised even if a new client took its slot.
+ */
+static uint64_t client_handle(const struct client_sock *c) {
+    return (uint64_t) c->gen << 32 | (c->slot + 1);
+}
+
+static struct client_sock *client_from_handle(client_table *t, uint64_t handle) {
+    struct client_sock *c = client_at(t, (uint32_t) handle - 1);
+    return c->gen == handle >> 32 && c->sock_fd >= 0 ? c : NULL;
+}
+
+// ===== Output =====
+
+/*
+ * Watch c for room in its send buffer only while the socket is full.
+ */
+static void watch_output(chat_server *srv, struct client_sock *c, int want) {
+    if (c->watching == want) {
+        return;
+    }
+    c->watching = want;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (want ? EPOLLOUT : 0);
+    ev.data.u64 = client_handle(c);
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, c->sock_fd, &ev);
+}
+
+static void out_clear(struct client_sock *c) {
+    for (uint32_t i = 0; i < c->out_count; i++) {
+        frame_release(c->out[(c->out_head + i) & (c->out_cap - 1)]);
+    }
+    free(c->out);
+    c->out = NULL;
+    c->out_head = c->out_count = c->out_cap = 0;
+    c->out_sent = 0;
+    c->out_bytes = 0;
+}
+
+/*
+ * Put f at the end of c's queue.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int out_push(struct client_sock *c, frame *f) {
+    if (c->out_count == c->out_cap) {
+        uint32_t cap = c->out_cap ? c->out_cap * 2 : 16;
+        frame **out = malloc(sizeof(frame *) * cap);
+        if (out == NULL) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < c->out_count; i++) {
+            out[i] = c->out[(c->out_head + i) & (c->out_cap - 1)];
+        }
+        free(c->out);
+        c->out = out;
+        c->out_head = 0;
+        c->out_cap = cap;
+    }
+    c->out[(c->out_head + c->out_count++) & (c->out_cap - 1)] = frame_hold(f);
+    c->out_bytes += f->len;
+    return 0;
+}
+
+/*
+ * Make room for len more bytes in c's queue by dropping its oldest frames.
+ * One the socket has taken part of stays, or the client would see half a
+ * message: the frame behind it goes instead.
+ */
+static void out_drop_oldest(struct client_sock *c, size_t len, size_t high_water) {
+    while (c->out_count > 0 && c->out_bytes + len > high_water) {
+        uint32_t mask = c->out_cap - 1;
+        if (c->out_sent == 0) {
+            frame *f = c->out[c->out_head];
+            c->out_bytes -= f->len;
+            frame_release(f);
+            c->out_head = (c->out_head + 1) & mask;
+            c->out_count--;
+        } else if (c->out_count > 1) {
+            uint32_t next = (c->out_head + 1) & mask;
+            c->out_bytes -= c->out[next]->len;
+            frame_release(c->out[next]);
+            c->out[next] = c->out[c->out_head];
+            c->out_head = next;
+            c->out_count--;
+        } else {
+            return;
+        }
+    }
+}
+
+static void pause_client(chat_server *srv, struct client_sock *c) {
+    if (c->paused) {
+        return;
+    }
+    if (srv->paused_count == srv->paused_cap) {
+        size_t cap = srv->paused_cap ? srv->paused_cap * 2 : 64;
+        uint64_t *paused = realloc(srv->paused, sizeof(uint64_t) * cap);
+        if (paused == NULL) {
+            // can't remember it to resume it: carry on reading instead.
+            return;
+        }
+        srv->paused = paused;
+        srv->paused_cap = cap;
+    }
+    srv->paused[srv->paused_count++] = client_handle(c);
+    c->paused = 1;
+}
+
+/*
+ * Send as much of c's queue as the socket takes, up to SERVER_IOV frames a
+ * call, and watch for room to send the rest.
+ * Return 0 on success and 2 on client disconnect.
+ */
+static int flush_client(chat_server *srv, struct client_sock *c) {
+    struct iovec iov[SERVER_IOV];
+    while (c->out_count > 0) {
+        uint32_t mask = c->out_cap - 1;
+        size_t total = 0;
+        int n_iov = 0;
+        for (uint32_t i = 0; i < c->out_count && n_iov < SERVER_IOV; i++) {
+            frame *f = c->out[(c->out_head + i) & mask];
+            int skip = i == 0 ? c->out_sent : 0;
+            iov[n_iov].iov_base = f->data + skip;
+            iov[n_iov].iov_len = f->len - skip;
+            total += iov[n_iov++].iov_len;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n_iov;
+        // more frames behind this batch: don't push out a short segment.
+        int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (c->out_count > (uint32_t) n_iov ? MSG_MORE : 0);
+        ssize_t n = sendmsg(c->sock_fd, &msg, flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return 2;
+        }
+        c->out_bytes -= n;
+        for (size_t left = n; left > 0;) {
+            frame *f = c->out[c->out_head];
+            size_t rest = f->len - c->out_sent;
+            if (left < rest) {
+                c->out_sent += left;
+                break;
+            }
+            left -= rest;
+            frame_release(f);
+            c->out_head = (c->out_head + 1) & mask;
+            c->out_count--;
+            c->out_sent = 0;
+        }
+        if ((size_t) n < total) {
+            // the socket is full.
+            break;
+        }
+    }
+    watch_output(srv, c, c->out_count > 0);
+    if (srv->paused_count > 0 && c->out_bytes <= SERVER_HIGH_WATER / 2) {
+        srv->resume = 1;
+    }
+    return 0;
+}
+
+static int uring_flush(chat_server *srv, struct client_sock *c);
+
+/*
+ * Start sending c's queue, by whichever engine the shard runs.
+ * Return 0 on success and 2 on client disconnect.
+ */
+static int flush_out(chat_server *srv, struct client_sock *c) {
+    return srv->ring != NULL ? uring_flush(srv, c) : flush_client(srv, c);
+}
+
+/*
+ * Queue f for c. It goes out when the loop iteration ends, together with
+ * whatever else c is sent meanwhile (or straight away once SERVER_FLUSH_BYTES
+ * have built up). Past SERVER_HIGH_WATER queued bytes the server's overflow
+ * policy decides between dropping c's oldest frames, dropping c, or pausing
+ * sender (past twice the mark c is dropped regardless).
+ *
+ * On success, return 0.
+ * On client disconnect (or a client to be dropped), return 2.
+ */
+static int send_frame(chat_server *srv, struct client_sock *c, frame *f, struct client_sock *sender) {
+    f = frame_as(f, c->binary);
+    if (f == NULL) {
+        return 0;
+    }
+    // room for a couple of the largest frames, in binary framing.
+    size_t high_water = SERVER_HIGH_WATER;
+    if (c->binary && high_water < 2 * (BIN_HEADER + (size_t) srv->opts.max_frame)) {
+        high_water = 2 * (BIN_HEADER + (size_t) srv->opts.max_frame);
+    }
+    if (c->out_bytes + f->len > high_water) {
+        switch (srv->opts.overflow) {
+        case OVERFLOW_DROP_OLDEST:
+            out_drop_oldest(c, f->len, high_water);
+            break;
+        case OVERFLOW_DISCONNECT:
+            return 2;
+        case OVERFLOW_PAUSE:
+            if (c->out_bytes + f->len > 2 * high_water) {
+                return 2;
+            }
+            if (sender != NULL) {
+                pause_client(srv, sender);
+            }
+            break;
+        }
+    }
+    if (out_push(c, f) < 0) {
+        return 2;
+    }
+    if (!c->dirty) {
+        if (srv->dirty_count == srv->dirty_cap) {
+            size_t cap = srv->dirty_cap ? srv->dirty_cap * 2 : 256;
+            uint64_t *dirty = realloc(srv->dirty, sizeof(uint64_t) * cap);
+            if (dirty == NULL) {
+                // no list to flush it from: send now.
+                return flush_out(srv, c);
+            }
+            srv->dirty = dirty;
+            srv->dirty_cap = cap;
+        }
+        srv->dirty[srv->dirty_count++] = client_handle(c);
+        c->dirty = 1;
+    }
+    if (c->out_bytes >= SERVER_FLUSH_BYTES && !c->watching && c->inflight == 0) {
+        return flush_out(srv, c);
+    }
+    if (c->out_bytes >= SERVER_FLUSH_BYTES && c->inflight > 0) {
+        // io_uring: its last chain has to be reaped before it can go.
+        srv->backed_up = 1;
+    }
+    return 0;
+}
+
+// ===== Rooms =====
+
+static uint32_t room_hash(int named, struct in_addr addr, const char *name) {
+    // FNV-1a over the kind and then the address or the name.
+    uint32_t h = 2166136261u ^ (uint32_t) named;
+    h *= 16777619u;
+    const unsigned char *key = named ? (const unsigned char *) name : (const unsigned char *) &addr;
+    size_t len = named ? strlen(name) : sizeof(addr);
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ key[i]) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Double the bucket count (or make the first 64) and rehash.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int rooms_grow(chat_server *srv) {
+    size_t buckets = srv->room_buckets ? srv->room_buckets * 2 : 64;
+    room **table = calloc(buckets, sizeof(room *));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < srv->room_buckets; i++) {
+        room *r = srv->rooms[i];
+        while (r != NULL) {
+            room *next = r->next;
+            r->next = table[r->hash & (buckets - 1)];
+            table[r->hash & (buckets - 1)] = r;
+            r = next;
+        }
+    }
+    free(srv->rooms);
+    srv->rooms = table;
+    srv->room_buckets = buckets;
+    return 0;
+}
+
+/*
+ * Return the channel called name or, if named is 0, the room of addr, or
+ * NULL if it has no members on this shard.
+ */
+static room *room_find(chat_server *srv, uint32_t h, int named, struct in_addr addr, const char *name) {
+    for (room *r = srv->room_buckets ? srv->rooms[h & (srv->room_buckets - 1)] : NULL; r != NULL; r = r->next) {
+        if (r->hash == h && r->named == named &&
+            (named ? strcmp(r->name, name) == 0 : r->addr.s_addr == addr.s_addr)) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Find the room as room_find does, and make it if there is none yet.
+ * Return the room, or NULL on out of memory.
+ */
+static room *room_get(chat_server *srv, int named, struct in_addr addr, const char *name) {
+    uint32_t h = room_hash(named, addr, name);
+    room *found = room_find(srv, h, named, addr, name);
+    if (found != NULL) {
+        return found;
+    }
+    if (srv->room_count >= srv->room_buckets && rooms_grow(srv) < 0) {
+        return NULL;
+    }
+    room *r = calloc(1, sizeof(room));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->hash = h;
+    r->named = named;
+    r->addr = addr;
+    if (named) {
+        strncpy(r->name, name, MAX_ROOM_NAME);
+    }
+    r->next = srv->rooms[h & (srv->room_buckets - 1)];
+    srv->rooms[h & (srv->room_buckets - 1)] = r;
+    srv->room_count++;
+    return r;
+}
+
+/*
+ * Take c out of its room, and drop the room if that leaves it empty.
+ */
+static void room_leave(chat_server *srv, struct client_sock *c) {
+    room *r = c->room;
+    if (r == NULL) {
+        return;
+    }
+    c->room = NULL;
+    uint32_t last = r->members[--r->count];
+    r->members[c->room_pos] = last;
+    client_at(&srv->clients, last)->room_pos = c->room_pos;
+    if (r->count > 0) {
+        return;
+    }
+    room **link = &srv->rooms[r->hash & (srv->room_buckets - 1)];
+    while (*link != r) {
+        link = &(*link)->next;
+    }
+    *link = r->next;
+    srv->room_count--;
+    free(r->members);
+    free(r);
+}
+
+/*
+ * Move c into r.
+ * Return 0 on success and -1 on out of memory (c is then in no room).
+ */
+static int room_enter(chat_server *srv, struct client_sock *c, room *r) {
+    if (c->room == r) {
+        return 0;
+    }
+    // r can't go away here: it has at least one other member or was made
+    // for c, and c is not in it yet.
+    room_leave(srv, c);
+    if (r->count == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 8;
+        uint32_t *members = realloc(r->members, sizeof(uint32_t) * cap);
+        if (members == NULL) {
+            return -1;
+        }
+        r->members = members;
+        r->cap = cap;
+    }
+    c->room = r;
+    c->room_pos = r->count;
+    r->members[r->count++] = c->slot;
+    return 0;
+}
+
+static void rooms_free(chat_server *srv) {
+    for (size_t i = 0; i < srv->room_buckets; i++) {
+        while (srv->rooms[i] != NULL) {
+            room *r = srv->rooms[i];
+            srv->rooms[i] = r->next;
+            free(r->members);
+            free(r);
+        }
+    }
+    free(srv->rooms);
+    srv->rooms = NULL;
+    srv->room_buckets = srv->room_count = 0;
+}
+
+/*
+ * Take c out of its room, the epoll set and the table, and close it.
+ */
+static void resume_accepting(chat_server *srv);
+
+static void drop_client(chat_server *srv, struct client_sock *c) {
+    if (c->sock_fd < 0) {
+        return;
+    }
+    room_leave(srv, c);
+    if (c->out_count > 0 && srv->paused_count > 0) {
+        // whoever it held up may go on.
+        srv->resume = 1;
+    }
+    out_clear(c);
+    bin_buf_free(&c->bin);
+    int inflight = c->inflight;
+    c->paused = c->dirty = c->watching = c->inflight = 0;
+    if (srv->ring != NULL) {
+        // ends its recv, and any sends still in flight, which let go of
+        // their frames as they complete. Sends not yet submitted name the
+        // descriptor by number, so they go before it can be reused.
+        shutdown(c->sock_fd, SHUT_RDWR);
+        if (inflight > 0) {
+            uring_submit(srv->ring, 0);
+        }
+    } else {
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->sock_fd, NULL);
+    }
+    close(c->sock_fd);
+    client_release(&srv->clients, c);
+    __atomic_fetch_sub(&srv->group->live_total, 1, __ATOMIC_RELAXED);
+    if (srv->accept_paused) {
+        resume_accepting(srv);
+    }
+}
+
+// ===== Event loop =====
+
+/*
+ * Let the process hold MAX_CONNECTIONS sockets, as far as the hard limit
+ * on open files allows.
+ */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    rlim_t want = MAX_CONNECTIONS + SERVER_SPARE_FDS;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur >= want) {
+        return;
+    }
+    rl.rlim_cur = rl.rlim_max != RLIM_INFINITY && rl.rlim_max < want ? rl.rlim_max : want;
+    setrlimit(RLIMIT_NOFILE, &rl);
+}
+
+static int uring_arm_recv(chat_server *srv, struct client_sock *c);
+
+/*
+ * Give the connection on client_fd, from addr, a slot and start reading
+ * from it: under epoll by watching it (edge triggered) under the slot's
+ * handle, under io_uring with a multishot recv.
+ * Return client_fd, or -1 if the connection was refused.
+ */
+static int add_client(chat_server *srv, int client_fd, struct in_addr addr) {
+    // count it in first, so shards accepting at once can't overshoot.
+    struct client_sock *newclient = NULL;
+    if (__atomic_add_fetch(&srv->group->live_total, 1, __ATOMIC_RELAXED) > MAX_CONNECTIONS ||
+        (newclient = client_alloc(&srv->clients)) == NULL) {
+        __atomic_fetch_sub(&srv->group->live_total, 1, __ATOMIC_RELAXED);
+        close(client_fd);
+        return -1;
+    }
+    newclient->sock_fd = client_fd;
+    newclient->in.start = newclient->in.len = newclient->state = 0;
+    newclient->binary = 0;
+    newclient->seq = 0;
+    memset(&newclient->bin, 0, sizeof(newclient->bin));
+    newclient->id = __atomic_fetch_add(&srv->group->next_id, 1, __ATOMIC_RELAXED);
+    newclient->room = NULL;
+    newclient->out = NULL;
+    newclient->out_head = newclient->out_count = newclient->out_cap = 0;
+    newclient->out_sent = 0;
+    newclient->out_bytes = 0;
+    newclient->paused = newclient->dirty = newclient->watching = newclient->inflight = 0;
+    // clients start out talking to everyone else from the same address.
+    client_info_at(&srv->clients, newclient->slot)->addr = addr;
+    room *r = room_get(srv, 0, addr, NULL);
+    if (r == NULL || room_enter(srv, newclient, r) < 0) {
+        __atomic_fetch_sub(&srv->group->live_total, 1, __ATOMIC_RELAXED);
+        close(client_fd);
+        client_release(&srv->clients, newclient);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = client_handle(newclient);
+    if (srv->ring != NULL ? uring_arm_recv(srv, newclient) < 0 :
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+        perror("server: watch client");
+        __atomic_fetch_sub(&srv->group->live_total, 1, __ATOMIC_RELAXED);
+        close(client_fd);
+        room_leave(srv, newclient);
+        client_release(&srv->clients, newclient);
+        return -1;
+    }
+    return client_fd;
+}
+
+/*
+ * The descriptor table is full (EMFILE or ENFILE) while a connection is
+ * pending, and the listener stays readable until it is taken. Give up the
+ * spare descriptor to accept the connection and close it right away. Without
+ * a spare, stop watching the listener until a client leaves.
+ * Return 1 if a connection was refused, 0 if none was pending and -1 if
+ * accepting is paused.
+ */
+static int refuse_connection(chat_server *srv) {
+    if (srv->spare_fd >= 0) {
+        close(srv->spare_fd);
+        int fd = accept4(srv->listener.sock_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd >= 0) {
+            close(fd);
+        }
+        srv->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        return fd >= 0;
+    }
+    srv->accept_paused = 1;
+    if (srv->ring == NULL) {
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, srv->listener.sock_fd, NULL);
+    }
+    // under io_uring the accept is simply not armed again.
+    return -1;
+}
+
+/*
+ * Accept one pending connection and add it.
+ * Return the new client's fd, or -1 once nothing is pending or on error.
+ */
+static int accept_connection(chat_server *srv) {
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    peer.sin_family = AF_INET;
+
+    int client_fd = accept4(srv->listener.sock_fd, (struct sockaddr *)&peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+        if (errno == EMFILE || errno == ENFILE) {
+            refuse_connection(srv);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+            perror("server: accept");
+        }
+        return -1;
+    }
+    return add_client(srv, client_fd, peer.sin_addr);
+}
+
+/*
+ * Send f to every member of r on this shard.
+ */
+static void deliver(chat_server *srv, room *r, frame *f, struct client_sock *sender) {
+    // backwards, as dropping a member moves the last one into its place (and
+    // the room only goes once its last member, at 0, is dropped).
+    for (size_t k = r->count; k-- > 0;) {
+        struct client_sock *dest_c = client_at(&srv->clients, r->members[k]);
+        if (send_frame(srv, dest_c, f, sender) == 2) {
+            drop_client(srv, dest_c);
+        }
+    }
+}
+
+// ===== Shards =====
+
+static void inbox_init(shard_inbox *q) {
+    q->stub.next = NULL;
+    q->head = q->tail = &q->stub;
+}
+
+static void inbox_push(shard_inbox *q, shard_msg *m) {
+    __atomic_store_n(&m->next, NULL, __ATOMIC_RELAXED);
+    shard_msg *prev = __atomic_exchange_n(&q->tail, m, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, m, __ATOMIC_RELEASE);
+}
+
+/*
+ * Return the oldest message in q, or NULL if there is none or the one
+ * after it is still being pushed (its producer wakes the shard again).
+ */
+static shard_msg *inbox_pop(shard_inbox *q) {
+    shard_msg *head = q->head;
+    shard_msg *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (head == &q->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        q->head = head = next;
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    }
+    if (next == NULL) {
+        // head is the last one: put the stub behind it before taking it.
+        if (head != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+        inbox_push(q, &q->stub);
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+        if (next == NULL) {
+            return NULL;
+        }
+    }
+    q->head = next;
+    return head;
+}
+
+/*
+ * Pass f on to every other shard, for their members of r. Each shard gets
+ * a shard's messages in the order they were sent.
+ */
+static void forward(chat_server *srv, room *r, frame *f) {
+    server_group *group = srv->group;
+    for (int i = 0; i < group->count; i++) {
+        chat_server *dst = &group->shards[i];
+        if (dst == srv) {
+            continue;
+        }
+        shard_msg *m = malloc(sizeof(shard_msg));
+        if (m == NULL) {
+            perror("malloc");
+            continue;
+        }
+        m->f = frame_hold(f);
+        m->named = r->named;
+        m->addr = r->addr;
+        memcpy(m->name, r->name, sizeof(m->name));
+        inbox_push(&dst->inbox, m);
+        if (!__atomic_exchange_n(&dst->woken, 1, __ATOMIC_SEQ_CST)) {
+            uint64_t one = 1;
+            if (write(dst->wake_fd, &one, sizeof(one)) < 0) {
+                perror("server: eventfd");
+            }
+        }
+    }
+}
+
+/*
+ * Deliver what the other shards have forwarded since the last wakeup.
+ */
+static void take_forwarded(chat_server *srv) {
+    uint64_t count;
+    if (read(srv->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("server: eventfd");
+    }
+    // from here on a new message wakes us again.
+    __atomic_store_n(&srv->woken, 0, __ATOMIC_SEQ_CST);
+    shard_msg *m;
+    while ((m = inbox_pop(&srv->inbox)) != NULL) {
+        room *r = room_find(srv, room_hash(m->named, m->addr, m->name), m->named, m->addr, m->name);
+        if (r != NULL) {
+            deliver(srv, r, m->f, NULL);
+        }
+        frame_release(m->f);
+        free(m);
+    }
+}
+
+/*
+ * Send text (len bytes), with the sender's id, to every member of the
+ * sender's room (the sender included), on every shard. It goes out as a
+ * line or a binary frame, as each member takes them.
+ */
+static void broadcast(chat_server *srv, struct client_sock *sender, const char *text, int len) {
+    // Write the message to the server console, in the format client#: message
+    char write_buf[BUF_SIZE + 20];
+    snprintf(write_buf, sizeof(write_buf), "client%d: %.*s\n", sender->id, line_length(text, len), text);
+    display_message(write_buf);
+    room *r = sender->room;
+    if (r == NULL) {
+        return;
+    }
+    sender->seq++;
+    frame *f = sender->binary ? frame_bin(sender->id, sender->seq, text, len) :
+                                frame_text(sender->id, sender->seq, text, len);
+    if (f == NULL) {
+        return;
+    }
+    // first, while r is sure to be there.
+    if (srv->group->count > 1) {
+        forward(srv, r, f);
+    }
+    deliver(srv, r, f, sender);
+    frame_release(f);
+}
+
+/*
+ * Handle "\join name": move c to the channel name or, without a name, back
+ * to the room of its address, and tell it which one it is in now.
+ */
+static void join_room(chat_server *srv, struct client_sock *c, const char *args) {
+    while (*args == ' ') {
+        args++;
+    }
+    frame *f;
+    if (strlen(args) > MAX_ROOM_NAME) {
+        f = frame_new("Channel names are at most %d characters", MAX_ROOM_NAME);
+    } else {
+        struct in_addr addr = client_info_at(&srv->clients, c->slot)->addr;
+        room *r = room_get(srv, *args != '\0', addr, args);
+        if (r == NULL || room_enter(srv, c, r) < 0) {
+            display_error("ERROR: out of memory joining a room", "");
+            drop_client(srv, c);
+            return;
+        }
+        char addr_name[INET_ADDRSTRLEN];
+        f = frame_new("Joined %s", r->named ? r->name : inet_ntop(AF_INET, &addr, addr_name, sizeof(addr_name)));
+    }
+    if (f != NULL && send_frame(srv, c, f, c) == 2) {
+        drop_client(srv, c);
+    }
+    frame_release(f);
+}
+
+/*
+ * Switch c to binary framing (see commands.h), answering it in the last
+ * line it is sent. Already switched, it is only answered.
+ */
+static void use_binary(chat_server *srv, struct client_sock *c) {
+    frame *f = frame_new("\\binary %u", srv->opts.max_frame);
+    if (f == NULL || send_frame(srv, c, f, c) == 2 ||
+        (!c->binary && bin_buf_init(&c->bin, srv->opts.max_frame, &c->in) < 0)) {
+        frame_release(f);
+        drop_client(srv, c);
+        return;
+    }
+    frame_release(f);
+    c->binary = 1;
+}
+
+/*
+ * Act on msg if it is one of the server's commands.
+ * Return 1 if it was, and 0 if it is a message to pass on.
+ */
+static int take_command(chat_server *srv, struct client_sock *curr, char *msg) {
+    // check if the command run was the \\connected command.
+    if (strncmp(msg, "\\connected", 10) == 0) {
+        // write it to the client that sent the message, and no one else.
+        frame *f = frame_new("Connected clients: %zu", __atomic_load_n(&srv->group->live_total, __ATOMIC_RELAXED));
+        if (f != NULL && send_frame(srv, curr, f, curr) == 2) {
+            drop_client(srv, curr);
+        }
+        frame_release(f);
+        return 1;
+    }
+    if (strncmp(msg, "\\join", 5) == 0 && (msg[5] == '\0' || msg[5] == ' ')) {
+        join_room(srv, curr, msg + 5);
+        return 1;
+    }
+    if (strcmp(msg, "\\binary") == 0) {
+        use_binary(srv, curr);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Handle the complete frames in curr's buffer, until there are none left
+ * or curr is dropped or paused. Each payload is passed on from where it was
+ * read; only one short enough to be a command is copied, to end it.
+ */
+static void take_frames(chat_server *srv, struct client_sock *curr) {
+    bin_msg msg;
+    int got;
+    while (curr->sock_fd >= 0 && !curr->paused && (got = get_frame(&curr->bin, &msg)) != 0) {
+        if (got < 0) {
+            display_error("ERROR: Frame too large", "");
+            drop_client(srv, curr);
+            return;
+        }
+        if (msg.len > 0 && msg.len <= MAX_USER_MSG && msg.payload[0] == '\\') {
+            char command[MAX_USER_MSG + 1];
+            memcpy(command, msg.payload, msg.len);
+            command[msg.len] = '\0';
+            if (take_command(srv, curr, command)) {
+                continue;
+            }
+        }
+        broadcast(srv, curr, msg.payload, msg.len);
+    }
+}
+
+/*
+ * Handle the complete messages in curr's buffer, until there are none
+ * left or curr is dropped or paused.
+ */
+static void take_messages(chat_server *srv, struct client_sock *curr) {
+    if (curr->binary) {
+        take_frames(srv, curr);
+        return;
+    }
+    net_msg msgs[NET_BATCH];
+    int n = 0;
+    int i = 0;
+    // Loop through buffer to get complete message(s), a batch at a time
+    while (curr->sock_fd >= 0 && !curr->paused) {
+        if (i == n) {
+            n = get_messages(&curr->in, msgs, NET_BATCH);
+            i = 0;
+            if (n == 0) {
+                return;
+            }
+        }
+        char *msg = msgs[i++].text;
+        if (strcmp(msg, "\\binary") == 0) {
+            // what came after it is in frames.
+            unget_messages(&curr->in, msgs + i, n - i);
+            use_binary(srv, curr);
+            take_frames(srv, curr);
+            return;
+        }
+        if (!take_command(srv, curr, msg)) {
+            broadcast(srv, curr, msg, strlen(msg));
+        }
+    }
+    // paused: what is left of the batch waits in the buffer.
+    if (curr->sock_fd >= 0) {
+        unget_messages(&curr->in, msgs + i, n - i);
+    }
+}
+
+/*
+ * Act on what a read into curr's buffer returned (as read_from_socket, or
+ * read_frames in binary framing).
+ */
+static void take_read(chat_server *srv, struct client_sock *curr, int client_closed) {
+    if (client_closed == 2) {
+        // no network newline yet: pass on what came as a message of its own.
+        char text[MAX_USER_MSG + 2];
+        int len = curr->in.len < MAX_USER_MSG ? curr->in.len : MAX_USER_MSG;
+        memcpy(text, curr->in.data + curr->in.start, len);
+        text[len] = '\n';
+        text[len + 1] = '\0';
+        broadcast(srv, curr, text, len + 1);
+        // Clear the buffer for the client
+        curr->in.start = curr->in.len = 0;
+    } else if (client_closed == -1 || client_closed == 1) {
+        // If error encountered when receiving data, or the client left.
+        drop_client(srv, curr);
+    }
+}
+
+/*
+ * Handle everything curr sent since the last wakeup. The socket is edge
+ * triggered, so it is read until it has nothing more to give, unless curr
+ * gets paused: then what is left stays put (in buf or the socket) until it
+ * is resumed.
+ */
+static void serve_client(chat_server *srv, struct client_sock *curr) {
+    while (curr->sock_fd >= 0 && !curr->paused) {
+        take_messages(srv, curr);
+        if (curr->sock_fd < 0 || curr->paused) {
+            return;
+        }
+        int client_closed = curr->binary ? read_frames(curr->sock_fd, &curr->bin) :
+                            read_from_socket(curr->sock_fd, &curr->in);
+        if (client_closed == 3) {
+            return;
+        }
+        take_read(srv, curr, client_closed);
+    }
+}
+
+/*
+ * Send what this loop iteration queued, one call per client.
+ */
+static void flush_dirty(chat_server *srv) {
+    // flushing drops clients, which never queues more.
+    for (size_t i = 0; i < srv->dirty_count; i++) {
+        struct client_sock *c = client_from_handle(&srv->clients, srv->dirty[i]);
+        if (c == NULL) {
+            continue;
+        }
+        c->dirty = 0;
+        if (flush_out(srv, c) == 2) {
+            drop_client(srv, c);
+        }
+    }
+    srv->dirty_count = 0;
+}
+
+/*
+ * Give every paused client another go, once some queue has drained.
+ */
+static void resume_paused(chat_server *srv) {
+    uint64_t *paused = srv->paused;
+    size_t count = srv->paused_count;
+    srv->paused = NULL;
+    srv->paused_count = srv->paused_cap = 0;
+    srv->resume = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct client_sock *c = client_from_handle(&srv->clients, paused[i]);
+        if (c != NULL && c->paused) {
+            c->paused = 0;
+            serve_client(srv, c);
+        }
+    }
+    free(paused);
+}
+
+static void uring_close(chat_server *srv);
+
+static void clean_exit(chat_server *srv, int exit_status) {
+    while (srv->clients.live_count > 0) {
+        drop_client(srv, client_at(&srv->clients, srv->clients.live[0]));
+    }
+    table_free(&srv->clients);
+    rooms_free(srv);
+    free(srv->paused);
+    free(srv->dirty);
+    if (srv->epoll_fd >= 0) {
+        close(srv->epoll_fd);
+    }
+    if (srv->wake_fd >= 0) {
+        close(srv->wake_fd);
+    }
+    if (srv->spare_fd >= 0) {
+        close(srv->spare_fd);
+    }
+    uring_close(srv);
+    close(srv->listener.sock_fd);
+    free(srv->listener.addr);
+    exit(exit_status);
+}
+
+// ===== io_uring engine =====
+
+/* What a completion is for, as its user_data: accepts, wakeups and the
+ * start-up probe have a constant each, recvs and sends point at an op.
+ */
+#define URING_ACCEPT 1
+#define URING_WAKE 2
+#define URING_PROBE 3
+#define URING_LISTEN 4
+// buffer group the recvs pick from.
+#define RECV_GROUP 0
+
+typedef struct uring_op {
+    // the client it is for.
+    uint64_t handle;
+    // frames it sends (then it is a uring_send), 0 for a recv.
+    int count;
+    // on a spare list.
+    struct uring_op *next;
+} uring_op;
+
+/* One sendmsg of a chain: the frames it holds a reference to, back to back.
+ */
+typedef struct uring_send {
+    uring_op op;
+    size_t len;
+    struct msghdr msg;
+    struct iovec iov[SERVER_IOV];
+    frame *frames[SERVER_IOV];
+} uring_send;
+
+/* A recv completion waiting its turn (see shard_run_uring).
+ */
+typedef struct held_cqe {
+    uint64_t user_data;
+    int res;
+    unsigned int flags;
+} held_cqe;
+
+static uring_op *op_get(chat_server *srv, struct client_sock *c) {
+    uring_op *op = srv->spare_ops;
+    if (op != NULL) {
+        srv->spare_ops = op->next;
+    } else if ((op = malloc(sizeof(uring_op))) == NULL) {
+        return NULL;
+    }
+    op->handle = client_handle(c);
+    op->count = 0;
+    return op;
+}
+
+static void op_put(chat_server *srv, uring_op *op) {
+    op->next = srv->spare_ops;
+    srv->spare_ops = op;
+}
+
+static uring_send *send_get(chat_server *srv, struct client_sock *c) {
+    uring_send *send = (uring_send *) srv->spare_sends;
+    if (send != NULL) {
+        srv->spare_sends = send->op.next;
+    } else if ((send = malloc(sizeof(uring_send))) == NULL) {
+        return NULL;
+    }
+    send->op.handle = client_handle(c);
+    send->op.count = 0;
+    send->len = 0;
+    return send;
+}
+
+static void send_put(chat_server *srv, uring_send *send) {
+    for (int i = 0; i < send->op.count; i++) {
+        frame_release(send->frames[i]);
+    }
+    send->op.next = srv->spare_sends;
+    srv->spare_sends = &send->op;
+}
+
+/*
+ * Make sure n submissions fit, handing the queued ones to the kernel
+ * early if need be.
+ * Return 0 on success and -1 if they don't.
+ */
+static int sq_reserve(chat_server *srv, unsigned int n) {
+    if (uring_sq_space(srv->ring) < n) {
+        uring_submit(srv->ring, 0);
+    }
+    return uring_sq_space(srv->ring) >= n ? 0 : -1;
+}
+
+static int uring_arm_accept(chat_server *srv) {
+    if (sq_reserve(srv, 1) < 0) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(srv->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = srv->listener.sock_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    // blocking, so that a send waits for room rather than coming back short.
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_ACCEPT;
+    return 0;
+}
+
+/*
+ * Wait for a connection to be pending without taking a descriptor, which an
+ * accept does up front (and fails with EMFILE) while the table is full.
+ */
+static int uring_arm_listen(chat_server *srv) {
+    if (sq_reserve(srv, 1) < 0) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(srv->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = srv->listener.sock_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_LISTEN;
+    return 0;
+}
+
+/*
+ * A client left after accepting was paused: watch the listener again.
+ */
+static void resume_accepting(chat_server *srv) {
+    srv->accept_paused = 0;
+    if (srv->ring != NULL) {
+        uring_arm_accept(srv);
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.u64 = 0;
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listener.sock_fd, &ev);
+}
+
+static int uring_arm_wake(chat_server *srv) {
+    if (sq_reserve(srv, 1) < 0) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(srv->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = srv->wake_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_WAKE;
+    return 0;
+}
+
+/*
+ * Queue a multishot recv on fd, each completion with a buffer of its own
+ * from the provided ring.
+ */
+static int uring_recv_on(chat_server *srv, int fd, uint64_t user_data) {
+    if (sq_reserve(srv, 1) < 0) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(srv->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+static int uring_arm_recv(chat_server *srv, struct client_sock *c) {
+    uring_op *op = op_get(srv, c);
+    if (op == NULL) {
+        return -1;
+    }
+    if (uring_recv_on(srv, c->sock_fd, (uintptr_t) op) < 0) {
+        op_put(srv, op);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Hand recv buffer bid back to the kernel.
+ */
+static void recv_buf_put(chat_server *srv, uint16_t bid) {
+    struct io_uring_buf *b = &srv->recv_bufs->bufs[srv->recv_tail & (SERVER_URING_BUFS - 1)];
+    b->addr = (uintptr_t) (srv->recv_mem + (size_t) bid * SERVER_URING_BUF_SIZE);
+    b->len = SERVER_URING_BUF_SIZE;
+    b->bid = bid;
+    srv->recv_tail++;
+    __atomic_store_n(&srv->recv_bufs->tail, srv->recv_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Send c's queue as one chain of linked sendmsgs, SERVER_IOV frames each:
+ * they go out in order, each whole (MSG_WAITALL) or the chain breaks.
+ * Whatever is queued meanwhile goes once the chain has completed, and the
+ * frames stay counted in out_bytes until then.
+ * Return 0 on success and 2 on out of memory (c is to be dropped).
+ */
+static int uring_flush(chat_server *srv, struct client_sock *c) {
+    if (c->inflight > 0 || c->out_count == 0) {
+        return 0;
+    }
+    unsigned int k = (c->out_count + SERVER_IOV - 1) / SERVER_IOV;
+    if (sq_reserve(srv, k) < 0) {
+        return 2;
+    }
+    struct io_uring_sqe *prev = NULL;
+    for (unsigned int i = 0; i < k; i++) {
+        uring_send *send = send_get(srv, c);
+        if (send == NULL) {
+            if (prev != NULL) {
+                prev->flags &= ~IOSQE_IO_LINK;
+            }
+            return 2;
+        }
+        // the queue's references go to the send.
+        while (c->out_count > 0 && send->op.count < SERVER_IOV) {
+            frame *f = c->out[c->out_head];
+            send->iov[send->op.count].iov_base = f->data;
+            send->iov[send->op.count].iov_len = f->len;
+            send->frames[send->op.count++] = f;
+            send->len += f->len;
+            c->out_head = (c->out_head + 1) & (c->out_cap - 1);
+            c->out_count--;
+        }
+        memset(&send->msg, 0, sizeof(send->msg));
+        send->msg.msg_iov = send->iov;
+        send->msg.msg_iovlen = send->op.count;
+        struct io_uring_sqe *sqe = uring_get_sqe(srv->ring);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = c->sock_fd;
+        sqe->addr = (uintptr_t) &send->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->flags = i + 1 < k ? IOSQE_IO_LINK : 0;
+        sqe->user_data = (uintptr_t) &send->op;
+        c->inflight++;
+        prev = sqe;
+    }
+    return 0;
+}
+
+/*
+ * Take len bytes c sent, as if read_from_socket had read them into its
+ * buffer (as much at a time as fits).
+ */
+static void uring_input(chat_server *srv, struct client_sock *c, const char *data, size_t len) {
+    while (len > 0 && c->sock_fd >= 0) {
+        if (c->binary) {
+            size_t space = bin_buf_space(&c->bin);
+            size_t n = space < len ? space : len;
+            memcpy(c->bin.data + c->bin.start + c->bin.len, data, n);
+            c->bin.len += n;
+            data += n;
+            len -= n;
+        } else {
+            size_t space = net_buf_space(&c->in);
+            size_t n = space < len ? space : len;
+            memcpy(c->in.data + c->in.start + c->in.len, data, n);
+            c->in.len += n;
+            data += n;
+            len -= n;
+            take_read(srv, c, check_buffer(&c->in));
+        }
+        take_messages(srv, c);
+    }
+}
+
+static void uring_accepted(chat_server *srv, int res, unsigned int flags) {
+    if (res >= 0) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        if (getpeername(res, (struct sockaddr *) &peer, &peer_len) < 0) {
+            close(res);
+        } else {
+            add_client(srv, res, peer.sin_addr);
+        }
+    } else if (res == -EMFILE || res == -ENFILE) {
+        int refused = refuse_connection(srv);
+        if (refused < 0) {
+            return;
+        }
+        if (refused == 0 && !(flags & IORING_CQE_F_MORE)) {
+            // nothing was pending: accepting again now would just fail again.
+            uring_arm_listen(srv);
+            return;
+        }
+    } else if (res != -ECONNABORTED && res != -EINTR) {
+        errno = -res;
+        perror("server: accept");
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept(srv);
+    }
+}
+
+static void uring_received(chat_server *srv, uring_op *op, int res, unsigned int flags) {
+    struct client_sock *c = client_from_handle(&srv->clients, op->handle);
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (c != NULL && res > 0) {
+            uring_input(srv, c, srv->recv_mem + (size_t) bid * SERVER_URING_BUF_SIZE, res);
+        }
+        recv_buf_put(srv, bid);
+    } else if (c != NULL && res == 0) {
+        // the client left: pass on whatever it sent without a newline first.
+        if (!c->binary && c->in.len > 0) {
+            take_read(srv, c, 2);
+        }
+        drop_client(srv, c);
+    } else if (c != NULL && res < 0 && res != -ENOBUFS) {
+        drop_client(srv, c);
+    }
+    if (flags & IORING_CQE_F_MORE) {
+        return;
+    }
+    // the recv is over: start another while the client is still there.
+    c = client_from_handle(&srv->clients, op->handle);
+    if (c == NULL) {
+        op_put(srv, op);
+    } else if (uring_recv_on(srv, c->sock_fd, (uintptr_t) op) < 0) {
+        op_put(srv, op);
+        drop_client(srv, c);
+    }
+}
+
+static void uring_sent(chat_server *srv, uring_send *send, int res) {
+    struct client_sock *c = client_from_handle(&srv->clients, send->op.handle);
+    if (c != NULL) {
+        c->inflight--;
+        if (res < 0 || (size_t) res != send->len) {
+            drop_client(srv, c);
+        } else {
+            c->out_bytes -= res;
+            if (c->inflight == 0 && uring_flush(srv, c) == 2) {
+                drop_client(srv, c);
+            }
+        }
+    }
+    send_put(srv, send);
+}
+
+/*
+ * Check the kernel does multishot recv from a provided buffer ring (which
+ * also means multishot accept), on a socket pair.
+ * Return 0 if it does and -1 if not.
+ */
+static int uring_probe(chat_server *srv) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        return -1;
+    }
+    int ok = 0;
+    int more = 0;
+    if (uring_recv_on(srv, sv[0], URING_PROBE) == 0 && write(sv[1], "x", 1) == 1) {
+        // the first completion says whether it works, then closing the
+        // other end ends the recv.
+        for (int first = 1; first || more; first = 0) {
+            if (!first) {
+                close(sv[1]);
+                sv[1] = -1;
+            }
+            struct io_uring_cqe *cqe;
+            while ((cqe = uring_peek_cqe(srv->ring)) == NULL) {
+                if (uring_submit(srv->ring, 1) < 0 && errno != EBUSY) {
+                    break;
+                }
+            }
+            if (cqe == NULL) {
+                break;
+            }
+            if (first) {
+                ok = cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER);
+            }
+            more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                recv_buf_put(srv, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+            uring_cqe_seen(srv->ring);
+        }
+    }
+    close(sv[0]);
+    if (sv[1] >= 0) {
+        close(sv[1]);
+    }
+    return ok ? 0 : -1;
+}
+
+static void uring_close(chat_server *srv) {
+    if (srv->ring != NULL) {
+        uring_exit(srv->ring);
+        free(srv->ring);
+        srv->ring = NULL;
+    }
+    if (srv->recv_bufs != NULL) {
+        munmap(srv->recv_bufs, sizeof(struct io_uring_buf) * SERVER_URING_BUFS +
+               (size_t) SERVER_URING_BUFS * SERVER_URING_BUF_SIZE);
+        srv->recv_bufs = NULL;
+    }
+    while (srv->spare_ops != NULL) {
+        uring_op *op = srv->spare_ops;
+        srv->spare_ops = op->next;
+        free(op);
+    }
+    while (srv->spare_sends != NULL) {
+        uring_op *op = srv->spare_sends;
+        srv->spare_sends = op->next;
+        free(op);
+    }
+    free(srv->held);
+    srv->held = NULL;
+    srv->held_head = srv->held_count = srv->held_cap = 0;
+}
+
+/*
+ * Set up srv's ring and its provided recv buffers.
+ * Return 0 on success and -1 if the kernel lacks what the engine needs
+ * (srv is then left as it was).
+ */
+static int uring_open(chat_server *srv) {
+    if (getenv("MYSH_NO_URING") != NULL || (srv->ring = malloc(sizeof(uring))) == NULL) {
+        return -1;
+    }
+    if (uring_init(srv->ring, SERVER_URING_ENTRIES, IORING_SETUP_SUBMIT_ALL) < 0 &&
+        uring_init(srv->ring, SERVER_URING_ENTRIES, 0) < 0) {
+        free(srv->ring);
+        srv->ring = NULL;
+        return -1;
+    }
+    // the buffer ring, then the buffers, in one mapping.
+    size_t ring_size = sizeof(struct io_uring_buf) * SERVER_URING_BUFS;
+    void *mem = mmap(NULL, ring_size + (size_t) SERVER_URING_BUFS * SERVER_URING_BUF_SIZE,
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        uring_close(srv);
+        return -1;
+    }
+    srv->recv_bufs = mem;
+    srv->recv_mem = (char *) mem + ring_size;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t) mem;
+    reg.ring_entries = SERVER_URING_BUFS;
+    reg.bgid = RECV_GROUP;
+    if (uring_register(srv->ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uring_close(srv);
+        return -1;
+    }
+    srv->recv_tail = 0;
+    for (int i = 0; i < SERVER_URING_BUFS; i++) {
+        recv_buf_put(srv, i);
+    }
+    if (uring_probe(srv) < 0) {
+        uring_close(srv);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Put a recv completion at the end of the held ones.
+ * Return 0 on success and -1 on out of memory.
+ */
+static int hold_cqe(chat_server *srv, const struct io_uring_cqe *cqe) {
+    if (srv->held_count == srv->held_cap) {
+        size_t cap = srv->held_cap ? srv->held_cap * 2 : SERVER_URING_BUFS;
+        held_cqe *held = malloc(sizeof(held_cqe) * cap);
+        if (held == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < srv->held_count; i++) {
+            held[i] = srv->held[(srv->held_head + i) & (srv->held_cap - 1)];
+        }
+        free(srv->held);
+        srv->held = held;
+        srv->held_head = 0;
+        srv->held_cap = cap;
+    }
+    held_cqe *h = &srv->held[(srv->held_head + srv->held_count++) & (srv->held_cap - 1)];
+    h->user_data = cqe->user_data;
+    h->res = cqe->res;
+    h->flags = cqe->flags;
+    return 0;
+}
+
+/*
+ * Act on every completion there is, except recvs: those are held, in
+ * order, for the loop to take. One that can't be held is left in the
+ * completion queue, and so is everything after it.
+ */
+static void uring_reap(chat_server *srv) {
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(srv->ring)) != NULL) {
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+        if (user_data == URING_ACCEPT) {
+            uring_cqe_seen(srv->ring);
+            uring_accepted(srv, res, flags);
+        } else if (user_data == URING_LISTEN) {
+            uring_cqe_seen(srv->ring);
+            uring_arm_accept(srv);
+        } else if (user_data == URING_WAKE) {
+            uring_cqe_seen(srv->ring);
+            take_forwarded(srv);
+            if (!(flags & IORING_CQE_F_MORE)) {
+                uring_arm_wake(srv);
+            }
+        } else if (((uring_op *) (uintptr_t) user_data)->count > 0) {
+            uring_cqe_seen(srv->ring);
+            uring_sent(srv, (uring_send *) (uintptr_t) user_data, res);
+        } else if (hold_cqe(srv, cqe) == 0) {
+            uring_cqe_seen(srv->ring);
+        } else {
+            return;
+        }
+    }
+}
+
+/*
+ * Run one shard's io_uring event loop: each pass hands the kernel every
+ * accept, recv and send queued since the last, in one io_uring_enter that
+ * also waits for the next completion unless input is held. Input is taken
+ * until a queue it adds to is backed up behind a send still in flight;
+ * the rest waits for the next pass, which reaps the sends first (and keeps
+ * the buffers of what waits, so a client sending faster than others read
+ * runs out of them). Only returns (taking the process with it) if the
+ * ring fails.
+ */
+static void *shard_run_uring(void *arg) {
+    chat_server *srv = arg;
+    while (1) {
+        // EBUSY: completions are backed up, so reap them first.
+        if (uring_submit(srv->ring, srv->held_count == 0) < 0 && errno != EBUSY) {
+            perror("server: io_uring_enter");
+            break;
+        }
+        uring_reap(srv);
+        srv->backed_up = 0;
+        while (srv->held_count > 0 && !srv->backed_up) {
+            held_cqe h = srv->held[srv->held_head];
+            srv->held_head = (srv->held_head + 1) & (srv->held_cap - 1);
+            srv->held_count--;
+            uring_received(srv, (uring_op *) (uintptr_t) h.user_data, h.res, h.flags);
+        }
+        flush_dirty(srv);
+    }
+    clean_exit(srv, 1);
+    return NULL;
+}
+
+void server_options_default(server_options *opts) {
+    opts->overflow = OVERFLOW_DROP_OLDEST;
+    opts->workers = 1;
+    opts->engine = ENGINE_EPOLL;
+    opts->max_frame = BIN_MAX_DEFAULT;
+}
+
+int server_parse_option(server_options *opts, char **args) {
+    const char *arg = args[0];
+    if (strncmp(arg, "--overflow=", 11) == 0) {
+        const char *policy = arg + 11;
+        if (strcmp(policy, "drop-oldest") == 0) {
+            opts->overflow = OVERFLOW_DROP_OLDEST;
+        } else if (strcmp(policy, "disconnect") == 0) {
+            opts->overflow = OVERFLOW_DISCONNECT;
+        } else if (strcmp(policy, "pause") == 0) {
+            opts->overflow = OVERFLOW_PAUSE;
+        } else {
+            display_error("ERROR: Unknown overflow policy (drop-oldest, disconnect or pause): ", (char *) policy);
+            return -1;
+        }
+        return 1;
+    }
+    if (strncmp(arg, "--engine=", 9) == 0) {
+        if (strcmp(arg + 9, "epoll") == 0) {
+            opts->engine = ENGINE_EPOLL;
+        } else if (strcmp(arg + 9, "uring") == 0) {
+            opts->engine = ENGINE_URING;
+        } else {
+            display_error("ERROR: Unknown engine (epoll or uring): ", (char *) arg + 9);
+            return -1;
+        }
+        return 1;
+    }
+    if (strcmp(arg, "--workers") == 0 || strncmp(arg, "--workers=", 10) == 0) {
+        const char *count = arg[9] == '=' ? arg + 10 : args[1];
+        if (count == NULL) {
+            display_error("ERROR: --workers needs a count", "");
+            return -1;
+        }
+        char *end;
+        long workers = strtol(count, &end, 10);
+        if (*count == '\0' || *end != '\0' || workers < 1 || workers > SERVER_MAX_WORKERS) {
+            display_error("ERROR: Invalid worker count: ", (char *) count);
+            return -1;
+        }
+        opts->workers = workers;
+        return arg[9] == '=' ? 1 : 2;
+    }
+    if (strncmp(arg, "--max-frame=", 12) == 0) {
+        char *end;
+        long max = strtol(arg + 12, &end, 10);
+        if (arg[12] == '\0' || *end != '\0' || max < BIN_MAX_DEFAULT || max > BIN_MAX_LIMIT) {
+            display_error("ERROR: Invalid frame size (65536 to 16777216 bytes): ", (char *) arg + 12);
+            return -1;
+        }
+        opts->max_frame = max;
+        return 1;
+    }
+    display_error("ERROR: Unknown server option: ", (char *) arg);
+    return -1;
+}
+
+/*
+ * Set up shard index of group: its listener on port, its eventfd if it has
+ * other shards to hear from, and its io_uring ring or else its epoll set.
+ * Exits on failure.
+ */
+static void shard_open(server_group *group, int index, int port, const server_options *opts) {
+    chat_server *srv = &group->shards[index];
+    memset(srv, 0, sizeof(*srv));
+    srv->group = group;
+    srv->opts = *opts;
+    srv->epoll_fd = srv->wake_fd = srv->spare_fd = -1;
+    inbox_init(&srv->inbox);
+    // every shard listens on the port itself (SO_REUSEPORT), and the kernel
+    // spreads the connections over them.
+    setup_server_socket(&srv->listener, port);
+    fcntl(srv->listener.sock_fd, F_SETFL, fcntl(srv->listener.sock_fd, F_GETFL) | O_NONBLOCK);
+    srv->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (group->count > 1) {
+        srv->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (srv->wake_fd < 0) {
+            perror("server: eventfd");
+            clean_exit(srv, 1);
+        }
+    }
+
+    // pausing senders needs epoll, which can stop watching a socket.
+    if (opts->engine == ENGINE_URING && opts->overflow != OVERFLOW_PAUSE) {
+        if (uring_open(srv) == 0) {
+            if (uring_arm_accept(srv) < 0 || (srv->wake_fd >= 0 && uring_arm_wake(srv) < 0)) {
+                clean_exit(srv, 1);
+            }
+            return;
+        }
+        if (index == 0) {
+            display_message("io_uring unavailable, using epoll\n");
+        }
+    }
+    srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (srv->epoll_fd < 0) {
+        perror("server: epoll_create1");
+        clean_exit(srv, 1);
+    }
+    // the listener has no client: handle 0 marks it.
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.u64 = 0;
+    if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listener.sock_fd, &ev) < 0) {
+        perror("server: epoll_ctl");
+        clean_exit(srv, 1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.u64 = WAKE_HANDLE;
+    if (srv->wake_fd >= 0 && epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->wake_fd, &ev) < 0) {
+        perror("server: epoll_ctl");
+        clean_exit(srv, 1);
+    }
+}
+
+static void *shard_run(void *arg) {
+    chat_server *srv = arg;
+    struct epoll_event events[SERVER_EVENTS];
+    while (1) {
+        int nready = epoll_wait(srv->epoll_fd, events, SERVER_EVENTS, -1);
+        if (nready == -1) {
+            if (errno == EINTR) continue;
+            perror("server: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < nready; i++) {
+            if (events[i].data.u64 == 0) {
+                while (accept_connection(srv) >= 0);
+                continue;
+            }
+            if (events[i].data.u64 == WAKE_HANDLE) {
+                take_forwarded(srv);
+                continue;
+            }
+            struct client_sock *c = client_from_handle(&srv->clients, events[i].data.u64);
+            if (c != NULL && (events[i].events & EPOLLOUT) && flush_client(srv, c) == 2) {
+                drop_client(srv, c);
+            }
+            if (c != NULL && c->sock_fd >= 0 && (events[i].events & ~EPOLLOUT)) {
+                serve_client(srv, c);
+            }
+        }
+        flush_dirty(srv);
+        if (srv->resume) {
+            resume_paused(srv);
+            flush_dirty(srv);
+        }
+    }
+    clean_exit(srv, 1);
+    return NULL;
+}
+
+/*
+ * Run a shard on the engine shard_open set up for it.
+ */
+static void *shard_main(void *arg) {
+    chat_server *srv = arg;
+    return srv->ring != NULL ? shard_run_uring(srv) : shard_run(srv);
+}
+
+/*
+ * Run one shard's event loop. Only returns (taking the process with it)
+ * if epoll fails.
+ */
+void start_server(int port, const server_options *opts) {
+    /*
+     * Turn off SIGPIPE: write() to a socket that is closed on the other
+     * end will return -1 with errno set to EPIPE, instead of generating
+     * a SIGPIPE signal that terminates the process.
+     */
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        perror("signal");
+        exit(1);
+    }
+    raise_fd_limit();
+
+    // Set up SIGINT handler: Want to ignore sigint here:
+    struct sigaction sa_sigint;
+    memset(&sa_sigint, 0, sizeof(sa_sigint));
+    sa_sigint.sa_handler = SIG_IGN;
+    sa_sigint.sa_flags = 0;
+    sigemptyset(&sa_sigint.sa_mask);
+    sigaction(SIGINT, &sa_sigint, NULL);
+
+    // the shards live as long as the process, so this is never freed.
+    static server_group group;
+    group.count = opts->workers;
+    group.next_id = 1;
+    group.shards = calloc(group.count, sizeof(chat_server));
+    if (group.shards == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < group.count; i++) {
+        shard_open(&group, i, port, opts);
+    }
+    // shard 0 runs here, the rest on threads of their own.
+    for (int i = 1; i < group.count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, shard_main, &group.shards[i]) != 0) {
+            perror("server: pthread_create");
+            clean_exit(&group.shards[0], 1);
+        }
+        pthread_detach(thread);
+    }
+    shard_main(&group.shards[0]);
+}
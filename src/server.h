@@ -0,0 +1,93 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "io_helpers.h"
+#include "commands.h"
+
+// Events taken per epoll_wait.
+#define SERVER_EVENTS 256
+// Descriptors kept free for the listener, epoll and stdio on top of the
+// MAX_CONNECTIONS clients when raising RLIMIT_NOFILE.
+#define SERVER_SPARE_FDS 64
+// Client slots allocated at a time; a slot keeps its address for the life
+// of the server.
+#define CLIENT_SLAB 1024
+// Longest channel name \join takes.
+#define MAX_ROOM_NAME 32
+// Bytes queued for one client before the overflow policy steps in.
+#define SERVER_HIGH_WATER (64 * 1024)
+// Bytes queued for one client in a loop iteration before they are sent
+// without waiting for the iteration to end.
+#define SERVER_FLUSH_BYTES (16 * 1024)
+// Frames handed to the kernel in one sendmsg.
+#define SERVER_IOV 64
+// Most event loops start-server --workers runs.
+#define SERVER_MAX_WORKERS 64
+// Submission queue size of each --engine=uring ring.
+#define SERVER_URING_ENTRIES 4096
+// Receive buffers each ring hands out to its recvs (a power of 2), and their size.
+#define SERVER_URING_BUFS 1024
+#define SERVER_URING_BUF_SIZE 2048
+
+/* What to do about a client that isn't reading fast enough to keep its
+ * queue under SERVER_HIGH_WATER.
+ */
+typedef enum overflow_policy {
+    // lose its oldest queued messages.
+    OVERFLOW_DROP_OLDEST,
+    // drop the client.
+    OVERFLOW_DISCONNECT,
+    // stop reading from whoever sent to it until queues drain.
+    OVERFLOW_PAUSE,
+} overflow_policy;
+
+/* How an event loop waits on its sockets.
+ */
+typedef enum server_engine {
+    // readiness from epoll, then read and sendmsg.
+    ENGINE_EPOLL,
+    // multishot accept and recv, and linked sends, on an io_uring ring;
+    // falls back to epoll where the kernel lacks them, and for
+    // --overflow=pause.
+    ENGINE_URING,
+} server_engine;
+
+typedef struct server_options {
+    overflow_policy overflow;
+    // event loops, each on a thread with its own listener and clients.
+    int workers;
+    server_engine engine;
+    // largest payload a client may send in binary framing.
+    uint32_t max_frame;
+} server_options;
+
+void server_options_default(server_options *opts);
+
+/*
+ * Apply the start-server option at args[0] (and its value, if that comes
+ * as the next word) to opts:
+ *   --overflow=drop-oldest|disconnect|pause
+ *   --workers N, --workers=N
+ *   --engine=epoll|uring
+ *   --max-frame=BYTES (BIN_MAX_DEFAULT to BIN_MAX_LIMIT)
+ * Return: the number of words used, or -1 (with an error shown) on a bad
+ * option.
+ */
+int server_parse_option(server_options *opts, char **args);
+
+/*
+ * Run the chat server on port until the process is killed. Every client
+ * socket is non-blocking and edge triggered in one epoll set, so each
+ * wakeup only touches the clients that have something to read, and a
+ * client's output is queued rather than waited for (see opts->overflow).
+ * A message goes to the sender's room: everyone connected from the same
+ * address, or everyone on the channel it picked with "\join name".
+ * Clients that send "\binary" switch to binary framing (see commands.h),
+ * and are sent every message that way, whoever it is from.
+ * With opts->workers above 1 the clients are split over that many event
+ * loops, which pass each other's messages on. opts->engine picks what the
+ * loops wait on.
+ */
+void start_server(int port, const server_options *opts);
+
+#endif
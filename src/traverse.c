@@ -0,0 +1,530 @@
+#define _GNU_SOURCE
+
+#include <time.h>
+
+#include "traverse.h"
+#include "metadata.h"
+#include "dircache.h"
+#include "dirstream.h"
+#include "extsort.h"
+
+// Fields a long listing prints; sorting alone only asks for its key.
+#define LONG_LISTING_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | \
+                           STATX_GID | STATX_SIZE | STATX_MTIME)
+#define SIX_MONTHS (182L * 24 * 60 * 60)
+
+// ===== Long listing =====
+
+static void format_mode(unsigned int mode, char *out) {
+	char type = '-';
+	if (S_ISDIR(mode)) type = 'd';
+	else if (S_ISLNK(mode)) type = 'l';
+	else if (S_ISCHR(mode)) type = 'c';
+	else if (S_ISBLK(mode)) type = 'b';
+	else if (S_ISFIFO(mode)) type = 'p';
+	else if (S_ISSOCK(mode)) type = 's';
+	out[0] = type;
+	const char *rwx = "rwxrwxrwx";
+	for (int i = 0; i < 9; i++) {
+		out[i + 1] = (mode & (1 << (8 - i))) ? rwx[i] : '-';
+	}
+	if (mode & S_ISUID) out[3] = (mode & S_IXUSR) ? 's' : 'S';
+	if (mode & S_ISGID) out[6] = (mode & S_IXGRP) ? 's' : 'S';
+	if (mode & S_ISVTX) out[9] = (mode & S_IXOTH) ? 't' : 'T';
+	out[10] = '\0';
+}
+
+static void print_long_entry(int dirfd, const ls_entry *e, out_buffer *out) {
+	char mode[11];
+	format_mode(e->stx.stx_mode, mode);
+	// like ls, old (or future) files show the year instead of the time.
+	char when[32];
+	struct tm tm;
+	time_t mtime = e->stx.stx_mtime.tv_sec;
+	time_t now = time(NULL);
+	localtime_r(&mtime, &tm);
+	if (mtime > now || now - mtime > SIX_MONTHS) {
+		strftime(when, sizeof(when), "%b %e  %Y", &tm);
+	} else {
+		strftime(when, sizeof(when), "%b %e %H:%M", &tm);
+	}
+	char line[512];
+	int len = snprintf(line, sizeof(line), "%s %3u %-8s %-8s %10llu %s ", mode,
+	                   e->stx.stx_nlink, uid_to_name(e->stx.stx_uid),
+	                   gid_to_name(e->stx.stx_gid),
+	                   (unsigned long long) e->stx.stx_size, when);
+	if (len < 0 || len >= (int) sizeof(line)) {
+		len = strlen(line);
+	}
+	out_append(out, line, len);
+	out_append(out, e->name, e->name_len);
+	if (S_ISLNK(e->stx.stx_mode)) {
+		char target[4096];
+		ssize_t n = readlinkat(dirfd, e->name, target, sizeof(target));
+		if (n > 0) {
+			out_append(out, " -> ", 4);
+			out_append(out, target, n);
+		}
+	}
+	out_append(out, "\n", 1);
+}
+
+static int compare_size(const void *a, const void *b) {
+	const ls_entry *x = a, *y = b;
+	if (x->stx.stx_size != y->stx.stx_size) {
+		return x->stx.stx_size < y->stx.stx_size ? 1 : -1;
+	}
+	return strcmp(x->name, y->name);
+}
+
+static int compare_mtime(const void *a, const void *b) {
+	const ls_entry *x = a, *y = b;
+	if (x->stx.stx_mtime.tv_sec != y->stx.stx_mtime.tv_sec) {
+		return x->stx.stx_mtime.tv_sec < y->stx.stx_mtime.tv_sec ? 1 : -1;
+	}
+	if (x->stx.stx_mtime.tv_nsec != y->stx.stx_mtime.tv_nsec) {
+		return x->stx.stx_mtime.tv_nsec < y->stx.stx_mtime.tv_nsec ? 1 : -1;
+	}
+	return strcmp(x->name, y->name);
+}
+
+/*
+ * Print the filtered entries of dir with metadata: everything is statx'd in
+ * one batch first, then sorted (if asked) and printed.
+ */
+static int print_with_metadata(char *dir, const dir_listing *listing,
+                               const ls_options *opts, out_buffer *out) {
+	ls_entry *entries = malloc(sizeof(ls_entry) * (listing->count > 0 ? listing->count : 1));
+	if (entries == NULL) {
+		display_error("ERROR: Out of memory listing: ", dir);
+		return -1;
+	}
+	size_t count = 0;
+	for (size_t i = 0; i < listing->count; i++) {
+		const dir_item *item = &listing->items[i];
+		if (filter_match(opts->filter, item->name, item->len)) {
+			entries[count].name = item->name;
+			entries[count].name_len = item->len;
+			entries[count].d_type = item->d_type;
+			entries[count].err = 0;
+			count++;
+		}
+	}
+	unsigned int mask = opts->long_format ? LONG_LISTING_MASK : 0;
+	if (opts->sort == LS_SORT_SIZE) mask |= STATX_SIZE;
+	if (opts->sort == LS_SORT_MTIME) mask |= STATX_MTIME;
+	int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0 || stat_batch(dirfd, entries, count, mask) < 0) {
+		display_error("ERROR: Cannot open directory: ", dir);
+		if (dirfd >= 0) close(dirfd);
+		free(entries);
+		return -1;
+	}
+	if (opts->sort == LS_SORT_SIZE) {
+		qsort(entries, count, sizeof(ls_entry), compare_size);
+	} else if (opts->sort == LS_SORT_MTIME) {
+		qsort(entries, count, sizeof(ls_entry), compare_mtime);
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (entries[i].err) {
+			out_flush(out);
+			display_error("ERROR: Cannot access: ", (char *) entries[i].name);
+			continue;
+		}
+		if (opts->long_format) {
+			print_long_entry(dirfd, &entries[i], out);
+		} else {
+			out_append(out, entries[i].name, entries[i].name_len);
+			out_append(out, "\n", 1);
+		}
+	}
+	close(dirfd);
+	free(entries);
+	return 0;
+}
+
+// ===== Chunked metadata =====
+
+/*
+ * Streaming long listings statx one chunk of entries at a time, so memory
+ * stays bounded however many entries the directory has.
+ */
+#define CHUNK_ENTRIES 256
+#define CHUNK_NAMES (CHUNK_ENTRIES * 64)
+
+typedef struct entry_chunk {
+    ls_entry entries[CHUNK_ENTRIES];
+    char names[CHUNK_NAMES];
+    size_t count;
+    size_t names_len;
+} entry_chunk;
+
+/*
+ * Return: 1 if the entry was added and 0 if the chunk has to be flushed first.
+ */
+static int chunk_add(entry_chunk *c, const char *name, size_t len, unsigned char d_type) {
+	if (c->count == CHUNK_ENTRIES || c->names_len + len + 1 > CHUNK_NAMES) {
+		return 0;
+	}
+	ls_entry *e = &c->entries[c->count++];
+	memcpy(c->names + c->names_len, name, len);
+	c->names[c->names_len + len] = '\0';
+	e->name = c->names + c->names_len;
+	e->name_len = len;
+	e->d_type = d_type;
+	e->err = 0;
+	c->names_len += len + 1;
+	return 1;
+}
+
+static void chunk_flush(int dirfd, entry_chunk *c, out_buffer *out) {
+	stat_batch(dirfd, c->entries, c->count, LONG_LISTING_MASK);
+	for (size_t i = 0; i < c->count; i++) {
+		if (c->entries[i].err) {
+			out_flush(out);
+			display_error("ERROR: Cannot access: ", (char *) c->entries[i].name);
+			continue;
+		}
+		print_long_entry(dirfd, &c->entries[i], out);
+	}
+	c->count = 0;
+	c->names_len = 0;
+}
+
+/*
+ * Print one entry that passed the filter: the name straight away, or queued
+ * in the chunk when the long format needs its metadata.
+ */
+static void emit_entry(int dirfd, entry_chunk *chunk, const char *name, size_t len,
+                       unsigned char d_type, out_buffer *out) {
+	if (chunk == NULL) {
+		out_append(out, name, len);
+		out_append(out, "\n", 1);
+		return;
+	}
+	if (!chunk_add(chunk, name, len, d_type)) {
+		chunk_flush(dirfd, chunk, out);
+		chunk_add(chunk, name, len, d_type);
+	}
+}
+
+// ===== Entry sources =====
+
+/* Where the entries of one directory come from: the (possibly cached)
+ * materialized listing, or the constant memory getdents64 stream.
+ */
+typedef struct item_source {
+    dir_listing *listing;
+    size_t pos;
+    dir_stream stream;
+    int dirfd;
+} item_source;
+
+static int source_open(item_source *src, const char *dir, int materialize) {
+	src->listing = NULL;
+	src->pos = 0;
+	src->stream.fd = -1;
+	src->stream.buf = NULL;
+	src->dirfd = -1;
+	// cached listings are served from memory, anything else streams from disk.
+	if (materialize || dircache_enabled()) {
+		src->listing = dircache_get(dir);
+		if (src->listing == NULL) {
+			return -1;
+		}
+		return 0;
+	}
+	if (dir_stream_open(&src->stream, dir) < 0) {
+		return -1;
+	}
+	src->dirfd = src->stream.fd;
+	return 0;
+}
+
+static int source_next(item_source *src, dir_item *item) {
+	if (src->listing != NULL) {
+		if (src->pos >= src->listing->count) {
+			return 0;
+		}
+		*item = src->listing->items[src->pos++];
+		return 1;
+	}
+	return dir_stream_next(&src->stream, item);
+}
+
+static int source_rewind(item_source *src) {
+	if (src->listing != NULL) {
+		src->pos = 0;
+		return 0;
+	}
+	return dir_stream_rewind(&src->stream);
+}
+
+/*
+ * Return: a descriptor of the directory for statx, opened on demand when the
+ * entries came from a listing.
+ */
+static int source_dirfd(item_source *src, const char *dir) {
+	if (src->dirfd < 0) {
+		src->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+	return src->dirfd;
+}
+
+static void source_close(item_source *src) {
+	if (src->listing != NULL) {
+		if (src->dirfd >= 0) {
+			close(src->dirfd);
+		}
+		dir_listing_release(src->listing);
+		src->listing = NULL;
+		return;
+	}
+	dir_stream_close(&src->stream);
+}
+
+static int is_dot_entry(const char *name, size_t len) {
+	return (len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+// ===== Name sorted listings =====
+
+/* Records are the d_type byte, a "passed the filter" byte, then the name. */
+#define REC_HEADER 2
+
+static int compare_records(const char *a, size_t alen, const char *b, size_t blen, void *ctx) {
+	(void) ctx;
+	// plain byte order, which is locale independent and matches strcmp.
+	size_t n = (alen < blen ? alen : blen) - REC_HEADER;
+	int c = memcmp(a + REC_HEADER, b + REC_HEADER, n);
+	if (c != 0) {
+		return c;
+	}
+	return (alen > blen) - (alen < blen);
+}
+
+static int add_record(extsort *s, const dir_item *item, int matched) {
+	char rec[REC_HEADER + 256];
+	if (item->len > 255) {
+		return 0;
+	}
+	rec[0] = item->d_type;
+	rec[1] = matched;
+	memcpy(rec + REC_HEADER, item->name, item->len);
+	return extsort_add(s, rec, REC_HEADER + item->len);
+}
+
+/*
+ * --sorted: collect the entries into an external merge sort (spilling runs to
+ * disk past the budget), print them in byte order, then recurse into the
+ * subdirectories in the same order.
+ */
+static int traverse_sorted(char *dir, int depth, int maxDepth, const ls_options *opts, out_buffer *out){
+	item_source src;
+	if(source_open(&src, dir, 0) < 0){
+		out_flush(out);
+		display_error(depth >= maxDepth ? "ERROR: Invalid path: " : "ERROR: Cannot open directory: ", dir);
+		return -1;
+	}
+	extsort all;
+	extsort_init(&all, opts->sort_budget, compare_records, NULL);
+	dir_item item;
+	int r, err = 0;
+	while((r = source_next(&src, &item)) == 1){
+		int matched = filter_match(opts->filter, item.name, item.len);
+		int subdir = depth < maxDepth && item.d_type == DT_DIR && !is_dot_entry(item.name, item.len);
+		// entries nobody will print or descend into are not worth sorting.
+		if((matched || subdir) && add_record(&all, &item, matched) < 0){
+			r = -1;
+			break;
+		}
+	}
+	if(r < 0 || extsort_finish(&all) < 0){
+		out_flush(out);
+		display_error("ERROR: Cannot sort directory: ", dir);
+		extsort_free(&all);
+		source_close(&src);
+		return -1;
+	}
+	entry_chunk *chunk = opts->long_format ? malloc(sizeof(entry_chunk)) : NULL;
+	if(chunk != NULL){
+		chunk->count = chunk->names_len = 0;
+	}
+	int dirfd = chunk != NULL ? source_dirfd(&src, dir) : -1;
+	const char *rec;
+	size_t len;
+	int next;
+	while((next = extsort_next(&all, &rec, &len)) == 1 && !io_output_closed()){
+		if(rec[1] && opts->visit != NULL){
+			opts->visit(opts->visit_ctx, dir, rec + REC_HEADER, len - REC_HEADER, rec[0]);
+		}else if(rec[1]){
+			emit_entry(dirfd, chunk, rec + REC_HEADER, len - REC_HEADER, rec[0], out);
+		}
+	}
+	if(chunk != NULL){
+		chunk_flush(dirfd, chunk, out);
+		free(chunk);
+	}
+	source_close(&src);
+	// a spilled run that cannot be read back would otherwise end the listing early.
+	if(next < 0){
+		out_flush(out);
+		display_error("ERROR: Cannot sort directory: ", dir);
+		extsort_free(&all);
+		return -1;
+	}
+	if(depth >= maxDepth){
+		extsort_free(&all);
+		return 0;
+	}
+	// only the subdirectories stay around (spilled if need be) while recursing.
+	extsort subdirs;
+	extsort_init(&subdirs, opts->sort_budget, compare_records, NULL);
+	r = extsort_rewind(&all) < 0 ? -1 : 0;
+	while(r == 0 && (next = extsort_next(&all, &rec, &len)) == 1){
+		if(rec[0] == DT_DIR && !is_dot_entry(rec + REC_HEADER, len - REC_HEADER)){
+			r = extsort_add(&subdirs, rec, len) < 0 ? -1 : 0;
+		}
+	}
+	extsort_free(&all);
+	if(r < 0 || next < 0 || extsort_finish(&subdirs) < 0){
+		out_flush(out);
+		display_error("ERROR: Cannot sort directory: ", dir);
+		extsort_free(&subdirs);
+		return -1;
+	}
+	while((next = extsort_next(&subdirs, &rec, &len)) == 1 && !io_output_closed()){
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%.*s", dir, (int) (len - REC_HEADER), rec + REC_HEADER);
+		err += traverse_sorted(path, depth+1, maxDepth, opts, out);
+	}
+	extsort_free(&subdirs);
+	if(next < 0){
+		out_flush(out);
+		display_error("ERROR: Cannot sort directory: ", dir);
+		err--;
+	}
+	return err;
+}
+
+// ===== Traversal =====
+
+/* Subdirectory names (NUL separated) remembered for the recursion. */
+typedef struct name_list {
+	char *data;
+	size_t len;
+	size_t cap;
+} name_list;
+
+static int name_list_add(name_list *l, const char *name, size_t len) {
+	if (l->len + len + 1 > l->cap) {
+		size_t cap = l->cap ? l->cap : 256;
+		while (cap < l->len + len + 1) {
+			cap *= 2;
+		}
+		char *data = realloc(l->data, cap);
+		if (data == NULL) {
+			return -1;
+		}
+		l->data = data;
+		l->cap = cap;
+	}
+	memcpy(l->data + l->len, name, len);
+	l->data[l->len + len] = '\0';
+	l->len += len + 1;
+	return 0;
+}
+
+/*
+ Aids in the expansion of directories (provided a depth is provided).
+ Every entry is printed when it passes the filter, and subdirectories are then
+ recursed into (regardless of the filter) until maxDepth is reached.
+ Entries are printed as getdents64 hands them over and only the names of the
+ subdirectories are kept for the recursion, so the directory is read once and
+ memory grows with the number of subdirectories rather than entries.
+*/
+int traverse_dir_depth(char *dir, int depth, int maxDepth, const ls_options *opts, out_buffer *out){
+	// base case: maxdepth of zero displays the current directory's name:
+	if(maxDepth == 0){
+		out_append(out, dir, strlen(dir));
+		out_append(out, "\n", 1);
+		return 0;
+	}
+	if(opts->sorted){
+		return traverse_sorted(dir, depth, maxDepth, opts, out);
+	}
+	// sorting by size or mtime needs every entry's metadata up front.
+	int materialize = opts->sort != LS_SORT_NONE;
+	item_source src;
+	if(source_open(&src, dir, materialize) < 0){
+		out_flush(out);
+		if(depth >= maxDepth){
+			display_error("ERROR: Invalid path: ", dir);
+		}else{
+			display_error("ERROR: Cannot open directory: ", dir);
+		}
+		return -1;
+	}
+	int err = 0, r = 0;
+	dir_item item;
+	int recurse = depth < maxDepth;
+	name_list subdirs = {NULL, 0, 0};
+	if(materialize){
+		err += print_with_metadata(dir, src.listing, opts, out) ? 1 : 0;
+	}else{
+		entry_chunk *chunk = opts->long_format ? malloc(sizeof(entry_chunk)) : NULL;
+		if(chunk != NULL){
+			chunk->count = chunk->names_len = 0;
+		}
+		int dirfd = chunk != NULL ? source_dirfd(&src, dir) : -1;
+		// nobody reads the output any more (ls | head), no need to go on.
+		while(!io_output_closed() && (r = source_next(&src, &item)) == 1){
+			// subdirectories are recursed into regardless of the filter.
+			if(recurse && item.d_type == DT_DIR && !is_dot_entry(item.name, item.len) &&
+			   name_list_add(&subdirs, item.name, item.len) < 0){
+				r = -1;
+				break;
+			}
+			// print the name of the file, given that it passes the filter.
+			if(!filter_match(opts->filter, item.name, item.len)){
+				continue;
+			}
+			if(opts->visit != NULL){
+				opts->visit(opts->visit_ctx, dir, item.name, item.len, item.d_type);
+			}else{
+				emit_entry(dirfd, chunk, item.name, item.len, item.d_type, out);
+			}
+		}
+		if(chunk != NULL){
+			chunk_flush(dirfd, chunk, out);
+			free(chunk);
+		}
+		if(r < 0){
+			err++;
+		}
+	}
+	// a materialized listing is already in memory, walking it again is free.
+	if(recurse && materialize && source_rewind(&src) == 0){
+		while(source_next(&src, &item) == 1){
+			// skip the parent and current directories:
+			if(item.d_type != DT_DIR || is_dot_entry(item.name, item.len)){
+				continue;
+			}
+			if(name_list_add(&subdirs, item.name, item.len) < 0){
+				err++;
+				break;
+			}
+		}
+	}
+	// the descriptor is not needed while recursing.
+	source_close(&src);
+	// recursive case: we have not reached the max depth.
+	for(size_t off = 0; off < subdirs.len && !io_output_closed(); off += strlen(subdirs.data + off) + 1){
+		// create the path to the directory.
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", dir, subdirs.data + off);
+		err += traverse_dir_depth(path, depth+1, maxDepth, opts, out);
+	}
+	free(subdirs.data);
+	return err;
+}
@@ -0,0 +1,41 @@
+#ifndef __TRAVERSE_H__
+#define __TRAVERSE_H__
+
+#include "filter.h"
+#include "io_helpers.h"
+
+// We'll make an assumption that the depth of the directory is at most 9999.
+// Directory depth is unlikely to be that deep.
+#define MAX_DEPTH 9999
+
+typedef enum {
+    LS_SORT_NONE,
+    LS_SORT_SIZE,     // largest first
+    LS_SORT_MTIME     // newest first
+} ls_sort;
+
+/* Type for entry visitors: called with every entry that passes the filter
+ * instead of printing it, so other builtins can reuse the walk.
+ */
+typedef void (*ls_visit)(void *ctx, const char *dir, const char *name, size_t len, unsigned char d_type);
+
+/* Everything a listing needs besides the directory itself.
+ */
+typedef struct ls_options {
+    const ls_filter *filter;
+    int long_format;
+    ls_sort sort;
+    // --sorted: byte order by name, spilling to disk past sort_budget bytes.
+    int sorted;
+    size_t sort_budget;
+    // when set, entries go to visit(visit_ctx, ...) and nothing is printed.
+    ls_visit visit;
+    void *visit_ctx;
+} ls_options;
+
+/* List dir (and its subdirectories up to maxDepth) into out.
+ * Return: 0 on success, or the number of directories that could not be read.
+ */
+int traverse_dir_depth(char *dir, int depth, int maxDepth, const ls_options *opts, out_buffer *out);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <linux/io_uring.h>
+
+/* A minimal io_uring wrapper on top of the raw syscalls (no liburing).
+ * The rings are mapped once in uring_init and reused for every batch.
+ */
+typedef struct uring {
+    int fd;
+    unsigned int sq_entries;
+    unsigned int cq_entries;
+    unsigned int features;
+    // submission ring
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_local_tail;
+    // completion ring
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    // mappings, kept for uring_exit
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+} uring;
+
+/* Set up a ring with room for entries submissions (flags go to io_uring_setup).
+ * Return: 0 on success and -1 if the kernel (or a seccomp filter) refuses io_uring.
+ */
+int uring_init(uring *ring, unsigned int entries, unsigned int flags);
+void uring_exit(uring *ring);
+
+/* Return: a zeroed submission queue entry, or NULL if the queue is full.
+ * Entries are only handed to the kernel by uring_submit.
+ */
+struct io_uring_sqe *uring_get_sqe(uring *ring);
+
+/* Submit every queued entry and wait for at least wait_nr completions.
+ * Return: number of entries submitted or -1 on error (errno is set).
+ */
+int uring_submit(uring *ring, unsigned int wait_nr);
+
+/* Return: the oldest unseen completion or NULL. Call uring_cqe_seen once done with it.
+ */
+struct io_uring_cqe *uring_peek_cqe(uring *ring);
+void uring_cqe_seen(uring *ring);
+
+/* Return: number of free slots left in the submission queue.
+ */
+unsigned int uring_sq_space(uring *ring);
+
+/* Call io_uring_register with opcode (an IORING_REGISTER_* value).
+ * Return: as the syscall, -1 on error with errno set.
+ */
+int uring_register(uring *ring, unsigned int opcode, void *arg, unsigned int nr_args);
+
+#endif
@@ -60,10 +60,9 @@ variable * createVar(char *name, char *value, variable *nextVar){
 	strncpy(v->name, name, strlen(name));
 	v->name[strlen(name)] = '\0';
 	// check for variable expansion.
-	char *varV;
 	if(strchr(value, '$') != NULL){
-		varV = decode_variable(value);
-		v->value = strndup(varV, strlen(varV));
+		// decode_variable already hands back a fresh string.
+		v->value = decode_variable(value);
 	}else{
 		v->value= malloc(strlen(value)+1);
 		v->value[strlen(value)] = '\0';
@@ -107,6 +106,9 @@ void updateVar(char *name, char *value){
 			}	
 			free(temp->value);
 			temp->value = strndup(varV, strlen(varV));
+			if(varV != value){
+				free(varV);
+			}
 			// printf("\nmatach found: %s\n", temp->value);
 			return;
 		}
@@ -140,6 +142,12 @@ char * getVar(char *name){
 	return "";
 }
 
+void visitVars(void (*visit)(void *ctx, const char *name, size_t len), void *ctx){
+	for(variable *currVar = varList; currVar != NULL; currVar = currVar->nextVar){
+		visit(ctx, currVar->name, strlen(currVar->name));
+	}
+}
+
 void freeVars(){
 	if(varList == NULL){
 		return;
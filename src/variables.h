@@ -1,6 +1,8 @@
 #ifndef __VARIABLES_H__
 #define __VARIABLES_H__
 
+#include <stddef.h>
+
 typedef struct variable variable;
 
 // Creates a new variable with the name <name> and value
@@ -14,5 +16,7 @@ void freeVars();
 int getVarLength(char *str);
 char * decode_variable(char *str);
 char * getBefore(char *str);
+// Calls visit with the name of every variable set.
+void visitVars(void (*visit)(void *ctx, const char *name, size_t len), void *ctx);
 
 #endif
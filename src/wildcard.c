@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "wildcard.h"
+#include "filter.h"
+
+/* State of one word's expansion: its components (split at /), each compiled
+ * once, and where the matches go.
+ */
+typedef struct glob_walk {
+    glob_cache *cache;
+    char **comps;
+    ls_filter *filters;
+    size_t comp_count;
+    // the word ended in /, so only directories match (and keep the /).
+    int dirs_only;
+    char ***out;
+    size_t *count;
+    size_t *cap;
+    int failed;
+} glob_walk;
+
+// ===== Listings =====
+
+static uint64_t path_hash(const char *path) {
+	uint64_t h = 14695981039346656037ull;
+	for (; *path != '\0'; path++) {
+		h = (h ^ (unsigned char) *path) * 1099511628211ull;
+	}
+	return h;
+}
+
+static int cache_grow(glob_cache *c) {
+	size_t slot_cap = c->slot_cap ? c->slot_cap * 2 : 64;
+	size_t *slots = calloc(slot_cap, sizeof(size_t));
+	glob_dir *dirs = realloc(c->dirs, sizeof(glob_dir) * (slot_cap / 2));
+	if (slots == NULL || dirs == NULL) {
+		free(slots);
+		if (dirs != NULL) c->dirs = dirs;
+		return -1;
+	}
+	c->dirs = dirs;
+	for (size_t i = 0; i < c->count; i++) {
+		size_t s = path_hash(dirs[i].path) & (slot_cap - 1);
+		while (slots[s] != 0) s = (s + 1) & (slot_cap - 1);
+		slots[s] = i + 1;
+	}
+	free(c->slots);
+	c->slots = slots;
+	c->slot_cap = slot_cap;
+	return 0;
+}
+
+/*
+ * Return: the listing of dir, read on first use and remembered for the rest
+ * of the line (an unreadable directory is remembered as NULL too).
+ */
+static dir_listing *cache_listing(glob_cache *c, const char *dir) {
+	if (c->slot_cap > 0) {
+		size_t s = path_hash(dir) & (c->slot_cap - 1);
+		while (c->slots[s] != 0) {
+			glob_dir *d = &c->dirs[c->slots[s] - 1];
+			if (!strcmp(d->path, dir)) {
+				return d->listing;
+			}
+			s = (s + 1) & (c->slot_cap - 1);
+		}
+	}
+	if ((c->count + 1) * 2 > c->slot_cap && cache_grow(c) < 0) {
+		return NULL;
+	}
+	char *path = strdup(dir);
+	if (path == NULL) {
+		return NULL;
+	}
+	dir_listing *l = dircache_get(dir);
+	size_t s = path_hash(dir) & (c->slot_cap - 1);
+	while (c->slots[s] != 0) s = (s + 1) & (c->slot_cap - 1);
+	c->dirs[c->count].path = path;
+	c->dirs[c->count].listing = l;
+	c->slots[s] = ++c->count;
+	return l;
+}
+
+void glob_cache_free(glob_cache *c) {
+	for (size_t i = 0; i < c->count; i++) {
+		free(c->dirs[i].path);
+		dir_listing_release(c->dirs[i].listing);
+	}
+	free(c->dirs);
+	free(c->slots);
+	memset(c, 0, sizeof(*c));
+}
+
+// ===== Matching =====
+
+int glob_is_pattern(const char *word) {
+	for (const char *p = word; *p != '\0'; p++) {
+		if (*p == '\\' && p[1] != '\0') {
+			p++;
+		} else if (*p == '*' || *p == '?' || (*p == '[' && strchr(p + 1, ']') != NULL)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void add_match(glob_walk *w, const char *path, size_t len) {
+	if (*w->count + 2 > *w->cap) {
+		size_t cap = *w->cap ? *w->cap * 2 : 64;
+		char **grown = realloc(*w->out, sizeof(char *) * cap);
+		if (grown == NULL) {
+			w->failed = 1;
+			return;
+		}
+		*w->out = grown;
+		*w->cap = cap;
+	}
+	char *copy = malloc(len + 2);
+	if (copy == NULL) {
+		w->failed = 1;
+		return;
+	}
+	memcpy(copy, path, len);
+	if (w->dirs_only) {
+		copy[len++] = '/';
+	}
+	copy[len] = '\0';
+	(*w->out)[(*w->count)++] = copy;
+}
+
+/*
+ * The listing's d_type says directory for most entries; only links and file
+ * systems that leave d_type unknown cost a stat.
+ */
+static int is_dir(unsigned char d_type, const char *path) {
+	struct stat st;
+	if (d_type == DT_DIR) {
+		return 1;
+	}
+	if (d_type != DT_LNK && d_type != DT_UNKNOWN) {
+		return 0;
+	}
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Match component i against the directory path[0..len) (empty for the
+ * current directory, otherwise ending in /), descending for the components
+ * left after it.
+ */
+static void walk(glob_walk *w, char *path, size_t len, size_t i) {
+	const char *comp = w->comps[i];
+	size_t comp_len = strlen(comp);
+	int last = i + 1 == w->comp_count;
+	if (w->failed) {
+		return;
+	}
+	if (w->filters[i].kind == FILTER_NONE) {
+		// a plain name is looked up directly, not searched for.
+		if (len + comp_len + 2 > PATH_MAX) {
+			return;
+		}
+		memcpy(path + len, comp, comp_len + 1);
+		struct stat st;
+		if (!last) {
+			path[len + comp_len] = '/';
+			walk(w, path, len + comp_len + 1, i + 1);
+		} else if (lstat(path, &st) == 0 && (!w->dirs_only || is_dir(DT_UNKNOWN, path))) {
+			add_match(w, path, len + comp_len);
+		}
+		return;
+	}
+	path[len] = '\0';
+	dir_listing *l = cache_listing(w->cache, len > 0 ? path : ".");
+	if (l == NULL) {
+		return;
+	}
+	int dotfiles = comp[0] == '.';
+	for (size_t k = 0; k < l->count && !w->failed; k++) {
+		const dir_item *item = &l->items[k];
+		if (item->name[0] == '.' && (!dotfiles || item->len == 1 || (item->len == 2 && item->name[1] == '.'))) {
+			continue;
+		}
+		if (!filter_match(&w->filters[i], item->name, item->len) || len + item->len + 2 > PATH_MAX) {
+			continue;
+		}
+		memcpy(path + len, item->name, item->len + 1);
+		if (last && !w->dirs_only) {
+			add_match(w, path, len + item->len);
+		} else if (is_dir(item->d_type, path)) {
+			if (last) {
+				add_match(w, path, len + item->len);
+			} else {
+				path[len + item->len] = '/';
+				walk(w, path, len + item->len + 1, i + 1);
+			}
+		}
+	}
+}
+
+static int compare_paths(const void *a, const void *b) {
+	// plain byte order, whatever the locale says.
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int glob_expand(glob_cache *cache, const char *word, char ***out, size_t *count, size_t *cap) {
+	char *copy = strdup(word);
+	size_t n = 0;
+	for (const char *p = word; *p != '\0'; p++) {
+		n += *p == '/';
+	}
+	char **comps = malloc(sizeof(char *) * (n + 1));
+	ls_filter *filters = calloc(n + 1, sizeof(ls_filter));
+	char *path = malloc(PATH_MAX);
+	glob_walk w = {cache, comps, filters, 0, 0, out, count, cap, 0};
+	size_t start = *count;
+	int ret = -1;
+	if (copy == NULL || comps == NULL || filters == NULL || path == NULL) {
+		goto done;
+	}
+	char *save = NULL;
+	for (char *c = strtok_r(copy, "/", &save); c != NULL; c = strtok_r(NULL, "/", &save)) {
+		if (glob_is_pattern(c) && filter_compile(&filters[w.comp_count], FILTER_GLOB, c) < 0) {
+			goto done;
+		}
+		comps[w.comp_count++] = c;
+	}
+	w.dirs_only = word[0] != '\0' && word[strlen(word) - 1] == '/';
+	if (w.comp_count > 0) {
+		size_t len = 0;
+		if (word[0] == '/') {
+			path[len++] = '/';
+		}
+		walk(&w, path, len, 0);
+	}
+	if (w.failed) {
+		for (size_t i = start; i < *count; i++) {
+			free((*out)[i]);
+		}
+		*count = start;
+		goto done;
+	}
+	qsort(*out + start, *count - start, sizeof(char *), compare_paths);
+	ret = (int) (*count - start);
+done:
+	for (size_t i = 0; i < w.comp_count; i++) {
+		filter_free(&filters[i]);
+	}
+	free(path);
+	free(filters);
+	free(comps);
+	free(copy);
+	return ret;
+}
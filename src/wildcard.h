@@ -0,0 +1,41 @@
+#ifndef __WILDCARD_H__
+#define __WILDCARD_H__
+
+#include <stddef.h>
+
+#include "dircache.h"
+
+/* Directories read while expanding one command line, so each of them is
+ * listed at most once no matter how many words look into it.
+ */
+typedef struct glob_dir {
+    char *path;
+    // NULL when the directory could not be read.
+    dir_listing *listing;
+} glob_dir;
+
+typedef struct glob_cache {
+    glob_dir *dirs;
+    size_t count;
+    // open addressing index into dirs (by path), holding index + 1.
+    size_t *slots;
+    size_t slot_cap;
+} glob_cache;
+
+/* Return: 1 if word has a *, ? or [ that makes it a pattern.
+ */
+int glob_is_pattern(const char *word);
+
+/* Expand the pattern word into the paths it matches, sorted bytewise, and
+ * add them (as strings the caller frees) to *out, which holds *count of *cap
+ * entries and is grown as needed. Names starting with . only match a pattern
+ * that starts with . too.
+ * Return: the number of paths added (0 if none match) or -1 on out of memory.
+ */
+int glob_expand(glob_cache *cache, const char *word, char ***out, size_t *count, size_t *cap);
+
+/* Release every listing the cache holds.
+ */
+void glob_cache_free(glob_cache *cache);
+
+#endif
@@ -0,0 +1,235 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "workpool.h"
+#include "io_helpers.h"
+
+// Batches smaller than this are not worth a thread start.
+#define WORKPOOL_MIN_BATCH 64
+
+typedef struct {
+    size_t n;
+    size_t next;     // next unclaimed item, shared between the workers
+    work_fn fn;
+    void *ctx;
+} work_batch;
+
+static void *worker(void *arg) {
+	work_batch *b = arg;
+	size_t i;
+	while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->n) {
+		b->fn(b->ctx, i);
+	}
+	return NULL;
+}
+
+int workpool_threads(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1) {
+		cpus = 1;
+	}
+	if (cpus > WORKPOOL_MAX_THREADS) {
+		cpus = WORKPOOL_MAX_THREADS;
+	}
+	return (int) cpus;
+}
+
+static void run_batch(size_t n, work_fn fn, void *ctx, size_t min_batch) {
+	work_batch b = {n, 0, fn, ctx};
+	int threads = workpool_threads();
+	if (n < min_batch || threads == 1) {
+		worker(&b);
+		return;
+	}
+	pthread_t tids[WORKPOOL_MAX_THREADS];
+	int started = 0;
+	// the calling thread works too, so start one fewer.
+	for (int t = 0; t < threads - 1; t++) {
+		if (pthread_create(&tids[started], NULL, worker, &b) == 0) {
+			started++;
+		}
+	}
+	worker(&b);
+	for (int t = 0; t < started; t++) {
+		pthread_join(tids[t], NULL);
+	}
+}
+
+void workpool_run(size_t n, work_fn fn, void *ctx) {
+	run_batch(n, fn, ctx, WORKPOOL_MIN_BATCH);
+}
+
+void workpool_run_tasks(size_t n, work_fn fn, void *ctx) {
+	run_batch(n, fn, ctx, 2);
+}
+
+// ===== Work stealing =====
+
+/* One thread's deque: tasks[head, tail) with the owner's end at tail.
+ */
+struct task_worker {
+    pthread_mutex_t lock;
+    void **tasks;
+    size_t head;
+    size_t tail;
+    size_t cap;
+    struct task_pool *pool;
+    int id;
+};
+
+typedef struct task_pool {
+    task_fn fn;
+    void *ctx;
+    task_worker workers[WORKPOOL_MAX_THREADS];
+    int threads;
+    // tasks pushed but not finished yet; the pool is done when it drops to 0.
+    size_t outstanding;
+    // idle workers sleep on idle until a push or the last task finishing.
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;
+    unsigned long pushes;
+    int sleeping;
+    // output of the thread that started the pool; the helpers print there too.
+    io_fds io;
+} task_pool;
+
+int task_push(task_worker *w, void *task) {
+	pthread_mutex_lock(&w->lock);
+	if (w->tail == w->cap) {
+		// slide the stolen-from front back before growing.
+		if (w->head > 0) {
+			memmove(w->tasks, w->tasks + w->head, (w->tail - w->head) * sizeof(void *));
+			w->tail -= w->head;
+			w->head = 0;
+		}
+		if (w->tail == w->cap) {
+			size_t cap = w->cap ? w->cap * 2 : 64;
+			void **tasks = realloc(w->tasks, cap * sizeof(void *));
+			if (tasks == NULL) {
+				pthread_mutex_unlock(&w->lock);
+				return -1;
+			}
+			w->tasks = tasks;
+			w->cap = cap;
+		}
+	}
+	w->tasks[w->tail++] = task;
+	__atomic_fetch_add(&w->pool->outstanding, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&w->lock);
+	// a sleeper bumps sleeping before checking pushes, we do the reverse,
+	// so either it sees this push or we see it and wake it.
+	task_pool *pool = w->pool;
+	__atomic_add_fetch(&pool->pushes, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pool->idle_lock);
+		pthread_cond_signal(&pool->idle);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+	return 0;
+}
+
+static void *take_task(task_worker *w, int steal) {
+	void *task = NULL;
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail) {
+		task = steal ? w->tasks[w->head++] : w->tasks[--w->tail];
+	}
+	pthread_mutex_unlock(&w->lock);
+	return task;
+}
+
+static void finish_task(task_pool *pool) {
+	if (__atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_ACQ_REL) == 0) {
+		// the last task is done: nothing can be pushed any more.
+		pthread_mutex_lock(&pool->idle_lock);
+		pthread_cond_broadcast(&pool->idle);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+}
+
+int task_help(task_worker *w) {
+	void *task = take_task(w, 0);
+	if (task == NULL) {
+		return 0;
+	}
+	w->pool->fn(w, task, w->pool->ctx);
+	finish_task(w->pool);
+	return 1;
+}
+
+static void *task_worker_main(void *arg) {
+	task_worker *w = arg;
+	task_pool *pool = w->pool;
+	if (w->id != 0) {
+		io_redirect(pool->io);
+	}
+	while (1) {
+		unsigned long seen = __atomic_load_n(&pool->pushes, __ATOMIC_SEQ_CST);
+		void *task = take_task(w, 0);
+		// own deque is empty: steal the oldest (shallowest) task of another.
+		for (int i = 1; task == NULL && i < pool->threads; i++) {
+			task = take_task(&pool->workers[(w->id + i) % pool->threads], 1);
+		}
+		if (task != NULL) {
+			pool->fn(w, task, pool->ctx);
+			finish_task(pool);
+			continue;
+		}
+		if (__atomic_load_n(&pool->outstanding, __ATOMIC_ACQUIRE) == 0) {
+			return NULL;
+		}
+		// someone is still running a task that may push more: sleep until
+		// something was pushed since the scan above or the pool is done.
+		pthread_mutex_lock(&pool->idle_lock);
+		__atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&pool->pushes, __ATOMIC_SEQ_CST) == seen &&
+		       __atomic_load_n(&pool->outstanding, __ATOMIC_ACQUIRE) != 0) {
+			pthread_cond_wait(&pool->idle, &pool->idle_lock);
+		}
+		__atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+}
+
+int task_pool_run(task_fn fn, void *ctx, void *first) {
+	task_pool *pool = calloc(1, sizeof(task_pool));
+	if (pool == NULL) {
+		return -1;
+	}
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->threads = workpool_threads();
+	pool->io = io_current();
+	pthread_mutex_init(&pool->idle_lock, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	for (int t = 0; t < pool->threads; t++) {
+		pthread_mutex_init(&pool->workers[t].lock, NULL);
+		pool->workers[t].pool = pool;
+		pool->workers[t].id = t;
+	}
+	// first counts as outstanding while it runs, so the helpers wait for its pushes.
+	pool->outstanding = 1;
+	pthread_t tids[WORKPOOL_MAX_THREADS];
+	int started = 0;
+	for (int t = 1; t < pool->threads; t++) {
+		if (pthread_create(&tids[started], NULL, task_worker_main, &pool->workers[t]) == 0) {
+			started++;
+		}
+	}
+	fn(&pool->workers[0], first, ctx);
+	finish_task(pool);
+	task_worker_main(&pool->workers[0]);
+	for (int t = 0; t < started; t++) {
+		pthread_join(tids[t], NULL);
+	}
+	for (int t = 0; t < pool->threads; t++) {
+		pthread_mutex_destroy(&pool->workers[t].lock);
+		free(pool->workers[t].tasks);
+	}
+	pthread_cond_destroy(&pool->idle);
+	pthread_mutex_destroy(&pool->idle_lock);
+	free(pool);
+	return 0;
+}
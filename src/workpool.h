@@ -0,0 +1,55 @@
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#include <stddef.h>
+
+// Upper bound on workpool_threads().
+#define WORKPOOL_MAX_THREADS 16
+
+/* Type for a unit of parallel work: handles item i of the batch.
+ */
+typedef void (*work_fn)(void *ctx, size_t i);
+
+/* Run fn(ctx, i) for every i in [0, n) across up to workpool_threads() threads.
+ * Small batches run on the calling thread. Returns once every item is done.
+ */
+void workpool_run(size_t n, work_fn fn, void *ctx);
+
+/* Same as workpool_run, for a handful of heavy items (one per thread, say):
+ * anything more than one item is spread over the threads.
+ */
+void workpool_run_tasks(size_t n, work_fn fn, void *ctx);
+
+/* Return: number of worker threads a batch may use (online cpus, capped).
+ */
+int workpool_threads(void);
+
+/* Work stealing pool for tasks that spawn more tasks (tree walks). Every
+ * thread keeps its own deque: it pushes and pops at the back, so it works
+ * depth first, while idle threads steal from the front of the others.
+ */
+typedef struct task_worker task_worker;
+
+/* Type for a task handler: runs one task, and may push more with task_push
+ * on the worker it was given.
+ */
+typedef void (*task_fn)(task_worker *w, void *task, void *ctx);
+
+/* Run first and every task pushed from it until none are left. first runs
+ * on the calling thread, so it can feed the pool while it prints.
+ * Return: 0 on success and -1 if the pool could not be set up.
+ */
+int task_pool_run(task_fn fn, void *ctx, void *first);
+
+/* Queue a task on w's own deque.
+ * Return: 0 on success and -1 on out of memory (the task is not queued).
+ */
+int task_push(task_worker *w, void *task);
+
+/* Run the newest task on w's own deque on the calling thread, so a task
+ * waiting on the ones it pushed can work instead of block.
+ * Return: 1 if a task ran and 0 if the deque was empty.
+ */
+int task_help(task_worker *w);
+
+#endif
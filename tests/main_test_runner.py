@@ -18,11 +18,13 @@ import tests_compile, tests_commands, tests_echo, tests_launch
 # Milestone 2 tests
 import tests_variables
 # Milestone 3 tests
-import tests_cat, tests_wc, tests_ls_cd
+import tests_cat, tests_wc, tests_ls_cd, tests_ls_filter, tests_ls_long, tests_plugins, tests_tee
+import tests_head_tail, tests_sort, tests_search, tests_du, tests_history
 # Milestone 4 tests
-import tests_builtins_pipes, tests_bash, tests_bg, tests_signals
+import tests_builtins_pipes, tests_bash, tests_bg, tests_signals, tests_substitution
+import tests_redirection, tests_glob
 # Milestone 5 tests 
-import tests_short_client, tests_long_client
+import tests_short_client, tests_long_client, tests_server
 
 student_submissions_path = os.path.dirname(os.path.abspath(__file__))+ "/../"
 
@@ -49,6 +51,15 @@ def run_milestone3_tests(comment_file_path, student_dir):
   tests_cat.test_cat_suite(comment_file_path, student_dir)
   tests_wc.test_wc_suite(comment_file_path, student_dir)
   tests_ls_cd.test_ls_cd_suite(comment_file_path, student_dir)
+  tests_ls_filter.test_ls_filter_suite(comment_file_path, student_dir)
+  tests_ls_long.test_ls_long_suite(comment_file_path, student_dir)
+  tests_plugins.test_plugins_suite(comment_file_path, student_dir)
+  tests_tee.test_tee_suite(comment_file_path, student_dir)
+  tests_head_tail.test_head_tail_suite(comment_file_path, student_dir)
+  tests_sort.test_sort_suite(comment_file_path, student_dir)
+  tests_search.test_search_suite(comment_file_path, student_dir)
+  tests_du.test_du_suite(comment_file_path, student_dir)
+  tests_history.test_history_suite(comment_file_path, student_dir)
 
 
 def run_milestone4_tests(comment_file_path, student_dir):
@@ -56,10 +67,14 @@ def run_milestone4_tests(comment_file_path, student_dir):
   tests_bash.test_bash_suite(comment_file_path, student_dir)
   tests_bg.test_bg_suite(comment_file_path, student_dir)
   tests_signals.test_signals_suite(comment_file_path, student_dir)
+  tests_substitution.test_substitution_suite(comment_file_path, student_dir)
+  tests_redirection.test_redirection_suite(comment_file_path, student_dir)
+  tests_glob.test_glob_suite(comment_file_path, student_dir)
 
 def run_milestone5_tests(comment_file_path, student_dir):
   tests_short_client.test_short_client_suite(comment_file_path, student_dir)
   tests_long_client.test_long_client_suite(comment_file_path, student_dir)
+  tests_server.test_server_suite(comment_file_path, student_dir)
 
 def run_tests(comment_file_path, student_dir):
   _helper_cd_to_student(student_dir)
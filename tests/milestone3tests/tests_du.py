@@ -0,0 +1,58 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _check_lines(comment_file_path, command, expected, stderr=False):
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, command)
+    lines = read_available_lines(p, p.stderr if stderr else None)
+    if lines != expected:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_du(comment_file_path, student_dir):
+  start_test(comment_file_path, "du prints the disk usage of each directory in kilobytes")
+  setup_dir = student_dir + "/dufolder"
+  remove_folder(setup_dir)
+  os.makedirs(setup_dir + "/inner")
+  with open(setup_dir + "/inner/data", "w") as f:
+    f.write("x" * 100000)
+  # the same sizes du -k reports, subdirectories first
+  expected = check_output(["du", "-k", "dufolder"], cwd=student_dir).decode().strip().split("\n")
+  _check_lines(comment_file_path, "du dufolder", expected)
+  remove_folder(setup_dir)
+
+
+def _test_du_missing(comment_file_path, student_dir):
+  start_test(comment_file_path, "du on a missing path reports an error")
+  _check_lines(comment_file_path, "du dumissing",
+               ["ERROR: Invalid path: dumissing", "ERROR: Builtin failed: du"], True)
+
+
+def _test_du_arguments(comment_file_path, student_dir):
+  start_test(comment_file_path, "du with more than one path reports an error")
+  _check_lines(comment_file_path, "du . ..",
+               ["ERROR: Too many arguments: du takes a single path", "ERROR: Builtin failed: du"], True)
+
+
+def test_du_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "du")
+  start_with_timeout(_test_du, comment_file_path, student_dir)
+  start_with_timeout(_test_du_missing, comment_file_path, student_dir)
+  start_with_timeout(_test_du_arguments, comment_file_path, student_dir)
+  end_suite(comment_file_path)
@@ -0,0 +1,72 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _write_lines(file_path):
+  with open(file_path, "w") as f:
+    f.write("one\ntwo\nthree\nfour\n")
+
+
+def _check_lines(comment_file_path, command, expected, stderr=False):
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, command)
+    lines = read_available_lines(p, p.stderr if stderr else None)
+    if lines != expected:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_head(comment_file_path, student_dir):
+  start_test(comment_file_path, "head -n prints the first lines of a file")
+  file_path = student_dir + "/headtailfile.txt"
+  _write_lines(file_path)
+  _check_lines(comment_file_path, "head -n 2 headtailfile.txt", ["one", "two"])
+  remove_file(file_path)
+
+
+def _test_tail(comment_file_path, student_dir):
+  start_test(comment_file_path, "tail -n prints the last lines of a file")
+  file_path = student_dir + "/headtailfile.txt"
+  _write_lines(file_path)
+  _check_lines(comment_file_path, "tail -n 3 headtailfile.txt", ["two", "three", "four"])
+  remove_file(file_path)
+
+
+def _test_head_pipe(comment_file_path, student_dir):
+  start_test(comment_file_path, "head reads from a pipe")
+  file_path = student_dir + "/headtailfile.txt"
+  _write_lines(file_path)
+  _check_lines(comment_file_path, "cat headtailfile.txt | head -n 1", ["one"])
+  remove_file(file_path)
+
+
+def _test_head_bad_count(comment_file_path, student_dir):
+  start_test(comment_file_path, "head with an invalid line count reports an error")
+  file_path = student_dir + "/headtailfile.txt"
+  _write_lines(file_path)
+  _check_lines(comment_file_path, "head -n x headtailfile.txt",
+               ["ERROR: Invalid line count: x", "ERROR: Builtin failed: head"], True)
+  remove_file(file_path)
+
+
+def test_head_tail_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "head and tail")
+  start_with_timeout(_test_head, comment_file_path, student_dir)
+  start_with_timeout(_test_tail, comment_file_path, student_dir)
+  start_with_timeout(_test_head_pipe, comment_file_path, student_dir)
+  start_with_timeout(_test_head_bad_count, comment_file_path, student_dir)
+  end_suite(comment_file_path)
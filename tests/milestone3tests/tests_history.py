@@ -0,0 +1,95 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _test_history(comment_file_path, student_dir):
+  start_test(comment_file_path, "history lists the commands kept in MYSH_HISTFILE")
+  history_path = student_dir + "/historyfile"
+  remove_folder(history_path)
+  # each test runs in its own process, so the environment change stays local
+  os.environ["MYSH_HISTFILE"] = history_path
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "echo hello history")
+    write_no_stdout_flush_wait(p, "history")
+    lines = read_available_lines(p)
+    if lines != ["hello history", "1  echo hello history", "2  history"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    if not os.path.exists(history_path):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(history_path)
+
+
+def _test_history_pipeline(comment_file_path, student_dir):
+  start_test(comment_file_path, "history on both sides of a pipe")
+  history_path = student_dir + "/historyfile"
+  remove_folder(history_path)
+  os.environ["MYSH_HISTFILE"] = history_path
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "echo hello history")
+    write_no_stdout_flush_wait(p, "history | history -s hello")
+    lines = read_available_lines(p)
+    if lines != ["hello history", "history | history -s hello", "echo hello history"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(history_path)
+
+
+def _test_history_not_interactive(comment_file_path, student_dir):
+  start_test(comment_file_path, "a non-interactive shell does not write a history file")
+  home_dir = student_dir + "/historyhome"
+  remove_folder(home_dir)
+  os.mkdir(home_dir)
+  os.environ.pop("MYSH_HISTFILE", None)
+  os.environ["HOME"] = home_dir
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "echo hello history")
+    write_no_stdout_flush_wait(p, "history")
+    errors = read_available_lines(p, p.stderr)
+    if errors != ["ERROR: History is unavailable", "ERROR: Builtin failed: history"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    if os.listdir(home_dir) != []:
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(home_dir)
+
+
+def test_history_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "history")
+  start_with_timeout(_test_history, comment_file_path, student_dir)
+  start_with_timeout(_test_history_pipeline, comment_file_path, student_dir)
+  start_with_timeout(_test_history_not_interactive, comment_file_path, student_dir)
+  end_suite(comment_file_path)
@@ -0,0 +1,99 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _setup_names(setup_dir):
+  remove_folder(setup_dir)
+  os.mkdir(setup_dir)
+  for name in ["apple.txt", "apricot.log", "banana.txt", "aXbXc", "abab.c", "cherry.md"]:
+    open(setup_dir + "/" + name, "w").close()
+
+
+def _check_names(comment_file_path, student_dir, command, expected, stderr=False):
+  setup_dir = student_dir + "/lsfilterfolder"
+  _setup_names(setup_dir)
+  # ls prints the entries in directory order
+  with open(student_dir + "/lsfilterpattern.txt", "w") as f:
+    f.write("rry|^ban\n")
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, command)
+    lines = read_available_lines(p, p.stderr if stderr else None)
+    if (lines if stderr else sorted(lines)) != expected:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+    remove_file(student_dir + "/lsfilterpattern.txt")
+
+
+def _test_glob_star(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --glob matches a literal prefix and a star")
+  _check_names(comment_file_path, student_dir, "ls lsfilterfolder --glob a*.txt", ["apple.txt"])
+
+
+def _test_glob_backtracking(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --glob retries from the last star on a mismatch")
+  _check_names(comment_file_path, student_dir, "ls lsfilterfolder --glob *a*b*c", ["aXbXc", "abab.c"])
+
+
+def _test_glob_sets(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --glob supports sets and negated sets")
+  _check_names(comment_file_path, student_dir, "ls lsfilterfolder --glob [!a]*.??",
+               ["cherry.md"])
+
+
+def _test_regex_prefix(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --regex with an anchored literal prefix")
+  _check_names(comment_file_path, student_dir, "ls lsfilterfolder --regex ^ap",
+               ["apple.txt", "apricot.log"])
+
+
+def _test_regex_required(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --regex with a quantified literal")
+  _check_names(comment_file_path, student_dir, "ls lsfilterfolder --regex an+a\\.", ["banana.txt"])
+
+
+def _test_regex_alternation(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --regex with | matches either branch")
+  # the pattern comes from a substitution so the | is not read as a pipe
+  _check_names(comment_file_path, student_dir, "ls lsfilterfolder --regex $(cat lsfilterpattern.txt)",
+               ["banana.txt", "cherry.md"])
+
+
+def _test_regex_invalid(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --regex with an invalid expression reports an error")
+  _check_names(comment_file_path, student_dir, "ls lsfilterfolder --regex (",
+               ["ERROR: Invalid filter: (", "ERROR: Builtin failed: ls"], True)
+
+
+def _test_filters_differ(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls with two different filters reports an error")
+  _check_names(comment_file_path, student_dir, "ls lsfilterfolder --glob a* --regex a",
+               ["ERROR: Filters differ: a", "ERROR: Builtin failed: ls"], True)
+
+
+def test_ls_filter_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "ls glob and regex filters")
+  start_with_timeout(_test_glob_star, comment_file_path, student_dir)
+  start_with_timeout(_test_glob_backtracking, comment_file_path, student_dir)
+  start_with_timeout(_test_glob_sets, comment_file_path, student_dir)
+  start_with_timeout(_test_regex_prefix, comment_file_path, student_dir)
+  start_with_timeout(_test_regex_required, comment_file_path, student_dir)
+  start_with_timeout(_test_regex_alternation, comment_file_path, student_dir)
+  start_with_timeout(_test_regex_invalid, comment_file_path, student_dir)
+  start_with_timeout(_test_filters_differ, comment_file_path, student_dir)
+  end_suite(comment_file_path)
@@ -0,0 +1,140 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _setup_sizes(setup_dir):
+  remove_folder(setup_dir)
+  os.mkdir(setup_dir)
+  with open(setup_dir + "/big", "w") as f:
+    f.write("x" * 5000)
+  with open(setup_dir + "/small", "w") as f:
+    f.write("x\n")
+
+
+def _test_ls_long(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls -l prints the mode, size and name of each entry")
+  setup_dir = student_dir + "/lslongfolder"
+  _setup_sizes(setup_dir)
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "ls -l lslongfolder")
+    lines = read_available_lines(p)
+    small = [line for line in lines if line.endswith(" small")]
+    big = [line for line in lines if line.endswith(" big")]
+    if len(small) != 1 or len(big) != 1:
+      finish(comment_file_path, "NOT OK")
+      return
+    if not small[0].startswith("-rw") or " 2 " not in small[0] or " 5000 " not in big[0]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+
+
+def _test_ls_sort_size(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --sort=size lists the largest files first")
+  setup_dir = student_dir + "/lslongfolder"
+  _setup_sizes(setup_dir)
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "ls lslongfolder --sort=size")
+    lines = read_available_lines(p)
+    if "big" not in lines or "small" not in lines or lines.index("big") > lines.index("small"):
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+
+
+def _test_ls_sorted(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --sorted lists entries by name")
+  setup_dir = student_dir + "/lslongfolder"
+  _setup_sizes(setup_dir)
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "ls lslongfolder --sorted")
+    lines = read_available_lines(p)
+    if lines != [".", "..", "big", "small"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+
+
+def _test_ls_sorted_recursive(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls --sorted --rec visits subdirectories in name order")
+  setup_dir = student_dir + "/lslongfolder"
+  remove_folder(setup_dir)
+  os.makedirs(setup_dir + "/b/y")
+  os.makedirs(setup_dir + "/a/x")
+  for name in ["b/f2", "a/f1", "c"]:
+    open(setup_dir + "/" + name, "w").close()
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "ls lslongfolder --sorted --rec")
+    lines = read_available_lines(p)
+    expected = [".", "..", "a", "b", "c", ".", "..", "f1", "x", ".", "..",
+                ".", "..", "f2", "y", ".", ".."]
+    if lines != expected:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+
+
+def _test_ls_bad_sort_key(comment_file_path, student_dir):
+  start_test(comment_file_path, "ls with an unknown sort key reports an error")
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "ls --sort=bogus")
+    errors = read_available_lines(p, p.stderr)
+    if errors != ["ERROR: Invalid sort key: bogus", "ERROR: Builtin failed: ls"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def test_ls_long_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "ls long listing and sorting")
+  start_with_timeout(_test_ls_long, comment_file_path, student_dir)
+  start_with_timeout(_test_ls_sort_size, comment_file_path, student_dir)
+  start_with_timeout(_test_ls_sorted, comment_file_path, student_dir)
+  start_with_timeout(_test_ls_sorted_recursive, comment_file_path, student_dir)
+  start_with_timeout(_test_ls_bad_sort_key, comment_file_path, student_dir)
+  end_suite(comment_file_path)
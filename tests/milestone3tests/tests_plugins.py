@@ -0,0 +1,96 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+PLUGIN_SOURCE = """
+#include "plugins.h"
+
+static const plugin_api *shell;
+
+static ssize_t greet(char **tokens) {
+    shell->display_message("greetings from ");
+    shell->display_message(tokens[1] != NULL ? tokens[1] : "nobody");
+    shell->display_message("\\n");
+    return 0;
+}
+
+int mysh_plugin_init(const plugin_api *api) {
+    shell = api;
+    if (api->version != PLUGIN_API_VERSION) {
+        return -1;
+    }
+    // the core builtins and names the tokenizer would split are refused.
+    if (api->register_builtin("echo", greet) == 0 || api->register_builtin("bad|name", greet) == 0) {
+        return -1;
+    }
+    return api->register_builtin("greet", greet);
+}
+"""
+
+
+def _build_plugin(student_dir):
+  source_path = student_dir + "/testplugin.c"
+  with open(source_path, "w") as f:
+    f.write(PLUGIN_SOURCE)
+  check_output(["gcc", "-shared", "-fPIC", "-I", student_dir, "-o", student_dir + "/testplugin.so", source_path])
+  remove_file(source_path)
+  return student_dir + "/testplugin.so"
+
+
+def _test_plugin(comment_file_path, student_dir):
+  start_test(comment_file_path, "A plugin from MYSH_PLUGINS registers a builtin")
+  try:
+    # each test runs in its own process, so the environment change stays local
+    os.environ["MYSH_PLUGINS"] = _build_plugin(student_dir)
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "greet plugins")
+    write_no_stdout_flush_wait(p, "echo still core")
+    lines = read_available_lines(p)
+    errors = read_available_lines(p, p.stderr)
+    if lines != ["greetings from plugins", "still core"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if errors != ["ERROR: Builtin already exists: echo", "ERROR: Invalid builtin name: bad|name"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_file(student_dir + "/testplugin.so")
+
+
+def _test_plugin_missing(comment_file_path, student_dir):
+  start_test(comment_file_path, "A plugin that cannot be loaded is reported and skipped")
+  os.environ["MYSH_PLUGINS"] = student_dir + "/missingplugin.so"
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "echo started")
+    lines = read_available_lines(p)
+    errors = read_available_lines(p, p.stderr)
+    if lines != ["started"] or len(errors) != 1 or not errors[0].startswith("ERROR: Cannot load plugin: "):
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def test_plugins_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "Builtin plugins")
+  start_with_timeout(_test_plugin, comment_file_path, student_dir)
+  start_with_timeout(_test_plugin_missing, comment_file_path, student_dir)
+  end_suite(comment_file_path)
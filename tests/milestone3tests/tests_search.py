@@ -0,0 +1,112 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _setup_haystack(setup_dir):
+  remove_folder(setup_dir)
+  os.mkdir(setup_dir)
+  with open(setup_dir + "/hay.txt", "w") as f:
+    f.write("searchf* literal\nother\nsearchfolder word\n")
+
+
+def _check_lines(comment_file_path, student_dir, command, expected, stderr=False):
+  setup_dir = student_dir + "/searchfolder"
+  _setup_haystack(setup_dir)
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, command)
+    lines = read_available_lines(p, p.stderr if stderr else None)
+    if lines != expected:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+
+
+def _test_search(comment_file_path, student_dir):
+  start_test(comment_file_path, "search prints the file, line number and matching line")
+  _check_lines(comment_file_path, student_dir, "search other searchfolder",
+               ["searchfolder/hay.txt:2:other"])
+
+
+def _test_search_regex(comment_file_path, student_dir):
+  start_test(comment_file_path, "search -E matches a regular expression")
+  _check_lines(comment_file_path, student_dir, "search -E ^searchfo.*d$ searchfolder",
+               ["searchfolder/hay.txt:3:searchfolder word"])
+
+
+def _test_search_not_globbed(comment_file_path, student_dir):
+  start_test(comment_file_path, "search's pattern is not expanded as a glob")
+  _check_lines(comment_file_path, student_dir, "search searchf* searchfolder",
+               ["searchfolder/hay.txt:1:searchf* literal"])
+
+
+def _test_search_many_files(comment_file_path, student_dir):
+  start_test(comment_file_path, "search prints every match once across hundreds of files")
+  setup_dir = student_dir + "/searchfolder"
+  remove_folder(setup_dir)
+  expected = []
+  for d in range(6):
+    os.makedirs(setup_dir + "/dir" + str(d))
+    for f in range(100):
+      path = "searchfolder/dir%d/file%d.txt" % (d, f)
+      with open(student_dir + "/" + path, "w") as fh:
+        fh.write("hay\nneedle %d %d\nhay\nneedle again\n" % (d, f))
+      expected += [path + ":2:needle %d %d" % (d, f), path + ":4:needle again"]
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "search needle searchfolder")
+    sleep(1)
+    lines = read_available_lines(p)
+    if sorted(lines) != sorted(expected):
+      finish(comment_file_path, "NOT OK")
+      return
+    # the two lines of a file are printed together, in line order.
+    for i in range(0, len(lines), 2):
+      if lines[i].split(":")[0] != lines[i + 1].split(":")[0] or ":2:" not in lines[i]:
+        finish(comment_file_path, "NOT OK")
+        return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+
+
+def _test_search_bad_regex(comment_file_path, student_dir):
+  start_test(comment_file_path, "search -E with an invalid expression reports an error")
+  _check_lines(comment_file_path, student_dir, "search -E ( searchfolder",
+               ["ERROR: Invalid pattern: (", "ERROR: Builtin failed: search"], True)
+
+
+def _test_search_no_pattern(comment_file_path, student_dir):
+  start_test(comment_file_path, "search without a pattern reports an error")
+  _check_lines(comment_file_path, student_dir, "search",
+               ["ERROR: No search pattern provided", "ERROR: Builtin failed: search"], True)
+
+
+def test_search_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "search")
+  start_with_timeout(_test_search, comment_file_path, student_dir)
+  start_with_timeout(_test_search_regex, comment_file_path, student_dir)
+  start_with_timeout(_test_search_not_globbed, comment_file_path, student_dir)
+  start_with_timeout(_test_search_many_files, comment_file_path, student_dir)
+  start_with_timeout(_test_search_bad_regex, comment_file_path, student_dir)
+  start_with_timeout(_test_search_no_pattern, comment_file_path, student_dir)
+  end_suite(comment_file_path)
@@ -0,0 +1,72 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _write_records(file_path):
+  with open(file_path, "w") as f:
+    f.write("bb 2\naa 10\ncc 1\naa 10\n")
+
+
+def _check_lines(comment_file_path, command, expected, stderr=False):
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, command)
+    lines = read_available_lines(p, p.stderr if stderr else None)
+    if lines != expected:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_sort(comment_file_path, student_dir):
+  start_test(comment_file_path, "sort orders the lines of a file")
+  file_path = student_dir + "/sortfile.txt"
+  _write_records(file_path)
+  _check_lines(comment_file_path, "sort sortfile.txt", ["aa 10", "aa 10", "bb 2", "cc 1"])
+  remove_file(file_path)
+
+
+def _test_sort_numeric_key(comment_file_path, student_dir):
+  start_test(comment_file_path, "sort -n -k orders by a numeric field")
+  file_path = student_dir + "/sortfile.txt"
+  _write_records(file_path)
+  _check_lines(comment_file_path, "sort -n -k 2 sortfile.txt", ["cc 1", "bb 2", "aa 10", "aa 10"])
+  remove_file(file_path)
+
+
+def _test_sort_unique(comment_file_path, student_dir):
+  start_test(comment_file_path, "sort -u drops repeated lines")
+  file_path = student_dir + "/sortfile.txt"
+  _write_records(file_path)
+  _check_lines(comment_file_path, "cat sortfile.txt | sort -u", ["aa 10", "bb 2", "cc 1"])
+  remove_file(file_path)
+
+
+def _test_sort_bad_option(comment_file_path, student_dir):
+  start_test(comment_file_path, "sort with an unknown option reports an error")
+  file_path = student_dir + "/sortfile.txt"
+  _write_records(file_path)
+  _check_lines(comment_file_path, "sort -z sortfile.txt",
+               ["ERROR: Unknown sort option: -z", "ERROR: Builtin failed: sort"], True)
+  remove_file(file_path)
+
+
+def test_sort_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "sort")
+  start_with_timeout(_test_sort, comment_file_path, student_dir)
+  start_with_timeout(_test_sort_numeric_key, comment_file_path, student_dir)
+  start_with_timeout(_test_sort_unique, comment_file_path, student_dir)
+  start_with_timeout(_test_sort_bad_option, comment_file_path, student_dir)
+  end_suite(comment_file_path)
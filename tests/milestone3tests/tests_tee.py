@@ -0,0 +1,57 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _test_tee(comment_file_path, student_dir):
+  start_test(comment_file_path, "tee copies its input to stdout and to a file")
+  file_path = student_dir + "/teefile.txt"
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "echo hello tee | tee teefile.txt")
+    lines = read_available_lines(p)
+    if lines != ["hello tee"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    with open(file_path) as f:
+      if f.read() != "hello tee\n":
+        finish(comment_file_path, "NOT OK")
+        return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_file(file_path)
+
+
+def _test_tee_bad_file(comment_file_path, student_dir):
+  start_test(comment_file_path, "tee into a missing directory reports an error")
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "echo hello | tee teemissing/out.txt")
+    errors = read_available_lines(p, p.stderr)
+    if errors != ["ERROR: Cannot open file: teemissing/out.txt", "ERROR: Builtin failed: tee"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def test_tee_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "tee")
+  start_with_timeout(_test_tee, comment_file_path, student_dir)
+  start_with_timeout(_test_tee_bad_file, comment_file_path, student_dir)
+  end_suite(comment_file_path)
@@ -356,6 +356,79 @@ def _test_echo_cat_wc(comment_file_path, student_dir, command_wait=0.05):
 
 
 
+# Pipes that stop early
+
+def _test_tail_follow_head(comment_file_path, student_dir, command_wait=0.05):
+    start_test(comment_file_path, "tail -f stops once the reader of its pipe is gone")
+    file_path = student_dir + "/followfile.txt"
+    fptr = open(file_path, "w")
+    fptr.write("line1\nline2\nline3\n")
+    fptr.close()
+
+    try:
+        p = start('./mysh')
+        write_no_stdout_flush_wait(p, "tail -n 2 -f followfile.txt | head -n 1")
+        sleep(1)
+        write_no_stdout_flush_wait(p, "echo done")
+        if read_available_lines(p) != ["line2", "done"]:
+            finish(comment_file_path, "NOT OK")
+            return
+        finish(comment_file_path, "OK")
+    except Exception as e:
+        finish(comment_file_path, "NOT OK")
+    finally:
+        remove_file(file_path)
+
+def _test_ls_rec_head(comment_file_path, student_dir, command_wait=0.05):
+    start_test(comment_file_path, "ls --rec stops walking once head has its lines")
+    folder_path = student_dir + "/headfolder"
+    remove_folder(folder_path)
+    for i in range(40):
+        os.makedirs(folder_path + "/inner" + str(i))
+        for j in range(50):
+            open(folder_path + "/inner" + str(i) + "/file" + str(j), "w").close()
+
+    try:
+        p = start('./mysh')
+        write_no_stdout_flush_wait(p, "ls headfolder --rec | head -n 1")
+        sleep(0.5)
+        write_no_stdout_flush_wait(p, "echo done")
+        lines = read_available_lines(p)
+        if len(lines) != 2 or lines[1] != "done":
+            finish(comment_file_path, "NOT OK")
+            return
+        if has_memory_leaks(p):
+            finish(comment_file_path, "NOT OK")
+            return
+        finish(comment_file_path, "OK")
+    except Exception as e:
+        finish(comment_file_path, "NOT OK")
+    finally:
+        remove_folder(folder_path)
+
+def _test_cat_sort_head(comment_file_path, student_dir, command_wait=0.05):
+    start_test(comment_file_path, "sort in the middle of a pipe")
+    file_path = student_dir + "/sortpipefile.txt"
+    fptr = open(file_path, "w")
+    fptr.write("cherry\napple\nbanana\n")
+    fptr.close()
+
+    try:
+        p = start('./mysh')
+        write_no_stdout_flush_wait(p, "cat sortpipefile.txt | sort | head -n 2")
+        if read_available_lines(p) != ["apple", "banana"]:
+            finish(comment_file_path, "NOT OK")
+            return
+        if has_memory_leaks(p):
+            finish(comment_file_path, "NOT OK")
+            return
+        finish(comment_file_path, "OK")
+    except Exception as e:
+        finish(comment_file_path, "NOT OK")
+    finally:
+        remove_file(file_path)
+
+
 def test_builtin_pipes_suite(comment_file_path, student_dir):
     start_suite(comment_file_path, "Sample echo pipes")
     start_with_timeout(_test_echo_pipe, comment_file_path,  student_dir)
@@ -400,6 +473,12 @@ def test_builtin_pipes_suite(comment_file_path, student_dir):
     start_with_timeout(_test_echo_cat_wc, comment_file_path, student_dir)
     end_suite(comment_file_path)
 
+    start_suite(comment_file_path, "Pipes that stop early")
+    start_with_timeout(_test_tail_follow_head, comment_file_path, student_dir)
+    start_with_timeout(_test_ls_rec_head, comment_file_path, student_dir)
+    start_with_timeout(_test_cat_sort_head, comment_file_path, student_dir)
+    end_suite(comment_file_path)
+
     
     remove_folder(student_dir + "/testfolder")
     
@@ -0,0 +1,70 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _setup_glob(setup_dir):
+  remove_folder(setup_dir)
+  os.mkdir(setup_dir)
+  for name in ["b.txt", "a.txt", "c.log"]:
+    with open(setup_dir + "/" + name, "w") as f:
+      f.write(name + " contents\n")
+
+
+def _check_lines(comment_file_path, student_dir, command, expected):
+  setup_dir = student_dir + "/globfolder"
+  _setup_glob(setup_dir)
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, command)
+    lines = read_available_lines(p)
+    if lines != expected:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+
+
+def _test_glob_star(comment_file_path, student_dir):
+  start_test(comment_file_path, "* expands to the sorted matching paths")
+  _check_lines(comment_file_path, student_dir, "echo globfolder/*.txt",
+               ["globfolder/a.txt globfolder/b.txt"])
+
+
+def _test_glob_question(comment_file_path, student_dir):
+  start_test(comment_file_path, "? matches a single character")
+  _check_lines(comment_file_path, student_dir, "echo globfolder/?.log",
+               ["globfolder/c.log"])
+
+
+def _test_glob_no_match(comment_file_path, student_dir):
+  start_test(comment_file_path, "a pattern without matches is kept as written")
+  _check_lines(comment_file_path, student_dir, "echo globfolder/*.none",
+               ["globfolder/*.none"])
+
+
+def _test_glob_builtin_argument(comment_file_path, student_dir):
+  start_test(comment_file_path, "an expanded path is passed to a builtin")
+  _check_lines(comment_file_path, student_dir, "cat globfolder/c.*",
+               ["c.log contents"])
+
+
+def test_glob_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "Globbing")
+  start_with_timeout(_test_glob_star, comment_file_path, student_dir)
+  start_with_timeout(_test_glob_question, comment_file_path, student_dir)
+  start_with_timeout(_test_glob_no_match, comment_file_path, student_dir)
+  start_with_timeout(_test_glob_builtin_argument, comment_file_path, student_dir)
+  end_suite(comment_file_path)
@@ -0,0 +1,124 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _test_redirect_output(comment_file_path, student_dir):
+  start_test(comment_file_path, "> truncates and >> appends to a file")
+  file_path = student_dir + "/redirfile.txt"
+  with open(file_path, "w") as f:
+    f.write("old contents\n")
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "echo first > redirfile.txt")
+    write_no_stdout_flush_wait(p, "echo second >> redirfile.txt")
+    if read_available_lines(p) != []:
+      finish(comment_file_path, "NOT OK")
+      return
+    with open(file_path) as f:
+      if f.read() != "first\nsecond\n":
+        finish(comment_file_path, "NOT OK")
+        return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_file(file_path)
+
+
+def _test_redirect_input(comment_file_path, student_dir):
+  start_test(comment_file_path, "< feeds a file to a builtin")
+  file_path = student_dir + "/redirfile.txt"
+  with open(file_path, "w") as f:
+    f.write("one two\nthree\n")
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "wc < redirfile.txt")
+    lines = read_available_lines(p)
+    if lines != ["word count 3", "character count 14", "newline count 2"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_file(file_path)
+
+
+def _test_redirect_stderr(comment_file_path, student_dir):
+  start_test(comment_file_path, "2> sends a builtin's errors to a file")
+  file_path = student_dir + "/redirerrors.txt"
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "cat redirmissing.txt 2> redirerrors.txt")
+    if read_available_lines(p, p.stderr) != []:
+      finish(comment_file_path, "NOT OK")
+      return
+    with open(file_path) as f:
+      if f.read() != "ERROR: Cannot open file: redirmissing.txt\nERROR: Builtin failed: cat\n":
+        finish(comment_file_path, "NOT OK")
+        return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_file(file_path)
+
+
+def _test_redirect_missing_input(comment_file_path, student_dir):
+  start_test(comment_file_path, "< from a missing file reports an error")
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "wc < redirmissing.txt")
+    errors = read_available_lines(p, p.stderr)
+    if errors != ["ERROR: Cannot open file: redirmissing.txt"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_redirect_no_file(comment_file_path, student_dir):
+  start_test(comment_file_path, "a redirection without a file name reports an error")
+  try:
+    p = start('./mysh')
+    write_no_stdout_flush_wait(p, "echo hello >")
+    errors = read_available_lines(p, p.stderr)
+    if errors != ["ERROR: No file given for redirection: >"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def test_redirection_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "Redirection")
+  start_with_timeout(_test_redirect_output, comment_file_path, student_dir)
+  start_with_timeout(_test_redirect_input, comment_file_path, student_dir)
+  start_with_timeout(_test_redirect_stderr, comment_file_path, student_dir)
+  start_with_timeout(_test_redirect_missing_input, comment_file_path, student_dir)
+  start_with_timeout(_test_redirect_no_file, comment_file_path, student_dir)
+  end_suite(comment_file_path)
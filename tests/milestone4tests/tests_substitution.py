@@ -0,0 +1,129 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep
+import subprocess
+import multiprocessing
+from tests_helpers import *
+
+
+def _check_lines(comment_file_path, commands, expected):
+  try:
+    p = start('./mysh')
+    for command in commands:
+      write_no_stdout_flush_wait(p, command)
+    lines = read_available_lines(p)
+    if lines != expected:
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_substitution_echo(comment_file_path, student_dir):
+  start_test(comment_file_path, "A substitution is replaced by the command's output")
+  _check_lines(comment_file_path, ["echo $(echo inner) outer"], ["inner outer"])
+
+
+def _test_substitution_pipeline(comment_file_path, student_dir):
+  start_test(comment_file_path, "A substitution can run a pipeline")
+  _check_lines(comment_file_path, ["echo $(echo one two | wc)"],
+               ["word count 2 character count 8 newline count 1"])
+
+
+def _test_substitution_assignment(comment_file_path, student_dir):
+  start_test(comment_file_path, "A substitution can be assigned to a variable")
+  _check_lines(comment_file_path, ["value=$(echo assigned)", "echo $value"], ["assigned"])
+
+
+def _test_substitution_control_bytes(comment_file_path, student_dir):
+  start_test(comment_file_path, "Control bytes, typed or substituted, are kept as they are")
+  file_path = student_dir + "/substfile.txt"
+  with open(file_path, "w") as f:
+    f.write("a\x19\x1a\x1c\x1d\x1e\x1fb\n")
+  try:
+    _check_lines(comment_file_path, ["echo $(cat substfile.txt)", "echo c\x1d\x19d"],
+                 ["a\x19\x1a\x1c\x1d\x1e\x1fb", "c\x1d\x19d"])
+  finally:
+    remove_file(file_path)
+
+
+def _test_substitution_typed_operators(comment_file_path, student_dir):
+  start_test(comment_file_path, "Operators typed next to a substitution still apply")
+  file_path = student_dir + "/substfile.txt"
+  with open(file_path, "w") as f:
+    f.write("one two\n")
+  try:
+    _check_lines(comment_file_path, ["echo $(cat substfile.txt) >$(echo substfile.txt)",
+                                     "cat $(echo substfile.txt)|wc"],
+                 ["word count 2", "character count 8", "newline count 1"])
+  finally:
+    remove_file(file_path)
+
+
+def _test_substitution_operators(comment_file_path, student_dir):
+  start_test(comment_file_path, "Operators in substituted output are printed, not run")
+  file_path = student_dir + "/substfile.txt"
+  with open(file_path, "w") as f:
+    f.write("a | wc > out & b < in\n")
+
+  try:
+    p = start('./mysh')
+    write(p, "echo $(cat substfile.txt)")
+    output = read_stdout(p).replace('mysh$ ', '')
+    if output != "a | wc > out & b < in" or os.path.exists(student_dir + "/out"):
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_file(file_path)
+
+
+def _test_substitution_cd(comment_file_path, student_dir):
+  start_test(comment_file_path, "cd inside a substitution does not change the shell's directory")
+  setup_dir = student_dir + "/substfolder"
+  remove_folder(setup_dir)
+  os.mkdir(setup_dir)
+  open(setup_dir + "/inner.txt", "w").close()
+  try:
+    p = start('./mysh')
+    write(p, "echo $(cd substfolder)")
+    sleep(0.1)
+    write(p, "ls substfolder --f inner")
+    # the first line is the empty output of the substitution.
+    output = read_stdout(p).replace('mysh$', '').strip()
+    output = output if output else read_stdout(p).replace('mysh$', '').strip()
+    if output != "inner.txt":
+      finish(comment_file_path, "NOT OK")
+      return
+    if has_memory_leaks(p):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+  finally:
+    remove_folder(setup_dir)
+
+
+def test_substitution_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "Command substitution")
+  start_with_timeout(_test_substitution_echo, comment_file_path, student_dir)
+  start_with_timeout(_test_substitution_pipeline, comment_file_path, student_dir)
+  start_with_timeout(_test_substitution_assignment, comment_file_path, student_dir)
+  start_with_timeout(_test_substitution_operators, comment_file_path, student_dir)
+  start_with_timeout(_test_substitution_control_bytes, comment_file_path, student_dir)
+  start_with_timeout(_test_substitution_typed_operators, comment_file_path, student_dir)
+  start_with_timeout(_test_substitution_cd, comment_file_path, student_dir)
+  end_suite(comment_file_path)
@@ -0,0 +1,372 @@
+from subprocess import CalledProcessError, STDOUT, check_output, TimeoutExpired, Popen, PIPE
+import os
+import datetime
+import sys
+sys.path.append("..")
+from time import sleep, monotonic
+import subprocess
+import multiprocessing
+from tests_helpers import *
+import socketserver
+import socket
+import threading
+import re
+import struct
+
+
+def get_free_port():
+  with socketserver.TCPServer(("localhost", 0), None) as s:
+    free_port = s.server_address[1]
+  sleep(0.2)
+  return free_port
+
+
+def _start_server(options=""):
+  # the server shows every message it passes on; nothing here reads them.
+  p = Popen(['./mysh'], stdin=PIPE, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+  port = get_free_port()
+  write_no_stdout_flush(p, "start-server {} {}".format(port, options))
+  sleep(0.5)
+  return p, port
+
+
+def _stop_server(p):
+  write_no_stdout_flush(p, "close-server")
+  write_no_stdout_flush(p, "exit")
+
+
+def _connect(port):
+  return socket.create_connection(("127.0.0.1", port), timeout=2)
+
+
+def _read_lines(sock, count, timeout=2):
+  # the first count network lines sock is sent, fewer if they do not come in time
+  data = b""
+  deadline = monotonic() + timeout
+  while data.count(b"\r\n") < count and monotonic() < deadline:
+    sock.settimeout(max(deadline - monotonic(), 0.01))
+    try:
+      got = sock.recv(65536)
+    except socket.timeout:
+      break
+    if not got:
+      break
+    data += got
+  return [line.decode("utf-8", "replace") for line in data.split(b"\r\n")[:count] if line]
+
+
+def _test_many_clients(comment_file_path, student_dir):
+  start_test(comment_file_path, "The server takes more clients than select could watch")
+  try:
+    p, port = _start_server()
+    clients = [_connect(port) for i in range(1100)]
+    sleep(0.5)
+    clients[0].sendall(b"hello everyone\r\n")
+    last = _read_lines(clients[-1], 1)
+    clients[-1].sendall(b"\\connected\r\n")
+    connected = _read_lines(clients[-1], 1)
+    _stop_server(p)
+    if len(last) != 1 or not last[0].endswith(": hello everyone"):
+      finish(comment_file_path, "NOT OK")
+      return
+    if connected != ["Connected clients: 1100"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_join(comment_file_path, student_dir):
+  start_test(comment_file_path, "\\join moves a client between rooms")
+  try:
+    p, port = _start_server()
+    a, b, c = _connect(port), _connect(port), _connect(port)
+    sleep(0.2)
+    b.sendall(b"\\join lobby\r\n")
+    c.sendall(b"\\join lobby\r\n")
+    joined = _read_lines(b, 1) + _read_lines(c, 1)
+    a.sendall(b"outside\r\n")
+    b.sendall(b"inside\r\n")
+    outside = _read_lines(a, 2, 1)
+    inside = _read_lines(c, 2, 1)
+    c.sendall(b"\\join\r\n")
+    back = _read_lines(c, 1)
+    _stop_server(p)
+    if joined != ["Joined lobby", "Joined lobby"] or back != ["Joined 127.0.0.1"]:
+      finish(comment_file_path, "NOT OK")
+      return
+    if len(outside) != 1 or not outside[0].endswith(": outside"):
+      finish(comment_file_path, "NOT OK")
+      return
+    if len(inside) != 1 or not inside[0].endswith(": inside"):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _flood(options, count):
+  # a client that does not read while another sends it count messages; what
+  # the reader gets afterwards is returned as the numbers of the messages
+  # that came whole, and whether the server hung up on it.
+  p, port = _start_server(options)
+  reader = socket.socket()
+  reader.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+  reader.connect(("127.0.0.1", port))
+  writer = _connect(port)
+  writer.settimeout(None)
+
+  def drain():
+    try:
+      while writer.recv(65536):
+        pass
+    except Exception:
+      pass
+
+  def send():
+    writer.sendall(b"".join(("msg %d " % i).ljust(120, "x").encode() + b"\r\n" for i in range(count)))
+
+  threading.Thread(target=drain, daemon=True).start()
+  threading.Thread(target=send, daemon=True).start()
+  sleep(1.5)
+  data = b""
+  hung_up = False
+  reader.settimeout(1)
+  while True:
+    try:
+      got = reader.recv(65536)
+    except socket.timeout:
+      break
+    except ConnectionResetError:
+      got = b""
+    if not got:
+      hung_up = True
+      break
+    data += got
+  _stop_server(p)
+  return [int(n) for n in re.findall(rb"msg (\d+) ", data)], hung_up
+
+
+def _test_overflow_drop_oldest(comment_file_path, student_dir):
+  start_test(comment_file_path, "A slow reader loses its oldest messages by default")
+  try:
+    nums, hung_up = _flood("", 40000)
+    if hung_up or nums != sorted(set(nums)) or nums[-1] != 39999 or len(nums) > 39000:
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_overflow_disconnect(comment_file_path, student_dir):
+  start_test(comment_file_path, "--overflow=disconnect drops a slow reader")
+  try:
+    nums, hung_up = _flood("--overflow=disconnect", 40000)
+    if not hung_up or nums != sorted(set(nums)) or len(nums) > 39000:
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_overflow_pause(comment_file_path, student_dir):
+  start_test(comment_file_path, "--overflow=pause holds the sender back until a slow reader catches up")
+  try:
+    nums, hung_up = _flood("--overflow=pause", 40000)
+    # a message the server read in two parts is passed on as two, so a few
+    # may not come whole; none is lost.
+    if hung_up or nums != sorted(set(nums)) or nums[-1] != 39999 or len(nums) < 39990:
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_workers(comment_file_path, student_dir):
+  start_test(comment_file_path, "--workers shares clients, counts and messages across event loops")
+  try:
+    p, port = _start_server("--workers 4")
+    clients = [_connect(port) for i in range(20)]
+    sleep(0.3)
+    counts = []
+    for c in clients:
+      c.sendall(b"\\connected\r\n")
+      counts += _read_lines(c, 1)
+    clients[0].sendall(b"hello shards\r\n")
+    heard = [_read_lines(c, 1) for c in clients]
+    _stop_server(p)
+    if counts != ["Connected clients: 20"] * 20:
+      finish(comment_file_path, "NOT OK")
+      return
+    if any(len(lines) != 1 or not lines[0].endswith(": hello shards") for lines in heard):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _burst(options, count):
+  # the numbers of the messages a client got back whole after sending count
+  # at once
+  p, port = _start_server(options)
+  writer = _connect(port)
+  threading.Thread(target=lambda: writer.sendall(b"".join(b"msg %d \r\n" % i for i in range(count))),
+                   daemon=True).start()
+  data = b""
+  writer.settimeout(2)
+  while data.count(b"\r\n") < count:
+    try:
+      got = writer.recv(65536)
+    except socket.timeout:
+      break
+    if not got:
+      break
+    data += got
+  _stop_server(p)
+  return [int(n) for n in re.findall(rb"msg (\d+) ", data)]
+
+
+def _test_uring_burst(comment_file_path, student_dir):
+  start_test(comment_file_path, "--engine=uring echoes a burst bigger than a send queue")
+  try:
+    nums = _burst("--engine=uring", 20000)
+    # as with pausing, a message read in two parts comes back as two.
+    if nums != sorted(set(nums)) or nums[-1] != 19999 or len(nums) < 19950:
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_uring_fallback(comment_file_path, student_dir):
+  start_test(comment_file_path, "--engine=uring falls back to epoll without io_uring")
+  try:
+    # each test runs in its own process, so the environment change stays local
+    os.environ["MYSH_NO_URING"] = "1"
+    nums = _burst("--engine=uring", 2000)
+    if nums != sorted(set(nums)) or nums[-1] != 1999 or len(nums) < 1990:
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _frame(payload, seq):
+  return struct.pack("!III", len(payload), 0, seq) + payload
+
+
+def _read_bytes(sock, count, timeout=2):
+  # the first count bytes sock is sent, fewer if they do not come in time or
+  # it is closed
+  data = b""
+  deadline = monotonic() + timeout
+  while len(data) < count and monotonic() < deadline:
+    sock.settimeout(max(deadline - monotonic(), 0.01))
+    try:
+      got = sock.recv(count - len(data))
+    except (socket.timeout, ConnectionResetError):
+      break
+    if not got:
+      break
+    data += got
+  return data
+
+
+def _binary_echo(options, payload, same_write):
+  # what a client that asks for binary framing is told and then sent back
+  # for one frame of payload, with or without waiting for the answer.
+  p, port = _start_server(options)
+  c = _connect(port)
+  c.sendall(b"\\binary\r\n" + (_frame(payload, 1) if same_write else b""))
+  # a byte at a time, so none of the frame is taken with the answer
+  answer = b""
+  while not answer.endswith(b"\r\n"):
+    got = _read_bytes(c, 1)
+    if not got:
+      break
+    answer += got
+  if not same_write:
+    c.sendall(_frame(payload, 1))
+  echo = _read_bytes(c, 12 + len(payload), 4)
+  _stop_server(p)
+  answer = answer.decode("utf-8", "replace").split("\r\n")[:1]
+  if len(echo) < 12:
+    return answer, None
+  length, sender, seq = struct.unpack("!III", echo[:12])
+  return answer, (length, seq, echo[12:])
+
+
+def _test_binary_same_write(comment_file_path, student_dir):
+  start_test(comment_file_path, "A frame sent with \\binary in one write comes back whole")
+  try:
+    # long enough that it would be cut short as a line, with a network
+    # newline in it.
+    payload = bytes(range(1, 120)) + b"\r\n" + bytes(range(256))[::-1][:131]
+    answer, echo = _binary_echo("", payload, True)
+    if answer != ["\\binary 65536"] or echo != (len(payload), 1, payload):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_binary_client(comment_file_path, student_dir):
+  start_test(comment_file_path, "send --binary reaches a client reading lines")
+  try:
+    p, port = _start_server()
+    listener = _connect(port)
+    sleep(0.2)
+    shell = start('./mysh')
+    write_no_stdout_flush(shell, "send {} 127.0.0.1 --binary hello in frames".format(port))
+    heard = _read_lines(listener, 1)
+    write_no_stdout_flush(shell, "exit")
+    _stop_server(p)
+    if len(heard) != 1 or not heard[0].endswith(": hello in frames"):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def _test_max_frame(comment_file_path, student_dir):
+  start_test(comment_file_path, "--max-frame sets the largest frame the server takes")
+  try:
+    payload = b"y" * 100000
+    answer, echo = _binary_echo("", payload, False)
+    # over the default, the server hangs up instead.
+    if answer != ["\\binary 65536"] or echo is not None:
+      finish(comment_file_path, "NOT OK")
+      return
+    answer, echo = _binary_echo("--max-frame=131072", payload, False)
+    if answer != ["\\binary 131072"] or echo != (len(payload), 1, payload):
+      finish(comment_file_path, "NOT OK")
+      return
+    finish(comment_file_path, "OK")
+  except Exception as e:
+    finish(comment_file_path, "NOT OK")
+
+
+def test_server_suite(comment_file_path, student_dir):
+  start_suite(comment_file_path, "Chat server")
+  start_with_timeout(_test_many_clients, comment_file_path, student_dir, 10)
+  start_with_timeout(_test_join, comment_file_path, student_dir, 8)
+  start_with_timeout(_test_overflow_drop_oldest, comment_file_path, student_dir, 15)
+  start_with_timeout(_test_overflow_disconnect, comment_file_path, student_dir, 15)
+  start_with_timeout(_test_overflow_pause, comment_file_path, student_dir, 15)
+  start_with_timeout(_test_workers, comment_file_path, student_dir, 8)
+  start_with_timeout(_test_uring_burst, comment_file_path, student_dir, 10)
+  start_with_timeout(_test_uring_fallback, comment_file_path, student_dir, 8)
+  start_with_timeout(_test_binary_same_write, comment_file_path, student_dir, 8)
+  start_with_timeout(_test_binary_client, comment_file_path, student_dir, 8)
+  start_with_timeout(_test_max_frame, comment_file_path, student_dir, 15)
+  end_suite(comment_file_path)
@@ -190,6 +190,12 @@ def write_no_stdout_flush_wait(process, message):
     os.set_blocking(process.stderr.fileno(), False)
     sleep(0.3)
 
+def read_available_lines(process, stream=None):
+  # lines printed so far with the prompts removed, after write_no_stdout_flush_wait
+  data = (stream or process.stdout).read() or b""
+  lines = [line.replace("mysh$", "").strip() for line in data.decode("utf-8").split("\n")]
+  return [line for line in lines if line]
+
 def generate_random_message():
   length = random.randint(10, 30)
   message = ""